@@ -3,9 +3,49 @@
  * See included LICENSE file for license details.
  */
 
+/* Needed for madvise(), pthreads and friends when compiling in strict ANSI
+ * mode. This must come before any system header is included */
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "jsonsl.h"
 #include <limits.h>
 #include <ctype.h>
+#include <errno.h>
+
+#if !defined(JSONSL_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define JSONSL__HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Offsets past 2GB: fseeko() takes an off_t, which is 64 bits wide on LP64
+ * systems and wherever _FILE_OFFSET_BITS is 64, and Windows has _fseeki64().
+ * Anything else gets fseek() and its long */
+#if defined(_WIN32)
+#define JSONSL__HAVE_FSEEKI64
+#elif defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#if defined(_LARGEFILE_SOURCE) || \
+        (defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L)
+#define JSONSL__HAVE_FSEEKO
+#endif
+#endif
+
+#ifdef JSONSL_USE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef JSONSL_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef JSONSL_USE_ZSTD
+#include <zstd.h>
+#endif
 
 #ifdef JSONSL_USE_METRICS
 #define XMETRICS \
@@ -96,6 +136,34 @@ static int is_allowed_whitespace(unsigned);
 static int is_allowed_escape(unsigned);
 static int is_simple_char(unsigned);
 static char get_escape_equiv(unsigned);
+static char get_escape_letter(unsigned);
+
+#ifndef JSONSL_NO_JPR
+/* What jsonsl__query_push() wants done with the value just pushed */
+#define JSONSL__QUERY_LEX 0
+/* Skip the contents of the (container) value */
+#define JSONSL__QUERY_SKIP 1
+/* Drop the value and skip the rest of the list it is in */
+#define JSONSL__QUERY_SKIP_REST 2
+/* FNV-1a, which keys and path components are hashed with. A hash of zero
+ * stands for none */
+#define JSONSL__HASH_INIT 2166136261U
+#define JSONSL__HASH_STEP(h, c) (((h) ^ (unsigned char)(c)) * 16777619U)
+static int jsonsl__query_push(jsonsl_t, struct jsonsl_state_st *);
+static int jsonsl__hkey_fastparse(jsonsl_t, const jsonsl_uchar_t **, size_t *);
+static void jsonsl__query_key_begin(jsonsl_t, struct jsonsl_state_st *);
+static void jsonsl__query_key_add(jsonsl_t, const struct jsonsl_state_st *,
+                                  size_t);
+static void jsonsl__query_key_end(jsonsl_t, const struct jsonsl_state_st *,
+                                  size_t);
+static void jsonsl__query_key_keep(jsonsl_t);
+static void jsonsl__query_watch_add(jsonsl_t, size_t, size_t);
+static int jsonsl__query_watch_end(jsonsl_t, const struct jsonsl_state_st *,
+                                   size_t, size_t);
+static int jsonsl__query_pop(jsonsl_t);
+static void jsonsl__query_begin(struct jsonsl_jpr_cursor_st *);
+static void jsonsl__jpr_cursor_free(struct jsonsl_jpr_cursor_st *);
+#endif /* JSONSL_NO_JPR */
 
 JSONSL_API
 jsonsl_t jsonsl_new(int nlevels)
@@ -131,12 +199,23 @@ void jsonsl_reset(jsonsl_t jsn)
     jsn->stopfl = 0;
     jsn->in_escape = 0;
     jsn->expecting = 0;
+#ifndef JSONSL_NO_JPR
+    jsn->query_skip = 0;
+    jsn->query_instr = 0;
+    jsn->query_level = 0;
+    jsn->query_stop_level = 0;
+    jsn->query_watch = 0;
+#endif
 }
 
 JSONSL_API
 void jsonsl_destroy(jsonsl_t jsn)
 {
     if (jsn) {
+#ifndef JSONSL_NO_JPR
+        jsonsl_jpr_set_detach(jsn);
+        jsonsl__jpr_cursor_free(jsn->jpr_cursor);
+#endif
         free(jsn);
     }
 }
@@ -215,9 +294,66 @@ jsonsl__num_fastparse(jsonsl_t jsn,
     return FASTPARSE_BREAK;
 }
 
-JSONSL_API
-void
-jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
+#ifndef JSONSL_NO_JPR
+/* Skips over the contents of a container in query mode, until the bracket
+ * which closes it (which is left for the main loop to pop). Only strings
+ * need any care, since they may contain brackets. */
+static int
+jsonsl__skip_fastparse(jsonsl_t jsn,
+                       const jsonsl_uchar_t **bytes_p, size_t *nbytes_p)
+{
+    const jsonsl_uchar_t *bytes = *bytes_p;
+    const jsonsl_uchar_t *end = bytes + *nbytes_p;
+    size_t depth = jsn->query_skip;
+    int instr = jsn->query_instr;
+
+    for (; bytes != end; bytes++) {
+        if (instr) {
+            if (instr == 2) {
+                instr = 1;
+                continue;
+            }
+            while (bytes != end && *bytes != '"' && *bytes != '\\') {
+                bytes++;
+            }
+            if (bytes == end) {
+                break;
+            }
+            instr = *bytes == '"' ? 0 : 2;
+            continue;
+        }
+        switch (*bytes) {
+        case '"':
+            instr = 1;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                jsn->pos += (bytes - *bytes_p);
+                *nbytes_p -= (bytes - *bytes_p);
+                *bytes_p = bytes;
+                jsn->query_skip = 0;
+                return FASTPARSE_BREAK;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    jsn->pos += (bytes - *bytes_p);
+    jsn->query_skip = depth;
+    jsn->query_instr = instr;
+    return FASTPARSE_EXHAUSTED;
+}
+#endif /* JSONSL_NO_JPR */
+
+static void
+jsonsl__feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 {
 
 #define INVOKE_ERROR(eb) \
@@ -248,7 +384,8 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
         state->pos_cur = jsn->pos; \
         DO_CALLBACK(T, POP); \
         state->nescapes = 0; \
-        state = jsn->stack + (--jsn->level);
+        state = jsn->stack + (--jsn->level); \
+        QUERY_POP;
 
 #define CALLBACK_AND_POP(T) \
         CALLBACK_AND_POP_NOPOS(T); \
@@ -303,11 +440,122 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 
 #define CONTINUE_NEXT_CHAR() continue
 
+#ifndef JSONSL_NO_JPR
+    /* Query mode. See jsonsl_st::options */
+#define QUERY_PUSH \
+    if (jsn->options.query && \
+            jsonsl__query_push(jsn, state) == JSONSL__QUERY_SKIP_REST) { \
+        QUERY_SKIP_REST; \
+    }
+
+#define QUERY_PUSH_CONTAINER \
+    if (jsn->options.query) { \
+        int skip__ = jsonsl__query_push(jsn, state); \
+        if (skip__ == JSONSL__QUERY_SKIP) { \
+            jsn->tok_last = 0; \
+            jsn->query_skip = 1; \
+            jsn->query_instr = 0; \
+            c++; \
+            nbytes--; \
+            jsn->pos++; \
+            if (jsonsl__skip_fastparse(jsn, &c, &nbytes) == \
+                    FASTPARSE_EXHAUSTED) { \
+                return; \
+            } \
+            /* At the closing bracket */ \
+            goto GT_AGAIN; \
+        } else if (skip__ == JSONSL__QUERY_SKIP_REST) { \
+            QUERY_SKIP_REST; \
+        } \
+    }
+
+/* Drop the value just pushed (whose first character is at 'c'), and skip
+ * to the bracket which closes the list it is in */
+#define QUERY_SKIP_REST \
+    state->nescapes = 0; \
+    state = jsn->stack + (--jsn->level); \
+    jsn->tok_last = 0; \
+    jsn->query_skip = 1; \
+    jsn->query_instr = 0; \
+    if (jsonsl__skip_fastparse(jsn, &c, &nbytes) == FASTPARSE_EXHAUSTED) { \
+        return; \
+    } \
+    goto GT_AGAIN;
+
+/* Stop once all paths are satisfied; see jsonsl_st::options */
+#define QUERY_POP \
+    if (jsn->query_stop_level > jsn->level && jsonsl__query_pop(jsn)) { \
+        return; \
+    }
+
+/* In query mode, keys are hashed as they are lexed */
+#define STR_FASTPARSE \
+    (state_type == JSONSL_T_HKEY && jsn->options.query ? \
+            jsonsl__hkey_fastparse(jsn, &c, &nbytes) : \
+            jsonsl__str_fastparse(jsn, &c, &nbytes))
+
+#define QUERY_HKEY_BEGIN \
+    if (jsn->options.query) { \
+        jsonsl__query_key_begin(jsn, state); \
+    }
+
+#define QUERY_HKEY_END \
+    if (jsn->options.query) { \
+        jsonsl__query_key_end(jsn, state, \
+                              jsn->pos - (c - (jsonsl_uchar_t*)bytes)); \
+    }
+
+/* Decide the predicates waiting on the member value about to be popped,
+ * which ends just before stream position 'end'. If its object can no
+ * longer match, pop the value with 'pop' and skip the rest of the object,
+ * starting 'adv' characters on */
+#define QUERY_WATCH_END(pop, end, adv) \
+    if (jsn->query_watch) { \
+        int skip__ = jsonsl__query_watch_end(jsn, state, \
+                jsn->pos - (c - (jsonsl_uchar_t*)bytes), (end)); \
+        if (jsn->stopfl) { \
+            return; \
+        } \
+        if (skip__) { \
+            pop; \
+            jsn->expecting = ','; \
+            jsn->tok_last = 0; \
+            jsn->query_skip = 1; \
+            jsn->query_instr = 0; \
+            c += (adv); \
+            nbytes -= (adv); \
+            jsn->pos += (adv); \
+            if (jsonsl__skip_fastparse(jsn, &c, &nbytes) == \
+                    FASTPARSE_EXHAUSTED) { \
+                return; \
+            } \
+            goto GT_AGAIN; \
+        } \
+    }
+#else
+#define QUERY_PUSH
+#define QUERY_PUSH_CONTAINER
+#define QUERY_SKIP_REST
+#define QUERY_POP
+#define STR_FASTPARSE jsonsl__str_fastparse(jsn, &c, &nbytes)
+#define QUERY_HKEY_BEGIN
+#define QUERY_HKEY_END
+#define QUERY_WATCH_END(pop, end, adv)
+#endif /* JSONSL_NO_JPR */
+
     const jsonsl_uchar_t *c = (jsonsl_uchar_t*)bytes;
     size_t levels_max = jsn->levels_max;
     struct jsonsl_state_st *state = jsn->stack + jsn->level;
     jsn->base = bytes;
 
+#ifndef JSONSL_NO_JPR
+    /* Still inside a container being skipped */
+    if (jsn->query_skip &&
+            jsonsl__skip_fastparse(jsn, &c, &nbytes) == FASTPARSE_EXHAUSTED) {
+        return;
+    }
+#endif
+
     for (; nbytes; nbytes--, jsn->pos++, c++) {
         unsigned state_type;
         INCR_METRIC(TOTAL);
@@ -330,8 +578,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
                 CONTINUE_NEXT_CHAR();
             }
 
-            if (jsonsl__str_fastparse(jsn, &c, &nbytes) ==
-                    FASTPARSE_EXHAUSTED) {
+            if (STR_FASTPARSE == FASTPARSE_EXHAUSTED) {
                 /* No need to readjust variables as we've exhausted the iterator */
                 return;
             } else {
@@ -501,6 +748,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
                     INVOKE_ERROR(SPECIAL_INCOMPLETE);
                 }
             }
+            QUERY_WATCH_END(SPECIAL_POP, jsn->pos, 0);
             SPECIAL_POP;
             jsn->expecting = ',';
             if (is_allowed_whitespace(CUR_CHAR)) {
@@ -534,9 +782,11 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 
             /* the end of a string or hash key */
             case JSONSL_T_STRING:
+                QUERY_WATCH_END(CALLBACK_AND_POP(STRING), jsn->pos + 1, 1);
                 CALLBACK_AND_POP(STRING);
                 CONTINUE_NEXT_CHAR();
             case JSONSL_T_HKEY:
+                QUERY_HKEY_END;
                 CALLBACK_AND_POP(HKEY);
                 CONTINUE_NEXT_CHAR();
 
@@ -552,6 +802,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 
                     STACK_PUSH;
                     state->type = JSONSL_T_STRING;
+                    QUERY_PUSH;
                     DO_CALLBACK(STRING, PUSH);
 
                 } else {
@@ -564,6 +815,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 
                     STACK_PUSH;
                     state->type = JSONSL_T_HKEY;
+                    QUERY_HKEY_BEGIN;
                     DO_CALLBACK(HKEY, PUSH);
                 }
                 CONTINUE_NEXT_CHAR();
@@ -574,6 +826,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
                 state->type = JSONSL_T_STRING;
                 jsn->expecting = ',';
                 jsn->tok_last = 0;
+                QUERY_PUSH;
                 DO_CALLBACK(STRING, PUSH);
                 CONTINUE_NEXT_CHAR();
 
@@ -656,6 +909,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
                 /* If we're a hash, we expect a key first, which is quouted */
                 jsn->expecting = '"';
             }
+            QUERY_PUSH_CONTAINER;
             if (CUR_CHAR == JSONSL_T_OBJECT) {
                 DO_CALLBACK(OBJECT, PUSH);
             } else {
@@ -691,6 +945,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
             }
             state = jsn->stack + jsn->level;
             state->pos_cur = jsn->pos;
+            QUERY_POP;
             CONTINUE_NEXT_CHAR();
 
         default:
@@ -733,6 +988,7 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
                     STATE_NUM_LAST = '-';
                     state->nelem = 0;
                 }
+                QUERY_PUSH;
                 DO_CALLBACK(SPECIAL, PUSH);
             }
             CONTINUE_NEXT_CHAR();
@@ -741,501 +997,6416 @@ jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 }
 
 JSONSL_API
-const char* jsonsl_strerror(jsonsl_error_t err)
+void
+jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes)
 {
-    if (err == JSONSL_ERROR_SUCCESS) {
-        return "SUCCESS";
+#ifndef JSONSL_NO_JPR
+    size_t pos_orig = jsn->pos;
+    jsonsl__feed(jsn, bytes, nbytes);
+    if (jsn->options.query) {
+        if (jsn->stack[jsn->level].type == JSONSL_T_HKEY) {
+            /* The rest of the key is in the next buffer */
+            jsonsl__query_key_add(jsn, jsn->stack + jsn->level, pos_orig);
+        }
+        if (jsn->query_watch) {
+            /* The rest of the value is in the next buffer */
+            jsonsl__query_watch_add(jsn, pos_orig, jsn->pos);
+        }
+        jsonsl__query_key_keep(jsn);
     }
-#define X(t) \
-    if (err == JSONSL_ERROR_##t) \
-        return #t;
-    JSONSL_XERR;
-#undef X
-    return "<UNKNOWN_ERROR>";
+#else
+    jsonsl__feed(jsn, bytes, nbytes);
+#endif
 }
 
 JSONSL_API
-const char *jsonsl_strtype(jsonsl_type_t type)
+size_t
+jsonsl_feed_budget(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes,
+                   size_t budget)
 {
-#define X(o,c) \
-    if (type == JSONSL_T_##o) \
-        return #o;
-    JSONSL_XTYPE
-#undef X
-    return "UNKNOWN TYPE";
-
+    size_t pos_orig = jsn->pos;
+    if (nbytes > budget) {
+        nbytes = budget;
+    }
+    jsonsl_feed(jsn, bytes, nbytes);
+    /* The lexer always keeps 'pos' in sync with the bytes it has examined,
+     * so the difference is exactly what was consumed, even if we returned
+     * early */
+    return jsn->pos - pos_orig;
 }
 
-/*
- *
- * JPR/JSONPointer functions
- *
- *
- */
-#ifndef JSONSL_NO_JPR
-static
-jsonsl_jpr_type_t
-populate_component(char *in,
-                   struct jsonsl_jpr_component_st *component,
-                   char **next,
-                   jsonsl_error_t *errp)
+JSONSL_API
+size_t
+jsonsl_feedv(jsonsl_t jsn, const jsonsl_iovec_t *iov, int niov)
 {
-    unsigned long pctval;
-    char *c = NULL, *outp = NULL, *end = NULL;
-    size_t input_len;
-    jsonsl_jpr_type_t ret = JSONSL_PATH_NONE;
+    size_t pos_orig = jsn->pos;
+    int ii;
 
-    if (*next == NULL || *(*next) == '\0') {
-        return JSONSL_PATH_NONE;
+    for (ii = 0; ii < niov; ii++) {
+        size_t pos_seg = jsn->pos;
+        size_t nchars = iov[ii].iov_len / sizeof(jsonsl_char_t);
+        if (!nchars) {
+            continue;
+        }
+        jsonsl_feed(jsn, (const jsonsl_char_t *)iov[ii].iov_base, nchars);
+        if (jsn->pos - pos_seg != nchars) {
+            /* Stopped in the middle of this segment */
+            break;
+        }
     }
+    return jsn->pos - pos_orig;
+}
 
-    /* Replace the next / with a NULL */
-    *next = strstr(in, "/");
-    if (*next != NULL) {
-        *(*next) = '\0'; /* drop the forward slash */
-        input_len = *next - in;
-        end = *next;
-        *next += 1; /* next character after the '/' */
-    } else {
-        input_len = strlen(in);
-        end = in + input_len + 1;
+/* Read the file in windows into a private buffer */
+static int
+jsonsl__feed_stdio(jsonsl_t jsn, const char *path)
+{
+    FILE *fp;
+    char *buf;
+    size_t nread;
+    int rv = 0;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return -1;
     }
+    if ((buf = (char *)malloc(JSONSL_FILE_WINDOW)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    while ((nread = fread(buf, 1, JSONSL_FILE_WINDOW, fp)) > 0) {
+        if (jsonsl_feed_budget(jsn, buf, nread, nread) != nread) {
+            break;
+        }
+    }
+    if (ferror(fp)) {
+        rv = -1;
+    }
+    free(buf);
+    fclose(fp);
+    return rv;
+}
 
-    component->pstr = in;
+#ifdef JSONSL__HAVE_MMAP
+static int
+jsonsl__feed_mmap(jsonsl_t jsn, int fd, size_t fsize, int flags)
+{
+    size_t window, offset;
+    long pagesize = sysconf(_SC_PAGESIZE);
 
-    /* Check for special components of interest */
-    if (*in == JSONSL_PATH_WILDCARD_CHAR && input_len == 1) {
-        /* Lone wildcard */
-        ret = JSONSL_PATH_WILDCARD;
-        goto GT_RET;
-    } else if (isdigit(*in)) {
-        /* ASCII Numeric */
-        char *endptr;
-        component->idx = strtoul(in, &endptr, 10);
-        if (endptr && *endptr == '\0') {
-            ret = JSONSL_PATH_NUMERIC;
-            goto GT_RET;
-        }
+    if (pagesize <= 0) {
+        pagesize = 4096;
+    }
+    window = JSONSL_FILE_WINDOW - (JSONSL_FILE_WINDOW % pagesize);
+    if (!window) {
+        window = pagesize;
     }
 
-    /* Default, it's a string */
-    ret = JSONSL_PATH_STRING;
-    for (c = outp = in; c < end; c++, outp++) {
-        char origc;
-        if (*c != '%') {
-            goto GT_ASSIGN;
+    for (offset = 0; offset < fsize; offset += window) {
+        size_t nmap = fsize - offset < window ? fsize - offset : window;
+        size_t nfed;
+        void *map = mmap(NULL, nmap, PROT_READ, MAP_PRIVATE, fd,
+                         (off_t)offset);
+        if (map == MAP_FAILED) {
+            return -1;
         }
-        /*
-         * c = { [+0] = '%', [+1] = 'b', [+2] = 'e', [+3] = '\0' }
-         */
-
-        /* Need %XX */
-        if (c+2 >= end) {
-            *errp = JSONSL_ERROR_PERCENT_BADHEX;
-            return JSONSL_PATH_INVALID;
+#ifdef MADV_SEQUENTIAL
+        if (flags & JSONSL_FILEf_SEQUENTIAL) {
+            madvise(map, nmap, MADV_SEQUENTIAL);
         }
-        if (! (isxdigit(*(c+1)) && isxdigit(*(c+2))) ) {
-            *errp = JSONSL_ERROR_PERCENT_BADHEX;
-            return JSONSL_PATH_INVALID;
+#endif
+#ifdef MADV_HUGEPAGE
+        if (flags & JSONSL_FILEf_HUGEPAGE) {
+            madvise(map, nmap, MADV_HUGEPAGE);
         }
+#endif
+        nfed = jsonsl_feed_budget(jsn, (const jsonsl_char_t *)map, nmap, nmap);
+        /* Drop the window so the resident set doesn't grow with the file */
+        munmap(map, nmap);
+        if (nfed != nmap) {
+            break;
+        }
+    }
+    return 0;
+}
+#endif /* JSONSL__HAVE_MMAP */
 
-        /* Temporarily null-terminate the characters */
-        origc = *(c+3);
-        *(c+3) = '\0';
-        pctval = strtoul(c+1, NULL, 16);
-        *(c+3) = origc;
-
-        *outp = (char) pctval;
-        c += 2;
-        continue;
-
-        GT_ASSIGN:
-        *outp = *c;
+JSONSL_API
+int
+jsonsl_feed_file(jsonsl_t jsn, const char *path, int flags)
+{
+#ifdef JSONSL__HAVE_MMAP
+    if (!(flags & JSONSL_FILEf_NOMMAP)) {
+        struct stat sb;
+        int rv, fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            return -1;
+        }
+        if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+            rv = jsonsl__feed_mmap(jsn, fd, (size_t)sb.st_size, flags);
+            close(fd);
+            return rv;
+        }
+        /* Not mappable. Fall through */
+        close(fd);
     }
-    /* Null-terminate the string */
-    for (; outp < c; outp++) {
-        *outp = '\0';
+#endif /* JSONSL__HAVE_MMAP */
+    return jsonsl__feed_stdio(jsn, path);
+}
+
+/* Saved indexes are little endian, with 64 bit sizes */
+static void
+jsonsl__put32(unsigned char *p, uint32_t v)
+{
+    int ii;
+    for (ii = 0; ii < 4; ii++) {
+        p[ii] = (unsigned char)(v >> (8 * ii));
     }
+}
 
-    GT_RET:
-    component->ptype = ret;
-    if (ret != JSONSL_PATH_WILDCARD) {
-        component->len = strlen(component->pstr);
+static void
+jsonsl__put64(unsigned char *p, uint64_t v)
+{
+    int ii;
+    for (ii = 0; ii < 8; ii++) {
+        p[ii] = (unsigned char)(v >> (8 * ii));
     }
-    return ret;
 }
 
-JSONSL_API
-jsonsl_jpr_t
-jsonsl_jpr_new(const char *path, jsonsl_error_t *errp)
+static uint32_t
+jsonsl__get32(const unsigned char *p)
 {
-    char *my_copy = NULL;
-    int count, curidx;
-    struct jsonsl_jpr_st *ret = NULL;
-    struct jsonsl_jpr_component_st *components = NULL;
-    size_t origlen;
-    jsonsl_error_t errstacked;
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+            (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
 
-#define JPR_BAIL(err) *errp = err; goto GT_ERROR;
+static uint64_t
+jsonsl__get64(const unsigned char *p)
+{
+    return (uint64_t)jsonsl__get32(p) | (uint64_t)jsonsl__get32(p + 4) << 32;
+}
 
-    if (errp == NULL) {
-        errp = &errstacked;
-    }
+/* Read a 64 bit field into a size_t, failing if it doesn't fit */
+static int
+jsonsl__get_size(const unsigned char *p, size_t *out)
+{
+    uint64_t v = jsonsl__get64(p);
+    *out = (size_t)v;
+    return (uint64_t)*out == v ? 0 : -1;
+}
 
-    if (path == NULL || *path != '/') {
-        JPR_BAIL(JSONSL_ERROR_JPR_NOROOT);
-    }
+/* NDJSON record indexes. A record is a line which is neither empty nor
+ * only a carriage return; the scan only looks for newlines */
+struct jsonsl__recscan_st {
+    /* Stream position of the next character */
+    size_t pos;
+    /* Where the current line begins */
+    size_t line_start;
+    /* What the current line holds so far: 0 nothing, 1 only a '\r', 2 a
+     * record */
+    int line;
+};
 
-    count = 1;
-    path++;
-    {
-        const char *c = path;
-        for (; *c; c++) {
-            if (*c == '/') {
-                count++;
-                if (*(c+1) == '/') {
-                    JPR_BAIL(JSONSL_ERROR_JPR_DUPSLASH);
-                }
+struct jsonsl_recindex_st {
+    size_t interval;
+    size_t nrecords;
+    size_t *offsets;
+    size_t noffsets;
+    size_t offsets_alloc;
+    struct jsonsl__recscan_st scan;
+    int finished;
+};
+
+#define JSONSL__RECINDEX_MAGIC "JSLRECIX"
+#define JSONSL__RECINDEX_VERSION 1
+#define JSONSL__RECINDEX_HDR_SIZE 48
+/* How much jsonsl_recindex_seek() reads at a time */
+#define JSONSL__RECINDEX_WINDOW (64 * 1024)
+
+/* Scan up to the end of the next record. Returns the number of characters
+ * consumed, and sets '*found' if a record ended (its newline included) */
+static size_t
+jsonsl__recscan(struct jsonsl__recscan_st *rs, const char *bytes,
+                size_t nbytes, int *found)
+{
+    const char *p = bytes, *end = bytes + nbytes;
+
+    *found = 0;
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        const char *seg_end = nl ? nl : end;
+        if (seg_end > p) {
+            if (rs->line == 0 && seg_end - p == 1 && *p == '\r') {
+                rs->line = 1;
+            } else {
+                rs->line = 2;
             }
         }
+        if (!nl) {
+            p = end;
+            break;
+        }
+        p = nl + 1;
+        if (rs->line == 2) {
+            *found = 1;
+            rs->line = 0;
+            rs->pos += p - bytes;
+            return p - bytes;
+        }
+        rs->line = 0;
+        rs->line_start = rs->pos + (p - bytes);
     }
-    if(*path) {
-        count++;
-    }
+    rs->pos += p - bytes;
+    return p - bytes;
+}
 
-    components = (struct jsonsl_jpr_component_st *)
-            malloc(sizeof(*components) * count);
-    if (!components) {
-        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+/* Account for a record which began at rs->line_start */
+static jsonsl_error_t
+jsonsl__recindex_add(struct jsonsl_recindex_st *idx)
+{
+    if (idx->nrecords++ % idx->interval) {
+        return JSONSL_ERROR_SUCCESS;
     }
-
-    my_copy = (char *)malloc(strlen(path) + 1);
-    if (!my_copy) {
-        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    if (idx->noffsets == idx->offsets_alloc) {
+        size_t nalloc = idx->offsets_alloc ? idx->offsets_alloc * 2 : 64;
+        size_t *noffsets = (size_t *)realloc(idx->offsets,
+                                             nalloc * sizeof(*noffsets));
+        if (!noffsets) {
+            idx->nrecords--;
+            return JSONSL_ERROR_ENOMEM;
+        }
+        idx->offsets = noffsets;
+        idx->offsets_alloc = nalloc;
     }
+    idx->offsets[idx->noffsets++] = idx->scan.line_start;
+    return JSONSL_ERROR_SUCCESS;
+}
 
-    strcpy(my_copy, path);
+JSONSL_API
+jsonsl_recindex_t
+jsonsl_recindex_new(size_t interval)
+{
+    struct jsonsl_recindex_st *idx;
+    if (!interval) {
+        return NULL;
+    }
+    idx = (struct jsonsl_recindex_st *)calloc(1, sizeof(*idx));
+    if (idx) {
+        idx->interval = interval;
+    }
+    return idx;
+}
 
-    components[0].ptype = JSONSL_PATH_ROOT;
+JSONSL_API
+jsonsl_error_t
+jsonsl_recindex_feed(jsonsl_recindex_t idx, const char *bytes, size_t nbytes)
+{
+    while (nbytes) {
+        int found;
+        size_t n = jsonsl__recscan(&idx->scan, bytes, nbytes, &found);
+        if (found) {
+            if (jsonsl__recindex_add(idx) != JSONSL_ERROR_SUCCESS) {
+                return JSONSL_ERROR_ENOMEM;
+            }
+            idx->scan.line_start = idx->scan.pos;
+        }
+        bytes += n;
+        nbytes -= n;
+    }
+    return JSONSL_ERROR_SUCCESS;
+}
 
-    if (*my_copy) {
-        char *cur = my_copy;
-        int pathret = JSONSL_PATH_STRING;
-        curidx = 1;
-        while (curidx < count) {
-            pathret = populate_component(cur, components + curidx, &cur, errp);
-            if (pathret > 0) {
-                curidx++;
-            } else {
+JSONSL_API
+jsonsl_error_t
+jsonsl_recindex_finish(jsonsl_recindex_t idx)
+{
+    if (!idx->finished && idx->scan.line == 2) {
+        /* The last record has no newline */
+        if (jsonsl__recindex_add(idx) != JSONSL_ERROR_SUCCESS) {
+            return JSONSL_ERROR_ENOMEM;
+        }
+    }
+    idx->finished = 1;
+    return JSONSL_ERROR_SUCCESS;
+}
+
+JSONSL_API
+int
+jsonsl_recindex_build_file(jsonsl_recindex_t idx, const char *path)
+{
+    FILE *fp;
+    char *buf;
+    size_t nread;
+    int rv = 0;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return -1;
+    }
+    if ((buf = (char *)malloc(JSONSL_FILE_WINDOW)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    while ((nread = fread(buf, 1, JSONSL_FILE_WINDOW, fp)) > 0) {
+        if (jsonsl_recindex_feed(idx, buf, nread) != JSONSL_ERROR_SUCCESS) {
+            errno = ENOMEM;
+            rv = -1;
+            break;
+        }
+    }
+    if (ferror(fp)) {
+        rv = -1;
+    }
+    if (rv == 0 && jsonsl_recindex_finish(idx) != JSONSL_ERROR_SUCCESS) {
+        errno = ENOMEM;
+        rv = -1;
+    }
+    free(buf);
+    fclose(fp);
+    return rv;
+}
+
+JSONSL_API
+size_t
+jsonsl_recindex_count(jsonsl_recindex_t idx)
+{
+    return idx->nrecords;
+}
+
+JSONSL_API
+size_t
+jsonsl_recindex_length(jsonsl_recindex_t idx)
+{
+    return idx->scan.pos;
+}
+
+/* Seek to an offset from the start of the file, failing (with EOVERFLOW)
+ * rather than truncating an offset which the seek function can't take */
+static int
+jsonsl__fseek(FILE *fp, size_t pos)
+{
+#if defined(JSONSL__HAVE_FSEEKI64)
+    __int64 off = (__int64)pos;
+#elif defined(JSONSL__HAVE_FSEEKO)
+    off_t off = (off_t)pos;
+#else
+    long off = (long)pos;
+#endif
+    if (off < 0 || (size_t)off != pos) {
+#ifdef EOVERFLOW
+        errno = EOVERFLOW;
+#else
+        errno = ERANGE;
+#endif
+        return -1;
+    }
+#if defined(JSONSL__HAVE_FSEEKI64)
+    return _fseeki64(fp, off, SEEK_SET);
+#elif defined(JSONSL__HAVE_FSEEKO)
+    return fseeko(fp, off, SEEK_SET);
+#else
+    return fseek(fp, off, SEEK_SET);
+#endif
+}
+
+JSONSL_API
+int
+jsonsl_recindex_seek(jsonsl_recindex_t idx, const char *path, size_t recno,
+                     size_t *offset)
+{
+    struct jsonsl__recscan_st rs;
+    size_t nscan;
+    char *buf;
+    FILE *fp;
+    int rv = -1;
+
+    if (recno >= idx->nrecords) {
+        errno = EINVAL;
+        return -1;
+    }
+    rs.pos = rs.line_start = idx->offsets[recno / idx->interval];
+    rs.line = 0;
+    if (recno % idx->interval == 0) {
+        *offset = rs.pos;
+        return 0;
+    }
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return -1;
+    }
+    if ((buf = (char *)malloc(JSONSL__RECINDEX_WINDOW)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    if (jsonsl__fseek(fp, rs.pos) != 0) {
+        goto GT_DONE;
+    }
+    /* Scan up to the end of the record we want, which leaves line_start
+     * at its beginning */
+    nscan = recno % idx->interval + 1;
+    while (nscan) {
+        size_t nread = fread(buf, 1, JSONSL__RECINDEX_WINDOW, fp), used = 0;
+        if (!nread) {
+            if (nscan == 1 && rs.line == 2) {
+                /* The last record has no newline */
                 break;
             }
+            /* The file is shorter than when it was indexed */
+            if (!ferror(fp)) {
+                errno = EINVAL;
+            }
+            goto GT_DONE;
+        }
+        while (nscan && used < nread) {
+            int found;
+            used += jsonsl__recscan(&rs, buf + used, nread - used, &found);
+            if (found && --nscan) {
+                rs.line_start = rs.pos;
+            }
         }
+    }
+    *offset = rs.line_start;
+    rv = 0;
 
-        if (pathret == JSONSL_PATH_INVALID) {
-            JPR_BAIL(JSONSL_ERROR_JPR_BADPATH);
+    GT_DONE:
+    free(buf);
+    fclose(fp);
+    return rv;
+}
+
+/* Offsets are saved as the difference from the previous one, in base 128
+ * with the high bit set on all but the last digit */
+JSONSL_API
+int
+jsonsl_recindex_save(jsonsl_recindex_t idx, const char *path)
+{
+    unsigned char buf[JSONSL__RECINDEX_HDR_SIZE];
+    size_t ii, prev = 0;
+    FILE *fp;
+
+    if (!idx->finished) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((fp = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    memcpy(buf, JSONSL__RECINDEX_MAGIC, 8);
+    jsonsl__put32(buf + 8, JSONSL__RECINDEX_VERSION);
+    jsonsl__put32(buf + 12, 0);
+    jsonsl__put64(buf + 16, idx->interval);
+    jsonsl__put64(buf + 24, idx->nrecords);
+    jsonsl__put64(buf + 32, idx->scan.pos);
+    jsonsl__put64(buf + 40, idx->noffsets);
+    fwrite(buf, 1, sizeof(buf), fp);
+    for (ii = 0; ii < idx->noffsets; ii++) {
+        size_t delta = idx->offsets[ii] - prev;
+        prev = idx->offsets[ii];
+        for (; delta >= 0x80; delta >>= 7) {
+            putc((int)(delta & 0x7f) | 0x80, fp);
         }
-    } else {
-        curidx = 1;
+        putc((int)delta, fp);
+    }
+    if (ferror(fp)) {
+        fclose(fp);
+        return -1;
     }
+    return fclose(fp) == 0 ? 0 : -1;
+}
 
-    path--; /*revert path to leading '/' */
-    origlen = strlen(path) + 1;
-    ret = (struct jsonsl_jpr_st *)malloc(sizeof(*ret));
-    if (!ret) {
-        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+JSONSL_API
+jsonsl_recindex_t
+jsonsl_recindex_load(const char *path)
+{
+    unsigned char buf[JSONSL__RECINDEX_HDR_SIZE];
+    struct jsonsl_recindex_st *idx;
+    size_t ii, prev = 0;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp) {
+        return NULL;
     }
-    ret->orig = (char *)malloc(origlen);
-    if (!ret->orig) {
-        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    idx = (struct jsonsl_recindex_st *)calloc(1, sizeof(*idx));
+    if (!idx) {
+        fclose(fp);
+        errno = ENOMEM;
+        return NULL;
     }
-    ret->components = components;
-    ret->ncomponents = curidx;
-    ret->basestr = my_copy;
-    ret->norig = origlen-1;
-    strcpy(ret->orig, path);
+    idx->finished = 1;
+    if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf) ||
+            memcmp(buf, JSONSL__RECINDEX_MAGIC, 8) != 0 ||
+            jsonsl__get32(buf + 8) != JSONSL__RECINDEX_VERSION ||
+            jsonsl__get_size(buf + 16, &idx->interval) != 0 ||
+            jsonsl__get_size(buf + 24, &idx->nrecords) != 0 ||
+            jsonsl__get_size(buf + 32, &idx->scan.pos) != 0 ||
+            jsonsl__get_size(buf + 40, &idx->noffsets) != 0 ||
+            !idx->interval ||
+            idx->noffsets != idx->nrecords / idx->interval +
+                    (idx->nrecords % idx->interval != 0) ||
+            idx->noffsets > (size_t)-1 / sizeof(*idx->offsets)) {
+        goto GT_INVALID;
+    }
+    idx->offsets_alloc = idx->noffsets;
+    idx->offsets = (size_t *)malloc(sizeof(*idx->offsets) *
+                                    (idx->noffsets ? idx->noffsets : 1));
+    if (!idx->offsets) {
+        jsonsl_recindex_destroy(idx);
+        fclose(fp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (ii = 0; ii < idx->noffsets; ii++) {
+        size_t delta = 0;
+        unsigned shift = 0;
+        int c;
+        do {
+            if ((c = getc(fp)) == EOF || shift >= sizeof(size_t) * 8) {
+                goto GT_INVALID;
+            }
+            delta |= (size_t)(c & 0x7f) << shift;
+            shift += 7;
+        } while (c & 0x80);
+        if (delta > idx->scan.pos - prev) {
+            goto GT_INVALID;
+        }
+        prev = idx->offsets[ii] = prev + delta;
+    }
+    if (getc(fp) != EOF) {
+        goto GT_INVALID;
+    }
+    fclose(fp);
+    return idx;
 
-    return ret;
+    GT_INVALID:
+    jsonsl_recindex_destroy(idx);
+    fclose(fp);
+    errno = EINVAL;
+    return NULL;
+}
 
-    GT_ERROR:
-    free(my_copy);
-    free(components);
-    if (ret) {
-        free(ret->orig);
+JSONSL_API
+void
+jsonsl_recindex_destroy(jsonsl_recindex_t idx)
+{
+    if (idx) {
+        free(idx->offsets);
+        free(idx);
+    }
+}
+
+#ifdef JSONSL_USE_PTHREADS
+struct jsonsl_reader_slot_st {
+    jsonsl_char_t *buf;
+    /* Number of valid bytes in buf */
+    size_t len;
+    /* Stream position of buf[0] */
+    size_t pos;
+};
+
+/*
+ * The ring is managed with three monotonic counters. Slot N is at index
+ * (N % nslots):
+ *
+ *   [nreleased, nfed)   fed to the lexer, but still referenced
+ *   [nfed, nfilled)     filled by the reader, waiting to be fed
+ *   [nfilled, nreleased + nslots)  free for the reader to fill
+ *
+ * nfilled (along with eof/err) is written by the reader thread, and
+ * nfed/nreleased by the parsing thread; all under the mutex.
+ */
+struct jsonsl_reader_st {
+    int fd;
+    size_t bufsize;
+    unsigned nslots;
+    struct jsonsl_reader_slot_st *slots;
+
+    size_t nfilled;
+    size_t nfed;
+    size_t nreleased;
+    int eof;
+    int err;
+    int stop;
+    size_t retain;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+JSONSL_API
+jsonsl_reader_t
+jsonsl_reader_new(int fd, size_t bufsize, unsigned nbufs)
+{
+    struct jsonsl_reader_st *rd;
+    unsigned ii;
+
+    if (nbufs < 2 || bufsize == 0) {
+        return NULL;
+    }
+    rd = (struct jsonsl_reader_st *)calloc(1, sizeof(*rd));
+    if (!rd) {
+        return NULL;
+    }
+    rd->slots = (struct jsonsl_reader_slot_st *)
+            calloc(nbufs, sizeof(*rd->slots));
+    if (!rd->slots) {
+        free(rd);
+        return NULL;
+    }
+    rd->fd = fd;
+    rd->bufsize = bufsize;
+    rd->nslots = nbufs;
+    rd->retain = (size_t)-1;
+    pthread_mutex_init(&rd->mutex, NULL);
+    pthread_cond_init(&rd->cond, NULL);
+    for (ii = 0; ii < nbufs; ii++) {
+        rd->slots[ii].buf = (jsonsl_char_t *)malloc(bufsize);
+        if (!rd->slots[ii].buf) {
+            jsonsl_reader_destroy(rd);
+            return NULL;
+        }
+    }
+    return rd;
+}
+
+JSONSL_API
+void
+jsonsl_reader_destroy(jsonsl_reader_t rd)
+{
+    unsigned ii;
+    if (!rd) {
+        return;
+    }
+    for (ii = 0; ii < rd->nslots; ii++) {
+        free(rd->slots[ii].buf);
+    }
+    pthread_mutex_destroy(&rd->mutex);
+    pthread_cond_destroy(&rd->cond);
+    free(rd->slots);
+    free(rd);
+}
+
+static void *
+jsonsl__reader_main(void *arg)
+{
+    struct jsonsl_reader_st *rd = (struct jsonsl_reader_st *)arg;
+    size_t pos = 0;
+
+    for (;;) {
+        struct jsonsl_reader_slot_st *slot;
+        ssize_t nr;
+
+        pthread_mutex_lock(&rd->mutex);
+        while (!rd->stop && rd->nfilled - rd->nreleased == rd->nslots) {
+            pthread_cond_wait(&rd->cond, &rd->mutex);
+        }
+        if (rd->stop) {
+            pthread_mutex_unlock(&rd->mutex);
+            break;
+        }
+        slot = rd->slots + (rd->nfilled % rd->nslots);
+        pthread_mutex_unlock(&rd->mutex);
+
+        /* The slot is ours until we bump nfilled. Hand it over as soon as
+         * anything arrives, rather than waiting for it to fill up */
+        do {
+            nr = read(rd->fd, slot->buf, rd->bufsize);
+        } while (nr == -1 && errno == EINTR);
+
+        pthread_mutex_lock(&rd->mutex);
+        if (nr > 0) {
+            slot->len = (size_t)nr;
+            slot->pos = pos;
+            pos += (size_t)nr;
+            rd->nfilled++;
+        } else {
+            rd->eof = 1;
+            rd->err = nr ? errno : 0;
+        }
+        pthread_cond_broadcast(&rd->cond);
+        pthread_mutex_unlock(&rd->mutex);
+        if (nr <= 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Release all slots which are no longer needed. Called with the lock held */
+static void
+jsonsl__reader_release(struct jsonsl_reader_st *rd, jsonsl_t jsn)
+{
+    struct jsonsl_state_st *state = jsn->stack + jsn->level;
+    size_t keep = jsn->pos;
+
+    if ((state->type & JSONSL_Tf_STRINGY) || state->type == JSONSL_T_SPECIAL) {
+        keep = state->pos_begin;
+    }
+    if (rd->retain < keep) {
+        keep = rd->retain;
+    }
+
+    while (rd->nreleased < rd->nfed) {
+        const struct jsonsl_reader_slot_st *oldest =
+                rd->slots + (rd->nreleased % rd->nslots);
+        /* Never hold every slot, or the reader can't make progress */
+        if (oldest->pos + oldest->len > keep &&
+                rd->nfed - rd->nreleased < rd->nslots) {
+            break;
+        }
+        rd->nreleased++;
+    }
+}
+
+JSONSL_API
+int
+jsonsl_reader_run(jsonsl_reader_t rd, jsonsl_t jsn)
+{
+    pthread_t thr;
+    int rv;
+
+    if ((rv = pthread_create(&thr, NULL, jsonsl__reader_main, rd)) != 0) {
+        errno = rv;
+        return -1;
+    }
+
+    for (;;) {
+        struct jsonsl_reader_slot_st *slot;
+        size_t nfed, len;
+
+        pthread_mutex_lock(&rd->mutex);
+        while (rd->nfed == rd->nfilled && !rd->eof) {
+            pthread_cond_wait(&rd->cond, &rd->mutex);
+        }
+        if (rd->nfed == rd->nfilled) {
+            /* EOF and all data fed */
+            pthread_mutex_unlock(&rd->mutex);
+            break;
+        }
+        slot = rd->slots + (rd->nfed % rd->nslots);
+        len = slot->len;
+        pthread_mutex_unlock(&rd->mutex);
+
+        nfed = jsonsl_feed_budget(jsn, slot->buf, len, len);
+
+        pthread_mutex_lock(&rd->mutex);
+        rd->nfed++;
+        jsonsl__reader_release(rd, jsn);
+        pthread_cond_broadcast(&rd->cond);
+        pthread_mutex_unlock(&rd->mutex);
+
+        /* The slot may already have been released and refilled, so don't
+         * look at it again */
+        if (nfed != len) {
+            /* Lexer returned early */
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&rd->mutex);
+    rd->stop = 1;
+    pthread_cond_broadcast(&rd->cond);
+    pthread_mutex_unlock(&rd->mutex);
+    pthread_join(thr, NULL);
+
+    if (rd->err) {
+        errno = rd->err;
+        return -1;
+    }
+    return 0;
+}
+
+JSONSL_API
+const jsonsl_char_t *
+jsonsl_reader_at(jsonsl_reader_t rd, size_t pos, size_t *navail)
+{
+    size_t ii;
+    /* Only the parsing thread modifies these, and we are on it. The slot
+     * currently being fed is at index nfed */
+    for (ii = rd->nreleased; ii <= rd->nfed; ii++) {
+        const struct jsonsl_reader_slot_st *slot = rd->slots + (ii % rd->nslots);
+        if (pos >= slot->pos && pos < slot->pos + slot->len) {
+            *navail = slot->len - (pos - slot->pos);
+            return slot->buf + (pos - slot->pos);
+        }
+    }
+    *navail = 0;
+    return NULL;
+}
+
+JSONSL_API
+void
+jsonsl_reader_retain(jsonsl_reader_t rd, size_t pos)
+{
+    rd->retain = pos;
+}
+#endif /* JSONSL_USE_PTHREADS */
+
+#if defined(JSONSL_USE_ZLIB) || defined(JSONSL_USE_ZSTD)
+/* Compressed input is read in chunks of this many bytes */
+#define JSONSL__ZCHUNK (JSONSL_DECOMPRESS_WINDOW / 2)
+
+/**
+ * Each of the decoders below is handed the first chunk of input (which was
+ * read to detect the format) in 'in'. They return 0 once the input is
+ * exhausted or the lexer stops, and -1 (with errno set) on bad data.
+ *
+ * Note that once the output window has been filled up completely, the
+ * decoder may still have more output for the input it has already seen, so
+ * it must be called again before reading more.
+ */
+
+#ifdef JSONSL_USE_ZLIB
+static int
+jsonsl__feed_gzip(jsonsl_t jsn, FILE *fp, unsigned char *in, size_t nin,
+                  jsonsl_char_t *out)
+{
+    z_stream zs;
+    int zrv, rv = 0, ended = 0, full = 0;
+
+    memset(&zs, 0, sizeof(zs));
+    /* +32: accept both gzip and zlib headers */
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+        errno = ENOMEM;
+        return -1;
+    }
+    zs.next_in = in;
+    zs.avail_in = (uInt)nin;
+
+    for (;;) {
+        size_t nout;
+        if (zs.avail_in == 0 && !full) {
+            if ((nin = fread(in, 1, JSONSL__ZCHUNK, fp)) == 0) {
+                if (!ended) {
+                    /* Truncated (or empty) */
+                    errno = EINVAL;
+                    rv = -1;
+                }
+                break;
+            }
+            zs.next_in = in;
+            zs.avail_in = (uInt)nin;
+        }
+
+        zs.next_out = (Bytef *)out;
+        zs.avail_out = JSONSL_DECOMPRESS_WINDOW * sizeof(jsonsl_char_t);
+        ended = 0;
+        zrv = inflate(&zs, Z_NO_FLUSH);
+        if (zrv != Z_OK && zrv != Z_STREAM_END && zrv != Z_BUF_ERROR) {
+            errno = EINVAL;
+            rv = -1;
+            break;
+        }
+
+        full = zs.avail_out == 0;
+        nout = JSONSL_DECOMPRESS_WINDOW - zs.avail_out / sizeof(jsonsl_char_t);
+        if (nout && jsonsl_feed_budget(jsn, out, nout, nout) != nout) {
+            break;
+        }
+        if (zrv == Z_STREAM_END) {
+            /* There may be another member following this one */
+            ended = 1;
+            full = 0;
+            inflateReset(&zs);
+        }
+    }
+    inflateEnd(&zs);
+    return rv;
+}
+#endif /* JSONSL_USE_ZLIB */
+
+#ifdef JSONSL_USE_ZSTD
+static int
+jsonsl__feed_zstd(jsonsl_t jsn, FILE *fp, unsigned char *in, size_t nin,
+                  jsonsl_char_t *out)
+{
+    ZSTD_DStream *zds;
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    /* ZSTD_decompressStream() returns 0 only at the end of a frame */
+    size_t zrv = 1;
+    int rv = 0, full = 0;
+
+    if ((zds = ZSTD_createDStream()) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ZSTD_initDStream(zds);
+    zin.src = in;
+    zin.size = nin;
+    zin.pos = 0;
+
+    for (;;) {
+        size_t nout;
+        if (zin.pos == zin.size && !full) {
+            if ((nin = fread(in, 1, JSONSL__ZCHUNK, fp)) == 0) {
+                if (zrv != 0) {
+                    errno = EINVAL;
+                    rv = -1;
+                }
+                break;
+            }
+            zin.size = nin;
+            zin.pos = 0;
+        }
+
+        zout.dst = out;
+        zout.size = JSONSL_DECOMPRESS_WINDOW * sizeof(jsonsl_char_t);
+        zout.pos = 0;
+        zrv = ZSTD_decompressStream(zds, &zout, &zin);
+        if (ZSTD_isError(zrv)) {
+            errno = EINVAL;
+            rv = -1;
+            break;
+        }
+
+        /* A zero return means everything has been flushed already */
+        full = zout.pos == zout.size && zrv != 0;
+        nout = zout.pos / sizeof(jsonsl_char_t);
+        if (nout && jsonsl_feed_budget(jsn, out, nout, nout) != nout) {
+            break;
+        }
+    }
+    ZSTD_freeDStream(zds);
+    return rv;
+}
+#endif /* JSONSL_USE_ZSTD */
+
+JSONSL_API
+int
+jsonsl_feed_compressed(jsonsl_t jsn, const char *path, int format)
+{
+    FILE *fp;
+    unsigned char *in;
+    jsonsl_char_t *out;
+    size_t nin;
+    int rv = -1;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return -1;
+    }
+    in = (unsigned char *)malloc(JSONSL__ZCHUNK);
+    out = (jsonsl_char_t *)malloc(JSONSL_DECOMPRESS_WINDOW * sizeof(*out));
+    if (!in || !out) {
+        errno = ENOMEM;
+        goto GT_DONE;
+    }
+
+    nin = fread(in, 1, JSONSL__ZCHUNK, fp);
+    if (format == JSONSL_COMPRESS_AUTO) {
+        if (nin >= 2 && in[0] == 0x1f && in[1] == 0x8b) {
+            format = JSONSL_COMPRESS_GZIP;
+        } else if (nin >= 4 && in[0] == 0x28 && in[1] == 0xb5 &&
+                in[2] == 0x2f && in[3] == 0xfd) {
+            format = JSONSL_COMPRESS_ZSTD;
+        }
+    }
+
+    switch (format) {
+#ifdef JSONSL_USE_ZLIB
+    case JSONSL_COMPRESS_GZIP:
+        rv = jsonsl__feed_gzip(jsn, fp, in, nin, out);
+        break;
+#endif
+#ifdef JSONSL_USE_ZSTD
+    case JSONSL_COMPRESS_ZSTD:
+        rv = jsonsl__feed_zstd(jsn, fp, in, nin, out);
+        break;
+#endif
+    case JSONSL_COMPRESS_AUTO:
+        /* Not compressed; feed it straight from the input buffer */
+        rv = 0;
+        while (nin) {
+            size_t nchars = nin / sizeof(jsonsl_char_t);
+            if (jsonsl_feed_budget(jsn, (const jsonsl_char_t *)in,
+                                   nchars, nchars) != nchars) {
+                break;
+            }
+            nin = fread(in, 1, JSONSL__ZCHUNK, fp);
+        }
+        break;
+    default:
+        errno = EINVAL;
+        break;
+    }
+
+    if (rv == 0 && ferror(fp)) {
+        rv = -1;
+    }
+
+    GT_DONE:
+    free(in);
+    free(out);
+    fclose(fp);
+    return rv;
+}
+#endif /* JSONSL_USE_ZLIB || JSONSL_USE_ZSTD */
+
+/* Numbers. Doubles are formatted with Grisu2 (Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", 2010): a
+ * double and the midpoints to its neighbours are scaled by a cached power
+ * of ten into 64 bit fixed point, and digits are generated until they fall
+ * between the midpoints. */
+static const char jsonsl__digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Write the digits of 'value' so that they end at 'end', two at a time,
+ * returning where they begin */
+static char *
+jsonsl__format_digits(uint64_t value, char *end)
+{
+    unsigned pair;
+    while (value > 0xffffffffUL) {
+        pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--end = jsonsl__digit_pairs[pair + 1];
+        *--end = jsonsl__digit_pairs[pair];
+    }
+    {
+        /* The rest fit in 32 bits, which divide more cheaply */
+        unsigned long small = (unsigned long)value;
+        while (small >= 100) {
+            pair = (unsigned)(small % 100) * 2;
+            small /= 100;
+            *--end = jsonsl__digit_pairs[pair + 1];
+            *--end = jsonsl__digit_pairs[pair];
+        }
+        if (small >= 10) {
+            *--end = jsonsl__digit_pairs[small * 2 + 1];
+            *--end = jsonsl__digit_pairs[small * 2];
+        } else {
+            *--end = (char)('0' + small);
+        }
+    }
+    return end;
+}
+
+JSONSL_API
+size_t
+jsonsl_format_int(int64_t value, char *buf)
+{
+    char digits[20], *p;
+    size_t len = 0, ndigits;
+    /* Negated as unsigned, as -INT64_MIN overflows */
+    uint64_t mag = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    p = jsonsl__format_digits(mag, digits + sizeof(digits));
+    ndigits = digits + sizeof(digits) - p;
+    if (value < 0) {
+        buf[len++] = '-';
+    }
+    memcpy(buf + len, p, ndigits);
+    len += ndigits;
+    buf[len] = '\0';
+    return len;
+}
+
+/* f * 2^e */
+struct jsonsl__diyfp {
+    uint64_t f;
+    int e;
+};
+
+/* 10^k, for every eighth k from -300 to 340, as the nearest f * 2^e with f
+ * (hi * 2^32 + lo) of exactly 64 bits */
+static const struct {
+    unsigned long hi;
+    unsigned long lo;
+    int e;
+    int k;
+} jsonsl__cached_powers[] = {
+    { 0xAB70FE17UL, 0xC79AC6CAUL, -1060, -300 },
+    { 0xFF77B1FCUL, 0xBEBCDC4FUL, -1034, -292 },
+    { 0xBE5691EFUL, 0x416BD60CUL, -1007, -284 },
+    { 0x8DD01FADUL, 0x907FFC3CUL,  -980, -276 },
+    { 0xD3515C28UL, 0x31559A83UL,  -954, -268 },
+    { 0x9D71AC8FUL, 0xADA6C9B5UL,  -927, -260 },
+    { 0xEA9C2277UL, 0x23EE8BCBUL,  -901, -252 },
+    { 0xAECC4991UL, 0x4078536DUL,  -874, -244 },
+    { 0x823C1279UL, 0x5DB6CE57UL,  -847, -236 },
+    { 0xC2109436UL, 0x4DFB5637UL,  -821, -228 },
+    { 0x9096EA6FUL, 0x3848984FUL,  -794, -220 },
+    { 0xD77485CBUL, 0x25823AC7UL,  -768, -212 },
+    { 0xA086CFCDUL, 0x97BF97F4UL,  -741, -204 },
+    { 0xEF340A98UL, 0x172AACE5UL,  -715, -196 },
+    { 0xB23867FBUL, 0x2A35B28EUL,  -688, -188 },
+    { 0x84C8D4DFUL, 0xD2C63F3BUL,  -661, -180 },
+    { 0xC5DD4427UL, 0x1AD3CDBAUL,  -635, -172 },
+    { 0x936B9FCEUL, 0xBB25C996UL,  -608, -164 },
+    { 0xDBAC6C24UL, 0x7D62A584UL,  -582, -156 },
+    { 0xA3AB6658UL, 0x0D5FDAF6UL,  -555, -148 },
+    { 0xF3E2F893UL, 0xDEC3F126UL,  -529, -140 },
+    { 0xB5B5ADA8UL, 0xAAFF80B8UL,  -502, -132 },
+    { 0x87625F05UL, 0x6C7C4A8BUL,  -475, -124 },
+    { 0xC9BCFF60UL, 0x34C13053UL,  -449, -116 },
+    { 0x964E858CUL, 0x91BA2655UL,  -422, -108 },
+    { 0xDFF97724UL, 0x70297EBDUL,  -396, -100 },
+    { 0xA6DFBD9FUL, 0xB8E5B88FUL,  -369,  -92 },
+    { 0xF8A95FCFUL, 0x88747D94UL,  -343,  -84 },
+    { 0xB9447093UL, 0x8FA89BCFUL,  -316,  -76 },
+    { 0x8A08F0F8UL, 0xBF0F156BUL,  -289,  -68 },
+    { 0xCDB02555UL, 0x653131B6UL,  -263,  -60 },
+    { 0x993FE2C6UL, 0xD07B7FACUL,  -236,  -52 },
+    { 0xE45C10C4UL, 0x2A2B3B06UL,  -210,  -44 },
+    { 0xAA242499UL, 0x697392D3UL,  -183,  -36 },
+    { 0xFD87B5F2UL, 0x8300CA0EUL,  -157,  -28 },
+    { 0xBCE50864UL, 0x92111AEBUL,  -130,  -20 },
+    { 0x8CBCCC09UL, 0x6F5088CCUL,  -103,  -12 },
+    { 0xD1B71758UL, 0xE219652CUL,   -77,   -4 },
+    { 0x9C400000UL, 0x00000000UL,   -50,    4 },
+    { 0xE8D4A510UL, 0x00000000UL,   -24,   12 },
+    { 0xAD78EBC5UL, 0xAC620000UL,     3,   20 },
+    { 0x813F3978UL, 0xF8940984UL,    30,   28 },
+    { 0xC097CE7BUL, 0xC90715B3UL,    56,   36 },
+    { 0x8F7E32CEUL, 0x7BEA5C70UL,    83,   44 },
+    { 0xD5D238A4UL, 0xABE98068UL,   109,   52 },
+    { 0x9F4F2726UL, 0x179A2245UL,   136,   60 },
+    { 0xED63A231UL, 0xD4C4FB27UL,   162,   68 },
+    { 0xB0DE6538UL, 0x8CC8ADA8UL,   189,   76 },
+    { 0x83C7088EUL, 0x1AAB65DBUL,   216,   84 },
+    { 0xC45D1DF9UL, 0x42711D9AUL,   242,   92 },
+    { 0x924D692CUL, 0xA61BE758UL,   269,  100 },
+    { 0xDA01EE64UL, 0x1A708DEAUL,   295,  108 },
+    { 0xA26DA399UL, 0x9AEF774AUL,   322,  116 },
+    { 0xF209787BUL, 0xB47D6B85UL,   348,  124 },
+    { 0xB454E4A1UL, 0x79DD1877UL,   375,  132 },
+    { 0x865B8692UL, 0x5B9BC5C2UL,   402,  140 },
+    { 0xC83553C5UL, 0xC8965D3DUL,   428,  148 },
+    { 0x952AB45CUL, 0xFA97A0B3UL,   455,  156 },
+    { 0xDE469FBDUL, 0x99A05FE3UL,   481,  164 },
+    { 0xA59BC234UL, 0xDB398C25UL,   508,  172 },
+    { 0xF6C69A72UL, 0xA3989F5CUL,   534,  180 },
+    { 0xB7DCBF53UL, 0x54E9BECEUL,   561,  188 },
+    { 0x88FCF317UL, 0xF22241E2UL,   588,  196 },
+    { 0xCC20CE9BUL, 0xD35C78A5UL,   614,  204 },
+    { 0x98165AF3UL, 0x7B2153DFUL,   641,  212 },
+    { 0xE2A0B5DCUL, 0x971F303AUL,   667,  220 },
+    { 0xA8D9D153UL, 0x5CE3B396UL,   694,  228 },
+    { 0xFB9B7CD9UL, 0xA4A7443CUL,   720,  236 },
+    { 0xBB764C4CUL, 0xA7A44410UL,   747,  244 },
+    { 0x8BAB8EEFUL, 0xB6409C1AUL,   774,  252 },
+    { 0xD01FEF10UL, 0xA657842CUL,   800,  260 },
+    { 0x9B10A4E5UL, 0xE9913129UL,   827,  268 },
+    { 0xE7109BFBUL, 0xA19C0C9DUL,   853,  276 },
+    { 0xAC2820D9UL, 0x623BF429UL,   880,  284 },
+    { 0x80444B5EUL, 0x7AA7CF85UL,   907,  292 },
+    { 0xBF21E440UL, 0x03ACDD2DUL,   933,  300 },
+    { 0x8E679C2FUL, 0x5E44FF8FUL,   960,  308 },
+    { 0xD433179DUL, 0x9C8CB841UL,   986,  316 },
+    { 0x9E19DB92UL, 0xB4E31BA9UL,  1013,  324 },
+    { 0xEB96BF6EUL, 0xBADF77D9UL,  1039,  332 },
+    { 0xAF87023BUL, 0x9BF0EE6BUL,  1066,  340 }
+};
+
+/* The binary exponents the scaled values are brought within, so that their
+ * integer parts fit in 32 bits */
+#define JSONSL__GRISU_ALPHA -60
+#define JSONSL__GRISU_GAMMA -32
+
+/* The upper 64 bits of the product, rounded */
+static struct jsonsl__diyfp
+jsonsl__diyfp_mul(struct jsonsl__diyfp x, struct jsonsl__diyfp y)
+{
+    struct jsonsl__diyfp r;
+    uint64_t x_lo = x.f & 0xffffffffUL, x_hi = x.f >> 32;
+    uint64_t y_lo = y.f & 0xffffffffUL, y_hi = y.f >> 32;
+    uint64_t lo_lo = x_lo * y_lo, lo_hi = x_lo * y_hi;
+    uint64_t hi_lo = x_hi * y_lo, hi_hi = x_hi * y_hi;
+    uint64_t mid = (lo_lo >> 32) + (lo_hi & 0xffffffffUL) +
+            (hi_lo & 0xffffffffUL) + ((uint64_t)1 << 31);
+
+    r.f = hi_hi + (lo_hi >> 32) + (hi_lo >> 32) + (mid >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static struct jsonsl__diyfp
+jsonsl__diyfp_normalize(struct jsonsl__diyfp x)
+{
+    while (!(x.f >> 63)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* Returns the number of digits of 'n', setting 'pow10' to the place of the
+ * first */
+static int
+jsonsl__grisu_pow10(unsigned long n, unsigned long *pow10)
+{
+    int ndigits = 10;
+    *pow10 = 1000000000UL;
+    while (*pow10 > n && ndigits > 1) {
+        *pow10 /= 10;
+        ndigits--;
+    }
+    return ndigits;
+}
+
+/* Bring the last digit towards 'w', while it stays within the midpoints */
+static void
+jsonsl__grisu_round(char *digits, int ndigits, uint64_t dist, uint64_t delta,
+                    uint64_t rest, uint64_t ten_k)
+{
+    while (rest < dist && delta - rest >= ten_k &&
+            (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        digits[ndigits - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* Generate the digits of a positive, finite double. Returns their number,
+ * and sets 'dexp' so that the value is digits * 10^dexp */
+static int
+jsonsl__grisu2(double value, char *digits, int *dexp)
+{
+    struct jsonsl__diyfp v, m_plus, m_minus, c, w, w_plus, w_minus, one;
+    uint64_t bits, significand, delta, dist, p2, rest;
+    unsigned long p1, pow10;
+    int biased, f, k, index, ndigits = 0, n;
+
+    memcpy(&bits, &value, sizeof(bits));
+    significand = bits & (((uint64_t)1 << 52) - 1);
+    biased = (int)(bits >> 52) & 0x7ff;
+    if (biased) {
+        v.f = significand | ((uint64_t)1 << 52);
+        v.e = biased - 1075;
+    } else {
+        v.f = significand;
+        v.e = 1 - 1075;
+    }
+
+    /* The midpoints between 'v' and its neighbours. The one below is nearer
+     * at a power of two, where the exponent steps down */
+    m_plus.f = 2 * v.f + 1;
+    m_plus.e = v.e - 1;
+    if (significand == 0 && biased > 1) {
+        m_minus.f = 4 * v.f - 1;
+        m_minus.e = v.e - 2;
+    } else {
+        m_minus.f = 2 * v.f - 1;
+        m_minus.e = v.e - 1;
+    }
+    m_plus = jsonsl__diyfp_normalize(m_plus);
+    m_minus.f <<= m_minus.e - m_plus.e;
+    m_minus.e = m_plus.e;
+    v = jsonsl__diyfp_normalize(v);
+
+    /* A power of ten bringing the exponent within [ALPHA, GAMMA]: k is
+     * ceil((ALPHA - e - 1) * log10(2)) */
+    f = JSONSL__GRISU_ALPHA - m_plus.e - 1;
+    k = (f * 78913) / (1 << 18) + (f > 0);
+    index = (300 + k + 7) / 8;
+    c.f = (uint64_t)jsonsl__cached_powers[index].hi << 32 |
+            jsonsl__cached_powers[index].lo;
+    c.e = jsonsl__cached_powers[index].e;
+    *dexp = -jsonsl__cached_powers[index].k;
+
+    w = jsonsl__diyfp_mul(v, c);
+    w_plus = jsonsl__diyfp_mul(m_plus, c);
+    w_minus = jsonsl__diyfp_mul(m_minus, c);
+    /* Narrowed by an ulp each, for the error of the scaling */
+    w_plus.f--;
+    w_minus.f++;
+
+    delta = w_plus.f - w_minus.f;
+    dist = w_plus.f - w.f;
+    one.e = w_plus.e;
+    one.f = (uint64_t)1 << -one.e;
+    p1 = (unsigned long)(w_plus.f >> -one.e);
+    p2 = w_plus.f & (one.f - 1);
+
+    /* The digits of the integer part, stopping as soon as they are close
+     * enough */
+    n = jsonsl__grisu_pow10(p1, &pow10);
+    while (n > 0) {
+        digits[ndigits++] = (char)('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+        rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *dexp += n;
+            jsonsl__grisu_round(digits, ndigits, dist, delta, rest,
+                                (uint64_t)pow10 << -one.e);
+            return ndigits;
+        }
+        pow10 /= 10;
+    }
+
+    /* Then those of the fraction */
+    for (;;) {
+        p2 *= 10;
+        digits[ndigits++] = (char)('0' + (p2 >> -one.e));
+        p2 &= one.f - 1;
+        delta *= 10;
+        dist *= 10;
+        (*dexp)--;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    jsonsl__grisu_round(digits, ndigits, dist, delta, p2, one.f);
+    return ndigits;
+}
+
+JSONSL_API
+size_t
+jsonsl_format_double(double value, char *buf)
+{
+    char digits[20], *p = buf;
+    int ndigits, dexp, point;
+
+    if (value != value || value - value != 0) {
+        *buf = '\0';
+        return 0;
+    }
+    if (value < 0 || (value == 0 && 1 / value < 0)) {
+        *p++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        *p++ = '0';
+        *p = '\0';
+        return p - buf;
+    }
+
+    ndigits = jsonsl__grisu2(value, digits, &dexp);
+    /* Where the decimal point goes, counting from the first digit */
+    point = ndigits + dexp;
+    if (point >= ndigits && point <= 17) {
+        /* An integer: 1234500 */
+        memcpy(p, digits, ndigits);
+        memset(p + ndigits, '0', point - ndigits);
+        p += point;
+    } else if (point > 0 && point <= 17) {
+        /* 1234.5 */
+        memcpy(p, digits, point);
+        p[point] = '.';
+        memcpy(p + point + 1, digits + point, ndigits - point);
+        p += ndigits + 1;
+    } else if (point > -4 && point <= 0) {
+        /* 0.0012345 */
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, digits, ndigits);
+        p += ndigits;
+    } else {
+        /* 1.2345e21, 1.2345e-7 */
+        char expbuf[4], *exp;
+        *p++ = digits[0];
+        if (ndigits > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, ndigits - 1);
+            p += ndigits - 1;
+        }
+        *p++ = 'e';
+        if (point <= 0) {
+            *p++ = '-';
+        }
+        exp = jsonsl__format_digits(point > 0 ? point - 1 : 1 - point,
+                                    expbuf + sizeof(expbuf));
+        memcpy(p, exp, expbuf + sizeof(expbuf) - exp);
+        p += expbuf + sizeof(expbuf) - exp;
+    }
+    *p = '\0';
+    return p - buf;
+}
+
+/* Writers. 'stack' holds the type of each open container, with the
+ * document itself at level 0; 'nonempty' is set once the innermost container
+ * (or the document) has a value, and 'want_value' between a key and its
+ * value */
+struct jsonsl_writer_st {
+    char *buf;
+    size_t nbuf;
+    size_t pos;
+    jsonsl_writer_flush_callback flush;
+    void *data;
+    jsonsl_error_t err;
+    unsigned level;
+    unsigned nlevels;
+    int nonempty;
+    int want_value;
+    unsigned char stack[1];
+};
+
+JSONSL_API
+jsonsl_writer_t
+jsonsl_writer_new(unsigned nlevels, char *buf, size_t nbuf,
+                  jsonsl_writer_flush_callback flush, void *data)
+{
+    struct jsonsl_writer_st *writer;
+
+    /* jsonsl__writer_putc() writes after a flush without checking for
+     * room */
+    if (!nbuf) {
+        return NULL;
+    }
+    writer = (struct jsonsl_writer_st *)calloc(1, sizeof(*writer) + nlevels);
+    if (!writer) {
+        return NULL;
+    }
+    writer->buf = buf;
+    writer->nbuf = nbuf;
+    writer->flush = flush;
+    writer->data = data;
+    writer->nlevels = nlevels;
+    writer->stack[0] = JSONSL_T_ROOT;
+    return writer;
+}
+
+static int
+jsonsl__writer_flush(struct jsonsl_writer_st *writer)
+{
+    if (writer->flush(writer->data, writer->buf, writer->pos) != 0) {
+        writer->err = JSONSL_ERROR_WRITE_FAILED;
+        return -1;
+    }
+    writer->pos = 0;
+    return 0;
+}
+
+static void
+jsonsl__writer_put(struct jsonsl_writer_st *writer, const char *text,
+                   size_t ntext)
+{
+    if (writer->nbuf - writer->pos >= ntext) {
+        memcpy(writer->buf + writer->pos, text, ntext);
+        writer->pos += ntext;
+        return;
+    }
+    while (ntext) {
+        size_t n = writer->nbuf - writer->pos;
+        if (!n) {
+            if (jsonsl__writer_flush(writer) != 0) {
+                return;
+            }
+            n = writer->nbuf;
+        }
+        if (n > ntext) {
+            n = ntext;
+        }
+        memcpy(writer->buf + writer->pos, text, n);
+        writer->pos += n;
+        text += n;
+        ntext -= n;
+    }
+}
+
+static void
+jsonsl__writer_putc(struct jsonsl_writer_st *writer, char c)
+{
+    if (writer->pos == writer->nbuf && jsonsl__writer_flush(writer) != 0) {
+        return;
+    }
+    writer->buf[writer->pos++] = c;
+}
+
+/* Bytes of a word which are all the same */
+#define JSONSL__WORD_BYTES(c) (~(uint64_t)0 / 0xff * (c))
+
+/* Whether any of the 8 characters in 'word' needs escaping: a control
+ * character, a quote or a backslash. The subtractions borrow from a byte
+ * (setting its top bit) where it is below 0x20, or where the XORs zeroed
+ * it; bytes with their own top bit set are masked out */
+static int
+jsonsl__writer_word_dirty(uint64_t word)
+{
+    uint64_t quote = word ^ JSONSL__WORD_BYTES('"');
+    uint64_t bslash = word ^ JSONSL__WORD_BYTES('\\');
+    return (((word - JSONSL__WORD_BYTES(0x20)) & ~word) |
+            ((quote - JSONSL__WORD_BYTES(1)) & ~quote) |
+            ((bslash - JSONSL__WORD_BYTES(1)) & ~bslash)) &
+            JSONSL__WORD_BYTES(0x80) ? 1 : 0;
+}
+
+/* Write the escape of a character which needs one, returning its length */
+static size_t
+jsonsl__writer_escape_char(char c, char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+    out[0] = '\\';
+    out[1] = get_escape_letter(c);
+    if (out[1] != 'u') {
+        return 2;
+    }
+    out[2] = out[3] = '0';
+    out[4] = hex[(c >> 4) & 0xf];
+    out[5] = hex[c & 0xf];
+    return 6;
+}
+
+/* Write a string (or key) in quotes, escaping it */
+static void
+jsonsl__writer_escape(struct jsonsl_writer_st *writer, const char *str,
+                      size_t nstr)
+{
+    const char *end = str + nstr, *run = str, *word_end;
+    size_t room = writer->nbuf - writer->pos;
+    char esc[6], *out;
+    uint64_t word;
+
+    if (room >= 2 && nstr <= (room - 2) / 6) {
+        /* It fits, even if every character is escaped: write straight into
+         * the buffer */
+        out = writer->buf + writer->pos;
+        *out++ = '"';
+        while (str < end) {
+            if (end - str >= 8) {
+                memcpy(&word, str, 8);
+                if (!jsonsl__writer_word_dirty(word)) {
+                    memcpy(out, &word, 8);
+                    out += 8;
+                    str += 8;
+                    continue;
+                }
+            }
+            word_end = end - str < 8 ? end : str + 8;
+            for (; str < word_end; str++) {
+                if (get_escape_letter(*str)) {
+                    out += jsonsl__writer_escape_char(*str, out);
+                } else {
+                    *out++ = *str;
+                }
+            }
+        }
+        *out++ = '"';
+        writer->pos = out - writer->buf;
+        return;
+    }
+
+    jsonsl__writer_putc(writer, '"');
+    while (str < end) {
+        /* Skip clean words, then find the character in the next one */
+        for (; end - str >= 8; str += 8) {
+            memcpy(&word, str, 8);
+            if (jsonsl__writer_word_dirty(word)) {
+                break;
+            }
+        }
+        word_end = end - str < 8 ? end : str + 8;
+        for (; str < word_end && !get_escape_letter(*str); str++) {
+        }
+        if (str == word_end) {
+            continue;
+        }
+        jsonsl__writer_put(writer, run, str - run);
+        jsonsl__writer_put(writer, esc, jsonsl__writer_escape_char(*str, esc));
+        run = ++str;
+    }
+    jsonsl__writer_put(writer, run, end - run);
+    jsonsl__writer_putc(writer, '"');
+}
+
+/* Check that a value may be written, and write the comma before it */
+static int
+jsonsl__writer_value(struct jsonsl_writer_st *writer)
+{
+    if (writer->err != JSONSL_ERROR_SUCCESS) {
+        return -1;
+    }
+    if (writer->stack[writer->level] == JSONSL_T_OBJECT) {
+        if (!writer->want_value) {
+            writer->err = JSONSL_ERROR_HKEY_EXPECTED;
+            return -1;
+        }
+        writer->want_value = 0;
+    } else if (writer->nonempty) {
+        if (!writer->level) {
+            writer->err = JSONSL_ERROR_GARBAGE_TRAILING;
+            return -1;
+        }
+        jsonsl__writer_putc(writer, ',');
+    }
+    writer->nonempty = 1;
+    return 0;
+}
+
+static jsonsl_error_t
+jsonsl__writer_begin(struct jsonsl_writer_st *writer, jsonsl_type_t type)
+{
+    if (jsonsl__writer_value(writer) != 0) {
+        return writer->err;
+    }
+    if (writer->level == writer->nlevels) {
+        return writer->err = JSONSL_ERROR_LEVELS_EXCEEDED;
+    }
+    writer->stack[++writer->level] = type;
+    writer->nonempty = 0;
+    jsonsl__writer_putc(writer, (char)type);
+    return writer->err;
+}
+
+static jsonsl_error_t
+jsonsl__writer_end(struct jsonsl_writer_st *writer, jsonsl_type_t type)
+{
+    if (writer->err != JSONSL_ERROR_SUCCESS) {
+        return writer->err;
+    }
+    if (!writer->level) {
+        return writer->err = JSONSL_ERROR_STRAY_TOKEN;
+    }
+    if (writer->stack[writer->level] != type) {
+        return writer->err = JSONSL_ERROR_BRACKET_MISMATCH;
+    }
+    if (writer->want_value) {
+        return writer->err = JSONSL_ERROR_VALUE_EXPECTED;
+    }
+    writer->level--;
+    writer->nonempty = 1;
+    jsonsl__writer_putc(writer, type == JSONSL_T_OBJECT ? '}' : ']');
+    return writer->err;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_begin_object(jsonsl_writer_t writer)
+{
+    return jsonsl__writer_begin(writer, JSONSL_T_OBJECT);
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_end_object(jsonsl_writer_t writer)
+{
+    return jsonsl__writer_end(writer, JSONSL_T_OBJECT);
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_begin_list(jsonsl_writer_t writer)
+{
+    return jsonsl__writer_begin(writer, JSONSL_T_LIST);
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_end_list(jsonsl_writer_t writer)
+{
+    return jsonsl__writer_end(writer, JSONSL_T_LIST);
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_key(jsonsl_writer_t writer, const char *key, size_t nkey)
+{
+    if (writer->err != JSONSL_ERROR_SUCCESS) {
+        return writer->err;
+    }
+    if (writer->stack[writer->level] != JSONSL_T_OBJECT) {
+        return writer->err = JSONSL_ERROR_KEY_OUTSIDE_OBJECT;
+    }
+    if (writer->want_value) {
+        return writer->err = JSONSL_ERROR_VALUE_EXPECTED;
+    }
+    if (writer->nonempty) {
+        jsonsl__writer_putc(writer, ',');
+    }
+    writer->nonempty = writer->want_value = 1;
+    jsonsl__writer_escape(writer, key, nkey);
+    jsonsl__writer_putc(writer, ':');
+    return writer->err;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_string(jsonsl_writer_t writer, const char *str, size_t nstr)
+{
+    if (jsonsl__writer_value(writer) == 0) {
+        jsonsl__writer_escape(writer, str, nstr);
+    }
+    return writer->err;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_int(jsonsl_writer_t writer, int64_t value)
+{
+    char text[JSONSL_NUMBER_BUFSIZE];
+    return jsonsl_writer_raw(writer, text, jsonsl_format_int(value, text));
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_double(jsonsl_writer_t writer, double value)
+{
+    char text[JSONSL_NUMBER_BUFSIZE];
+    size_t ntext = jsonsl_format_double(value, text);
+    if (!ntext) {
+        if (writer->err == JSONSL_ERROR_SUCCESS) {
+            writer->err = JSONSL_ERROR_INVALID_NUMBER;
+        }
+        return writer->err;
+    }
+    return jsonsl_writer_raw(writer, text, ntext);
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_raw(jsonsl_writer_t writer, const char *text, size_t ntext)
+{
+    if (jsonsl__writer_value(writer) == 0) {
+        jsonsl__writer_put(writer, text, ntext);
+    }
+    return writer->err;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_writer_finish(jsonsl_writer_t writer)
+{
+    jsonsl_error_t err = writer->err;
+    if (err == JSONSL_ERROR_SUCCESS && (writer->level || !writer->nonempty)) {
+        err = JSONSL_ERROR_INCOMPLETE;
+    }
+    if (err == JSONSL_ERROR_SUCCESS && writer->pos &&
+            jsonsl__writer_flush(writer) != 0) {
+        err = writer->err;
+    }
+    writer->pos = 0;
+    writer->err = JSONSL_ERROR_SUCCESS;
+    writer->level = 0;
+    writer->nonempty = writer->want_value = 0;
+    return err;
+}
+
+JSONSL_API
+void
+jsonsl_writer_destroy(jsonsl_writer_t writer)
+{
+    free(writer);
+}
+
+JSONSL_API
+const char* jsonsl_strerror(jsonsl_error_t err)
+{
+    if (err == JSONSL_ERROR_SUCCESS) {
+        return "SUCCESS";
+    }
+#define X(t) \
+    if (err == JSONSL_ERROR_##t) \
+        return #t;
+    JSONSL_XERR;
+#undef X
+    return "<UNKNOWN_ERROR>";
+}
+
+JSONSL_API
+const char *jsonsl_strtype(jsonsl_type_t type)
+{
+#define X(o,c) \
+    if (type == JSONSL_T_##o) \
+        return #o;
+    JSONSL_XTYPE
+#undef X
+    return "UNKNOWN TYPE";
+
+}
+
+/*
+ *
+ * JPR/JSONPointer functions
+ *
+ *
+ */
+#ifndef JSONSL_NO_JPR
+/* Object keys are compared by this hash first, and looked up in path sets
+ * by it. It is the hash the lexer computes for keys as they are lexed */
+static uint32_t
+jsonsl__jpr_hash(const char *key, size_t nkey)
+{
+    uint32_t h = JSONSL__HASH_INIT;
+    for (; nkey; nkey--, key++) {
+        h = JSONSL__HASH_STEP(h, *key);
+    }
+    return h ? h : 1;
+}
+
+/* Parse a start:end:step slice. Returns 0 if the component isn't shaped
+ * like one (so that it is taken as a key), and -1 if it is invalid */
+static int
+jsonsl__jpr_parse_slice(const char *in, size_t len,
+                        struct jsonsl_jpr_component_st *component)
+{
+    unsigned long vals[3] = { 0, 0, 0 };
+    int have[3] = { 0, 0, 0 };
+    int field = 0;
+    size_t ii;
+
+    for (ii = 0; ii < len; ii++) {
+        if (in[ii] == ':') {
+            if (++field > 2) {
+                return 0;
+            }
+        } else if (isdigit((unsigned char)in[ii])) {
+            if (vals[field] > (ULONG_MAX - 9) / 10) {
+                return -1;
+            }
+            vals[field] = vals[field] * 10 + (in[ii] - '0');
+            have[field] = 1;
+        } else {
+            return 0;
+        }
+    }
+    if (!field || (have[2] && vals[2] == 0)) {
+        return field ? -1 : 0;
+    }
+    component->idx = vals[0];
+    component->idx_end = have[1] ? vals[1] : ULONG_MAX;
+    component->idx_step = have[2] ? vals[2] : 1;
+    return 1;
+}
+
+/* ASCII letters folded to lower case, for JSONSL_JPR_ICASE */
+static const unsigned char Jpr_Key_Fold[0x100] = {
+    /* 0x00 */ 0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+    /* 0x10 */ 0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f,
+    /* 0x20 */ 0x20,0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,0x29,0x2a,0x2b,0x2c,0x2d,0x2e,0x2f,
+    /* 0x30 */ 0x30,0x31,0x32,0x33,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x3b,0x3c,0x3d,0x3e,0x3f,
+    /* 0x40 */ 0x40,0x61,0x62,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x6b,0x6c,0x6d,0x6e,0x6f,
+    /* 0x50 */ 0x70,0x71,0x72,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x5b,0x5c,0x5d,0x5e,0x5f,
+    /* 0x60 */ 0x60,0x61,0x62,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x6b,0x6c,0x6d,0x6e,0x6f,
+    /* 0x70 */ 0x70,0x71,0x72,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x7b,0x7c,0x7d,0x7e,0x7f,
+    /* 0x80 */ 0x80,0x81,0x82,0x83,0x84,0x85,0x86,0x87,0x88,0x89,0x8a,0x8b,0x8c,0x8d,0x8e,0x8f,
+    /* 0x90 */ 0x90,0x91,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0x9b,0x9c,0x9d,0x9e,0x9f,
+    /* 0xa0 */ 0xa0,0xa1,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xab,0xac,0xad,0xae,0xaf,
+    /* 0xb0 */ 0xb0,0xb1,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xbb,0xbc,0xbd,0xbe,0xbf,
+    /* 0xc0 */ 0xc0,0xc1,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xcb,0xcc,0xcd,0xce,0xcf,
+    /* 0xd0 */ 0xd0,0xd1,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xdb,0xdc,0xdd,0xde,0xdf,
+    /* 0xe0 */ 0xe0,0xe1,0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xeb,0xec,0xed,0xee,0xef,
+    /* 0xf0 */ 0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff
+};
+
+/* Whether 'key' matches a component with flags (see
+ * jsonsl_jpr_component_st::flags), whose pattern is 'pat'. For a glob, a
+ * '*' first matches nothing, and is extended a character at a time on a
+ * mismatch after it */
+static int
+jsonsl__jpr_key_like(const char *pat, size_t npat, unsigned flags,
+                     const char *key, size_t nkey)
+{
+    const unsigned char *fold =
+            flags & JSONSL_JPR_ICASE ? Jpr_Key_Fold : NULL;
+    size_t pi = 0, ki = 0, star = npat, star_ki = 0;
+
+#define KEY_CHAR(ix) \
+    (fold ? fold[(unsigned char)key[ix]] : (unsigned char)key[ix])
+
+    if (!(flags & JSONSL_JPR_GLOB)) {
+        if (npat != nkey) {
+            return 0;
+        }
+        for (; ki < nkey; ki++) {
+            if ((unsigned char)pat[ki] != KEY_CHAR(ki)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    while (ki < nkey) {
+        if (pi < npat && pat[pi] == '*') {
+            star = pi++;
+            star_ki = ki;
+        } else if (pi < npat &&
+                (pat[pi] == '?' || (unsigned char)pat[pi] == KEY_CHAR(ki))) {
+            pi++;
+            ki++;
+        } else if (star != npat) {
+            pi = star + 1;
+            ki = ++star_ki;
+        } else {
+            return 0;
+        }
+    }
+#undef KEY_CHAR
+    while (pi < npat && pat[pi] == '*') {
+        pi++;
+    }
+    return pi == npat;
+}
+
+/* Whether a component's key can't be the key with hash 'h'. Either hash
+ * may be missing (zero): components built by hand have none, nor do keys
+ * with escapes, whose unescaped text hashes differently */
+#define JSONSL__JPR_HASH_DIFFERS(comp, h) \
+    ((h) && (comp)->key_hash && (comp)->key_hash != (h))
+
+/* Whether a slice component includes list index 'idx' */
+#define JSONSL__JPR_SLICE_HAS(comp, ix) \
+    ((ix) >= (comp)->idx && (ix) < (comp)->idx_end && \
+            ((ix) - (comp)->idx) % (comp)->idx_step == 0)
+
+/* Decode the %XX escapes in [in, end) in place, and null-terminate the
+ * result. Returns the decoded length, or -1 for a bad escape */
+static long
+jsonsl__jpr_unpercent(char *in, char *end)
+{
+    char *c, *outp;
+    for (c = outp = in; c < end; c++, outp++) {
+        char hex[3];
+        if (*c != '%') {
+            *outp = *c;
+            continue;
+        }
+        /*
+         * c = { [+0] = '%', [+1] = 'b', [+2] = 'e', [+3] = '\0' }
+         */
+
+        /* Need %XX */
+        if (c+2 >= end) {
+            return -1;
+        }
+        if (! (isxdigit(*(c+1)) && isxdigit(*(c+2))) ) {
+            return -1;
+        }
+        hex[0] = c[1];
+        hex[1] = c[2];
+        hex[2] = '\0';
+        *outp = (char)strtoul(hex, NULL, 16);
+        c += 2;
+    }
+    /* Null-terminate the string */
+    for (c = outp; c <= end; c++) {
+        *c = '\0';
+    }
+    return (long)(outp - in);
+}
+
+static
+jsonsl_jpr_type_t
+populate_component(char *in,
+                   struct jsonsl_jpr_component_st *component,
+                   char **next,
+                   int extended,
+                   jsonsl_error_t *errp)
+{
+    char *end = NULL, *grp, *pred = NULL, *pred_end = NULL;
+    size_t input_len;
+    jsonsl_jpr_type_t ret = JSONSL_PATH_NONE;
+
+    if (*next == NULL || *(*next) == '\0') {
+        return JSONSL_PATH_NONE;
+    }
+
+    /* Replace the next / with a NULL */
+    *next = strstr(in, "/");
+    if (*next != NULL) {
+        *(*next) = '\0'; /* drop the forward slash */
+        input_len = *next - in;
+        end = *next;
+        *next += 1; /* next character after the '/' */
+    } else {
+        input_len = strlen(in);
+        end = in + input_len;
+    }
+
+    component->pstr = in;
+
+    /* Trailing [flags], and/or a [key=value] predicate */
+    if (extended && input_len > 2 && in[input_len - 1] == ']' &&
+            (grp = (char *)memchr(in, '[', input_len)) != NULL) {
+        char *c;
+        unsigned flags = 0;
+        for (c = grp + 1; *c == 'i' || *c == 'g'; c++) {
+            flags |= *c == 'i' ? JSONSL_JPR_ICASE : JSONSL_JPR_GLOB;
+        }
+        if (flags && *c == ']') {
+            component->flags = flags;
+            if (c + 1 != end) {
+                pred = c + 1;
+            }
+        } else {
+            pred = grp;
+        }
+        if (pred && *pred != '[') {
+            *errp = JSONSL_ERROR_JPR_BADPATH;
+            return JSONSL_PATH_INVALID;
+        }
+        pred_end = end;
+        *grp = '\0';
+        end = grp;
+        input_len = grp - in;
+    }
+    if (pred) {
+        char *eq = (char *)memchr(pred, '=', pred_end - pred);
+        long nkey, nvalue;
+        if (!eq) {
+            *errp = JSONSL_ERROR_JPR_BADPATH;
+            return JSONSL_PATH_INVALID;
+        }
+        pred_end[-1] = '\0';
+        nkey = jsonsl__jpr_unpercent(pred + 1, eq);
+        nvalue = jsonsl__jpr_unpercent(eq + 1, pred_end - 1);
+        if (nkey < 0 || nvalue < 0) {
+            *errp = JSONSL_ERROR_PERCENT_BADHEX;
+            return JSONSL_PATH_INVALID;
+        } else if (nvalue == 0) {
+            *errp = JSONSL_ERROR_JPR_BADPATH;
+            return JSONSL_PATH_INVALID;
+        }
+        component->pred_key = pred + 1;
+        component->npred_key = (size_t)nkey;
+        component->pred_value = eq + 1;
+        component->npred_value = (size_t)nvalue;
+    }
+
+    /* Check for special components of interest */
+    if (component->flags) {
+        /* Always a key */
+        goto GT_STRING;
+    } else if (*in == JSONSL_PATH_WILDCARD_CHAR && input_len == 1) {
+        /* Lone wildcard */
+        ret = JSONSL_PATH_WILDCARD;
+        goto GT_RET;
+    } else if (extended && *in == JSONSL_PATH_WILDCARD_CHAR &&
+            input_len == 2 && in[1] == JSONSL_PATH_WILDCARD_CHAR) {
+        /* Any number of levels */
+        ret = JSONSL_PATH_DESCENDANT;
+        goto GT_RET;
+    } else if (isdigit(*in)) {
+        /* ASCII Numeric */
+        char *endptr;
+        component->idx = strtoul(in, &endptr, 10);
+        if (endptr && *endptr == '\0') {
+            ret = JSONSL_PATH_NUMERIC;
+            goto GT_RET;
+        }
+    }
+    if (extended && memchr(in, ':', input_len)) {
+        int rv = jsonsl__jpr_parse_slice(in, input_len, component);
+        if (rv < 0) {
+            *errp = JSONSL_ERROR_JPR_BADPATH;
+            return JSONSL_PATH_INVALID;
+        } else if (rv) {
+            ret = JSONSL_PATH_SLICE;
+            goto GT_RET;
+        }
+    }
+
+    /* Default, it's a string */
+    GT_STRING:
+    ret = JSONSL_PATH_STRING;
+    if (jsonsl__jpr_unpercent(in, end) < 0) {
+        *errp = JSONSL_ERROR_PERCENT_BADHEX;
+        return JSONSL_PATH_INVALID;
+    }
+    if (component->flags & JSONSL_JPR_ICASE) {
+        for (grp = in; *grp; grp++) {
+            *grp = (char)Jpr_Key_Fold[(unsigned char)*grp];
+        }
+    }
+    if ((component->flags & JSONSL_JPR_GLOB) && !strpbrk(in, "*?")) {
+        component->flags &= ~JSONSL_JPR_GLOB;
+    }
+
+    GT_RET:
+    component->ptype = ret;
+    if (ret != JSONSL_PATH_WILDCARD && ret != JSONSL_PATH_DESCENDANT) {
+        component->len = strlen(component->pstr);
+        /* Keys which match flagged components needn't hash alike */
+        component->key_hash = component->flags ? 0 :
+                jsonsl__jpr_hash(component->pstr, component->len);
+    }
+    return ret;
+}
+
+static jsonsl_jpr_t
+jsonsl__jpr_new(const char *path, int extended, jsonsl_error_t *errp)
+{
+    char *my_copy = NULL;
+    int count, curidx;
+    struct jsonsl_jpr_st *ret = NULL;
+    struct jsonsl_jpr_component_st *components = NULL;
+    size_t origlen;
+    jsonsl_error_t errstacked;
+
+#define JPR_BAIL(err) *errp = err; goto GT_ERROR;
+
+    if (errp == NULL) {
+        errp = &errstacked;
+    }
+
+    if (path == NULL || *path != '/') {
+        JPR_BAIL(JSONSL_ERROR_JPR_NOROOT);
+    }
+
+    count = 1;
+    path++;
+    {
+        const char *c = path;
+        for (; *c; c++) {
+            if (*c == '/') {
+                count++;
+                if (*(c+1) == '/') {
+                    JPR_BAIL(JSONSL_ERROR_JPR_DUPSLASH);
+                }
+            }
+        }
+    }
+    if(*path) {
+        count++;
+    }
+
+    components = (struct jsonsl_jpr_component_st *)
+            calloc(count, sizeof(*components));
+    if (!components) {
+        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    }
+
+    my_copy = (char *)malloc(strlen(path) + 1);
+    if (!my_copy) {
+        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    }
+
+    strcpy(my_copy, path);
+
+    components[0].ptype = JSONSL_PATH_ROOT;
+
+    if (*my_copy) {
+        char *cur = my_copy;
+        int pathret = JSONSL_PATH_STRING;
+        curidx = 1;
+        while (curidx < count) {
+            pathret = populate_component(cur, components + curidx, &cur,
+                                         extended, errp);
+            if (pathret > 0) {
+                curidx++;
+            } else {
+                break;
+            }
+        }
+
+        if (pathret == JSONSL_PATH_INVALID) {
+            JPR_BAIL(JSONSL_ERROR_JPR_BADPATH);
+        }
+        /* A descendant component must lead somewhere */
+        if (components[curidx - 1].ptype == JSONSL_PATH_DESCENDANT) {
+            JPR_BAIL(JSONSL_ERROR_JPR_BADPATH);
+        }
+        /* Only the value a path selects may have a predicate */
+        for (count = 1; count < curidx - 1; count++) {
+            if (components[count].pred_value) {
+                JPR_BAIL(JSONSL_ERROR_JPR_BADPATH);
+            }
+        }
+    } else {
+        curidx = 1;
+    }
+
+    path--; /*revert path to leading '/' */
+    origlen = strlen(path) + 1;
+    ret = (struct jsonsl_jpr_st *)malloc(sizeof(*ret));
+    if (!ret) {
+        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    }
+    ret->orig = (char *)malloc(origlen);
+    if (!ret->orig) {
+        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    }
+    ret->components = components;
+    ret->ncomponents = curidx;
+    ret->match_type = 0;
+    ret->basestr = my_copy;
+    ret->norig = origlen-1;
+    strcpy(ret->orig, path);
+
+    return ret;
+
+    GT_ERROR:
+    free(my_copy);
+    free(components);
+    if (ret) {
+        free(ret->orig);
+    }
+    free(ret);
+    return NULL;
+#undef JPR_BAIL
+}
+
+JSONSL_API
+jsonsl_jpr_t
+jsonsl_jpr_new(const char *path, jsonsl_error_t *errp)
+{
+    return jsonsl__jpr_new(path, 0, errp);
+}
+
+JSONSL_API
+jsonsl_jpr_t
+jsonsl_jpr_new_extended(const char *path, jsonsl_error_t *errp)
+{
+    return jsonsl__jpr_new(path, 1, errp);
+}
+
+JSONSL_API
+jsonsl_jpr_t
+jsonsl_jpr_new_pointer(const char *ptr, jsonsl_error_t *errp)
+{
+    struct jsonsl_jpr_st *ret = NULL;
+    struct jsonsl_jpr_component_st *comp;
+    const char *in;
+    char *outp;
+    size_t len, count = 1;
+    jsonsl_error_t errstacked;
+
+#define JPR_BAIL(err) *errp = err; goto GT_ERROR;
+
+    if (errp == NULL) {
+        errp = &errstacked;
+    }
+    /* The empty pointer is the whole document */
+    if (ptr == NULL || (*ptr && *ptr != '/')) {
+        JPR_BAIL(JSONSL_ERROR_JPR_NOROOT);
+    }
+    for (len = 0; ptr[len]; len++) {
+        if (ptr[len] == '/') {
+            count++;
+        }
+    }
+
+    ret = (struct jsonsl_jpr_st *)calloc(1, sizeof(*ret));
+    if (!ret) {
+        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    }
+    ret->components = (struct jsonsl_jpr_component_st *)
+            calloc(count, sizeof(*ret->components));
+    /* The pointer as given, followed by its unescaped reference tokens.
+     * Escapes only ever shrink a token, so the second half is enough */
+    ret->basestr = (char *)malloc(len * 2 + 2);
+    if (!ret->components || !ret->basestr) {
+        JPR_BAIL(JSONSL_ERROR_ENOMEM);
+    }
+    ret->orig = ret->basestr;
+    memcpy(ret->orig, ptr, len + 1);
+    ret->norig = len;
+    ret->ncomponents = count;
+    ret->components[0].ptype = JSONSL_PATH_ROOT;
+
+    outp = ret->basestr + len + 1;
+    for (in = ptr, comp = ret->components + 1; *in; comp++) {
+        int numeric = 1;
+        comp->pstr = outp;
+        for (in++; *in && *in != '/'; in++) {
+            char c = *in;
+            if (c == '~') {
+                if (in[1] == '0') {
+                    c = '~';
+                } else if (in[1] == '1') {
+                    c = '/';
+                } else {
+                    JPR_BAIL(JSONSL_ERROR_JPR_BADPATH);
+                }
+                in++;
+                numeric = 0;
+            } else if (numeric && isdigit((unsigned char)c)) {
+                if (comp->idx > (ULONG_MAX - 9) / 10) {
+                    numeric = 0;
+                } else {
+                    comp->idx = comp->idx * 10 + (c - '0');
+                }
+            } else {
+                numeric = 0;
+            }
+            *outp++ = c;
+        }
+        comp->len = outp - comp->pstr;
+        comp->key_hash = jsonsl__jpr_hash(comp->pstr, comp->len);
+        *outp++ = '\0';
+        /* Array indexes are "0" or have no leading zero; anything else
+         * (including "-", the element past the end) is a member name */
+        if (numeric && comp->len && (comp->len == 1 || *comp->pstr != '0')) {
+            comp->ptype = JSONSL_PATH_NUMERIC;
+        } else {
+            comp->ptype = JSONSL_PATH_STRING;
+            comp->idx = 0;
+        }
+    }
+    return ret;
+
+    GT_ERROR:
+    if (ret) {
+        free(ret->components);
+        free(ret->basestr);
+    }
+    free(ret);
+    return NULL;
+#undef JPR_BAIL
+}
+
+void jsonsl_jpr_destroy(jsonsl_jpr_t jpr)
+{
+    free(jpr->components);
+    if (jpr->orig != jpr->basestr) {
+        free(jpr->orig);
+    }
+    free(jpr->basestr);
+    free(jpr);
+}
+
+/**
+ * Call when there is a possibility of a match, either as a final match or
+ * as a path within a match
+ * @param jpr The JPR path
+ * @param component Component corresponding to the current element
+ * @param prlevel The level of the *parent*
+ * @param chtype The type of the child
+ * @return Match status
+ */
+static jsonsl_jpr_match_t
+jsonsl__match_continue(jsonsl_jpr_t jpr,
+                       const struct jsonsl_jpr_component_st *component,
+                       unsigned prlevel, unsigned chtype)
+{
+    const struct jsonsl_jpr_component_st *next_comp = component + 1;
+    if (prlevel == jpr->ncomponents - 1) {
+        /* This is the match. Check the expected type of the match against
+         * the child */
+        if (jpr->match_type == 0 || jpr->match_type == chtype) {
+            /* A predicate can only be evaluated by a path set */
+            return component->pred_value ? JSONSL_MATCH_POSSIBLE :
+                    JSONSL_MATCH_COMPLETE;
+        } else {
+            return JSONSL_MATCH_TYPE_MISMATCH;
+        }
+    }
+    if (chtype == JSONSL_T_LIST) {
+        if (next_comp->ptype == JSONSL_PATH_NUMERIC ||
+                next_comp->ptype == JSONSL_PATH_SLICE) {
+            return JSONSL_MATCH_POSSIBLE;
+        } else {
+            return JSONSL_MATCH_TYPE_MISMATCH;
+        }
+    } else if (chtype == JSONSL_T_OBJECT) {
+        if (next_comp->ptype == JSONSL_PATH_NUMERIC ||
+                next_comp->ptype == JSONSL_PATH_SLICE) {
+            return JSONSL_MATCH_TYPE_MISMATCH;
+        } else {
+            return JSONSL_MATCH_POSSIBLE;
+        }
+    } else {
+        return JSONSL_MATCH_TYPE_MISMATCH;
+    }
+}
+
+JSONSL_API
+jsonsl_jpr_match_t
+jsonsl_path_match(jsonsl_jpr_t jpr,
+                  const struct jsonsl_state_st *parent,
+                  const struct jsonsl_state_st *child,
+                  const char *key, size_t nkey)
+{
+    const struct jsonsl_jpr_component_st *comp;
+    if (!parent) {
+        /* No parent. Return immediately since it's always a match */
+        return jsonsl__match_continue(jpr, jpr->components, 0, child->type);
+    }
+
+    comp = jpr->components + parent->level;
+
+    /* note that we don't need to verify the type of the match, this is
+     * always done through the previous call to jsonsl__match_continue.
+     * If we are in a POSSIBLE tree then we can be certain the types (at
+     * least at this level) are correct */
+    if (parent->type == JSONSL_T_OBJECT) {
+        if (comp->flags) {
+            if (!jsonsl__jpr_key_like(comp->pstr, comp->len, comp->flags,
+                                      key, nkey)) {
+                return JSONSL_MATCH_NOMATCH;
+            }
+        } else if (comp->len != nkey || strncmp(key, comp->pstr, nkey) != 0) {
+            return JSONSL_MATCH_NOMATCH;
+        }
+    } else if (comp->ptype == JSONSL_PATH_SLICE) {
+        if (!JSONSL__JPR_SLICE_HAS(comp, (unsigned long)parent->nelem - 1)) {
+            return JSONSL_MATCH_NOMATCH;
+        }
+    } else {
+        if (comp->idx != parent->nelem - 1) {
+            return JSONSL_MATCH_NOMATCH;
+        }
+    }
+    return jsonsl__match_continue(jpr, comp, parent->level, child->type);
+}
+
+static jsonsl_jpr_match_t
+jsonsl__jpr_match_key(jsonsl_jpr_t jpr,
+                      unsigned int parent_type,
+                      unsigned int parent_level,
+                      const char *key,
+                      size_t nkey,
+                      uint32_t hash)
+{
+    /* find our current component. This is the child level */
+    int cmpret;
+    struct jsonsl_jpr_component_st *p_component;
+    p_component = jpr->components + parent_level;
+
+    if (parent_level >= jpr->ncomponents) {
+        return JSONSL_MATCH_NOMATCH;
+    }
+
+    /* Lone query for 'root' element. Always matches */
+    if (parent_level == 0) {
+        if (jpr->ncomponents == 1) {
+            return JSONSL_MATCH_COMPLETE;
+        } else {
+            return JSONSL_MATCH_POSSIBLE;
+        }
+    }
+
+    /* Only path sets can follow these */
+    if (p_component->ptype == JSONSL_PATH_DESCENDANT) {
+        return JSONSL_MATCH_NOMATCH;
+    }
+
+    if (p_component->ptype == JSONSL_PATH_SLICE) {
+        if (parent_type != JSONSL_T_LIST) {
+            return JSONSL_MATCH_TYPE_MISMATCH;
+        } else if (!JSONSL__JPR_SLICE_HAS(p_component, nkey)) {
+            return JSONSL_MATCH_NOMATCH;
+        } else if (parent_level == jpr->ncomponents-1) {
+            return JSONSL_MATCH_COMPLETE;
+        } else {
+            return JSONSL_MATCH_POSSIBLE;
+        }
+    }
+
+    /* Wildcard, always matches */
+    if (p_component->ptype == JSONSL_PATH_WILDCARD) {
+        if (parent_level == jpr->ncomponents-1) {
+            return JSONSL_MATCH_COMPLETE;
+        } else {
+            return JSONSL_MATCH_POSSIBLE;
+        }
+    }
+
+    /* Check numeric array index. This gets its special block so we can avoid
+     * string comparisons */
+    if (p_component->ptype == JSONSL_PATH_NUMERIC) {
+        if (parent_type == JSONSL_T_LIST) {
+            if (p_component->idx != nkey) {
+                /* Wrong index */
+                return JSONSL_MATCH_NOMATCH;
+            } else {
+                if (parent_level == jpr->ncomponents-1) {
+                    /* This is the last element of the path */
+                    return JSONSL_MATCH_COMPLETE;
+                } else {
+                    /* Intermediate element */
+                    return JSONSL_MATCH_POSSIBLE;
+                }
+            }
+        } else if (p_component->is_arridx) {
+            /* Numeric and an array index (set explicitly by user). But not
+             * a list for a parent */
+            return JSONSL_MATCH_TYPE_MISMATCH;
+        }
+    } else if (parent_type == JSONSL_T_LIST) {
+        return JSONSL_MATCH_TYPE_MISMATCH;
+    }
+
+    if (p_component->flags) {
+        cmpret = !jsonsl__jpr_key_like(p_component->pstr, p_component->len,
+                                       p_component->flags, key, nkey);
+    } else if (JSONSL__JPR_HASH_DIFFERS(p_component, hash) ||
+            p_component->len != nkey) {
+        /* Check hashes and lengths */
+        return JSONSL_MATCH_NOMATCH;
+    } else {
+        /* Check string comparison */
+        cmpret = strncmp(p_component->pstr, key, nkey);
+    }
+    if (cmpret == 0) {
+        if (parent_level == jpr->ncomponents-1) {
+            return JSONSL_MATCH_COMPLETE;
+        } else {
+            return JSONSL_MATCH_POSSIBLE;
+        }
+    }
+
+    return JSONSL_MATCH_NOMATCH;
+}
+
+/* 'hash' is the hash of 'key' if known, or zero */
+static jsonsl_jpr_match_t
+jsonsl__jpr_match(jsonsl_jpr_t jpr,
+                  unsigned int parent_type,
+                  unsigned int parent_level,
+                  const char *key,
+                  size_t nkey,
+                  uint32_t hash)
+{
+    jsonsl_jpr_match_t ret = jsonsl__jpr_match_key(jpr, parent_type,
+                                                   parent_level, key, nkey,
+                                                   hash);
+    /* A predicate can only be evaluated by a path set */
+    if (ret == JSONSL_MATCH_COMPLETE &&
+            jpr->components[jpr->ncomponents - 1].pred_value) {
+        ret = JSONSL_MATCH_POSSIBLE;
+    }
+    return ret;
+}
+
+JSONSL_API
+jsonsl_jpr_match_t
+jsonsl_jpr_match(jsonsl_jpr_t jpr,
+                   unsigned int parent_type,
+                   unsigned int parent_level,
+                   const char *key,
+                   size_t nkey)
+{
+    return jsonsl__jpr_match(jpr, parent_type, parent_level, key, nkey, 0);
+}
+
+#define JSONSL__JPR_WORDBITS (sizeof(unsigned long) * CHAR_BIT)
+
+JSONSL_API
+void jsonsl_jpr_match_state_init(jsonsl_t jsn,
+                                 jsonsl_jpr_t *jprs,
+                                 size_t njprs)
+{
+    size_t ii, nlevels = 1;
+    if (njprs == 0) {
+        return;
+    }
+    for (ii = 0; ii < njprs; ii++) {
+        if (jprs[ii]->ncomponents > nlevels) {
+            nlevels = jprs[ii]->ncomponents;
+        }
+    }
+    if (nlevels > jsn->levels_max) {
+        nlevels = jsn->levels_max;
+    }
+
+    jsn->jprs = (jsonsl_jpr_t *)malloc(sizeof(jsonsl_jpr_t) * njprs);
+    jsn->jpr_count = njprs;
+    jsn->jpr_nwords = (njprs + JSONSL__JPR_WORDBITS - 1) / JSONSL__JPR_WORDBITS;
+    jsn->jpr_nlevels = (unsigned)nlevels;
+    jsn->jpr_bits = (unsigned long *)
+            calloc(jsn->jpr_nwords * nlevels, sizeof(unsigned long));
+    memcpy(jsn->jprs, jprs, sizeof(jsonsl_jpr_t) * njprs);
+
+    /* Everything is possible at the root */
+    for (ii = 0; ii < njprs; ii++) {
+        jsn->jpr_bits[ii / JSONSL__JPR_WORDBITS] |=
+                1UL << (ii % JSONSL__JPR_WORDBITS);
+    }
+}
+
+JSONSL_API
+void jsonsl_jpr_match_state_cleanup(jsonsl_t jsn)
+{
+    if (jsn->jpr_count == 0) {
+        return;
+    }
+
+    free(jsn->jpr_bits);
+    free(jsn->jprs);
+    jsn->jprs = NULL;
+    jsn->jpr_bits = NULL;
+    jsn->jpr_count = 0;
+    jsn->jpr_nwords = 0;
+    jsn->jpr_nlevels = 0;
+}
+
+/**
+ * This function should be called exactly once on each element...
+ * This should also be called in recursive order, since we rely
+ * on the parent having been initalized for a match.
+ *
+ * The candidates for the state are those which were still possible at the
+ * parent. Those which remain possible for the state's own children are
+ * recorded in the bitset for the state's level, overwriting whatever a
+ * previous sibling left there.
+ */
+JSONSL_API
+jsonsl_jpr_t jsonsl_jpr_match_state(jsonsl_t jsn,
+                                    struct jsonsl_state_st *state,
+                                    const char *key,
+                                    size_t nkey,
+                                    jsonsl_jpr_match_t *out)
+{
+    struct jsonsl_state_st *parent_state;
+    jsonsl_jpr_t ret = NULL;
+    const unsigned long *pbits;
+    unsigned long *bits = NULL;
+    size_t ii, nwords = jsn->jpr_nwords;
+    unsigned level = state->level;
+    int possible = 0;
+    uint32_t hash = 0;
+
+    *out = JSONSL_MATCH_NOMATCH;
+    if (!jsn->jpr_bits || level - 1 >= jsn->jpr_nlevels) {
+        /* Deeper than any JPR */
+        return NULL;
+    }
+
+    pbits = jsn->jpr_bits + nwords * (level - 1);
+    if (level < jsn->jpr_nlevels) {
+        bits = jsn->jpr_bits + nwords * level;
+        memset(bits, 0, sizeof(*bits) * nwords);
+    }
+
+    parent_state = jsn->stack + level - 1;
+    if (parent_state->type == JSONSL_T_LIST) {
+        /* The parent's count already includes this element */
+        nkey = (size_t) parent_state->nelem - 1;
+    } else if (parent_state->type == JSONSL_T_OBJECT && key) {
+        /* Hashed once here, rather than once per path */
+        hash = jsonsl__jpr_hash(key, nkey);
+    }
+
+    for (ii = 0; ii < nwords; ii++) {
+        unsigned long word = pbits[ii];
+        size_t jprix = ii * JSONSL__JPR_WORDBITS;
+        for (; word; word >>= 1, jprix++) {
+            jsonsl_jpr_match_t res;
+            if (!(word & 1)) {
+                continue;
+            }
+            res = jsonsl__jpr_match(jsn->jprs[jprix],
+                                    parent_state->type,
+                                    parent_state->level,
+                                    key, nkey, hash);
+            if (res == JSONSL_MATCH_COMPLETE) {
+                if (!ret) {
+                    ret = jsn->jprs[jprix];
+                }
+            } else if (res == JSONSL_MATCH_POSSIBLE && bits) {
+                bits[ii] |= 1UL << (jprix % JSONSL__JPR_WORDBITS);
+                possible = 1;
+            }
+        }
+    }
+
+    if (ret) {
+        *out = JSONSL_MATCH_COMPLETE;
+    } else if (possible) {
+        *out = JSONSL_MATCH_POSSIBLE;
+    }
+    return ret;
+}
+
+#define JSONSL__JPR_INDEX_HASH(idx) ((uint32_t)(idx) * 2654435761U)
+
+struct jsonsl__jpr_node_st {
+    /* The component leading to this node. Numeric components keep both the
+     * index and the string (to match object keys) */
+    const char *key;
+    size_t nkey;
+    unsigned long idx;
+    /* For a slice; see jsonsl_jpr_component_st */
+    unsigned long idx_end;
+    unsigned long idx_step;
+    jsonsl_jpr_type_t ptype;
+    short is_arridx;
+
+    /* Child for a wildcard component, or 0 */
+    unsigned wildcard;
+    /* Child for a descendant component, or 0. That node is matched by this
+     * node's state itself as well as by everything below it */
+    unsigned descendant;
+    /* The first child for a slice component (or 0); the others follow
+     * through next_slice */
+    unsigned slices;
+    unsigned next_slice;
+    /* Likewise for components with flags, which are matched against every
+     * key rather than looked up by hash */
+    unsigned patterns;
+    unsigned next_pattern;
+    unsigned flags;
+    /* One past the highest list index which any child may match. Once a
+     * list is past that for all of its nodes, the rest of it is skipped
+     * in query mode */
+    unsigned long idx_limit;
+    /* Whether any (non-wildcard) edges lead out of this node */
+    char has_keys;
+    char has_indexes;
+    /* Whether this node is at or below the first wildcard of some path,
+     * i.e. whether more matches may turn up inside its value */
+    char wild_below;
+    /* Whether this node holds the first wildcard (or descendant, or slice)
+     * component of some path */
+    char wild_parent;
+
+    /* Paths completed at this node are set->ids[ids_begin..ids_end) */
+    unsigned ids_begin;
+    unsigned ids_end;
+};
+
+/* A path's predicate; see jsonsl_jpr_component_st::pred_key */
+struct jsonsl__jpr_pred_st {
+    const char *key;
+    size_t nkey;
+    const char *value;
+    size_t nvalue;
+};
+
+/* An object which matches a path with a predicate, not decided yet */
+struct jsonsl__jpr_pending_st {
+    size_t id;
+    unsigned level;
+    /* Whether the member being lexed is the predicate's, and whether it
+     * has compared equal so far */
+    char watching;
+    char ok;
+};
+
+struct jsonsl__jpr_edge_st {
+    uint32_t hash;
+    unsigned parent;
+    /* 0 for an empty slot. The root is never anyone's child */
+    unsigned child;
+    int is_index;
+};
+
+struct jsonsl_jpr_set_st {
+    struct jsonsl__jpr_node_st *nodes;
+    size_t nnodes;
+
+    /* Open-addressed, and never more than half full */
+    struct jsonsl__jpr_edge_st *edges;
+    size_t edge_mask;
+
+    /* Path ids, grouped by the node at which they complete */
+    size_t *ids;
+    /* jsonsl_jpr_st::match_type for each path */
+    unsigned *match_types;
+    /* Whether each path is free of wildcards, and so can only match once */
+    unsigned char *exact;
+    size_t nexact;
+    /* Number of nodes with wild_parent set */
+    size_t nwild_parents;
+    /* Number of nodes at or below a descendant component. Unlike the others,
+     * these may be matched at any number of levels at once */
+    size_t nfloating;
+    size_t njprs;
+    /* The predicate of each path (value is NULL for those without one), or
+     * NULL if no path has one */
+    struct jsonsl__jpr_pred_st *preds;
+    size_t npreds;
+
+    /* Copies of the string components */
+    char *strings;
+
+    /* Everything above is read-only once the set is compiled */
+    volatile long refcount;
+};
+
+/* Allocated as a single block, with the arrays following the header. It
+ * stays with the lexer when a set is detached, and is only reallocated
+ * when a larger set is attached */
+struct jsonsl_jpr_cursor_st {
+    jsonsl_jpr_set_t set;
+    /* Nodes with children which were matched by the states currently on
+     * the stack. Those for the state at level L are
+     * active[level_end[L-1]..level_end[L]). Each node is matched at most
+     * once per level, and only floating nodes at more than one level, so
+     * this never needs more than nnodes + nfloating * levels_max entries */
+    unsigned *active;
+    unsigned *level_end;
+    /* Returned by match_state */
+    size_t *results;
+    /* Objects matched by paths with predicates, innermost last. Each is
+     * pending for a given path at most once, so this never needs more than
+     * npreds * levels_max entries */
+    struct jsonsl__jpr_pending_st *pending;
+    size_t npending;
+    size_t max_pending;
+    /* Query mode: where the member value deciding the pending predicates
+     * begins, and how much of it has been compared */
+    size_t watch_begin;
+    size_t watch_len;
+    /* The match_state call in which each node was last matched, to keep
+     * floating nodes from being matched twice for the same state */
+    unsigned *stamps;
+    unsigned generation;
+    /* Capacity of the above */
+    size_t max_active;
+    size_t max_nodes;
+    size_t max_jprs;
+    /* The most recent match, for jsonsl_jpr_set_last_match() */
+    jsonsl_jpr_match_t match;
+    size_t nresults;
+    /* Query mode: which of the exact paths (and wild_parent nodes) have
+     * been matched in the current document, and how many have not */
+    unsigned char *done;
+    unsigned char *node_done;
+    size_t nremaining;
+    int satisfied;
+    /* Query mode: the key of the current object member. This points into
+     * the input buffer where possible, and into 'key' once the key spans
+     * buffers or outlives the buffer it was in. 'key_lost' is set when the
+     * copy couldn't be allocated, and then the member matches nothing */
+    const char *keyp;
+    size_t nkey;
+    char *key;
+    size_t key_alloc;
+    int key_lost;
+    /* Query mode: the hash of the key, computed as it is lexed, and how
+     * many of its characters went into it. Zero unless that was all of
+     * them (a key with escapes would hash differently once unescaped) */
+    uint32_t key_hash;
+    size_t key_nhashed;
+};
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define JSONSL__ATOMIC_INCR(p) _InterlockedIncrement(p)
+#define JSONSL__ATOMIC_DECR(p) _InterlockedDecrement(p)
+#elif defined(__GNUC__)
+#define JSONSL__ATOMIC_INCR(p) __sync_add_and_fetch(p, 1)
+#define JSONSL__ATOMIC_DECR(p) __sync_sub_and_fetch(p, 1)
+#else
+/* Sets may only be shared within a single thread */
+#define JSONSL__ATOMIC_INCR(p) (++*(p))
+#define JSONSL__ATOMIC_DECR(p) (--*(p))
+#endif
+
+#define JSONSL__JPR_EDGE_SLOT(set, parent, hash) \
+    (((hash) ^ ((uint32_t)(parent) * 0x9E3779B1U)) & (set)->edge_mask)
+
+/* Does the edge at 'slot' lead from 'parent' via the given key or index? */
+static JSONSL_INLINE int
+jsonsl__jpr_edge_matches(const struct jsonsl_jpr_set_st *set,
+                         const struct jsonsl__jpr_edge_st *edge,
+                         unsigned parent, int is_index, uint32_t hash,
+                         const char *key, size_t nkey, unsigned long idx)
+{
+    const struct jsonsl__jpr_node_st *child;
+    if (edge->hash != hash || edge->parent != parent ||
+            edge->is_index != is_index) {
+        return 0;
+    }
+    child = set->nodes + edge->child;
+    if (is_index) {
+        return child->idx == idx;
+    } else {
+        /* 'key' may be NULL for an empty key */
+        return child->nkey == nkey &&
+                (nkey == 0 || memcmp(child->key, key, nkey) == 0);
+    }
+}
+
+static void
+jsonsl__jpr_set_add_edge(struct jsonsl_jpr_set_st *set, unsigned parent,
+                         unsigned child, int is_index, uint32_t hash)
+{
+    size_t slot = JSONSL__JPR_EDGE_SLOT(set, parent, hash);
+    while (set->edges[slot].child) {
+        slot = (slot + 1) & set->edge_mask;
+    }
+    set->edges[slot].hash = hash;
+    set->edges[slot].parent = parent;
+    set->edges[slot].child = child;
+    set->edges[slot].is_index = is_index;
+    if (is_index) {
+        set->nodes[parent].has_indexes = 1;
+    } else {
+        set->nodes[parent].has_keys = 1;
+    }
+}
+
+/* Find the child of 'parent' for an identical component, or create it */
+static unsigned
+jsonsl__jpr_set_child(struct jsonsl_jpr_set_st *set, unsigned parent,
+                      const struct jsonsl_jpr_component_st *comp,
+                      char **strings)
+{
+    struct jsonsl__jpr_node_st *node;
+    unsigned child;
+    int is_index = comp->ptype == JSONSL_PATH_NUMERIC;
+    uint32_t hash = is_index ? JSONSL__JPR_INDEX_HASH(comp->idx) :
+            jsonsl__jpr_hash(comp->pstr, comp->len);
+    size_t slot;
+
+    if (comp->ptype == JSONSL_PATH_WILDCARD) {
+        if (set->nodes[parent].wildcard) {
+            return set->nodes[parent].wildcard;
+        }
+    } else if (comp->ptype == JSONSL_PATH_DESCENDANT) {
+        if (set->nodes[parent].descendant) {
+            return set->nodes[parent].descendant;
+        }
+    } else if (comp->ptype == JSONSL_PATH_SLICE) {
+        for (child = set->nodes[parent].slices; child;
+                child = set->nodes[child].next_slice) {
+            node = set->nodes + child;
+            if (node->idx == comp->idx && node->idx_end == comp->idx_end &&
+                    node->idx_step == comp->idx_step) {
+                return child;
+            }
+        }
+    } else if (comp->flags) {
+        for (child = set->nodes[parent].patterns; child;
+                child = set->nodes[child].next_pattern) {
+            node = set->nodes + child;
+            if (node->flags == comp->flags && node->nkey == comp->len &&
+                    memcmp(node->key, comp->pstr, comp->len) == 0) {
+                return child;
+            }
+        }
+    } else {
+        for (slot = JSONSL__JPR_EDGE_SLOT(set, parent, hash);
+                set->edges[slot].child;
+                slot = (slot + 1) & set->edge_mask) {
+            const struct jsonsl__jpr_edge_st *edge = set->edges + slot;
+            if (jsonsl__jpr_edge_matches(set, edge, parent, is_index, hash,
+                                         comp->pstr, comp->len, comp->idx)) {
+                node = set->nodes + edge->child;
+                if (node->ptype == comp->ptype &&
+                        node->is_arridx == comp->is_arridx &&
+                        node->nkey == comp->len &&
+                        memcmp(node->key, comp->pstr, comp->len) == 0) {
+                    return edge->child;
+                }
+            }
+        }
+    }
+
+    child = (unsigned)set->nnodes++;
+    node = set->nodes + child;
+    memset(node, 0, sizeof(*node));
+    node->ptype = comp->ptype;
+    node->is_arridx = comp->is_arridx;
+    node->idx = comp->idx;
+
+    if (comp->ptype == JSONSL_PATH_WILDCARD) {
+        set->nodes[parent].wildcard = child;
+        set->nodes[parent].idx_limit = ULONG_MAX;
+        return child;
+    } else if (comp->ptype == JSONSL_PATH_DESCENDANT) {
+        set->nodes[parent].descendant = child;
+        /* Matches every element of a list below it */
+        node->idx_limit = ULONG_MAX;
+        return child;
+    } else if (comp->ptype == JSONSL_PATH_SLICE) {
+        node->idx_end = comp->idx_end;
+        node->idx_step = comp->idx_step;
+        node->next_slice = set->nodes[parent].slices;
+        set->nodes[parent].slices = child;
+        set->nodes[parent].has_indexes = 1;
+        if (set->nodes[parent].idx_limit < comp->idx_end) {
+            set->nodes[parent].idx_limit = comp->idx_end;
+        }
+        return child;
+    }
+
+    memcpy(*strings, comp->pstr, comp->len);
+    node->key = *strings;
+    node->nkey = comp->len;
+    *strings += comp->len;
+
+    if (comp->flags) {
+        node->flags = comp->flags;
+        node->next_pattern = set->nodes[parent].patterns;
+        set->nodes[parent].patterns = child;
+        set->nodes[parent].has_keys = 1;
+        return child;
+    }
+
+    if (is_index) {
+        jsonsl__jpr_set_add_edge(set, parent, child, 1, hash);
+        if (set->nodes[parent].idx_limit <= comp->idx) {
+            set->nodes[parent].idx_limit = comp->idx == ULONG_MAX ?
+                    ULONG_MAX : comp->idx + 1;
+        }
+        if (comp->is_arridx) {
+            return child;
+        }
+        /* Also matches the equivalent object key */
+        hash = jsonsl__jpr_hash(comp->pstr, comp->len);
+    }
+    jsonsl__jpr_set_add_edge(set, parent, child, 0, hash);
+    return child;
+}
+
+static void
+jsonsl__jpr_set_free(struct jsonsl_jpr_set_st *set)
+{
+    free(set->nodes);
+    free(set->edges);
+    free(set->ids);
+    free(set->match_types);
+    free(set->exact);
+    free(set->preds);
+    free(set->strings);
+    free(set);
+}
+
+JSONSL_API
+jsonsl_jpr_set_t
+jsonsl_jpr_set_new(jsonsl_jpr_t *jprs, size_t njprs, jsonsl_error_t *errp)
+{
+    struct jsonsl_jpr_set_st *set;
+    size_t ii, jj, maxnodes = 1, nstrings = 0, nslots = 4, npreds = 0;
+    unsigned *terminals = NULL;
+    char *strings;
+    jsonsl_error_t errstacked;
+
+    if (errp == NULL) {
+        errp = &errstacked;
+    }
+    for (ii = 0; ii < njprs; ii++) {
+        for (jj = 1; jj < jprs[ii]->ncomponents; jj++) {
+            jsonsl_jpr_type_t ptype = jprs[ii]->components[jj].ptype;
+            maxnodes++;
+            if (ptype == JSONSL_PATH_STRING || ptype == JSONSL_PATH_NUMERIC) {
+                nstrings += jprs[ii]->components[jj].len;
+            }
+        }
+        jj = jprs[ii]->ncomponents - 1;
+        if (jprs[ii]->components[jj].pred_value) {
+            npreds++;
+            nstrings += jprs[ii]->components[jj].npred_key +
+                    jprs[ii]->components[jj].npred_value;
+        }
+    }
+    /* Each node has at most two edges leading to it */
+    while (nslots < maxnodes * 4) {
+        nslots *= 2;
+    }
+
+    set = (struct jsonsl_jpr_set_st *)calloc(1, sizeof(*set));
+    if (!set) {
+        *errp = JSONSL_ERROR_ENOMEM;
+        return NULL;
+    }
+    set->njprs = njprs;
+    set->edge_mask = nslots - 1;
+    set->nodes = (struct jsonsl__jpr_node_st *)
+            malloc(sizeof(*set->nodes) * maxnodes);
+    set->edges = (struct jsonsl__jpr_edge_st *)
+            calloc(nslots, sizeof(*set->edges));
+    set->ids = (size_t *)malloc(sizeof(*set->ids) * (njprs + 1));
+    set->match_types = (unsigned *)
+            malloc(sizeof(*set->match_types) * (njprs + 1));
+    set->exact = (unsigned char *)malloc(njprs + 1);
+    set->strings = (char *)malloc(nstrings + 1);
+    if (npreds) {
+        set->npreds = npreds;
+        set->preds = (struct jsonsl__jpr_pred_st *)
+                calloc(njprs, sizeof(*set->preds));
+    }
+    terminals = (unsigned *)malloc(sizeof(*terminals) * (njprs + 1));
+    if (!set->nodes || !set->edges || !set->ids || !set->match_types ||
+            !set->exact || !set->strings || !terminals ||
+            (npreds && !set->preds)) {
+        free(terminals);
+        jsonsl__jpr_set_free(set);
+        *errp = JSONSL_ERROR_ENOMEM;
+        return NULL;
+    }
+
+    /* The root; matched by the topmost state */
+    memset(set->nodes, 0, sizeof(*set->nodes));
+    set->nodes[0].ptype = JSONSL_PATH_ROOT;
+    set->nnodes = 1;
+
+    strings = set->strings;
+    for (ii = 0; ii < njprs; ii++) {
+        unsigned cur = 0;
+        char wild = 0, floating = 0;
+        for (jj = 1; jj < jprs[ii]->ncomponents; jj++) {
+            jsonsl_jpr_type_t ptype = jprs[ii]->components[jj].ptype;
+            size_t nnodes = set->nnodes;
+            if ((ptype == JSONSL_PATH_WILDCARD ||
+                    ptype == JSONSL_PATH_DESCENDANT ||
+                    ptype == JSONSL_PATH_SLICE ||
+                    jprs[ii]->components[jj].flags) && !wild) {
+                /* The parent may hold any number of matches from here */
+                struct jsonsl__jpr_node_st *parent = set->nodes + cur;
+                set->nwild_parents += !parent->wild_parent;
+                parent->wild_parent = parent->wild_below = wild = 1;
+            }
+            floating |= ptype == JSONSL_PATH_DESCENDANT;
+            cur = jsonsl__jpr_set_child(set, cur,
+                                        jprs[ii]->components + jj, &strings);
+            set->nodes[cur].wild_below |= wild;
+            if (set->nnodes != nnodes && floating) {
+                set->nfloating++;
+            }
+        }
+        terminals[ii] = cur;
+        if (jprs[ii]->components[jj - 1].pred_value) {
+            const struct jsonsl_jpr_component_st *comp =
+                    jprs[ii]->components + jj - 1;
+            struct jsonsl__jpr_pred_st *pred = set->preds + ii;
+            memcpy(strings, comp->pred_key, comp->npred_key);
+            pred->key = strings;
+            pred->nkey = comp->npred_key;
+            strings += comp->npred_key;
+            memcpy(strings, comp->pred_value, comp->npred_value);
+            pred->value = strings;
+            pred->nvalue = comp->npred_value;
+            strings += comp->npred_value;
+        }
+        set->exact[ii] = !wild;
+        set->nexact += !wild;
+        set->match_types[ii] = jprs[ii]->match_type;
+        set->nodes[cur].ids_end++;
+    }
+
+    /* Turn the per-node counts into ranges, and fill them in */
+    for (ii = 0, jj = 0; ii < set->nnodes; ii++) {
+        unsigned count = set->nodes[ii].ids_end;
+        set->nodes[ii].ids_begin = set->nodes[ii].ids_end = (unsigned)jj;
+        jj += count;
+    }
+    for (ii = 0; ii < njprs; ii++) {
+        struct jsonsl__jpr_node_st *node = set->nodes + terminals[ii];
+        set->ids[node->ids_end++] = ii;
+    }
+
+    free(terminals);
+    set->refcount = 1;
+    return set;
+}
+
+JSONSL_API
+jsonsl_jpr_set_t
+jsonsl_jpr_set_ref(jsonsl_jpr_set_t set)
+{
+    JSONSL__ATOMIC_INCR(&set->refcount);
+    return set;
+}
+
+JSONSL_API
+void
+jsonsl_jpr_set_destroy(jsonsl_jpr_set_t set)
+{
+    if (set && JSONSL__ATOMIC_DECR(&set->refcount) == 0) {
+        jsonsl__jpr_set_free(set);
+    }
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_jpr_set_attach(jsonsl_t jsn, jsonsl_jpr_set_t set)
+{
+    struct jsonsl_jpr_cursor_st *cur;
+    size_t nactive = set->nnodes + set->nfloating * jsn->levels_max;
+    size_t npending = set->npreds * jsn->levels_max;
+
+    jsonsl_jpr_set_detach(jsn);
+    cur = jsn->jpr_cursor;
+    if (cur && (cur->max_nodes < set->nnodes || cur->max_jprs < set->njprs ||
+            cur->max_active < nactive || cur->max_pending < npending)) {
+        jsonsl__jpr_cursor_free(cur);
+        cur = jsn->jpr_cursor = NULL;
+    }
+    if (!cur) {
+        /* The header's alignment is at least that of size_t */
+        size_t nalloc = sizeof(*cur) +
+                sizeof(*cur->results) * (set->njprs + 1) +
+                sizeof(*cur->pending) * npending +
+                sizeof(*cur->stamps) * set->nnodes +
+                sizeof(*cur->active) * nactive +
+                sizeof(*cur->level_end) * jsn->levels_max +
+                set->njprs + set->nnodes + 1;
+        cur = (struct jsonsl_jpr_cursor_st *)malloc(nalloc);
+        if (!cur) {
+            return JSONSL_ERROR_ENOMEM;
+        }
+        cur->results = (size_t *)(cur + 1);
+        cur->pending = (struct jsonsl__jpr_pending_st *)
+                (cur->results + set->njprs + 1);
+        cur->stamps = (unsigned *)(cur->pending + npending);
+        cur->active = cur->stamps + set->nnodes;
+        cur->level_end = cur->active + nactive;
+        cur->done = (unsigned char *)(cur->level_end + jsn->levels_max);
+        cur->node_done = cur->done + set->njprs;
+        memset(cur->stamps, 0, sizeof(*cur->stamps) * set->nnodes);
+        cur->generation = 0;
+        cur->max_active = nactive;
+        cur->max_nodes = set->nnodes;
+        cur->max_jprs = set->njprs;
+        cur->max_pending = npending;
+        cur->keyp = cur->key = NULL;
+        cur->nkey = cur->key_alloc = 0;
+        cur->key_lost = 0;
+        jsn->jpr_cursor = cur;
+    }
+    cur->set = jsonsl_jpr_set_ref(set);
+    cur->match = JSONSL_MATCH_NOMATCH;
+    cur->nresults = 0;
+    cur->npending = 0;
+    /* Force the completion state to be cleared */
+    cur->nremaining = (size_t)-1;
+    jsonsl__query_begin(cur);
+    return JSONSL_ERROR_SUCCESS;
+}
+
+static void
+jsonsl__jpr_cursor_free(struct jsonsl_jpr_cursor_st *cur)
+{
+    if (cur) {
+        free(cur->key);
+        free(cur);
+    }
+}
+
+JSONSL_API
+void
+jsonsl_jpr_set_detach(jsonsl_t jsn)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    if (!cur || !cur->set) {
+        return;
+    }
+    jsonsl_jpr_set_destroy(cur->set);
+    cur->set = NULL;
+}
+
+/* 'key_hash' is the hash of 'key' if known, or zero */
+static jsonsl_jpr_match_t
+jsonsl__jpr_set_match(jsonsl_t jsn, struct jsonsl_state_st *state,
+                      const char *key, size_t nkey, uint32_t key_hash,
+                      const size_t **ids, size_t *nids)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    const struct jsonsl_jpr_set_st *set;
+    const struct jsonsl_state_st *parent;
+    unsigned level = state->level, pbegin, pend, out, ii;
+    unsigned long idx = 0;
+    uint32_t hash = 0;
+    int is_index, hashed = 0, container;
+    size_t nres = 0, npending;
+
+    *ids = NULL;
+    *nids = 0;
+    if (!cur || !cur->set) {
+        return JSONSL_MATCH_NOMATCH;
+    }
+    set = cur->set;
+    *ids = cur->results;
+    container = state->type == JSONSL_T_OBJECT ||
+            state->type == JSONSL_T_LIST;
+    /* Objects still pending at this level or below have been popped */
+    while (cur->npending && cur->pending[cur->npending - 1].level >= level) {
+        cur->npending--;
+    }
+    npending = cur->npending;
+    if (set->nfloating && ++cur->generation == 0) {
+        memset(cur->stamps, 0, sizeof(*cur->stamps) * set->nnodes);
+        cur->generation = 1;
+    }
+
+/* Match a node, along with the descendant nodes which hang off it (since
+ * those match zero levels down as well). Floating nodes may be reached
+ * more than once for the same state, so those are stamped */
+#define JPR_SET_VISIT(nodeix) { \
+    unsigned vix__ = (nodeix); \
+    do { \
+        const struct jsonsl__jpr_node_st *visit__ = set->nodes + vix__; \
+        unsigned id__; \
+        if (set->nfloating) { \
+            if (cur->stamps[vix__] == cur->generation) { \
+                break; \
+            } \
+            cur->stamps[vix__] = cur->generation; \
+        } \
+        for (id__ = visit__->ids_begin; id__ < visit__->ids_end; id__++) { \
+            size_t pid__ = set->ids[id__]; \
+            if (set->match_types[pid__] && \
+                    set->match_types[pid__] != state->type) { \
+                continue; \
+            } \
+            if (!set->preds || !set->preds[pid__].value) { \
+                cur->results[nres++] = pid__; \
+            } else if (state->type == JSONSL_T_OBJECT && \
+                    cur->npending < cur->max_pending) { \
+                struct jsonsl__jpr_pending_st *pend__ = \
+                        cur->pending + cur->npending++; \
+                pend__->id = pid__; \
+                pend__->level = level; \
+                pend__->watching = pend__->ok = 0; \
+            } \
+        } \
+        if (visit__->wildcard || \
+                (state->type == JSONSL_T_OBJECT && visit__->has_keys) || \
+                (state->type == JSONSL_T_LIST && visit__->has_indexes) || \
+                (container && (visit__->descendant || \
+                        visit__->ptype == JSONSL_PATH_DESCENDANT))) { \
+            cur->active[out++] = vix__; \
+        } \
+        vix__ = visit__->descendant; \
+    } while (vix__ && container); \
+}
+
+    out = level > 1 ? cur->level_end[level - 1] : 0;
+    if (level == 1) {
+        JPR_SET_VISIT(0);
+        cur->level_end[level] = out;
+        *nids = cur->nresults = nres;
+        return cur->match = nres ? JSONSL_MATCH_COMPLETE :
+                out || cur->npending != npending ? JSONSL_MATCH_POSSIBLE :
+                JSONSL_MATCH_NOMATCH;
+    }
+
+    parent = jsn->stack + level - 1;
+    pbegin = level > 2 ? cur->level_end[level - 2] : 0;
+    pend = cur->level_end[level - 1];
+    is_index = parent->type == JSONSL_T_LIST;
+    if (is_index) {
+        idx = (unsigned long)parent->nelem - 1;
+        hash = JSONSL__JPR_INDEX_HASH(idx);
+        hashed = 1;
+    } else if (key_hash) {
+        /* Hashed by the lexer */
+        hash = key_hash;
+        hashed = 1;
+    }
+
+    for (ii = pbegin; ii < pend; ii++) {
+        unsigned nodeix = cur->active[ii];
+        const struct jsonsl__jpr_node_st *node = set->nodes + nodeix;
+        size_t slot;
+
+        if (node->ptype == JSONSL_PATH_DESCENDANT) {
+            /* Still live one more level down */
+            JPR_SET_VISIT(nodeix);
+        }
+        if (node->wildcard) {
+            JPR_SET_VISIT(node->wildcard);
+        }
+        if (is_index && node->slices) {
+            unsigned sl;
+            for (sl = node->slices; sl; sl = set->nodes[sl].next_slice) {
+                if (JSONSL__JPR_SLICE_HAS(set->nodes + sl, idx)) {
+                    JPR_SET_VISIT(sl);
+                }
+            }
+        }
+        if (!is_index && node->patterns) {
+            unsigned pt;
+            for (pt = node->patterns; pt; pt = set->nodes[pt].next_pattern) {
+                const struct jsonsl__jpr_node_st *pnode = set->nodes + pt;
+                if (jsonsl__jpr_key_like(pnode->key, pnode->nkey,
+                                         pnode->flags, key, nkey)) {
+                    JPR_SET_VISIT(pt);
+                }
+            }
+        }
+        if (!(is_index ? node->has_indexes : node->has_keys)) {
+            continue;
+        }
+        if (!hashed) {
+            hash = jsonsl__jpr_hash(key, nkey);
+            hashed = 1;
+        }
+        for (slot = JSONSL__JPR_EDGE_SLOT(set, nodeix, hash);
+                set->edges[slot].child;
+                slot = (slot + 1) & set->edge_mask) {
+            const struct jsonsl__jpr_edge_st *edge = set->edges + slot;
+            if (jsonsl__jpr_edge_matches(set, edge, nodeix, is_index, hash,
+                                         key, nkey, idx)) {
+                JPR_SET_VISIT(edge->child);
+            }
+        }
+    }
+#undef JPR_SET_VISIT
+
+    cur->level_end[level] = out;
+    *nids = cur->nresults = nres;
+    if (nres) {
+        cur->match = JSONSL_MATCH_COMPLETE;
+    } else if (out != pend || cur->npending != npending) {
+        /* Pending objects are possible matches until decided */
+        cur->match = JSONSL_MATCH_POSSIBLE;
+    } else {
+        cur->match = JSONSL_MATCH_NOMATCH;
+    }
+    return cur->match;
+}
+
+JSONSL_API
+jsonsl_jpr_match_t
+jsonsl_jpr_set_match_state(jsonsl_t jsn, struct jsonsl_state_st *state,
+                           const char *key, size_t nkey,
+                           const size_t **ids, size_t *nids)
+{
+    return jsonsl__jpr_set_match(jsn, state, key, nkey, 0, ids, nids);
+}
+
+JSONSL_API
+jsonsl_jpr_match_t
+jsonsl_jpr_set_last_match(jsonsl_t jsn, const size_t **ids, size_t *nids)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    if (!cur || !cur->set) {
+        *ids = NULL;
+        *nids = 0;
+        return JSONSL_MATCH_NOMATCH;
+    }
+    *ids = cur->results;
+    *nids = cur->nresults;
+    return cur->match;
+}
+
+/* Query mode (see jsonsl_st::options). Keys are collected by the lexer,
+ * and every value is matched as it is pushed */
+
+/* Functions exactly like str_fastparse, except that it also hashes the
+ * key's characters into the cursor's key_hash */
+static int
+jsonsl__hkey_fastparse(jsonsl_t jsn,
+                       const jsonsl_uchar_t **bytes_p, size_t *nbytes_p)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    const jsonsl_uchar_t *bytes = *bytes_p;
+    const jsonsl_uchar_t *end;
+    uint32_t hash = cur ? cur->key_hash : 0;
+    int ret = FASTPARSE_EXHAUSTED;
+
+    for (end = bytes + *nbytes_p; bytes != end; bytes++) {
+        if (
+#ifdef JSONSL_USE_WCHAR
+                *bytes >= 0x100 ||
+#endif /* JSONSL_USE_WCHAR */
+                (is_simple_char(*bytes))) {
+            INCR_METRIC(TOTAL);
+            INCR_METRIC(STRINGY_INSIGNIFICANT);
+            hash = JSONSL__HASH_STEP(hash, *bytes);
+        } else {
+            *nbytes_p -= (bytes - *bytes_p);
+            ret = FASTPARSE_BREAK;
+            break;
+        }
+    }
+
+    if (cur) {
+        cur->key_hash = hash;
+        cur->key_nhashed += bytes - *bytes_p;
+    }
+    jsn->pos += (bytes - *bytes_p);
+    *bytes_p = bytes;
+    return ret;
+}
+
+static void
+jsonsl__query_key_begin(jsonsl_t jsn, struct jsonsl_state_st *state)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    if (!cur || !cur->set) {
+        return;
+    }
+    cur->nkey = 0;
+    cur->keyp = cur->key;
+    cur->key_lost = 0;
+    cur->key_hash = JSONSL__HASH_INIT;
+    cur->key_nhashed = 0;
+    if (jsn->query_level >= state->level) {
+        jsn->query_level = 0;
+    }
+    if (!jsn->query_level) {
+        state->ignore_callback = 1;
+    }
+}
+
+/* Append to the owned copy of the key */
+static void
+jsonsl__query_key_copy(struct jsonsl_jpr_cursor_st *cur, size_t offset,
+                       const char *bytes, size_t n)
+{
+    if (offset + n > cur->key_alloc) {
+        size_t nalloc = cur->key_alloc ? cur->key_alloc : 64;
+        char *key;
+        while (nalloc < offset + n) {
+            nalloc *= 2;
+        }
+        if ((key = (char *)realloc(cur->key, nalloc)) == NULL) {
+            /* What was borrowed may be gone once the caller has its buffer
+             * back, so drop it all */
+            cur->keyp = cur->key;
+            cur->nkey = 0;
+            cur->key_lost = 1;
+            return;
+        }
+        cur->key = key;
+        cur->key_alloc = nalloc;
+    }
+    memcpy(cur->key + offset, bytes, n);
+    cur->keyp = cur->key;
+    cur->nkey = offset + n;
+}
+
+/* Add the part of the key which is in the current buffer (which begins at
+ * stream position 'bufpos'), up to the current position */
+static void
+jsonsl__query_key_add(jsonsl_t jsn, const struct jsonsl_state_st *state,
+                      size_t bufpos)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    size_t begin = state->pos_begin + 1;
+    const char *seg;
+    if (!cur || !cur->set || cur->key_lost) {
+        return;
+    }
+    if (begin < bufpos) {
+        begin = bufpos;
+    }
+    if (jsn->pos <= begin) {
+        return;
+    }
+    seg = (const char *)jsn->base + (begin - bufpos);
+    if (cur->nkey == 0) {
+        /* Borrow it; see jsonsl__query_key_keep() */
+        cur->keyp = seg;
+        cur->nkey = jsn->pos - begin;
+    } else {
+        if (cur->keyp != cur->key) {
+            jsonsl__query_key_copy(cur, 0, cur->keyp, cur->nkey);
+        }
+        jsonsl__query_key_copy(cur, cur->nkey, seg, jsn->pos - begin);
+    }
+}
+
+/* Add the rest of the key, and settle its hash */
+static void
+jsonsl__query_key_end(jsonsl_t jsn, const struct jsonsl_state_st *state,
+                      size_t bufpos)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    jsonsl__query_key_add(jsn, state, bufpos);
+    if (!cur || !cur->set) {
+        return;
+    }
+    if (cur->key_nhashed != cur->nkey) {
+        cur->key_hash = 0;
+    } else if (!cur->key_hash) {
+        cur->key_hash = 1;
+    }
+}
+
+/* Called when returning to the caller, whose buffer may then go away */
+static void
+jsonsl__query_key_keep(jsonsl_t jsn)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    if (cur && !cur->key_lost && cur->nkey && cur->keyp != cur->key) {
+        jsonsl__query_key_copy(cur, 0, cur->keyp, cur->nkey);
+    }
+}
+
+/* Predicates (see jsonsl_jpr_new_extended()). The value of the member a pending
+ * object's predicate names is compared as it is lexed, a buffer at a time,
+ * so that nothing is copied */
+
+/* Called as a member value of the object at the top of the pending list is
+ * pushed; watch it if its key is one a predicate names */
+static void
+jsonsl__query_watch_begin(jsonsl_t jsn, const struct jsonsl_state_st *state)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    size_t ii;
+    for (ii = cur->npending;
+            ii > 0 && cur->pending[ii - 1].level == state->level - 1; ii--) {
+        struct jsonsl__jpr_pending_st *pend = cur->pending + ii - 1;
+        const struct jsonsl__jpr_pred_st *pred = cur->set->preds + pend->id;
+        if (!cur->key_lost && pred->nkey == cur->nkey &&
+                (!cur->nkey || memcmp(pred->key, cur->keyp, cur->nkey) == 0)) {
+            pend->watching = pend->ok = 1;
+            jsn->query_watch = 1;
+        }
+    }
+    cur->watch_begin = state->pos_begin;
+    cur->watch_len = 0;
+}
+
+/* Compare the part of the watched value in the current buffer (which begins
+ * at stream position 'bufpos'), up to stream position 'end' */
+static void
+jsonsl__query_watch_add(jsonsl_t jsn, size_t bufpos, size_t end)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    size_t begin = cur->watch_begin + cur->watch_len, n, ii;
+    const char *seg;
+
+    if (begin < bufpos) {
+        begin = bufpos;
+    }
+    if (end <= begin) {
+        return;
+    }
+    seg = (const char *)jsn->base + (begin - bufpos);
+    n = end - begin;
+    for (ii = cur->npending; ii > 0 &&
+            cur->pending[ii - 1].level == cur->pending[cur->npending - 1].level;
+            ii--) {
+        struct jsonsl__jpr_pending_st *pend = cur->pending + ii - 1;
+        const struct jsonsl__jpr_pred_st *pred = cur->set->preds + pend->id;
+        if (pend->watching && pend->ok &&
+                (cur->watch_len + n > pred->nvalue ||
+                memcmp(pred->value + cur->watch_len, seg, n) != 0)) {
+            pend->ok = 0;
+        }
+    }
+    cur->watch_len += n;
+}
+
+/* Called as the watched value is popped, 'end' being the stream position
+ * just past it. Reports the object to the predicate callback for each
+ * predicate it satisfies, and returns true if the rest of it can be
+ * skipped, i.e. it no longer matches anything */
+static int
+jsonsl__query_watch_end(jsonsl_t jsn, const struct jsonsl_state_st *state,
+                        size_t bufpos, size_t end)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    const struct jsonsl_jpr_set_st *set = cur->set;
+    struct jsonsl_state_st *parent = jsn->stack + state->level - 1;
+    unsigned level = parent->level;
+    size_t ii, out;
+    int committed = 0;
+
+    jsonsl__query_watch_add(jsn, bufpos, end);
+    jsn->query_watch = 0;
+    for (ii = cur->npending;
+            ii > 0 && cur->pending[ii - 1].level == level; ii--) {
+    }
+    for (out = ii; ii < cur->npending; ii++) {
+        struct jsonsl__jpr_pending_st pend = cur->pending[ii];
+        if (!pend.watching) {
+            cur->pending[out++] = pend;
+            continue;
+        }
+        if (!pend.ok || cur->watch_len != set->preds[pend.id].nvalue) {
+            continue;
+        }
+        if (jsn->options.query_stop && set->exact[pend.id] &&
+                cur->done[pend.id]) {
+            /* Matched once already; see jsonsl__query_push() */
+            continue;
+        }
+        committed = 1;
+        if (set->exact[pend.id] && !cur->done[pend.id] && cur->nremaining) {
+            cur->done[pend.id] = 1;
+            if (!--cur->nremaining && jsn->options.query_stop) {
+                jsn->query_stop_level = jsn->query_level ? jsn->query_level :
+                        level;
+            }
+        }
+        if (jsn->predicate_callback) {
+            jsn->predicate_callback(jsn, parent, pend.id);
+        }
+    }
+    cur->npending = out;
+
+    if (committed) {
+        /* Pass the rest of it through, as for a complete match */
+        parent->ignore_callback = 0;
+        if (!jsn->query_level) {
+            jsn->query_level = level;
+        }
+        return 0;
+    }
+    if (jsn->query_level ||
+            (out && cur->pending[out - 1].level == level)) {
+        return 0;
+    }
+    return cur->level_end[level] == (level > 1 ? cur->level_end[level - 1] : 0);
+}
+
+/* Start tracking completions for a new document */
+static void
+jsonsl__query_begin(struct jsonsl_jpr_cursor_st *cur)
+{
+    const struct jsonsl_jpr_set_st *set = cur->set;
+    if (cur->nremaining == set->nexact + set->nwild_parents) {
+        return;
+    }
+    memset(cur->done, 0, set->njprs + set->nnodes);
+    cur->nremaining = set->nexact + set->nwild_parents;
+    cur->satisfied = 0;
+}
+
+/* Called once the lexer has popped below query_stop_level, i.e. every exact
+ * path has been matched and its value is complete. Returns true if nothing
+ * else can match, in which case the lexer stops. Otherwise this is deferred
+ * until the innermost open container which may still contain a wildcard
+ * path's match is popped */
+static int
+jsonsl__query_pop(jsonsl_t jsn)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    unsigned level, ii;
+
+    jsn->query_stop_level = 0;
+    if (!cur || !cur->set || !jsn->options.query_stop) {
+        return 0;
+    }
+    for (level = jsn->level; level > 0; level--) {
+        unsigned begin = level > 1 ? cur->level_end[level - 1] : 0;
+        for (ii = begin; ii < cur->level_end[level]; ii++) {
+            if (cur->set->nodes[cur->active[ii]].wild_below) {
+                jsn->query_stop_level = level;
+                return 0;
+            }
+        }
+    }
+    cur->satisfied = 1;
+    jsn->stopfl = 1;
+    return 1;
+}
+
+JSONSL_API
+int
+jsonsl_jpr_set_satisfied(jsonsl_t jsn)
+{
+    return jsn->jpr_cursor && jsn->jpr_cursor->satisfied;
+}
+
+/* Whether no element after index 'idx' of the list at 'level' can match */
+static int
+jsonsl__query_list_done(const struct jsonsl_jpr_cursor_st *cur,
+                        unsigned level, unsigned long idx)
+{
+    unsigned ii, begin = level > 1 ? cur->level_end[level - 1] : 0;
+    for (ii = begin; ii < cur->level_end[level]; ii++) {
+        if (cur->set->nodes[cur->active[ii]].idx_limit > idx + 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Matches a value being pushed, and returns one of the JSONSL__QUERY_*
+ * constants: containers which no path can lead through are skipped, as is
+ * the rest of a list once no later element can match */
+static int
+jsonsl__query_push(jsonsl_t jsn, struct jsonsl_state_st *state)
+{
+    struct jsonsl_jpr_cursor_st *cur = jsn->jpr_cursor;
+    const struct jsonsl_state_st *parent = jsn->stack + state->level - 1;
+    const size_t *ids;
+    size_t nids;
+    jsonsl_jpr_match_t match;
+
+    if (!cur || !cur->set) {
+        return JSONSL__QUERY_LEX;
+    }
+    if (jsn->query_level >= state->level) {
+        /* The completed value has been popped */
+        jsn->query_level = 0;
+    }
+    if (state->level == 1) {
+        /* A new document */
+        jsonsl__query_begin(cur);
+    }
+    if (cur->key_lost && state->level > 1 && parent->type == JSONSL_T_OBJECT) {
+        /* Nothing at or below a member whose key was lost can match */
+        cur->level_end[state->level] = cur->level_end[state->level - 1];
+        cur->nresults = nids = 0;
+        ids = cur->results;
+        match = cur->match = JSONSL_MATCH_NOMATCH;
+    } else {
+        match = jsonsl__jpr_set_match(jsn, state, cur->keyp, cur->nkey,
+                                      cur->key_hash, &ids, &nids);
+    }
+    if (jsn->options.query_stop && match == JSONSL_MATCH_COMPLETE) {
+        /* A path without wildcards matches once: a later member with the
+         * same key is not reported again */
+        const struct jsonsl_jpr_set_st *set = cur->set;
+        size_t ii, out = 0;
+        for (ii = 0; ii < nids; ii++) {
+            if (!set->exact[ids[ii]] || !cur->done[ids[ii]]) {
+                cur->results[out++] = ids[ii];
+            }
+        }
+        nids = cur->nresults = out;
+        if (!nids) {
+            unsigned level = state->level;
+            int pending = cur->npending &&
+                    cur->pending[cur->npending - 1].level == level;
+            match = cur->match = pending || cur->level_end[level] !=
+                    (level > 1 ? cur->level_end[level - 1] : 0) ?
+                    JSONSL_MATCH_POSSIBLE : JSONSL_MATCH_NOMATCH;
+        }
+    }
+    if (cur->npending) {
+        if (state->type != JSONSL_T_OBJECT && state->type != JSONSL_T_LIST) {
+            jsonsl__query_watch_begin(jsn, state);
+        } else if (match == JSONSL_MATCH_POSSIBLE &&
+                cur->pending[cur->npending - 1].level == state->level &&
+                cur->level_end[state->level] ==
+                        (state->level > 1 ?
+                                cur->level_end[state->level - 1] : 0)) {
+            /* Only a predicate can make this match; nothing is reported
+             * until it does */
+            state->ignore_callback = 1;
+        }
+    }
+    if (jsn->options.query_stop && match != JSONSL_MATCH_NOMATCH &&
+            cur->nremaining) {
+        const struct jsonsl_jpr_set_st *set = cur->set;
+        size_t ii;
+        for (ii = 0; ii < nids; ii++) {
+            if (set->exact[ids[ii]] && !cur->done[ids[ii]]) {
+                cur->done[ids[ii]] = 1;
+                cur->nremaining--;
+            }
+        }
+        if (set->nwild_parents) {
+            /* Nodes matched by this state which have children */
+            unsigned begin = state->level > 1 ?
+                    cur->level_end[state->level - 1] : 0;
+            for (ii = begin; ii < cur->level_end[state->level]; ii++) {
+                unsigned nodeix = cur->active[ii];
+                if (set->nodes[nodeix].wild_parent && !cur->node_done[nodeix]) {
+                    cur->node_done[nodeix] = 1;
+                    cur->nremaining--;
+                }
+            }
+        }
+        if (!cur->nremaining) {
+            /* Wait for the outermost completed value to be popped */
+            jsn->query_stop_level = jsn->query_level ? jsn->query_level :
+                    state->level;
+        }
+    }
+    if (jsn->query_level || match == JSONSL_MATCH_POSSIBLE) {
+        return JSONSL__QUERY_LEX;
+    } else if (match == JSONSL_MATCH_COMPLETE) {
+        jsn->query_level = state->level;
+        return JSONSL__QUERY_LEX;
+    }
+    state->ignore_callback = 1;
+    if (state->level > 1 && parent->type == JSONSL_T_LIST &&
+            jsonsl__query_list_done(cur, parent->level,
+                                    (unsigned long)parent->nelem - 1)) {
+        return JSONSL__QUERY_SKIP_REST;
+    }
+    if (state->type == JSONSL_T_OBJECT || state->type == JSONSL_T_LIST) {
+        return JSONSL__QUERY_SKIP;
+    }
+    return JSONSL__QUERY_LEX;
+}
+
+/* jsonsl_extract(). While a value is being lexed, the pos_end of its span
+ * holds 1 + the index of the span opened before it (or 0), so that the open
+ * spans form a stack, innermost first */
+struct jsonsl__extract_st {
+    jsonsl_span_t *spans;
+    size_t nspans;
+    size_t nfound;
+    size_t open;
+    jsonsl_error_t err;
+};
+
+static void
+jsonsl__extract_add(jsonsl_t jsn, struct jsonsl_state_st *state, size_t id)
+{
+    struct jsonsl__extract_st *ex = (struct jsonsl__extract_st *)jsn->data;
+    jsonsl_span_t *span;
+    size_t *link = &ex->open;
+
+    if (ex->nfound++ >= ex->nspans) {
+        return;
+    }
+    span = ex->spans + ex->nfound - 1;
+    span->id = id;
+    span->pos_begin = state->pos_begin;
+    span->level = state->level;
+    span->type = (jsonsl_type_t)state->type;
+    span->special_flags = 0;
+    /* An object is only found once its predicate is decided, while the
+     * member which decided it is still open */
+    while (*link && ex->spans[*link - 1].level > state->level) {
+        link = &ex->spans[*link - 1].pos_end;
+    }
+    span->pos_end = *link;
+    *link = ex->nfound;
+}
+
+static void
+jsonsl__extract_push(jsonsl_t jsn, jsonsl_action_t action,
+                     struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    const size_t *ids;
+    size_t nids, ii;
+
+    if (jsonsl_jpr_set_last_match(jsn, &ids, &nids) != JSONSL_MATCH_COMPLETE) {
+        return;
+    }
+    for (ii = 0; ii < nids; ii++) {
+        jsonsl__extract_add(jsn, state, ids[ii]);
+    }
+}
+
+static void
+jsonsl__extract_pop(jsonsl_t jsn, jsonsl_action_t action,
+                    struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct jsonsl__extract_st *ex = (struct jsonsl__extract_st *)jsn->data;
+    /* Specials are popped at the character after them */
+    size_t end = state->type == JSONSL_T_SPECIAL ? jsn->pos : jsn->pos + 1;
+
+    while (ex->open && ex->spans[ex->open - 1].level == state->level) {
+        jsonsl_span_t *span = ex->spans + ex->open - 1;
+        ex->open = span->pos_end;
+        span->pos_end = end;
+        span->special_flags = state->special_flags;
+    }
+}
+
+static int
+jsonsl__extract_error(jsonsl_t jsn, jsonsl_error_t err,
+                      struct jsonsl_state_st *state, jsonsl_char_t *at)
+{
+    ((struct jsonsl__extract_st *)jsn->data)->err = err;
+    return 0;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_extract_with(jsonsl_t jsn, const jsonsl_char_t *buf, size_t nbuf,
+                    jsonsl_jpr_set_t set, jsonsl_span_t *spans, size_t *nspans)
+{
+    struct jsonsl__extract_st ex;
+
+    ex.spans = spans;
+    ex.nspans = *nspans;
+    ex.nfound = 0;
+    ex.open = 0;
+    ex.err = JSONSL_ERROR_SUCCESS;
+    *nspans = 0;
+
+    jsonsl_reset(jsn);
+    ex.err = jsonsl_jpr_set_attach(jsn, set);
+    if (ex.err != JSONSL_ERROR_SUCCESS) {
+        return ex.err;
+    }
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->call_HKEY = 0;
+    jsn->call_UESCAPE = 0;
+    jsn->return_UESCAPE = 0;
+    jsn->action_callback = NULL;
+    jsn->action_callback_PUSH = jsonsl__extract_push;
+    jsn->action_callback_POP = jsonsl__extract_pop;
+    jsn->predicate_callback = jsonsl__extract_add;
+    jsn->error_callback = jsonsl__extract_error;
+    jsn->max_callback_level = UINT_MAX;
+    jsn->data = &ex;
+    jsn->options.query = 1;
+    jsn->options.query_stop = 1;
+
+    jsonsl_feed(jsn, buf, nbuf);
+    if (ex.err == JSONSL_ERROR_SUCCESS && !jsn->stopfl && jsn->level == 1 &&
+            jsn->stack[1].type == JSONSL_T_SPECIAL) {
+        /* A number at the top level only ends with the buffer */
+        static const jsonsl_char_t space[] = { ' ' };
+        jsonsl_feed(jsn, space, 1);
+    }
+    if (ex.err == JSONSL_ERROR_SUCCESS && !jsonsl_jpr_set_satisfied(jsn) &&
+            (jsn->level || ex.open)) {
+        ex.err = JSONSL_ERROR_INCOMPLETE;
+    }
+    jsonsl_jpr_set_detach(jsn);
+    jsn->data = NULL;
+    if (ex.err == JSONSL_ERROR_SUCCESS) {
+        *nspans = ex.nfound;
+    }
+    return ex.err;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_extract(const jsonsl_char_t *buf, size_t nbuf, jsonsl_jpr_set_t set,
+               jsonsl_span_t *spans, size_t *nspans)
+{
+    jsonsl_t jsn = jsonsl_new(JSONSL_EXTRACT_LEVELS);
+    jsonsl_error_t err;
+
+    if (!jsn) {
+        *nspans = 0;
+        return JSONSL_ERROR_ENOMEM;
+    }
+    err = jsonsl_extract_with(jsn, buf, nbuf, set, spans, nspans);
+    jsonsl_destroy(jsn);
+    return err;
+}
+
+/* Offset indexes. While an index is built, its nodes are in document order
+ * and first_child holds the node's parent. jsonsl_index_finish() then lays
+ * them out breadth first, so that the children of each node are contiguous:
+ * list elements in order, and object members sorted by key hash.
+ *
+ * jsonsl_index_update() replaces the subtree of the value it reparses by
+ * one appended to the nodes, leaving the old one unreachable until
+ * jsonsl__index_collect(). Rather than shift the positions of everything
+ * after the value, it logs the shift in 'edits'; a node's positions are
+ * current once the edits from its 'gen' on are applied to them (see
+ * jsonsl__index_pos()). As most nodes are from the original document
+ * (gen 0), the edits are also kept as 'shifts' of its positions, so that
+ * those nodes are moved by a binary search rather than by every edit */
+struct jsonsl__index_node_st {
+    size_t pos_begin;
+    size_t pos_end;
+    size_t first_child;
+    size_t nchildren;
+    /* Offset of the key in jsonsl_index_st::keys, for object members */
+    size_t key;
+    size_t nkey;
+    uint32_t key_hash;
+    unsigned type;
+    unsigned special_flags;
+    unsigned level;
+    unsigned gen;
+};
+
+/* Positions from 'at' on were moved by replacing 'old_len' characters by
+ * 'new_len' */
+struct jsonsl__index_edit_st {
+    size_t at;
+    size_t old_len;
+    size_t new_len;
+};
+
+/* Positions of the original document from 'at' on are moved by 'shift'
+ * (modulo SIZE_MAX + 1, as it may be negative) */
+struct jsonsl__index_shift_st {
+    size_t at;
+    size_t shift;
+};
+
+/* Edits logged before they are applied to all the nodes */
+#define JSONSL__INDEX_MAX_EDITS 1024
+
+struct jsonsl_index_st {
+    unsigned depth;
+    size_t length;
+    struct jsonsl__index_node_st *nodes;
+    size_t nnodes;
+    size_t nodes_alloc;
+    char *keys;
+    size_t nkeys;
+    size_t keys_alloc;
+
+    /* For each run of children in 'nodes', their positions in it in
+     * document order (built with the layout, and saved with it) */
+    size_t *doc_order;
+    size_t doc_order_alloc;
+
+    /* Once updated (and allocated then): the edits not yet applied, the
+     * number of unreachable nodes, and the index values are lexed into,
+     * which keeps its lexer from one update to the next */
+    struct jsonsl__index_edit_st *edits;
+    unsigned nedits;
+    struct jsonsl__index_shift_st *shifts;
+    unsigned nshifts;
+    size_t ngarbage;
+    struct jsonsl_index_st *scratch;
+
+    /* While building: the lexer, the node open at each level, the buffer
+     * being fed and its position, and where the last key begins in 'keys' */
+    jsonsl_t jsn;
+    size_t *open;
+    const jsonsl_char_t *buf;
+    size_t buf_pos;
+    size_t key_begin;
+    jsonsl_error_t err;
+};
+
+#define JSONSL__INDEX_MAGIC "JSLINDEX"
+#define JSONSL__INDEX_VERSION 1
+/* Size of the header and of each node in a saved index. The last 8 bytes
+ * of a node are its doc_order entry, or 0 in files written before it was
+ * saved */
+#define JSONSL__INDEX_HDR_SIZE 40
+#define JSONSL__INDEX_NODE_SIZE 72
+
+/* Make room for 'need' elements in an array */
+static int
+jsonsl__index_grow(void **arr, size_t *alloc, size_t need, size_t elsize)
+{
+    size_t nalloc = *alloc ? *alloc : 64;
+    void *narr;
+    if (need <= *alloc) {
+        return 0;
+    }
+    while (nalloc < need) {
+        nalloc *= 2;
+    }
+    narr = realloc(*arr, nalloc * elsize);
+    if (!narr) {
+        return -1;
+    }
+    *arr = narr;
+    *alloc = nalloc;
+    return 0;
+}
+
+/* Append the characters at stream positions [begin, end) of the buffer
+ * being fed to the key being lexed */
+static int
+jsonsl__index_key_add(struct jsonsl_index_st *idx, size_t begin, size_t end)
+{
+    const jsonsl_char_t *src;
+    if (begin < idx->buf_pos) {
+        /* The beginning was in an earlier buffer, and is already added */
+        begin = idx->buf_pos;
+    }
+    if (begin >= end) {
+        return 0;
+    }
+    if (jsonsl__index_grow((void **)&idx->keys, &idx->keys_alloc,
+                           idx->nkeys + (end - begin), 1) != 0) {
+        return -1;
+    }
+    for (src = idx->buf + (begin - idx->buf_pos); begin < end; begin++) {
+        idx->keys[idx->nkeys++] = (char)*src++;
+    }
+    return 0;
+}
+
+static void
+jsonsl__index_push(jsonsl_t jsn, jsonsl_action_t action,
+                   struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct jsonsl_index_st *idx = (struct jsonsl_index_st *)jsn->data;
+    struct jsonsl__index_node_st *node;
+
+    if (state->type == JSONSL_T_HKEY) {
+        idx->key_begin = idx->nkeys;
+        return;
+    }
+    if (state->level == 1 && idx->nnodes) {
+        /* A second document */
+        idx->err = JSONSL_ERROR_GARBAGE_TRAILING;
+        jsonsl_stop(jsn);
+        return;
+    }
+    if (jsonsl__index_grow((void **)&idx->nodes, &idx->nodes_alloc,
+                           idx->nnodes + 1, sizeof(*node)) != 0) {
+        idx->err = JSONSL_ERROR_ENOMEM;
+        jsonsl_stop(jsn);
+        return;
+    }
+    node = idx->nodes + idx->nnodes;
+    node->pos_begin = state->pos_begin;
+    node->pos_end = 0;
+    node->first_child = 0;
+    node->nchildren = 0;
+    node->key = 0;
+    node->nkey = 0;
+    node->key_hash = 0;
+    node->type = state->type;
+    node->special_flags = 0;
+    node->level = state->level;
+    node->gen = 0;
+    if (state->level > 1) {
+        struct jsonsl__index_node_st *parent;
+        node->first_child = idx->open[state->level - 1];
+        parent = idx->nodes + node->first_child;
+        parent->nchildren++;
+        if (parent->type == JSONSL_T_OBJECT) {
+            node->key = idx->key_begin;
+            node->nkey = idx->nkeys - idx->key_begin;
+            node->key_hash = jsonsl__jpr_hash(idx->keys + node->key,
+                                              node->nkey);
+        }
+    }
+    idx->open[state->level] = idx->nnodes++;
+}
+
+static void
+jsonsl__index_pop(jsonsl_t jsn, jsonsl_action_t action,
+                  struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct jsonsl_index_st *idx = (struct jsonsl_index_st *)jsn->data;
+    struct jsonsl__index_node_st *node;
+
+    if (state->type == JSONSL_T_HKEY) {
+        if (jsonsl__index_key_add(idx, state->pos_begin + 1, jsn->pos) != 0) {
+            idx->err = JSONSL_ERROR_ENOMEM;
+            jsonsl_stop(jsn);
+        }
+        return;
+    }
+    node = idx->nodes + idx->open[state->level];
+    /* Specials are popped at the character after them */
+    if (state->type == JSONSL_T_SPECIAL) {
+        node->pos_end = jsn->pos;
+        node->special_flags = state->special_flags;
+    } else {
+        /* Containers may inherit stale flags from the lexer's state */
+        node->pos_end = jsn->pos + 1;
+    }
+}
+
+static int
+jsonsl__index_error(jsonsl_t jsn, jsonsl_error_t err,
+                    struct jsonsl_state_st *state, jsonsl_char_t *at)
+{
+    ((struct jsonsl_index_st *)jsn->data)->err = err;
+    return 0;
+}
+
+JSONSL_API
+jsonsl_index_t
+jsonsl_index_new(unsigned depth)
+{
+    struct jsonsl_index_st *idx;
+
+    if (depth > JSONSL_INDEX_LEVELS) {
+        depth = JSONSL_INDEX_LEVELS;
+    }
+    idx = (struct jsonsl_index_st *)calloc(1, sizeof(*idx));
+    if (!idx) {
+        return NULL;
+    }
+    idx->depth = depth;
+    idx->jsn = jsonsl_new(JSONSL_INDEX_LEVELS);
+    idx->open = (size_t *)malloc(sizeof(*idx->open) * (depth + 2));
+    if (!idx->jsn || !idx->open) {
+        jsonsl_index_destroy(idx);
+        return NULL;
+    }
+    jsonsl_enable_all_callbacks(idx->jsn);
+    idx->jsn->action_callback_PUSH = jsonsl__index_push;
+    idx->jsn->action_callback_POP = jsonsl__index_pop;
+    idx->jsn->error_callback = jsonsl__index_error;
+    idx->jsn->max_callback_level = depth + 2;
+    idx->jsn->data = idx;
+    return idx;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_index_feed(jsonsl_index_t idx, const jsonsl_char_t *bytes,
+                  size_t nbytes)
+{
+    jsonsl_t jsn = idx->jsn;
+    const struct jsonsl_state_st *state;
+
+    if (!jsn || idx->err != JSONSL_ERROR_SUCCESS) {
+        return idx->err;
+    }
+    idx->buf = bytes;
+    idx->buf_pos = jsn->pos;
+    jsonsl_feed(jsn, bytes, nbytes);
+    state = jsn->stack + jsn->level;
+    if (idx->err == JSONSL_ERROR_SUCCESS && state->type == JSONSL_T_HKEY &&
+            state->level < jsn->max_callback_level &&
+            jsonsl__index_key_add(idx, state->pos_begin + 1, jsn->pos) != 0) {
+        /* The rest of the key is in the next buffer */
+        idx->err = JSONSL_ERROR_ENOMEM;
+    }
+    return idx->err;
+}
+
+struct jsonsl__index_kid_st {
+    uint32_t hash;
+    size_t node;
+};
+
+static int
+jsonsl__index_kid_cmp(const void *a, const void *b)
+{
+    const struct jsonsl__index_kid_st *ka =
+            (const struct jsonsl__index_kid_st *)a;
+    const struct jsonsl__index_kid_st *kb =
+            (const struct jsonsl__index_kid_st *)b;
+    if (ka->hash != kb->hash) {
+        return ka->hash < kb->hash ? -1 : 1;
+    }
+    /* Keep duplicate keys in document order */
+    return ka->node < kb->node ? -1 : ka->node > kb->node;
+}
+
+/* Lay the nodes out breadth first (see jsonsl__index_node_st) */
+static jsonsl_error_t
+jsonsl__index_order(struct jsonsl_index_st *idx)
+{
+    size_t n = idx->nnodes, ii, jj, nout;
+    struct jsonsl__index_kid_st *kids;
+    struct jsonsl__index_node_st *out;
+    size_t *start, *order, *rank, *doc_order;
+
+    kids = (struct jsonsl__index_kid_st *)malloc(sizeof(*kids) * n);
+    start = (size_t *)malloc(sizeof(*start) * (n + 1) * 3);
+    out = (struct jsonsl__index_node_st *)malloc(sizeof(*out) * n);
+    doc_order = (size_t *)malloc(sizeof(*doc_order) * n);
+    if (!kids || !start || !out || !doc_order) {
+        free(kids);
+        free(start);
+        free(out);
+        free(doc_order);
+        return JSONSL_ERROR_ENOMEM;
+    }
+    order = start + n + 1;
+    /* Where each node is among its siblings, in document order */
+    rank = order + n + 1;
+
+    /* The children of node ii are kids[start[ii]] to kids[start[ii+1]-1] */
+    start[0] = 0;
+    for (ii = 0; ii < n; ii++) {
+        start[ii + 1] = start[ii] + idx->nodes[ii].nchildren;
+        order[ii] = start[ii];
+    }
+    for (ii = 1; ii < n; ii++) {
+        size_t parent = idx->nodes[ii].first_child;
+        rank[ii] = order[parent] - start[parent];
+        kids[order[parent]].hash = idx->nodes[ii].key_hash;
+        kids[order[parent]++].node = ii;
+    }
+    for (ii = 0; ii < n; ii++) {
+        if (idx->nodes[ii].type == JSONSL_T_OBJECT &&
+                idx->nodes[ii].nchildren > 1) {
+            qsort(kids + start[ii], idx->nodes[ii].nchildren, sizeof(*kids),
+                  jsonsl__index_kid_cmp);
+        }
+    }
+
+    order[0] = doc_order[0] = 0;
+    for (ii = 0, nout = 1; ii < n; ii++) {
+        size_t orig = order[ii];
+        out[ii] = idx->nodes[orig];
+        out[ii].first_child = nout;
+        for (jj = start[orig]; jj < start[orig + 1]; jj++) {
+            doc_order[out[ii].first_child + rank[kids[jj].node]] = nout;
+            order[nout++] = kids[jj].node;
+        }
+    }
+
+    free(kids);
+    free(start);
+    free(idx->nodes);
+    free(idx->doc_order);
+    idx->nodes = out;
+    idx->nodes_alloc = n;
+    idx->doc_order = doc_order;
+    idx->doc_order_alloc = n;
+    return JSONSL_ERROR_SUCCESS;
+}
+
+/* Finish lexing, and lay out the nodes. The lexer is kept */
+static jsonsl_error_t
+jsonsl__index_end(struct jsonsl_index_st *idx)
+{
+    jsonsl_t jsn = idx->jsn;
+
+    idx->length = jsn->pos;
+    if (idx->err == JSONSL_ERROR_SUCCESS && jsn->level == 1 &&
+            jsn->stack[1].type == JSONSL_T_SPECIAL) {
+        /* A number at the top level only ends with the document */
+        static const jsonsl_char_t space[] = { ' ' };
+        jsonsl_index_feed(idx, space, 1);
+    }
+    if (idx->err == JSONSL_ERROR_SUCCESS && (jsn->level || !idx->nnodes)) {
+        idx->err = JSONSL_ERROR_INCOMPLETE;
+    }
+    if (idx->err == JSONSL_ERROR_SUCCESS) {
+        idx->err = jsonsl__index_order(idx);
+    }
+    if (idx->err != JSONSL_ERROR_SUCCESS) {
+        idx->nnodes = 0;
+    }
+    return idx->err;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_index_finish(jsonsl_index_t idx)
+{
+    if (!idx->jsn) {
+        return idx->err;
+    }
+    jsonsl__index_end(idx);
+    jsonsl_destroy(idx->jsn);
+    idx->jsn = NULL;
+    free(idx->open);
+    idx->open = NULL;
+    return idx->err;
+}
+
+/* The current position of 'pos', a position of 'node' */
+static size_t
+jsonsl__index_pos(const struct jsonsl_index_st *idx,
+                  const struct jsonsl__index_node_st *node, size_t pos)
+{
+    unsigned ii, lo = 0, hi = idx->nshifts;
+    if (!node->gen) {
+        while (lo < hi) {
+            unsigned mid = lo + (hi - lo) / 2;
+            if (idx->shifts[mid].at <= pos) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo ? pos + idx->shifts[lo - 1].shift : pos;
+    }
+    for (ii = node->gen; ii < idx->nedits; ii++) {
+        if (pos >= idx->edits[ii].at) {
+            pos = pos - idx->edits[ii].old_len + idx->edits[ii].new_len;
+        }
+    }
+    return pos;
+}
+
+/* Find the first of 'n' object members (sorted by hash) with the key of
+ * 'comp' */
+static const struct jsonsl__index_node_st *
+jsonsl__index_find(const struct jsonsl_index_st *idx,
+                   const struct jsonsl__index_node_st *kids, size_t n,
+                   const struct jsonsl_jpr_component_st *comp)
+{
+    uint32_t hash = comp->key_hash ? comp->key_hash :
+            jsonsl__jpr_hash(comp->pstr, comp->len);
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (kids[mid].key_hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < n && kids[lo].key_hash == hash; lo++) {
+        if (kids[lo].nkey == comp->len &&
+                memcmp(idx->keys + kids[lo].key, comp->pstr, comp->len) == 0) {
+            return kids + lo;
+        }
+    }
+    return NULL;
+}
+
+JSONSL_API
+jsonsl_jpr_match_t
+jsonsl_index_lookup(jsonsl_index_t idx, jsonsl_jpr_t jpr, jsonsl_span_t *span)
+{
+    const struct jsonsl__index_node_st *node = idx->nodes;
+    jsonsl_jpr_match_t ret = JSONSL_MATCH_COMPLETE;
+    size_t ii;
+
+    if (!idx->nnodes) {
+        return JSONSL_MATCH_NOMATCH;
+    }
+    for (ii = 1; ii < jpr->ncomponents; ii++) {
+        const struct jsonsl_jpr_component_st *comp = jpr->components + ii;
+        const struct jsonsl__index_node_st *kids =
+                idx->nodes + node->first_child;
+
+        if (node->type != JSONSL_T_OBJECT && node->type != JSONSL_T_LIST) {
+            return JSONSL_MATCH_NOMATCH;
+        }
+        if (node->level > idx->depth || comp->flags ||
+                (comp->ptype != JSONSL_PATH_STRING &&
+                        comp->ptype != JSONSL_PATH_NUMERIC)) {
+            /* The rest has to be lexed */
+            ret = JSONSL_MATCH_POSSIBLE;
+            break;
+        }
+        if (node->type == JSONSL_T_LIST) {
+            if (comp->ptype != JSONSL_PATH_NUMERIC) {
+                return JSONSL_MATCH_TYPE_MISMATCH;
+            } else if (comp->idx >= node->nchildren) {
+                return JSONSL_MATCH_NOMATCH;
+            }
+            node = kids + comp->idx;
+        } else if (comp->ptype == JSONSL_PATH_NUMERIC && comp->is_arridx) {
+            return JSONSL_MATCH_TYPE_MISMATCH;
+        } else {
+            node = jsonsl__index_find(idx, kids, node->nchildren, comp);
+            if (!node) {
+                return JSONSL_MATCH_NOMATCH;
+            }
+        }
+    }
+    if (ret == JSONSL_MATCH_COMPLETE &&
+            jpr->components[jpr->ncomponents - 1].pred_value) {
+        ret = JSONSL_MATCH_POSSIBLE;
+    }
+    span->id = 0;
+    span->pos_begin = jsonsl__index_pos(idx, node, node->pos_begin);
+    span->pos_end = jsonsl__index_pos(idx, node, node->pos_end);
+    span->level = node->level;
+    span->type = (jsonsl_type_t)node->type;
+    span->special_flags = node->special_flags;
+    return ret;
+}
+
+JSONSL_API
+size_t
+jsonsl_index_length(jsonsl_index_t idx)
+{
+    return idx->length;
+}
+
+/* Apply the logged edits to every node */
+static void
+jsonsl__index_settle(struct jsonsl_index_st *idx)
+{
+    size_t ii;
+    if (!idx->nedits) {
+        return;
+    }
+    for (ii = 0; ii < idx->nnodes; ii++) {
+        struct jsonsl__index_node_st *node = idx->nodes + ii;
+        node->pos_begin = jsonsl__index_pos(idx, node, node->pos_begin);
+        node->pos_end = jsonsl__index_pos(idx, node, node->pos_end);
+        node->gen = 0;
+    }
+    idx->nedits = idx->nshifts = 0;
+}
+
+/* Lay the reachable nodes (and their keys) out again, breadth first */
+static void
+jsonsl__index_collect(struct jsonsl_index_st *idx)
+{
+    size_t n = idx->nnodes - idx->ngarbage, nout = 1, nkeys = 0, ii;
+    struct jsonsl__index_node_st *out;
+    size_t *order = NULL;
+    char *keys;
+
+    out = (struct jsonsl__index_node_st *)malloc(sizeof(*out) * n);
+    keys = (char *)malloc(idx->nkeys + 1);
+    order = (size_t *)malloc(sizeof(*order) * n);
+    if (!out || !keys || !order) {
+        /* Keep the garbage */
+        free(out);
+        free(keys);
+        free(order);
+        return;
+    }
+    out[0] = idx->nodes[0];
+    order[0] = 0;
+    for (ii = 0; ii < nout; ii++) {
+        size_t first = out[ii].first_child, nkids = out[ii].nchildren, jj;
+        memcpy(out + nout, idx->nodes + first, sizeof(*out) * nkids);
+        for (jj = 0; jj < nkids; jj++) {
+            order[nout + jj] = idx->doc_order[first + jj] - first + nout;
+        }
+        out[ii].first_child = nout;
+        nout += nkids;
+        if (out[ii].nkey) {
+            memcpy(keys + nkeys, idx->keys + out[ii].key, out[ii].nkey);
+        }
+        out[ii].key = nkeys;
+        nkeys += out[ii].nkey;
+    }
+    free(idx->nodes);
+    free(idx->keys);
+    free(idx->doc_order);
+    idx->nodes = out;
+    idx->nnodes = idx->nodes_alloc = n;
+    idx->keys = keys;
+    idx->nkeys = nkeys;
+    idx->keys_alloc = idx->nkeys + 1;
+    idx->doc_order = order;
+    idx->doc_order_alloc = n;
+    idx->ngarbage = 0;
+}
+
+struct jsonsl__index_pos_st {
+    size_t pos;
+    size_t node;
+};
+
+static int
+jsonsl__index_pos_cmp(const void *a, const void *b)
+{
+    const struct jsonsl__index_pos_st *pa =
+            (const struct jsonsl__index_pos_st *)a;
+    const struct jsonsl__index_pos_st *pb =
+            (const struct jsonsl__index_pos_st *)b;
+    return pa->pos < pb->pos ? -1 : pa->pos > pb->pos;
+}
+
+/* Fill in the document order of the children of nodes [first, end), for
+ * indexes saved without it */
+static jsonsl_error_t
+jsonsl__index_sort_kids(struct jsonsl_index_st *idx, size_t first, size_t end)
+{
+    struct jsonsl__index_pos_st *tmp = NULL;
+    size_t ntmp = 0, ii, jj;
+
+    for (ii = first; ii < end; ii++) {
+        const struct jsonsl__index_node_st *node = idx->nodes + ii;
+        size_t *order = idx->doc_order + node->first_child;
+        if (node->type != JSONSL_T_OBJECT || node->nchildren < 2) {
+            for (jj = 0; jj < node->nchildren; jj++) {
+                order[jj] = node->first_child + jj;
+            }
+            continue;
+        }
+        if (jsonsl__index_grow((void **)&tmp, &ntmp, node->nchildren,
+                               sizeof(*tmp)) != 0) {
+            free(tmp);
+            return JSONSL_ERROR_ENOMEM;
+        }
+        for (jj = 0; jj < node->nchildren; jj++) {
+            tmp[jj].node = node->first_child + jj;
+            tmp[jj].pos = jsonsl__index_pos(idx, idx->nodes + tmp[jj].node,
+                    idx->nodes[tmp[jj].node].pos_begin);
+        }
+        qsort(tmp, node->nchildren, sizeof(*tmp), jsonsl__index_pos_cmp);
+        for (jj = 0; jj < node->nchildren; jj++) {
+            order[jj] = tmp[jj].node;
+        }
+    }
+    free(tmp);
+    return JSONSL_ERROR_SUCCESS;
+}
+
+/* The child of 'node' whose value contains [begin, end), or 0 */
+static size_t
+jsonsl__index_enclosing(const struct jsonsl_index_st *idx, size_t node,
+                        size_t begin, size_t end)
+{
+    const struct jsonsl__index_node_st *np = idx->nodes + node, *kid;
+    const size_t *order = idx->doc_order + np->first_child;
+    size_t lo = 0, hi = np->nchildren;
+
+    /* Find the last child beginning at or before 'begin' */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        kid = idx->nodes + order[mid];
+        if (jsonsl__index_pos(idx, kid, kid->pos_begin) <= begin) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (!lo) {
+        return 0;
+    }
+    kid = idx->nodes + order[lo - 1];
+    return end <= jsonsl__index_pos(idx, kid, kid->pos_end) ? order[lo - 1] : 0;
+}
+
+static size_t
+jsonsl__index_subtree_size(const struct jsonsl_index_st *idx, size_t node)
+{
+    const struct jsonsl__index_node_st *np = idx->nodes + node;
+    size_t n = 1, ii;
+    for (ii = 0; ii < np->nchildren; ii++) {
+        n += jsonsl__index_subtree_size(idx, np->first_child + ii);
+    }
+    return n;
+}
+
+/* Log that the value at [begin, end) had 'old_len' of its characters
+ * replaced by 'new_len' */
+static void
+jsonsl__index_log(struct jsonsl_index_st *idx, size_t begin, size_t end,
+                  size_t old_len, size_t new_len)
+{
+    struct jsonsl__index_shift_st *shifts = idx->shifts;
+    unsigned lo = 0, hi = idx->nshifts, first, ii, split;
+    size_t at, shift;
+
+    idx->edits[idx->nedits].at = end;
+    idx->edits[idx->nedits].old_len = old_len;
+    idx->edits[idx->nedits].new_len = new_len;
+    idx->nedits++;
+
+    /* Find the first position of the original document which is at or
+     * after the end of the value now: in the shift before it, unless the
+     * end is in text inserted by an earlier edit, in which case it is where
+     * the next shift begins */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (shifts[mid].at + shifts[mid].shift <= end) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    shift = lo ? shifts[lo - 1].shift : 0;
+    at = end - shift;
+    split = !(lo < idx->nshifts && shifts[lo].at <= at);
+
+    /* Shifts beginning within the value (or at its end) only moved the
+     * nodes it replaced, or are replaced by the one added, and drop out.
+     * The others are still in order of their current positions */
+    for (first = lo; first && shifts[first - 1].at + shifts[first - 1].shift >
+            begin && shifts[first - 1].at + shifts[first - 1].shift <= end;
+            first--) {
+    }
+    memmove(shifts + first + split, shifts + lo,
+            sizeof(*shifts) * (idx->nshifts - lo));
+    idx->nshifts = idx->nshifts - (lo - first) + split;
+    if (split) {
+        shifts[first].at = at;
+        shifts[first].shift = shift;
+    }
+    for (ii = first; ii < idx->nshifts; ii++) {
+        shifts[ii].shift += new_len - old_len;
+    }
+}
+
+/* Index 'ndoc' characters of 'doc' into the scratch index, recording
+ * 'depth' levels. Values are lexed as the only element of a list, as
+ * strings may not appear on their own */
+static jsonsl_error_t
+jsonsl__index_scratch(struct jsonsl_index_st *idx, unsigned depth,
+                      const jsonsl_char_t *doc, size_t ndoc, int in_list)
+{
+    static const jsonsl_char_t brackets[] = { '[', ']' };
+    struct jsonsl_index_st *sub = idx->scratch;
+
+    if (!sub) {
+        /* Deep enough for any value of the document */
+        if ((sub = jsonsl_index_new(idx->depth)) == NULL) {
+            return JSONSL_ERROR_ENOMEM;
+        }
+        idx->scratch = sub;
+    }
+    jsonsl_reset(sub->jsn);
+    sub->jsn->max_callback_level = depth + 2;
+    sub->depth = depth;
+    sub->nnodes = sub->nkeys = 0;
+    sub->err = JSONSL_ERROR_SUCCESS;
+    if (in_list) {
+        jsonsl_index_feed(sub, brackets, 1);
+    }
+    jsonsl_index_feed(sub, doc, ndoc);
+    if (in_list) {
+        jsonsl_index_feed(sub, brackets + 1, 1);
+    }
+    return jsonsl__index_end(sub);
+}
+
+/* Reparse the value at 'node' after 'old_len' characters within it were
+ * replaced by 'new_len', and replace its subtree */
+static jsonsl_error_t
+jsonsl__index_reparse(struct jsonsl_index_st *idx, const jsonsl_char_t *doc,
+                      size_t node, size_t old_len, size_t new_len)
+{
+    struct jsonsl__index_node_st *np = idx->nodes + node, *sub_nodes;
+    size_t begin = jsonsl__index_pos(idx, np, np->pos_begin);
+    size_t end = jsonsl__index_pos(idx, np, np->pos_end), base, ii;
+    unsigned level = np->level, gen;
+    struct jsonsl_index_st *sub;
+    jsonsl_error_t err;
+
+    err = jsonsl__index_scratch(idx, idx->depth + 2 - level, doc + begin,
+                                end - begin - old_len + new_len, 1);
+    sub = idx->scratch;
+    if (err == JSONSL_ERROR_SUCCESS && sub->nodes[0].nchildren != 1) {
+        err = sub->nodes[0].nchildren ? JSONSL_ERROR_GARBAGE_TRAILING :
+                JSONSL_ERROR_VALUE_EXPECTED;
+    }
+    if (err == JSONSL_ERROR_SUCCESS &&
+            (jsonsl__index_grow((void **)&idx->nodes, &idx->nodes_alloc,
+                                idx->nnodes + sub->nnodes,
+                                sizeof(*idx->nodes)) != 0 ||
+             jsonsl__index_grow((void **)&idx->doc_order,
+                                &idx->doc_order_alloc,
+                                idx->nnodes + sub->nnodes,
+                                sizeof(*idx->doc_order)) != 0 ||
+             jsonsl__index_grow((void **)&idx->keys, &idx->keys_alloc,
+                                idx->nkeys + sub->nkeys, 1) != 0)) {
+        err = JSONSL_ERROR_ENOMEM;
+    }
+    if (err != JSONSL_ERROR_SUCCESS) {
+        return err;
+    }
+
+    /* Everything after the value moves */
+    idx->ngarbage += jsonsl__index_subtree_size(idx, node) - 1;
+    jsonsl__index_log(idx, begin, end, old_len, new_len);
+    gen = idx->nedits;
+
+    /* The value keeps its node (and key); what is below it is appended,
+     * along with its document order. Node 'ii' of 'sub' is below the list
+     * it was lexed in, and one character after where it is in the
+     * document */
+    base = idx->nnodes - 2;
+    sub_nodes = sub->nodes;
+    for (ii = 1; ii < sub->nnodes; ii++) {
+        struct jsonsl__index_node_st *out =
+                idx->nodes + (ii == 1 ? node : base + ii);
+        if (ii != 1) {
+            *out = sub_nodes[ii];
+            out->key += idx->nkeys;
+            out->level += level - 2;
+        }
+        out->pos_begin = sub_nodes[ii].pos_begin + begin - 1;
+        out->pos_end = sub_nodes[ii].pos_end + begin - 1;
+        out->first_child = sub_nodes[ii].first_child + base;
+        out->nchildren = sub_nodes[ii].nchildren;
+        out->type = sub_nodes[ii].type;
+        out->special_flags = sub_nodes[ii].special_flags;
+        out->gen = gen;
+        if (ii != 1) {
+            idx->doc_order[base + ii] = sub->doc_order[ii] + base;
+        }
+    }
+    if (sub->nkeys) {
+        memcpy(idx->keys + idx->nkeys, sub->keys, sub->nkeys);
+        idx->nkeys += sub->nkeys;
+    }
+    idx->nnodes += sub->nnodes - 2;
+    return JSONSL_ERROR_SUCCESS;
+}
+
+/* Swap two members of an index */
+#define JSONSL__INDEX_SWAP(type, a, b) \
+    do { type swap_ = (a); (a) = (b); (b) = swap_; } while (0)
+
+/* Replace the whole index with one of the new document */
+static jsonsl_error_t
+jsonsl__index_rebuild(struct jsonsl_index_st *idx, const jsonsl_char_t *doc,
+                      size_t ndoc)
+{
+    struct jsonsl_index_st *sub;
+    jsonsl_error_t err;
+
+    err = jsonsl__index_scratch(idx, idx->depth, doc, ndoc, 0);
+    if (err != JSONSL_ERROR_SUCCESS) {
+        return err;
+    }
+    sub = idx->scratch;
+    JSONSL__INDEX_SWAP(struct jsonsl__index_node_st *, idx->nodes, sub->nodes);
+    JSONSL__INDEX_SWAP(size_t, idx->nnodes, sub->nnodes);
+    JSONSL__INDEX_SWAP(size_t, idx->nodes_alloc, sub->nodes_alloc);
+    JSONSL__INDEX_SWAP(char *, idx->keys, sub->keys);
+    JSONSL__INDEX_SWAP(size_t, idx->nkeys, sub->nkeys);
+    JSONSL__INDEX_SWAP(size_t, idx->keys_alloc, sub->keys_alloc);
+    JSONSL__INDEX_SWAP(size_t *, idx->doc_order, sub->doc_order);
+    JSONSL__INDEX_SWAP(size_t, idx->doc_order_alloc, sub->doc_order_alloc);
+    idx->nedits = idx->nshifts = 0;
+    idx->ngarbage = 0;
+    return JSONSL_ERROR_SUCCESS;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_index_update(jsonsl_index_t idx, const jsonsl_char_t *doc,
+                    size_t begin, size_t old_end, size_t new_end)
+{
+    size_t old_len = old_end - begin, new_len = new_end - begin;
+    size_t *chain, nchain = 1, ndoc = idx->length - old_len + new_len;
+    jsonsl_error_t err = JSONSL_ERROR_SUCCESS;
+
+    if (!idx->nnodes) {
+        return idx->err;
+    }
+    if (!idx->edits) {
+        idx->edits = (struct jsonsl__index_edit_st *)
+                malloc(sizeof(*idx->edits) * JSONSL__INDEX_MAX_EDITS);
+        idx->shifts = (struct jsonsl__index_shift_st *)
+                malloc(sizeof(*idx->shifts) * JSONSL__INDEX_MAX_EDITS);
+        if (!idx->edits || !idx->shifts) {
+            free(idx->edits);
+            free(idx->shifts);
+            idx->edits = NULL;
+            idx->shifts = NULL;
+            return JSONSL_ERROR_ENOMEM;
+        }
+    }
+    if (idx->nedits == JSONSL__INDEX_MAX_EDITS) {
+        jsonsl__index_settle(idx);
+    }
+
+    /* Find the values enclosing the edit which have nodes, from the root */
+    chain = (size_t *)malloc(sizeof(*chain) * (idx->depth + 2));
+    if (!chain) {
+        return JSONSL_ERROR_ENOMEM;
+    }
+    chain[0] = 0;
+    while (idx->nodes[chain[nchain - 1]].level <= idx->depth) {
+        size_t kid = jsonsl__index_enclosing(idx, chain[nchain - 1],
+                                             begin, old_end);
+        if (!kid) {
+            break;
+        }
+        chain[nchain++] = kid;
+    }
+
+    /* Reparse the innermost of them which is still a single value, up to
+     * the whole document */
+    for (err = JSONSL_ERROR_INCOMPLETE; nchain > 1; nchain--) {
+        err = jsonsl__index_reparse(idx, doc, chain[nchain - 1], old_len,
+                                    new_len);
+        if (err == JSONSL_ERROR_SUCCESS || err == JSONSL_ERROR_ENOMEM) {
+            break;
+        }
+    }
+    free(chain);
+    if (nchain == 1) {
+        err = jsonsl__index_rebuild(idx, doc, ndoc);
+    }
+    if (err != JSONSL_ERROR_SUCCESS) {
+        return err;
+    }
+    idx->length = ndoc;
+    if (idx->ngarbage > idx->nnodes / 2) {
+        jsonsl__index_collect(idx);
+    }
+    return JSONSL_ERROR_SUCCESS;
+}
+
+JSONSL_API
+int
+jsonsl_index_save(jsonsl_index_t idx, const char *path)
+{
+    unsigned char buf[JSONSL__INDEX_HDR_SIZE];
+    size_t ii;
+    FILE *fp;
+
+    if (!idx->nnodes) {
+        errno = EINVAL;
+        return -1;
+    }
+    jsonsl__index_settle(idx);
+    if (idx->ngarbage) {
+        jsonsl__index_collect(idx);
+    }
+    fp = fopen(path, "wb");
+    if (!fp) {
+        return -1;
+    }
+    memcpy(buf, JSONSL__INDEX_MAGIC, 8);
+    jsonsl__put32(buf + 8, JSONSL__INDEX_VERSION);
+    jsonsl__put32(buf + 12, idx->depth);
+    jsonsl__put64(buf + 16, idx->length);
+    jsonsl__put64(buf + 24, idx->nnodes);
+    jsonsl__put64(buf + 32, idx->nkeys);
+    if (fwrite(buf, 1, JSONSL__INDEX_HDR_SIZE, fp) != JSONSL__INDEX_HDR_SIZE) {
+        goto GT_ERROR;
+    }
+    for (ii = 0; ii < idx->nnodes; ii++) {
+        const struct jsonsl__index_node_st *node = idx->nodes + ii;
+        unsigned char nbuf[JSONSL__INDEX_NODE_SIZE];
+        jsonsl__put64(nbuf, node->pos_begin);
+        jsonsl__put64(nbuf + 8, node->pos_end);
+        jsonsl__put64(nbuf + 16, node->first_child);
+        jsonsl__put64(nbuf + 24, node->nchildren);
+        jsonsl__put64(nbuf + 32, node->key);
+        jsonsl__put64(nbuf + 40, node->nkey);
+        jsonsl__put32(nbuf + 48, node->key_hash);
+        jsonsl__put32(nbuf + 52, node->type);
+        jsonsl__put32(nbuf + 56, node->special_flags);
+        jsonsl__put32(nbuf + 60, node->level);
+        jsonsl__put64(nbuf + 64, idx->doc_order[ii]);
+        if (fwrite(nbuf, 1, sizeof(nbuf), fp) != sizeof(nbuf)) {
+            goto GT_ERROR;
+        }
+    }
+    if (idx->nkeys && fwrite(idx->keys, 1, idx->nkeys, fp) != idx->nkeys) {
+        goto GT_ERROR;
+    }
+    if (fclose(fp) != 0) {
+        return -1;
+    }
+    return 0;
+
+    GT_ERROR:
+    fclose(fp);
+    return -1;
+}
+
+JSONSL_API
+jsonsl_index_t
+jsonsl_index_load(const char *path)
+{
+    unsigned char buf[JSONSL__INDEX_HDR_SIZE];
+    struct jsonsl_index_st *idx;
+    size_t ii;
+    int sorted = 1;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp) {
+        return NULL;
+    }
+    idx = (struct jsonsl_index_st *)calloc(1, sizeof(*idx));
+    if (!idx) {
+        fclose(fp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (fread(buf, 1, JSONSL__INDEX_HDR_SIZE, fp) != JSONSL__INDEX_HDR_SIZE ||
+            memcmp(buf, JSONSL__INDEX_MAGIC, 8) != 0 ||
+            jsonsl__get32(buf + 8) != JSONSL__INDEX_VERSION ||
+            jsonsl__get_size(buf + 16, &idx->length) != 0 ||
+            jsonsl__get_size(buf + 24, &idx->nnodes) != 0 ||
+            jsonsl__get_size(buf + 32, &idx->nkeys) != 0 ||
+            !idx->nnodes || idx->nnodes > (size_t)-1 / sizeof(*idx->nodes)) {
+        goto GT_INVALID;
+    }
+    idx->depth = jsonsl__get32(buf + 12);
+    idx->nodes = (struct jsonsl__index_node_st *)
+            malloc(sizeof(*idx->nodes) * idx->nnodes);
+    idx->keys = (char *)malloc(idx->nkeys + 1);
+    idx->doc_order = (size_t *)malloc(sizeof(*idx->doc_order) * idx->nnodes);
+    if (!idx->nodes || !idx->keys || !idx->doc_order) {
+        jsonsl_index_destroy(idx);
+        fclose(fp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    idx->nodes_alloc = idx->nnodes;
+    idx->keys_alloc = idx->nkeys + 1;
+    idx->doc_order_alloc = idx->nnodes;
+    for (ii = 0; ii < idx->nnodes; ii++) {
+        struct jsonsl__index_node_st *node = idx->nodes + ii;
+        unsigned char nbuf[JSONSL__INDEX_NODE_SIZE];
+        if (fread(nbuf, 1, sizeof(nbuf), fp) != sizeof(nbuf) ||
+                jsonsl__get_size(nbuf, &node->pos_begin) != 0 ||
+                jsonsl__get_size(nbuf + 8, &node->pos_end) != 0 ||
+                jsonsl__get_size(nbuf + 16, &node->first_child) != 0 ||
+                jsonsl__get_size(nbuf + 24, &node->nchildren) != 0 ||
+                jsonsl__get_size(nbuf + 32, &node->key) != 0 ||
+                jsonsl__get_size(nbuf + 40, &node->nkey) != 0 ||
+                jsonsl__get_size(nbuf + 64, idx->doc_order + ii) != 0) {
+            goto GT_INVALID;
+        }
+        node->key_hash = jsonsl__get32(nbuf + 48);
+        node->type = jsonsl__get32(nbuf + 52);
+        node->special_flags = jsonsl__get32(nbuf + 56);
+        node->level = jsonsl__get32(nbuf + 60);
+        node->gen = 0;
+        if (node->first_child > idx->nnodes ||
+                node->nchildren > idx->nnodes - node->first_child ||
+                node->key > idx->nkeys ||
+                node->nkey > idx->nkeys - node->key ||
+                idx->doc_order[ii] >= idx->nnodes) {
+            goto GT_INVALID;
+        }
+        if (ii && !idx->doc_order[ii]) {
+            /* Saved before the document order was */
+            sorted = 0;
+        }
+    }
+    if (fread(idx->keys, 1, idx->nkeys, fp) != idx->nkeys ||
+            fgetc(fp) != EOF) {
+        goto GT_INVALID;
+    }
+    fclose(fp);
+    if (!sorted && jsonsl__index_sort_kids(idx, 0, idx->nnodes) !=
+            JSONSL_ERROR_SUCCESS) {
+        jsonsl_index_destroy(idx);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return idx;
+
+    GT_INVALID:
+    jsonsl_index_destroy(idx);
+    fclose(fp);
+    errno = EINVAL;
+    return NULL;
+}
+
+JSONSL_API
+void
+jsonsl_index_destroy(jsonsl_index_t idx)
+{
+    if (!idx) {
+        return;
+    }
+    jsonsl_destroy(idx->jsn);
+    free(idx->open);
+    free(idx->nodes);
+    free(idx->keys);
+    free(idx->doc_order);
+    free(idx->edits);
+    free(idx->shifts);
+    jsonsl_index_destroy(idx->scratch);
+    free(idx);
+}
+
+/* Tapes. Each word has a tag in its top byte: the type character (see
+ * JSONSL_XTYPE) of the value it begins, or '}' or ']' for the word which
+ * ends a container. The word beginning a container holds the position of the
+ * word ending it, which holds the number of elements (or members). The
+ * words of strings and keys hold the offset of their length in 'strings',
+ * which is followed by the text and a NUL, and preceded by the hash of the
+ * text for keys. The word of a special holds its flags, and is followed by
+ * its value: an int64_t, or a double if JSONSL__TAPE_DOUBLE is set.
+ *
+ * Objects with at least 'index_min' members also get a hash table of their
+ * keys, built when they end. The word ending such an object has
+ * JSONSL__TAPE_INDEXED set, and its table is found by looking for it in
+ * 'indexes', which is in the order objects end, and so in tape order */
+#define JSONSL__TAPE_WORD(tag, payload) (((uint64_t)(tag) << 56) | (payload))
+#define JSONSL__TAPE_TAG(w) ((unsigned)((w) >> 56))
+#define JSONSL__TAPE_PAYLOAD(w) ((w) & (((uint64_t)1 << 56) - 1))
+#define JSONSL__TAPE_DOUBLE ((uint64_t)1 << 32)
+#define JSONSL__TAPE_INDEXED ((uint64_t)1 << 55)
+/* Integers with more digits than this may not fit an int64_t */
+#define JSONSL__TAPE_MAX_DIGITS 18
+
+/* A slot of a key table: the position of the key's word (0 if empty, as
+ * the root is never a key), and the hash of the key */
+struct jsonsl__tape_slot_st {
+    size_t key;
+    uint32_t hash;
+};
+
+/* The key table of the object ending at 'close': the 'mask' + 1 slots
+ * beginning at 'slots' */
+struct jsonsl__tape_index_st {
+    size_t close;
+    size_t slots;
+    size_t mask;
+};
+
+struct jsonsl_tape_st {
+    uint64_t *words;
+    size_t nwords;
+    size_t words_alloc;
+    char *strings;
+    size_t nstrings;
+    size_t strings_alloc;
+    struct jsonsl__tape_slot_st *slots;
+    size_t nslots;
+    size_t slots_alloc;
+    struct jsonsl__tape_index_st *indexes;
+    size_t nindexes;
+    size_t indexes_alloc;
+    size_t index_min;
+
+    /* While parsing: the lexer, the word beginning the container open at
+     * each level, and the document */
+    jsonsl_t jsn;
+    size_t *open;
+    const jsonsl_char_t *buf;
+    jsonsl_error_t err;
+};
+
+/* Copy the text of a string or key at [begin, end) of the document to the
+ * strings, and append its word */
+static jsonsl_error_t
+jsonsl__tape_add_text(struct jsonsl_tape_st *tape,
+                      const struct jsonsl_state_st *state, size_t end)
+{
+    size_t begin = state->pos_begin + 1, len = end - begin, off, ii;
+    int is_key = state->type == JSONSL_T_HKEY;
+    const jsonsl_char_t *src = tape->buf + begin;
+    uint32_t hash;
+    char *text;
+
+    off = tape->nstrings + (is_key ? sizeof(hash) : 0);
+    if (jsonsl__index_grow((void **)&tape->strings, &tape->strings_alloc,
+                           off + sizeof(len) + len + 1, 1) != 0) {
+        return JSONSL_ERROR_ENOMEM;
+    }
+    text = tape->strings + off + sizeof(len);
+    for (ii = 0; ii < len; ii++) {
+        text[ii] = (char)src[ii];
+    }
+    if (state->nescapes) {
+        /* The unescaped text is never longer */
+        jsonsl_error_t err;
+        len = jsonsl_util_unescape_ex(text, text, len, NULL, NULL, &err, NULL);
+        if (err != JSONSL_ERROR_SUCCESS) {
+            return err;
+        }
+    }
+    text[len] = '\0';
+    memcpy(tape->strings + off, &len, sizeof(len));
+    if (is_key) {
+        hash = jsonsl__jpr_hash(text, len);
+        memcpy(tape->strings + tape->nstrings, &hash, sizeof(hash));
+    }
+    tape->nstrings = off + sizeof(len) + len + 1;
+    tape->words[tape->nwords++] = JSONSL__TAPE_WORD(state->type & 0x7f, off);
+    return JSONSL_ERROR_SUCCESS;
+}
+
+/* Append the words of a special at [pos_begin, end) of the document */
+static jsonsl_error_t
+jsonsl__tape_add_special(struct jsonsl_tape_st *tape,
+                         const struct jsonsl_state_st *state, size_t end)
+{
+    uint64_t flags = state->special_flags, value = 0;
+    size_t len = end - state->pos_begin, ii;
+
+    if ((flags & JSONSL_SPECIALf_NUMNOINT) || ((flags & JSONSL_SPECIALf_NUMERIC) &&
+            len - (flags & JSONSL_SPECIALf_SIGNED ? 1 : 0) > JSONSL__TAPE_MAX_DIGITS)) {
+        /* Convert a NUL terminated copy, past the end of the strings */
+        const jsonsl_char_t *src = tape->buf + state->pos_begin;
+        char *text;
+        double dval;
+        if (jsonsl__index_grow((void **)&tape->strings, &tape->strings_alloc,
+                               tape->nstrings + len + 1, 1) != 0) {
+            return JSONSL_ERROR_ENOMEM;
+        }
+        text = tape->strings + tape->nstrings;
+        for (ii = 0; ii < len; ii++) {
+            text[ii] = (char)src[ii];
+        }
+        text[len] = '\0';
+        dval = strtod(text, NULL);
+        memcpy(&value, &dval, sizeof(value));
+        flags |= JSONSL__TAPE_DOUBLE;
+    } else if (flags & JSONSL_SPECIALf_SIGNED) {
+        value = (uint64_t)0 - state->nelem;
+    } else if (flags & JSONSL_SPECIALf_NUMERIC) {
+        value = state->nelem;
+    }
+    tape->words[tape->nwords++] = JSONSL__TAPE_WORD(JSONSL_T_SPECIAL, flags);
+    tape->words[tape->nwords++] = value;
+    return JSONSL_ERROR_SUCCESS;
+}
+
+static size_t
+jsonsl__tape_skip(const struct jsonsl_tape_st *tape, size_t node);
+
+/* The hash of the key whose word is at 'key' */
+static uint32_t
+jsonsl__tape_key_hash(const struct jsonsl_tape_st *tape, size_t key)
+{
+    uint32_t hash;
+    memcpy(&hash, tape->strings + JSONSL__TAPE_PAYLOAD(tape->words[key]) -
+           sizeof(hash), sizeof(hash));
+    return hash;
+}
+
+/* Build the key table of the object of 'nkeys' members beginning at 'open',
+ * whose end has just been appended */
+static jsonsl_error_t
+jsonsl__tape_index(struct jsonsl_tape_st *tape, size_t open, size_t nkeys)
+{
+    struct jsonsl__tape_index_st *index;
+    size_t close = tape->nwords - 1, nslots = 4, cur, ii;
+
+    /* Keep the table at most half full */
+    while (nslots < nkeys * 2) {
+        nslots *= 2;
+    }
+    if (jsonsl__index_grow((void **)&tape->slots, &tape->slots_alloc,
+                           tape->nslots + nslots, sizeof(*tape->slots)) != 0 ||
+            jsonsl__index_grow((void **)&tape->indexes, &tape->indexes_alloc,
+                               tape->nindexes + 1,
+                               sizeof(*tape->indexes)) != 0) {
+        return JSONSL_ERROR_ENOMEM;
+    }
+    index = tape->indexes + tape->nindexes++;
+    index->close = close;
+    index->slots = tape->nslots;
+    index->mask = nslots - 1;
+    memset(tape->slots + tape->nslots, 0, nslots * sizeof(*tape->slots));
+    tape->nslots += nslots;
+
+    /* Keys are added in order, so that the first of duplicate keys comes
+     * first along their probe sequence */
+    for (cur = open + 1; cur != close; cur = jsonsl__tape_skip(tape, cur + 1)) {
+        uint32_t hash = jsonsl__tape_key_hash(tape, cur);
+        struct jsonsl__tape_slot_st *slots = tape->slots + index->slots;
+        for (ii = hash & index->mask; slots[ii].key;
+                ii = (ii + 1) & index->mask) {
+        }
+        slots[ii].key = cur;
+        slots[ii].hash = hash;
+    }
+    tape->words[close] |= JSONSL__TAPE_INDEXED;
+    return JSONSL_ERROR_SUCCESS;
+}
+
+static void
+jsonsl__tape_push(jsonsl_t jsn, jsonsl_action_t action,
+                  struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct jsonsl_tape_st *tape = (struct jsonsl_tape_st *)jsn->data;
+
+    if (state->type != JSONSL_T_OBJECT && state->type != JSONSL_T_LIST) {
+        return;
+    }
+    if (jsonsl__index_grow((void **)&tape->words, &tape->words_alloc,
+                           tape->nwords + 1, sizeof(*tape->words)) != 0) {
+        tape->err = JSONSL_ERROR_ENOMEM;
+        jsonsl_stop(jsn);
+        return;
+    }
+    tape->open[state->level] = tape->nwords;
+    tape->words[tape->nwords++] = JSONSL__TAPE_WORD(state->type, 0);
+}
+
+static void
+jsonsl__tape_pop(jsonsl_t jsn, jsonsl_action_t action,
+                 struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct jsonsl_tape_st *tape = (struct jsonsl_tape_st *)jsn->data;
+    jsonsl_error_t err = JSONSL_ERROR_SUCCESS;
+
+    if (tape->nwords + 2 > tape->words_alloc &&
+            jsonsl__index_grow((void **)&tape->words, &tape->words_alloc,
+                               tape->nwords + 2, sizeof(*tape->words)) != 0) {
+        err = JSONSL_ERROR_ENOMEM;
+    } else if (state->type == JSONSL_T_OBJECT) {
+        size_t open = tape->open[state->level], nkeys = state->nelem / 2;
+        tape->words[open] |= tape->nwords;
+        tape->words[tape->nwords++] = JSONSL__TAPE_WORD('}', nkeys);
+        if (tape->index_min && nkeys >= tape->index_min) {
+            err = jsonsl__tape_index(tape, open, nkeys);
+        }
+    } else if (state->type == JSONSL_T_LIST) {
+        tape->words[tape->open[state->level]] |= tape->nwords;
+        tape->words[tape->nwords++] = JSONSL__TAPE_WORD(']', state->nelem);
+    } else if (state->type == JSONSL_T_SPECIAL) {
+        /* Specials are popped at the character after them */
+        err = jsonsl__tape_add_special(tape, state, jsn->pos);
+    } else {
+        err = jsonsl__tape_add_text(tape, state, jsn->pos);
+    }
+    if (err != JSONSL_ERROR_SUCCESS) {
+        tape->err = err;
+        jsonsl_stop(jsn);
+    }
+}
+
+static int
+jsonsl__tape_error(jsonsl_t jsn, jsonsl_error_t err,
+                   struct jsonsl_state_st *state, jsonsl_char_t *at)
+{
+    ((struct jsonsl_tape_st *)jsn->data)->err = err;
+    return 0;
+}
+
+/* How many words and string bytes a document may need at most, so that
+ * each is allocated once.
+ *
+ * Words: each word but a special's second has a character of its own: a
+ * bracket, a string's opening quote or the special's first character. A
+ * special's second goes with the ',' or ':' before it. The first special of
+ * a list has none, so it goes with the one before the list, which precedes
+ * a container and so has no word yet, or if the list is itself the first
+ * element of a list, with the one before that, and so on. Only the chain
+ * which begins the document ends at no character, so there is at most one
+ * word more than there are characters.
+ *
+ * Strings: the text of the strings (and of a number being converted) is
+ * never longer than the document, and each string adds its length, a NUL
+ * and maybe a hash. Quotes inside strings only make this looser */
+static void
+jsonsl__tape_bound(const jsonsl_char_t *buf, size_t nbuf,
+                   size_t *nwords, size_t *nstrings)
+{
+    size_t nquotes = 0, ii;
+    for (ii = 0; ii < nbuf; ii++) {
+        nquotes += buf[ii] == '"';
+    }
+    /* And one more for the room jsonsl__tape_pop() asks for */
+    *nwords = nbuf + 2;
+    *nstrings = nbuf + 1 + (nquotes / 2) *
+            (sizeof(size_t) + sizeof(uint32_t) + 1);
+}
+
+JSONSL_API
+jsonsl_tape_t
+jsonsl_tape_new(void)
+{
+    struct jsonsl_tape_st *tape;
+
+    tape = (struct jsonsl_tape_st *)calloc(1, sizeof(*tape));
+    if (!tape) {
+        return NULL;
+    }
+    tape->index_min = JSONSL_TAPE_INDEX_MIN;
+    tape->jsn = jsonsl_new(JSONSL_TAPE_LEVELS);
+    tape->open = (size_t *)malloc(sizeof(*tape->open) *
+                                  (JSONSL_TAPE_LEVELS + 1));
+    if (!tape->jsn || !tape->open) {
+        jsonsl_tape_destroy(tape);
+        return NULL;
+    }
+    jsonsl_enable_all_callbacks(tape->jsn);
+    tape->jsn->action_callback_PUSH = jsonsl__tape_push;
+    tape->jsn->action_callback_POP = jsonsl__tape_pop;
+    tape->jsn->error_callback = jsonsl__tape_error;
+    tape->jsn->max_callback_level = UINT_MAX;
+    tape->jsn->data = tape;
+    return tape;
+}
+
+JSONSL_API
+void
+jsonsl_tape_set_index_min(jsonsl_tape_t tape, size_t nkeys)
+{
+    tape->index_min = nkeys;
+}
+
+JSONSL_API
+jsonsl_error_t
+jsonsl_tape_parse(jsonsl_tape_t tape, const jsonsl_char_t *buf, size_t nbuf)
+{
+    jsonsl_t jsn = tape->jsn;
+    size_t nwords, nstrings;
+
+    tape->nwords = 0;
+    tape->nstrings = 0;
+    tape->nslots = 0;
+    tape->nindexes = 0;
+    tape->buf = buf;
+    tape->err = JSONSL_ERROR_SUCCESS;
+    jsonsl__tape_bound(buf, nbuf, &nwords, &nstrings);
+    if (jsonsl__index_grow((void **)&tape->words, &tape->words_alloc,
+                           nwords, sizeof(*tape->words)) != 0 ||
+            jsonsl__index_grow((void **)&tape->strings, &tape->strings_alloc,
+                               nstrings, 1) != 0) {
+        tape->err = JSONSL_ERROR_ENOMEM;
+    } else {
+        jsonsl_reset(jsn);
+        jsonsl_feed(jsn, buf, nbuf);
+    }
+    if (tape->err == JSONSL_ERROR_SUCCESS && !jsn->stopfl && jsn->level == 1 &&
+            jsn->stack[1].type == JSONSL_T_SPECIAL) {
+        /* A number at the top level only ends with the buffer */
+        static const jsonsl_char_t space[] = { ' ' };
+        jsonsl_feed(jsn, space, 1);
+    }
+    if (tape->err == JSONSL_ERROR_SUCCESS && (jsn->level || !tape->nwords)) {
+        tape->err = JSONSL_ERROR_INCOMPLETE;
+    }
+    if (tape->err != JSONSL_ERROR_SUCCESS) {
+        tape->nwords = 0;
+        tape->nstrings = 0;
+        tape->nslots = 0;
+        tape->nindexes = 0;
+    }
+    tape->buf = NULL;
+    return tape->err;
+}
+
+/* The position of the value after the one at 'node' and its contents */
+static size_t
+jsonsl__tape_skip(const struct jsonsl_tape_st *tape, size_t node)
+{
+    uint64_t word = tape->words[node];
+    switch (JSONSL__TAPE_TAG(word)) {
+    case JSONSL_T_OBJECT:
+    case JSONSL_T_LIST:
+        return (size_t)JSONSL__TAPE_PAYLOAD(word) + 1;
+    case JSONSL_T_SPECIAL:
+        return node + 2;
+    default:
+        return node + 1;
+    }
+}
+
+/* The value at 'node', stepping over a key, or JSONSL_TAPE_NONE if 'node'
+ * ends a container (or the document) */
+static size_t
+jsonsl__tape_value(const struct jsonsl_tape_st *tape, size_t node)
+{
+    if (node == tape->nwords) {
+        return JSONSL_TAPE_NONE;
+    }
+    switch (JSONSL__TAPE_TAG(tape->words[node])) {
+    case '}':
+    case ']':
+        return JSONSL_TAPE_NONE;
+    case JSONSL_T_HKEY & 0x7f:
+        return node + 1;
+    default:
+        return node;
+    }
+}
+
+/* The text (and its length) of the string or key whose word is 'word' */
+static const char *
+jsonsl__tape_text(const struct jsonsl_tape_st *tape, uint64_t word,
+                  size_t *len)
+{
+    const char *len_p = tape->strings + JSONSL__TAPE_PAYLOAD(word);
+    memcpy(len, len_p, sizeof(*len));
+    return len_p + sizeof(*len);
+}
+
+JSONSL_API
+jsonsl_type_t
+jsonsl_tape_type(jsonsl_tape_t tape, size_t node)
+{
+    unsigned tag = JSONSL__TAPE_TAG(tape->words[node]);
+    return tag == (JSONSL_T_STRING & 0x7f) ? JSONSL_T_STRING :
+            (jsonsl_type_t)tag;
+}
+
+JSONSL_API
+unsigned
+jsonsl_tape_special_flags(jsonsl_tape_t tape, size_t node)
+{
+    uint64_t word = tape->words[node];
+    if (JSONSL__TAPE_TAG(word) != JSONSL_T_SPECIAL) {
+        return 0;
+    }
+    return (unsigned)(JSONSL__TAPE_PAYLOAD(word) & (JSONSL__TAPE_DOUBLE - 1));
+}
+
+JSONSL_API
+size_t
+jsonsl_tape_size(jsonsl_tape_t tape, size_t node)
+{
+    uint64_t word = tape->words[node];
+    if (JSONSL__TAPE_TAG(word) != JSONSL_T_OBJECT &&
+            JSONSL__TAPE_TAG(word) != JSONSL_T_LIST) {
+        return 0;
+    }
+    return (size_t)(JSONSL__TAPE_PAYLOAD(
+            tape->words[JSONSL__TAPE_PAYLOAD(word)]) & ~JSONSL__TAPE_INDEXED);
+}
+
+JSONSL_API
+size_t
+jsonsl_tape_child(jsonsl_tape_t tape, size_t node)
+{
+    unsigned tag = JSONSL__TAPE_TAG(tape->words[node]);
+    if (tag != JSONSL_T_OBJECT && tag != JSONSL_T_LIST) {
+        return JSONSL_TAPE_NONE;
+    }
+    return jsonsl__tape_value(tape, node + 1);
+}
+
+JSONSL_API
+size_t
+jsonsl_tape_next(jsonsl_tape_t tape, size_t node)
+{
+    return jsonsl__tape_value(tape, jsonsl__tape_skip(tape, node));
+}
+
+/* Whether the key whose word is at 'key' is 'key' */
+static int
+jsonsl__tape_key_is(const struct jsonsl_tape_st *tape, size_t key,
+                    const char *text, size_t len)
+{
+    size_t klen;
+    const char *ktext = jsonsl__tape_text(tape, tape->words[key], &klen);
+    return klen == len && memcmp(ktext, text, len) == 0;
+}
+
+/* Look a key up in the table of the object ending at 'close' */
+static size_t
+jsonsl__tape_lookup_index(const struct jsonsl_tape_st *tape, size_t close,
+                          uint32_t hash, const char *key, size_t nkey)
+{
+    size_t lo = 0, hi = tape->nindexes, ii;
+    const struct jsonsl__tape_index_st *index;
+    const struct jsonsl__tape_slot_st *slots;
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tape->indexes[mid].close > close) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    index = tape->indexes + lo;
+    slots = tape->slots + index->slots;
+    for (ii = hash & index->mask; slots[ii].key; ii = (ii + 1) & index->mask) {
+        if (slots[ii].hash == hash &&
+                jsonsl__tape_key_is(tape, slots[ii].key, key, nkey)) {
+            return slots[ii].key + 1;
+        }
+    }
+    return JSONSL_TAPE_NONE;
+}
+
+JSONSL_API
+size_t
+jsonsl_tape_lookup(jsonsl_tape_t tape, size_t node,
+                   const char *key, size_t nkey)
+{
+    uint32_t hash = jsonsl__jpr_hash(key, nkey);
+    uint64_t word = tape->words[node];
+    size_t cur, close;
+
+    if (JSONSL__TAPE_TAG(word) != JSONSL_T_OBJECT) {
+        return JSONSL_TAPE_NONE;
+    }
+    close = (size_t)JSONSL__TAPE_PAYLOAD(word);
+    if (tape->words[close] & JSONSL__TAPE_INDEXED) {
+        return jsonsl__tape_lookup_index(tape, close, hash, key, nkey);
+    }
+    for (cur = node + 1; cur != close; cur = jsonsl__tape_skip(tape, cur + 1)) {
+        if (jsonsl__tape_key_hash(tape, cur) == hash &&
+                jsonsl__tape_key_is(tape, cur, key, nkey)) {
+            return cur + 1;
+        }
+    }
+    return JSONSL_TAPE_NONE;
+}
+
+JSONSL_API
+size_t
+jsonsl_tape_at(jsonsl_tape_t tape, size_t node, size_t index)
+{
+    size_t cur = jsonsl_tape_child(tape, node);
+    for (; index && cur != JSONSL_TAPE_NONE; index--) {
+        cur = jsonsl_tape_next(tape, cur);
+    }
+    return cur;
+}
+
+JSONSL_API
+const char *
+jsonsl_tape_key(jsonsl_tape_t tape, size_t node, size_t *len)
+{
+    return jsonsl__tape_text(tape, tape->words[node - 1], len);
+}
+
+JSONSL_API
+const char *
+jsonsl_tape_string(jsonsl_tape_t tape, size_t node, size_t *len)
+{
+    uint64_t word = tape->words[node];
+    if (JSONSL__TAPE_TAG(word) != (JSONSL_T_STRING & 0x7f)) {
+        *len = 0;
+        return NULL;
+    }
+    return jsonsl__tape_text(tape, word, len);
+}
+
+JSONSL_API
+int64_t
+jsonsl_tape_int(jsonsl_tape_t tape, size_t node)
+{
+    uint64_t word = tape->words[node];
+    int64_t ival;
+
+    if (JSONSL__TAPE_TAG(word) != JSONSL_T_SPECIAL) {
+        return 0;
+    }
+    if (JSONSL__TAPE_PAYLOAD(word) & JSONSL__TAPE_DOUBLE) {
+        return (int64_t)jsonsl_tape_double(tape, node);
+    }
+    memcpy(&ival, tape->words + node + 1, sizeof(ival));
+    return ival;
+}
+
+JSONSL_API
+double
+jsonsl_tape_double(jsonsl_tape_t tape, size_t node)
+{
+    uint64_t word = tape->words[node];
+    double dval;
+
+    if (JSONSL__TAPE_TAG(word) != JSONSL_T_SPECIAL) {
+        return 0;
+    }
+    if (!(JSONSL__TAPE_PAYLOAD(word) & JSONSL__TAPE_DOUBLE)) {
+        return (double)jsonsl_tape_int(tape, node);
+    }
+    memcpy(&dval, tape->words + node + 1, sizeof(dval));
+    return dval;
+}
+
+JSONSL_API
+void
+jsonsl_tape_destroy(jsonsl_tape_t tape)
+{
+    if (!tape) {
+        return;
+    }
+    jsonsl_destroy(tape->jsn);
+    free(tape->open);
+    free(tape->words);
+    free(tape->strings);
+    free(tape->slots);
+    free(tape->indexes);
+    free(tape);
+}
+
+/* Lazy documents. Parsing fills 'bounds' with the extent of each container,
+ * in the order they open, and the position in 'bounds' after its
+ * descendants; while a container is open, its 'end' holds 1 + the position
+ * of the one enclosing it (or 0). A container's members are added to 'nodes'
+ * when it is first navigated, and strings and specials are decoded in
+ * place when their values are first asked for */
+struct jsonsl__lazy_bound_st {
+    size_t begin;
+    size_t end;
+    size_t next;
+};
+
+/* The members of a container have been added */
+#define JSONSL__LAZYf_SCANNED 0x01
+/* The value of a special has been decoded */
+#define JSONSL__LAZYf_DECODED 0x02
+/* The value is a double (ival is not set) */
+#define JSONSL__LAZYf_DOUBLE 0x04
+/* 'text' (or 'key') still has its escapes */
+#define JSONSL__LAZYf_ESCAPED 0x08
+#define JSONSL__LAZYf_KEY_ESCAPED 0x10
+
+/* Unescaped text is kept in blocks of at least this size */
+#define JSONSL__LAZY_BLOCK 4096
+
+#define JSONSL__LAZY_IS_WS(c) \
+    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+struct jsonsl__lazy_node_st {
+    /* The value, at [begin, end) of the document */
+    size_t begin;
+    size_t end;
+    size_t parent;
+    /* For containers, its position in 'bounds', and once scanned, the node
+     * of its first member and the number of them */
+    size_t bound;
+    size_t children;
+    size_t nchildren;
+    /* For object members, the key, and the hash of it if it has no
+     * escapes */
+    const char *key;
+    size_t nkey;
+    uint32_t key_hash;
+    /* For strings, the contents */
+    const char *text;
+    size_t ntext;
+    /* For specials, once decoded */
+    int64_t ival;
+    double dval;
+    unsigned type;
+    unsigned special_flags;
+    unsigned flags;
+};
+
+struct jsonsl__lazy_block_st {
+    struct jsonsl__lazy_block_st *next;
+    size_t used;
+    size_t size;
+};
+
+struct jsonsl_lazy_st {
+    const char *buf;
+    size_t nbuf;
+    struct jsonsl__lazy_bound_st *bounds;
+    size_t nbounds;
+    size_t bounds_alloc;
+    struct jsonsl__lazy_node_st *nodes;
+    size_t nnodes;
+    size_t nodes_alloc;
+    /* Unescaped text, in blocks which never move */
+    struct jsonsl__lazy_block_st *blocks;
+    jsonsl_error_t err;
+};
+
+/* Keep the first error, and return JSONSL_LAZY_NONE */
+static size_t
+jsonsl__lazy_fail(struct jsonsl_lazy_st *lazy, jsonsl_error_t err)
+{
+    if (lazy->err == JSONSL_ERROR_SUCCESS) {
+        lazy->err = err;
+    }
+    return JSONSL_LAZY_NONE;
+}
+
+/* The position after the closing quote of the string whose opening quote is
+ * at 'pos', or 0 if it does not end before 'end'. If 'escaped' is not NULL,
+ * sets it to 1 if the string has escapes, or to -1 if it has an unescaped
+ * control character, which JSON does not allow */
+static size_t
+jsonsl__lazy_string_end(const char *buf, size_t pos, size_t end,
+                        int *escaped)
+{
+    int nescapes = 0;
+
+    for (pos++; pos < end; pos++) {
+        if (buf[pos] == '"') {
+            if (escaped) {
+                *escaped = nescapes;
+            }
+            return pos + 1;
+        } else if (buf[pos] == '\\') {
+            if (nescapes == 0) {
+                nescapes = 1;
+            }
+            pos++;
+        } else if ((unsigned char)buf[pos] < 0x20) {
+            nescapes = -1;
+        }
+    }
+    return 0;
+}
+
+/* The position after the special beginning at 'pos'. Specials end at
+ * anything which could follow them or begin another value, so that a
+ * container never begins inside one */
+static size_t
+jsonsl__lazy_special_end(const char *buf, size_t pos, size_t end)
+{
+    for (; pos < end; pos++) {
+        switch (buf[pos]) {
+        case ' ': case '\t': case '\n': case '\r':
+        case ',': case ':': case '"':
+        case '{': case '}': case '[': case ']':
+            return pos;
+        default:
+            break;
+        }
+    }
+    return pos;
+}
+
+static size_t
+jsonsl__lazy_skip_ws(const char *buf, size_t pos, size_t end)
+{
+    while (pos < end && JSONSL__LAZY_IS_WS(buf[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+static char *
+jsonsl__lazy_alloc(struct jsonsl_lazy_st *lazy, size_t n)
+{
+    struct jsonsl__lazy_block_st *blk = lazy->blocks;
+    if (!blk || blk->size - blk->used < n) {
+        size_t size = n > JSONSL__LAZY_BLOCK ? n : JSONSL__LAZY_BLOCK;
+        blk = (struct jsonsl__lazy_block_st *)malloc(sizeof(*blk) + size);
+        if (!blk) {
+            return NULL;
+        }
+        blk->next = lazy->blocks;
+        blk->used = 0;
+        blk->size = size;
+        lazy->blocks = blk;
+    }
+    blk->used += n;
+    return (char *)(blk + 1) + blk->used - n;
+}
+
+/* Append a node, returning its number */
+static size_t
+jsonsl__lazy_add(struct jsonsl_lazy_st *lazy,
+                 const struct jsonsl__lazy_node_st *node)
+{
+    if (lazy->nnodes == lazy->nodes_alloc &&
+            jsonsl__index_grow((void **)&lazy->nodes, &lazy->nodes_alloc,
+                               lazy->nnodes + 1, sizeof(*node)) != 0) {
+        return jsonsl__lazy_fail(lazy, JSONSL_ERROR_ENOMEM);
+    }
+    lazy->nodes[lazy->nnodes] = *node;
+    return lazy->nnodes++;
+}
+
+/* Find the extent of each container */
+static jsonsl_error_t
+jsonsl__lazy_bounds(struct jsonsl_lazy_st *lazy)
+{
+    const char *buf = lazy->buf;
+    size_t nbuf = lazy->nbuf, pos, open = 0;
+    struct jsonsl__lazy_bound_st *bound;
+
+    for (pos = 0; pos < nbuf; pos++) {
+        switch (buf[pos]) {
+        case '"':
+            pos = jsonsl__lazy_string_end(buf, pos, nbuf, NULL);
+            if (!pos) {
+                return JSONSL_ERROR_INCOMPLETE;
+            }
+            pos--;
+            break;
+        case '{':
+        case '[':
+            if (lazy->nbounds == lazy->bounds_alloc &&
+                    jsonsl__index_grow((void **)&lazy->bounds,
+                                       &lazy->bounds_alloc, lazy->nbounds + 1,
+                                       sizeof(*bound)) != 0) {
+                return JSONSL_ERROR_ENOMEM;
+            }
+            bound = lazy->bounds + lazy->nbounds;
+            bound->begin = pos;
+            bound->end = open;
+            open = ++lazy->nbounds;
+            break;
+        case '}':
+        case ']':
+            if (!open) {
+                return JSONSL_ERROR_STRAY_TOKEN;
+            }
+            bound = lazy->bounds + open - 1;
+            if (buf[bound->begin] != (buf[pos] == '}' ? '{' : '[')) {
+                return JSONSL_ERROR_BRACKET_MISMATCH;
+            }
+            open = bound->end;
+            bound->end = pos + 1;
+            bound->next = lazy->nbounds;
+            break;
+        default:
+            break;
+        }
+    }
+    return open ? JSONSL_ERROR_INCOMPLETE : JSONSL_ERROR_SUCCESS;
+}
+
+/* Add the members of a container */
+static jsonsl_error_t
+jsonsl__lazy_scan(struct jsonsl_lazy_st *lazy, size_t node)
+{
+    const char *buf = lazy->buf;
+    const struct jsonsl__lazy_node_st *parent = lazy->nodes + node;
+    size_t pos = parent->begin + 1, last = parent->end - 1, end;
+    size_t bound = parent->bound + 1, first = lazy->nnodes;
+    int is_object = parent->type == JSONSL_T_OBJECT, escaped = 0;
+    jsonsl_error_t err = JSONSL_ERROR_SUCCESS;
+    struct jsonsl__lazy_node_st child;
+
+    memset(&child, 0, sizeof(child));
+    child.parent = node;
+    for (pos = jsonsl__lazy_skip_ws(buf, pos, last); pos != last;) {
+        child.flags = 0;
+        if (is_object) {
+            if (buf[pos] != '"') {
+                err = JSONSL_ERROR_HKEY_EXPECTED;
+                break;
+            }
+            end = jsonsl__lazy_string_end(buf, pos, last, &escaped);
+            if (escaped < 0) {
+                err = JSONSL_ERROR_WEIRD_WHITESPACE;
+                break;
+            }
+            child.key = buf + pos + 1;
+            child.nkey = end - pos - 2;
+            if (escaped) {
+                child.flags |= JSONSL__LAZYf_KEY_ESCAPED;
+                child.key_hash = 0;
+            } else {
+                child.key_hash = jsonsl__jpr_hash(child.key, child.nkey);
+            }
+            pos = jsonsl__lazy_skip_ws(buf, end, last);
+            if (pos == last || buf[pos] != ':') {
+                err = JSONSL_ERROR_MISSING_TOKEN;
+                break;
+            }
+            pos = jsonsl__lazy_skip_ws(buf, pos + 1, last);
+            if (pos == last) {
+                err = JSONSL_ERROR_VALUE_EXPECTED;
+                break;
+            }
+        }
+        child.begin = pos;
+        if (buf[pos] == '{' || buf[pos] == '[') {
+            /* Its bound is next, unless it began in something which was
+             * not a value */
+            if (bound >= lazy->nbounds || lazy->bounds[bound].begin != pos) {
+                err = JSONSL_ERROR_STRAY_TOKEN;
+                break;
+            }
+            child.type = buf[pos] == '{' ? JSONSL_T_OBJECT : JSONSL_T_LIST;
+            child.bound = bound;
+            end = lazy->bounds[bound].end;
+            bound = lazy->bounds[bound].next;
+        } else if (buf[pos] == '"') {
+            end = jsonsl__lazy_string_end(buf, pos, last, &escaped);
+            if (escaped < 0) {
+                err = JSONSL_ERROR_WEIRD_WHITESPACE;
+                break;
+            }
+            child.type = JSONSL_T_STRING;
+            child.text = buf + pos + 1;
+            child.ntext = end - pos - 2;
+            if (escaped) {
+                child.flags |= JSONSL__LAZYf_ESCAPED;
+            }
+        } else {
+            end = jsonsl__lazy_special_end(buf, pos, last);
+            if (end == pos) {
+                err = buf[pos] == ',' ? JSONSL_ERROR_VALUE_EXPECTED :
+                        JSONSL_ERROR_STRAY_TOKEN;
+                break;
+            }
+            child.type = JSONSL_T_SPECIAL;
+        }
+        child.end = end;
+        if (jsonsl__lazy_add(lazy, &child) == JSONSL_LAZY_NONE) {
+            err = JSONSL_ERROR_ENOMEM;
+            break;
+        }
+        pos = jsonsl__lazy_skip_ws(buf, end, last);
+        if (pos == last) {
+            break;
+        } else if (buf[pos] != ',') {
+            err = JSONSL_ERROR_MISSING_TOKEN;
+            break;
+        }
+        pos = jsonsl__lazy_skip_ws(buf, pos + 1, last);
+        if (pos == last) {
+            err = JSONSL_ERROR_TRAILING_COMMA;
+        }
+    }
+
+    if (err != JSONSL_ERROR_SUCCESS) {
+        lazy->nnodes = first;
+        jsonsl__lazy_fail(lazy, err);
+        return err;
+    }
+    lazy->nodes[node].children = first;
+    lazy->nodes[node].nchildren = lazy->nnodes - first;
+    lazy->nodes[node].flags |= JSONSL__LAZYf_SCANNED;
+    return err;
+}
+
+/* Get a container, scanned, or NULL (on error, or for other values) */
+static struct jsonsl__lazy_node_st *
+jsonsl__lazy_container(struct jsonsl_lazy_st *lazy, size_t node)
+{
+    unsigned type = lazy->nodes[node].type;
+    if (type != JSONSL_T_OBJECT && type != JSONSL_T_LIST) {
+        return NULL;
     }
-    free(ret);
-    return NULL;
-#undef JPR_BAIL
+    if (!(lazy->nodes[node].flags & JSONSL__LAZYf_SCANNED) &&
+            jsonsl__lazy_scan(lazy, node) != JSONSL_ERROR_SUCCESS) {
+        return NULL;
+    }
+    return lazy->nodes + node;
 }
 
-void jsonsl_jpr_destroy(jsonsl_jpr_t jpr)
+/* Unescape 'text', replacing it. Returns 0 on success */
+static int
+jsonsl__lazy_unescape(struct jsonsl_lazy_st *lazy, const char **text,
+                      size_t *len)
 {
-    free(jpr->components);
-    free(jpr->basestr);
-    free(jpr->orig);
-    free(jpr);
+    char *out = jsonsl__lazy_alloc(lazy, *len);
+    jsonsl_error_t err;
+    size_t nout;
+
+    if (!out) {
+        jsonsl__lazy_fail(lazy, JSONSL_ERROR_ENOMEM);
+        return -1;
+    }
+    nout = jsonsl_util_unescape_ex(*text, out, *len, NULL, NULL, &err, NULL);
+    if (err != JSONSL_ERROR_SUCCESS) {
+        jsonsl__lazy_fail(lazy, err);
+        return -1;
+    }
+    *text = out;
+    *len = nout;
+    return 0;
 }
 
-/**
- * Call when there is a possibility of a match, either as a final match or
- * as a path within a match
- * @param jpr The JPR path
- * @param component Component corresponding to the current element
- * @param prlevel The level of the *parent*
- * @param chtype The type of the child
- * @return Match status
- */
-static jsonsl_jpr_match_t
-jsonsl__match_continue(jsonsl_jpr_t jpr,
-                       const struct jsonsl_jpr_component_st *component,
-                       unsigned prlevel, unsigned chtype)
+/* Decode a special. Returns 0 on success */
+static int
+jsonsl__lazy_decode(struct jsonsl_lazy_st *lazy,
+                    struct jsonsl__lazy_node_st *node)
 {
-    const struct jsonsl_jpr_component_st *next_comp = component + 1;
-    if (prlevel == jpr->ncomponents - 1) {
-        /* This is the match. Check the expected type of the match against
-         * the child */
-        if (jpr->match_type == 0 || jpr->match_type == chtype) {
-            return JSONSL_MATCH_COMPLETE;
-        } else {
-            return JSONSL_MATCH_TYPE_MISMATCH;
+    const char *text = lazy->buf + node->begin, *p = text;
+    const char *end = lazy->buf + node->end;
+    size_t len = node->end - node->begin, ndigits = 0;
+    unsigned flags;
+
+    if (len == 4 && memcmp(text, "true", 4) == 0) {
+        flags = JSONSL_SPECIALf_TRUE;
+    } else if (len == 5 && memcmp(text, "false", 5) == 0) {
+        flags = JSONSL_SPECIALf_FALSE;
+    } else if (len == 4 && memcmp(text, "null", 4) == 0) {
+        flags = JSONSL_SPECIALf_NULL;
+    } else {
+        flags = *p == '-' ? JSONSL_SPECIALf_SIGNED : JSONSL_SPECIALf_UNSIGNED;
+        if (*p == '-') {
+            p++;
         }
-    }
-    if (chtype == JSONSL_T_LIST) {
-        if (next_comp->ptype == JSONSL_PATH_NUMERIC) {
-            return JSONSL_MATCH_POSSIBLE;
+        if (p != end && *p == '0') {
+            p++;
+            ndigits = 1;
         } else {
-            return JSONSL_MATCH_TYPE_MISMATCH;
+            for (; p != end && *p >= '0' && *p <= '9'; p++, ndigits++) {
+                if (ndigits < JSONSL__TAPE_MAX_DIGITS) {
+                    node->ival = node->ival * 10 + (*p - '0');
+                }
+            }
         }
-    } else if (chtype == JSONSL_T_OBJECT) {
-        if (next_comp->ptype == JSONSL_PATH_NUMERIC) {
-            return JSONSL_MATCH_TYPE_MISMATCH;
+        if (!ndigits) {
+            jsonsl__lazy_fail(lazy, p == text ? JSONSL_ERROR_SPECIAL_EXPECTED :
+                                    JSONSL_ERROR_INVALID_NUMBER);
+            return -1;
+        }
+        if (p != end && *p == '.') {
+            flags |= JSONSL_SPECIALf_FLOAT;
+            for (p++, ndigits = 0; p != end && *p >= '0' && *p <= '9'; p++) {
+                ndigits++;
+            }
+        }
+        if (ndigits && p != end && (*p == 'e' || *p == 'E')) {
+            flags |= JSONSL_SPECIALf_EXPONENT;
+            if (++p != end && (*p == '-' || *p == '+')) {
+                p++;
+            }
+            for (ndigits = 0; p != end && *p >= '0' && *p <= '9'; p++) {
+                ndigits++;
+            }
+        }
+        if (!ndigits || p != end) {
+            jsonsl__lazy_fail(lazy, JSONSL_ERROR_INVALID_NUMBER);
+            return -1;
+        }
+        if (!(flags & JSONSL_SPECIALf_NUMNOINT) &&
+                len - (flags & JSONSL_SPECIALf_SIGNED ? 1 : 0) <=
+                JSONSL__TAPE_MAX_DIGITS) {
+            if (flags & JSONSL_SPECIALf_SIGNED) {
+                node->ival = -node->ival;
+            }
         } else {
-            return JSONSL_MATCH_POSSIBLE;
+            /* Convert a NUL terminated copy */
+            char tmp[64], *copy = len < sizeof(tmp) ? tmp :
+                    jsonsl__lazy_alloc(lazy, len + 1);
+            if (!copy) {
+                jsonsl__lazy_fail(lazy, JSONSL_ERROR_ENOMEM);
+                return -1;
+            }
+            memcpy(copy, text, len);
+            copy[len] = '\0';
+            node->dval = strtod(copy, NULL);
+            node->flags |= JSONSL__LAZYf_DOUBLE;
         }
-    } else {
-        return JSONSL_MATCH_TYPE_MISMATCH;
     }
+    node->special_flags = flags;
+    node->flags |= JSONSL__LAZYf_DECODED;
+    return 0;
 }
 
-JSONSL_API
-jsonsl_jpr_match_t
-jsonsl_path_match(jsonsl_jpr_t jpr,
-                  const struct jsonsl_state_st *parent,
-                  const struct jsonsl_state_st *child,
-                  const char *key, size_t nkey)
+/* Get a special, decoded, or NULL (on error, or for other values) */
+static struct jsonsl__lazy_node_st *
+jsonsl__lazy_special(struct jsonsl_lazy_st *lazy, size_t node)
 {
-    const struct jsonsl_jpr_component_st *comp;
-    if (!parent) {
-        /* No parent. Return immediately since it's always a match */
-        return jsonsl__match_continue(jpr, jpr->components, 0, child->type);
+    struct jsonsl__lazy_node_st *np = lazy->nodes + node;
+    if (np->type != JSONSL_T_SPECIAL) {
+        return NULL;
     }
-
-    comp = jpr->components + parent->level;
-
-    /* note that we don't need to verify the type of the match, this is
-     * always done through the previous call to jsonsl__match_continue.
-     * If we are in a POSSIBLE tree then we can be certain the types (at
-     * least at this level) are correct */
-    if (parent->type == JSONSL_T_OBJECT) {
-        if (comp->len != nkey || strncmp(key, comp->pstr, nkey) != 0) {
-            return JSONSL_MATCH_NOMATCH;
-        }
-    } else {
-        if (comp->idx != parent->nelem - 1) {
-            return JSONSL_MATCH_NOMATCH;
-        }
+    if (!(np->flags & JSONSL__LAZYf_DECODED) &&
+            jsonsl__lazy_decode(lazy, np) != 0) {
+        return NULL;
     }
-    return jsonsl__match_continue(jpr, comp, parent->level, child->type);
+    return np;
 }
 
 JSONSL_API
-jsonsl_jpr_match_t
-jsonsl_jpr_match(jsonsl_jpr_t jpr,
-                   unsigned int parent_type,
-                   unsigned int parent_level,
-                   const char *key,
-                   size_t nkey)
+jsonsl_lazy_t
+jsonsl_lazy_new(void)
 {
-    /* find our current component. This is the child level */
-    int cmpret;
-    struct jsonsl_jpr_component_st *p_component;
-    p_component = jpr->components + parent_level;
+    return (struct jsonsl_lazy_st *)calloc(1, sizeof(struct jsonsl_lazy_st));
+}
 
-    if (parent_level >= jpr->ncomponents) {
-        return JSONSL_MATCH_NOMATCH;
-    }
+JSONSL_API
+jsonsl_error_t
+jsonsl_lazy_parse(jsonsl_lazy_t lazy, const char *buf, size_t nbuf)
+{
+    struct jsonsl__lazy_node_st root;
+    int escaped = 0;
 
-    /* Lone query for 'root' element. Always matches */
-    if (parent_level == 0) {
-        if (jpr->ncomponents == 1) {
-            return JSONSL_MATCH_COMPLETE;
-        } else {
-            return JSONSL_MATCH_POSSIBLE;
-        }
+    while (lazy->blocks) {
+        struct jsonsl__lazy_block_st *next = lazy->blocks->next;
+        free(lazy->blocks);
+        lazy->blocks = next;
     }
-
-    /* Wildcard, always matches */
-    if (p_component->ptype == JSONSL_PATH_WILDCARD) {
-        if (parent_level == jpr->ncomponents-1) {
-            return JSONSL_MATCH_COMPLETE;
-        } else {
-            return JSONSL_MATCH_POSSIBLE;
-        }
+    lazy->buf = buf;
+    lazy->nbuf = nbuf;
+    lazy->nbounds = 0;
+    lazy->nnodes = 0;
+    lazy->err = jsonsl__lazy_bounds(lazy);
+    if (lazy->err != JSONSL_ERROR_SUCCESS) {
+        return lazy->err;
     }
 
-    /* Check numeric array index. This gets its special block so we can avoid
-     * string comparisons */
-    if (p_component->ptype == JSONSL_PATH_NUMERIC) {
-        if (parent_type == JSONSL_T_LIST) {
-            if (p_component->idx != nkey) {
-                /* Wrong index */
-                return JSONSL_MATCH_NOMATCH;
-            } else {
-                if (parent_level == jpr->ncomponents-1) {
-                    /* This is the last element of the path */
-                    return JSONSL_MATCH_COMPLETE;
-                } else {
-                    /* Intermediate element */
-                    return JSONSL_MATCH_POSSIBLE;
-                }
-            }
-        } else if (p_component->is_arridx) {
-            /* Numeric and an array index (set explicitly by user). But not
-             * a list for a parent */
-            return JSONSL_MATCH_TYPE_MISMATCH;
+    memset(&root, 0, sizeof(root));
+    root.parent = JSONSL_LAZY_NONE;
+    root.begin = jsonsl__lazy_skip_ws(buf, 0, nbuf);
+    if (root.begin == nbuf) {
+        lazy->err = JSONSL_ERROR_INCOMPLETE;
+        return lazy->err;
+    }
+    if (lazy->nbounds && lazy->bounds[0].begin == root.begin) {
+        root.type = buf[root.begin] == '{' ? JSONSL_T_OBJECT : JSONSL_T_LIST;
+        root.end = lazy->bounds[0].end;
+    } else if (buf[root.begin] == '"') {
+        root.type = JSONSL_T_STRING;
+        root.end = jsonsl__lazy_string_end(buf, root.begin, nbuf, &escaped);
+        if (escaped < 0) {
+            lazy->err = JSONSL_ERROR_WEIRD_WHITESPACE;
+            return lazy->err;
+        }
+        root.text = buf + root.begin + 1;
+        root.ntext = root.end - root.begin - 2;
+        root.flags = escaped ? JSONSL__LAZYf_ESCAPED : 0;
+    } else {
+        root.type = JSONSL_T_SPECIAL;
+        root.end = jsonsl__lazy_special_end(buf, root.begin, nbuf);
+        if (root.end == root.begin) {
+            lazy->err = JSONSL_ERROR_STRAY_TOKEN;
+            return lazy->err;
         }
-    } else if (parent_type == JSONSL_T_LIST) {
-        return JSONSL_MATCH_TYPE_MISMATCH;
     }
-
-    /* Check lengths */
-    if (p_component->len != nkey) {
-        return JSONSL_MATCH_NOMATCH;
+    if (jsonsl__lazy_skip_ws(buf, root.end, nbuf) != nbuf) {
+        lazy->err = JSONSL_ERROR_GARBAGE_TRAILING;
+    } else if (jsonsl__lazy_add(lazy, &root) == JSONSL_LAZY_NONE) {
+        lazy->err = JSONSL_ERROR_ENOMEM;
     }
-
-    /* Check string comparison */
-    cmpret = strncmp(p_component->pstr, key, nkey);
-    if (cmpret == 0) {
-        if (parent_level == jpr->ncomponents-1) {
-            return JSONSL_MATCH_COMPLETE;
-        } else {
-            return JSONSL_MATCH_POSSIBLE;
-        }
+    if (lazy->err != JSONSL_ERROR_SUCCESS) {
+        lazy->nnodes = 0;
     }
+    return lazy->err;
+}
 
-    return JSONSL_MATCH_NOMATCH;
+JSONSL_API
+jsonsl_error_t
+jsonsl_lazy_error(jsonsl_lazy_t lazy)
+{
+    return lazy->err;
 }
 
 JSONSL_API
-void jsonsl_jpr_match_state_init(jsonsl_t jsn,
-                                 jsonsl_jpr_t *jprs,
-                                 size_t njprs)
+jsonsl_type_t
+jsonsl_lazy_type(jsonsl_lazy_t lazy, size_t node)
 {
-    size_t ii, *firstjmp;
-    if (njprs == 0) {
-        return;
-    }
-    jsn->jprs = (jsonsl_jpr_t *)malloc(sizeof(jsonsl_jpr_t) * njprs);
-    jsn->jpr_count = njprs;
-    jsn->jpr_root = (size_t*)calloc(1, sizeof(size_t) * njprs * jsn->levels_max);
-    memcpy(jsn->jprs, jprs, sizeof(jsonsl_jpr_t) * njprs);
-    /* Set the initial jump table values */
+    return (jsonsl_type_t)lazy->nodes[node].type;
+}
 
-    firstjmp = jsn->jpr_root;
-    for (ii = 0; ii < njprs; ii++) {
-        firstjmp[ii] = ii+1;
-    }
+JSONSL_API
+unsigned
+jsonsl_lazy_special_flags(jsonsl_lazy_t lazy, size_t node)
+{
+    const struct jsonsl__lazy_node_st *np = jsonsl__lazy_special(lazy, node);
+    return np ? np->special_flags : 0;
 }
 
 JSONSL_API
-void jsonsl_jpr_match_state_cleanup(jsonsl_t jsn)
+size_t
+jsonsl_lazy_size(jsonsl_lazy_t lazy, size_t node)
 {
-    if (jsn->jpr_count == 0) {
-        return;
+    const struct jsonsl__lazy_node_st *np = jsonsl__lazy_container(lazy, node);
+    return np ? np->nchildren : 0;
+}
+
+JSONSL_API
+size_t
+jsonsl_lazy_child(jsonsl_lazy_t lazy, size_t node)
+{
+    return jsonsl_lazy_at(lazy, node, 0);
+}
+
+JSONSL_API
+size_t
+jsonsl_lazy_next(jsonsl_lazy_t lazy, size_t node)
+{
+    size_t parent = lazy->nodes[node].parent;
+    const struct jsonsl__lazy_node_st *pp;
+
+    if (parent == JSONSL_LAZY_NONE) {
+        return JSONSL_LAZY_NONE;
     }
+    pp = lazy->nodes + parent;
+    return node + 1 < pp->children + pp->nchildren ? node + 1 :
+            JSONSL_LAZY_NONE;
+}
 
-    free(jsn->jpr_root);
-    free(jsn->jprs);
-    jsn->jprs = NULL;
-    jsn->jpr_root = NULL;
-    jsn->jpr_count = 0;
+JSONSL_API
+size_t
+jsonsl_lazy_at(jsonsl_lazy_t lazy, size_t node, size_t index)
+{
+    const struct jsonsl__lazy_node_st *np = jsonsl__lazy_container(lazy, node);
+    if (!np || index >= np->nchildren) {
+        return JSONSL_LAZY_NONE;
+    }
+    return np->children + index;
 }
 
-/**
- * This function should be called exactly once on each element...
- * This should also be called in recursive order, since we rely
- * on the parent having been initalized for a match.
- *
- * Since the parent is checked for a match as well, we maintain a 'serial' counter.
- * Whenever we traverse an element, we expect the serial to be the same as a global
- * integer. If they do not match, we re-initialize the context, and set the serial.
- *
- * This ensures a type of consistency without having a proactive reset by the
- * main lexer itself.
- *
- */
 JSONSL_API
-jsonsl_jpr_t jsonsl_jpr_match_state(jsonsl_t jsn,
-                                    struct jsonsl_state_st *state,
-                                    const char *key,
-                                    size_t nkey,
-                                    jsonsl_jpr_match_t *out)
+size_t
+jsonsl_lazy_lookup(jsonsl_lazy_t lazy, size_t node,
+                   const char *key, size_t nkey)
 {
-    struct jsonsl_state_st *parent_state;
-    jsonsl_jpr_t ret = NULL;
+    const struct jsonsl__lazy_node_st *np = jsonsl__lazy_container(lazy, node);
+    uint32_t hash = jsonsl__jpr_hash(key, nkey);
+    size_t ii, end;
+
+    if (!np || np->type != JSONSL_T_OBJECT) {
+        return JSONSL_LAZY_NONE;
+    }
+    for (ii = np->children, end = ii + np->nchildren; ii < end; ii++) {
+        struct jsonsl__lazy_node_st *child = lazy->nodes + ii;
+        if (child->flags & JSONSL__LAZYf_KEY_ESCAPED) {
+            if (jsonsl__lazy_unescape(lazy, &child->key, &child->nkey) != 0) {
+                return JSONSL_LAZY_NONE;
+            }
+            child->flags &= ~JSONSL__LAZYf_KEY_ESCAPED;
+            child->key_hash = jsonsl__jpr_hash(child->key, child->nkey);
+        }
+        if (child->key_hash == hash && child->nkey == nkey &&
+                memcmp(child->key, key, nkey) == 0) {
+            return ii;
+        }
+    }
+    return JSONSL_LAZY_NONE;
+}
 
-    /* Jump and JPR tables for our own state and the parent state */
-    size_t *jmptable, *pjmptable;
-    size_t jmp_cur, ii, ourjmpidx;
+JSONSL_API
+const char *
+jsonsl_lazy_key(jsonsl_lazy_t lazy, size_t node, size_t *len)
+{
+    struct jsonsl__lazy_node_st *np = lazy->nodes + node;
 
-    if (!jsn->jpr_root) {
-        *out = JSONSL_MATCH_NOMATCH;
+    *len = 0;
+    if (!np->key) {
         return NULL;
     }
+    if (np->flags & JSONSL__LAZYf_KEY_ESCAPED) {
+        if (jsonsl__lazy_unescape(lazy, &np->key, &np->nkey) != 0) {
+            return NULL;
+        }
+        np->flags &= ~JSONSL__LAZYf_KEY_ESCAPED;
+        np->key_hash = jsonsl__jpr_hash(np->key, np->nkey);
+    }
+    *len = np->nkey;
+    return np->key;
+}
 
-    pjmptable = jsn->jpr_root + (jsn->jpr_count * (state->level-1));
-    jmptable = pjmptable + jsn->jpr_count;
+JSONSL_API
+const char *
+jsonsl_lazy_string(jsonsl_lazy_t lazy, size_t node, size_t *len)
+{
+    struct jsonsl__lazy_node_st *np = lazy->nodes + node;
 
-    /* If the parent cannot match, then invalidate it */
-    if (*pjmptable == 0) {
-        *jmptable = 0;
-        *out = JSONSL_MATCH_NOMATCH;
+    *len = 0;
+    if (np->type != JSONSL_T_STRING) {
         return NULL;
     }
+    if (np->flags & JSONSL__LAZYf_ESCAPED) {
+        if (jsonsl__lazy_unescape(lazy, &np->text, &np->ntext) != 0) {
+            return NULL;
+        }
+        np->flags &= ~JSONSL__LAZYf_ESCAPED;
+    }
+    *len = np->ntext;
+    return np->text;
+}
 
-    parent_state = jsn->stack + state->level - 1;
-
-    if (parent_state->type == JSONSL_T_LIST) {
-        nkey = (size_t) parent_state->nelem;
+JSONSL_API
+int64_t
+jsonsl_lazy_int(jsonsl_lazy_t lazy, size_t node)
+{
+    const struct jsonsl__lazy_node_st *np = jsonsl__lazy_special(lazy, node);
+    if (!np) {
+        return 0;
     }
+    return np->flags & JSONSL__LAZYf_DOUBLE ? (int64_t)np->dval : np->ival;
+}
 
-    *jmptable = 0;
-    ourjmpidx = 0;
-    memset(jmptable, 0, sizeof(int) * jsn->jpr_count);
+JSONSL_API
+double
+jsonsl_lazy_double(jsonsl_lazy_t lazy, size_t node)
+{
+    const struct jsonsl__lazy_node_st *np = jsonsl__lazy_special(lazy, node);
+    if (!np) {
+        return 0;
+    }
+    return np->flags & JSONSL__LAZYf_DOUBLE ? np->dval : (double)np->ival;
+}
 
-    for (ii = 0; ii <  jsn->jpr_count; ii++) {
-        jmp_cur = pjmptable[ii];
-        if (jmp_cur) {
-            jsonsl_jpr_t jpr = jsn->jprs[jmp_cur-1];
-            *out = jsonsl_jpr_match(jpr,
-                                    parent_state->type,
-                                    parent_state->level,
-                                    key, nkey);
-            if (*out == JSONSL_MATCH_COMPLETE) {
-                ret = jpr;
-                *jmptable = 0;
-                return ret;
-            } else if (*out == JSONSL_MATCH_POSSIBLE) {
-                jmptable[ourjmpidx] = ii+1;
-                ourjmpidx++;
-            }
-        } else {
-            break;
-        }
+JSONSL_API
+void
+jsonsl_lazy_destroy(jsonsl_lazy_t lazy)
+{
+    if (!lazy) {
+        return;
     }
-    if (!*jmptable) {
-        *out = JSONSL_MATCH_NOMATCH;
+    while (lazy->blocks) {
+        struct jsonsl__lazy_block_st *next = lazy->blocks->next;
+        free(lazy->blocks);
+        lazy->blocks = next;
     }
-    return NULL;
+    free(lazy->bounds);
+    free(lazy->nodes);
+    free(lazy);
 }
 
 JSONSL_API
@@ -1623,10 +7794,63 @@ static unsigned char Escape_Equivs[0x100] = {
         /* 0xf5 */ 0,0,0,0,0,0,0,0,0,0 /* 0xfe */
 };
 
+/**
+ * This table contains the letter with which each character is escaped when
+ * writing a string ('u' for a \u00XX escape), or 0 if it is written as is.
+ */
+static const char Escape_Letters[0x100] = {
+        /* 0x00 */ 'u' /* <NUL> */, /* 0x00 */
+        /* 0x01 */ 'u' /* <SOH> */, /* 0x01 */
+        /* 0x02 */ 'u' /* <STX> */, /* 0x02 */
+        /* 0x03 */ 'u' /* <ETX> */, /* 0x03 */
+        /* 0x04 */ 'u' /* <EOT> */, /* 0x04 */
+        /* 0x05 */ 'u' /* <ENQ> */, /* 0x05 */
+        /* 0x06 */ 'u' /* <ACK> */, /* 0x06 */
+        /* 0x07 */ 'u' /* <BEL> */, /* 0x07 */
+        /* 0x08 */ 'b' /* <BS> */, /* 0x08 */
+        /* 0x09 */ 't' /* <HT> */, /* 0x09 */
+        /* 0x0a */ 'n' /* <LF> */, /* 0x0a */
+        /* 0x0b */ 'u' /* <VT> */, /* 0x0b */
+        /* 0x0c */ 'f' /* <FF> */, /* 0x0c */
+        /* 0x0d */ 'r' /* <CR> */, /* 0x0d */
+        /* 0x0e */ 'u' /* <SO> */, /* 0x0e */
+        /* 0x0f */ 'u' /* <SI> */, /* 0x0f */
+        /* 0x10 */ 'u' /* <DLE> */, /* 0x10 */
+        /* 0x11 */ 'u' /* <DC1> */, /* 0x11 */
+        /* 0x12 */ 'u' /* <DC2> */, /* 0x12 */
+        /* 0x13 */ 'u' /* <DC3> */, /* 0x13 */
+        /* 0x14 */ 'u' /* <DC4> */, /* 0x14 */
+        /* 0x15 */ 'u' /* <NAK> */, /* 0x15 */
+        /* 0x16 */ 'u' /* <SYN> */, /* 0x16 */
+        /* 0x17 */ 'u' /* <ETB> */, /* 0x17 */
+        /* 0x18 */ 'u' /* <CAN> */, /* 0x18 */
+        /* 0x19 */ 'u' /* <EM> */, /* 0x19 */
+        /* 0x1a */ 'u' /* <SUB> */, /* 0x1a */
+        /* 0x1b */ 'u' /* <ESC> */, /* 0x1b */
+        /* 0x1c */ 'u' /* <FS> */, /* 0x1c */
+        /* 0x1d */ 'u' /* <GS> */, /* 0x1d */
+        /* 0x1e */ 'u' /* <RS> */, /* 0x1e */
+        /* 0x1f */ 'u' /* <US> */, /* 0x1f */
+        /* 0x20 */ 0,0, /* 0x21 */
+        /* 0x22 */ '"' /* <"> */, /* 0x22 */
+        /* 0x23 */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x42 */
+        /* 0x43 */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x5b */
+        /* 0x5c */ '\\' /* <\> */, /* 0x5c */
+        /* 0x5d */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x7c */
+        /* 0x7d */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x9c */
+        /* 0x9d */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0xbc */
+        /* 0xbd */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0xdc */
+        /* 0xdd */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0xfc */
+        /* 0xfd */ 0,0, /* 0xfe */
+};
+
 /* Definitions of above-declared static functions */
 static char get_escape_equiv(unsigned c) {
     return Escape_Equivs[c & 0xff];
 }
+static char get_escape_letter(unsigned c) {
+    return Escape_Letters[c & 0xff];
+}
 static unsigned extract_special(unsigned c) {
     return Special_Table[c & 0xff];
 }
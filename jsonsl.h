@@ -19,6 +19,18 @@
 #include <sys/types.h>
 #include <wchar.h>
 
+/* The optional parts the library was built with, from the header the build
+ * generates (see jsonsl_config.h.in). Compilers without __has_include need
+ * JSONSL_HAVE_CONFIG_H defined to pick it up. Without the generated header,
+ * JSONSL_USE_PTHREADS and the like may still be defined by hand */
+#ifdef JSONSL_HAVE_CONFIG_H
+#include "jsonsl_config.h"
+#elif defined(__has_include)
+#if __has_include("jsonsl_config.h")
+#include "jsonsl_config.h"
+#endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -100,6 +112,7 @@ struct jsonsl_st;
 typedef struct jsonsl_st *jsonsl_t;
 
 typedef struct jsonsl_jpr_st* jsonsl_jpr_t;
+typedef struct jsonsl_jpr_set_st* jsonsl_jpr_set_t;
 
 /**
  * This flag is true when AND'd against a type whose value
@@ -258,7 +271,11 @@ typedef enum {
 /* Allocation failure */ \
     X(ENOMEM) \
 /* Invalid unicode codepoint detected (in case of escapes) */ \
-    X(INVALID_CODEPOINT)
+    X(INVALID_CODEPOINT) \
+/* The input ended in the middle of a document */ \
+    X(INCOMPLETE) \
+/* A writer's flush callback failed */ \
+    X(WRITE_FAILED)
 
 typedef enum {
     JSONSL_ERROR_SUCCESS = 0,
@@ -389,33 +406,16 @@ struct jsonsl_state_st {
 #define JSONSL_NUMERIC_VALUE(st) ((st)->nelem)
 
 /*
- * So now we need some special structure for keeping the
- * JPR info in sync. Preferrably all in a single block
- * of memory (there's no need for separate allocations.
- * So we will define a 'table' with the following layout
- *
- * Level    nPosbl  JPR1_last   JPR2_last   JPR3_last
- *
- * 0        1       NOMATCH     POSSIBLE    POSSIBLE
- * 1        0       NOMATCH     NOMATCH     COMPLETE
- * [ table ends here because no further path is possible]
- *
- * Where the JPR..n corresponds to the number of JPRs
- * requested, and nPosble is a quick flag to determine
- *
- * the number of possibilities. In the future this might
- * be made into a proper 'jump' table,
- *
- * Since we always mark JPRs from the higher levels descending
- * into the lower ones, a prospective child match would first
- * look at the parent table to check the possibilities, and then
- * see which ones were possible..
+ * JPR matching state (for jsonsl_jpr_match_state()) is kept as one bitset
+ * per level, each with a bit for every JPR passed to
+ * jsonsl_jpr_match_state_init(). A bit is set at level L if its JPR is
+ * still a possible match for children of the state at that level. Level 0
+ * has all bits set.
  *
- * Thus, the size of this blob would be (and these are all ints here)
- * nLevels * nJPR * 2.
- *
- * the 'Width' of the table would be nJPR*2, and the 'height' would be
- * nlevels
+ * A JPR with N components can only be possible up to level N-1, so only as
+ * many levels are allocated as the longest JPR has components: for 1000
+ * paths of depth 8 this is 8 * 16 words, rather than a table with an entry
+ * per JPR for every possible level.
  */
 
 /**
@@ -458,6 +458,21 @@ typedef int (*jsonsl_error_callback)(
         struct jsonsl_state_st* state,
         jsonsl_char_t *at);
 
+/**
+ * A predicate callback, invoked in query mode once an object matching a
+ * path with a predicate (see jsonsl_jpr_new_extended()) is found to satisfy it.
+ *
+ * @param jsn The lexer
+ * @param state the object's state. Its text begins at state->pos_begin;
+ * the object is then passed through like a completed match, so its POP
+ * callback is invoked once it ends
+ * @param id the path's index in the attached set
+ */
+typedef void (*jsonsl_jpr_predicate_callback)(
+        jsonsl_t jsn,
+        struct jsonsl_state_st *state,
+        size_t id);
+
 struct jsonsl_st {
     /** Public, read-only */
 
@@ -539,8 +554,52 @@ struct jsonsl_st {
 
     struct {
         int allow_trailing_comma;
+
+        /**
+         * Query mode. If set, and a path set is attached (see
+         * jsonsl_jpr_set_attach()), the lexer matches every value against
+         * the set as it is pushed, and only invokes callbacks for values
+         * which complete a path, their ancestors, and anything inside a
+         * completed value (including object keys). Object keys elsewhere
+         * are tracked by the lexer itself.
+         *
+         * Objects and lists which cannot lead to any path are not lexed:
+         * the lexer only scans for their closing bracket (skipping over
+         * strings), so their contents are not validated. Likewise, once
+         * no later element of a list can match (e.g. past the end of a
+         * slice), the rest of the list is skipped; the list's nelem then
+         * only counts the elements before that point. Use
+         * jsonsl_jpr_set_last_match() from the PUSH callback to find out
+         * which paths matched.
+         *
+         * A key which spans input buffers is copied. If the copy cannot be
+         * allocated, its member (and anything inside it) matches no path.
+         */
+        int query;
+
+        /**
+         * In query mode, stop once every path without wildcards has been
+         * matched and the value it matched has been popped, provided that
+         * no open container can still contain a match for a path with
+         * wildcards. The lexer then sets jsonsl_st::stopfl and returns, with
+         * jsonsl_st::pos at the last character it examined, so the rest of
+         * the input need not be read. jsonsl_jpr_set_satisfied() tells this
+         * apart from other reasons for stopping.
+         *
+         * Each path without wildcards then matches at most once per document,
+         * so that what is reported does not depend on when the lexer stops:
+         * if an object repeats a key, only its first value matches.
+         */
+        int query_stop;
     } options;
 
+    /**
+     * Invoked in query mode for each object which satisfies the predicate
+     * of a path in the attached set. Objects which don't are skipped as
+     * soon as that is known
+     */
+    jsonsl_jpr_predicate_callback predicate_callback;
+
     /** Put anything here */
     void *data;
 
@@ -556,8 +615,28 @@ struct jsonsl_st {
     size_t jpr_count;
     jsonsl_jpr_t *jprs;
 
-    /* Root pointer for JPR matching information */
-    size_t *jpr_root;
+    /* Candidate JPRs at each level, as bitsets of jpr_count bits.
+     * See jsonsl_jpr_match_state() */
+    unsigned long *jpr_bits;
+    size_t jpr_nwords;
+    unsigned jpr_nlevels;
+
+    /* Matching state for an attached jsonsl_jpr_set_t */
+    struct jsonsl_jpr_cursor_st *jpr_cursor;
+
+    /* Query mode: depth of the container being skipped (0 if none), and
+     * whether the skip is inside a string (1), or just after a backslash
+     * inside one (2) */
+    size_t query_skip;
+    int query_instr;
+    /* Level of the outermost value which completed a path; everything
+     * below it is passed through */
+    unsigned query_level;
+    /* For options.query_stop: nonzero once the lexer should check whether
+     * to stop, after popping the state at this level */
+    unsigned query_stop_level;
+    /* Nonzero while lexing a member value which decides a predicate */
+    int query_watch;
 #endif /* JSONSL_NO_JPR */
     /*@}*/
 
@@ -588,6 +667,339 @@ jsonsl_t jsonsl_new(int nlevels);
 JSONSL_API
 void jsonsl_feed(jsonsl_t jsn, const jsonsl_char_t *bytes, size_t nbytes);
 
+/**
+ * Feeds data into the lexer, but processes no more than a given amount
+ * of it. This is useful for event loops which multiplex many streams and
+ * cannot afford to have a single large buffer monopolize the thread.
+ *
+ * Since the lexer does not buffer, the parser is left ready to continue:
+ * the remaining data (i.e. `bytes + return value`) may simply be passed to
+ * the next call to this function (or to jsonsl_feed()).
+ *
+ * @param jsn the lexer object
+ * @param bytes new data to be fed
+ * @param nbytes size of new data
+ * @param budget maximum number of bytes to process in this call
+ * @return the number of bytes actually consumed. This is smaller than
+ * `min(nbytes, budget)` only if the lexer was stopped (via jsonsl_stop(),
+ * an error, or a u-escape with jsonsl_st::return_UESCAPE set). It then
+ * points at the character the lexer stopped at (the one whose callback
+ * stopped it, or at which the error was found), not past it. After a
+ * u-escape the lexer may be fed again from there; after jsonsl_stop() or
+ * an error it is part way through that character, and must be reset
+ * before it is fed again (e.g. from there, to lex the value it stopped
+ * at on its own).
+ */
+JSONSL_API
+size_t jsonsl_feed_budget(jsonsl_t jsn, const jsonsl_char_t *bytes,
+                          size_t nbytes, size_t budget);
+
+#ifdef _WIN32
+/** Layout-compatible stand-in for POSIX `struct iovec` */
+struct jsonsl_iovec_st {
+    void *iov_base;
+    size_t iov_len;
+};
+typedef struct jsonsl_iovec_st jsonsl_iovec_t;
+#else
+#include <sys/uio.h>
+typedef struct iovec jsonsl_iovec_t;
+#endif
+
+/**
+ * Feeds a chain of non-contiguous segments into the lexer, as if they
+ * were a single buffer. Positions remain continuous across segments, so
+ * tokens which straddle a segment boundary get the same jsonsl_state_st::pos_begin
+ * they would get if the data had been coalesced. Within callbacks,
+ * jsonsl_st::base refers to the segment currently being processed.
+ *
+ * @param jsn the lexer object
+ * @param iov array of segments. Empty segments are skipped.
+ * @param niov number of segments in `iov`
+ * @return the total number of characters consumed. This is less than the
+ * sum of the segment lengths only if the lexer was stopped, in which case
+ * nothing past the stopping point (including any further segments) has been
+ * processed.
+ */
+JSONSL_API
+size_t jsonsl_feedv(jsonsl_t jsn, const jsonsl_iovec_t *iov, int niov);
+
+/**
+ * @name Flags for jsonsl_feed_file()
+ * @{
+ */
+
+/** Hint to the kernel that the file will be read sequentially */
+#define JSONSL_FILEf_SEQUENTIAL 0x01
+/** Ask for transparent huge pages for the mapping (if supported) */
+#define JSONSL_FILEf_HUGEPAGE 0x02
+/** Never map the file; read it in windows into a private buffer instead */
+#define JSONSL_FILEf_NOMMAP 0x04
+/**@}*/
+
+/**
+ * Size of the window in which jsonsl_feed_file() maps (or reads) the file.
+ * Only one window is resident at a time. This is rounded down to a multiple
+ * of the page size.
+ */
+#ifndef JSONSL_FILE_WINDOW
+#define JSONSL_FILE_WINDOW (4 * 1024 * 1024)
+#endif
+
+/**
+ * Feeds the contents of a file into the lexer.
+ *
+ * Where supported, the file is memory mapped in page-aligned windows of
+ * @ref JSONSL_FILE_WINDOW bytes. Each window is unmapped as soon as the lexer
+ * is done with it, so that the resident set stays constant regardless of
+ * the size of the file. Files which cannot be mapped (e.g. pipes) are read
+ * into a single window-sized buffer instead.
+ *
+ * Since each window is fed as a separate buffer, the same restrictions
+ * apply to the callbacks as with any other chunked input: only positions
+ * inside the current window (i.e. jsonsl_st::base) may be dereferenced.
+ *
+ * @param jsn the lexer object
+ * @param path the file to read
+ * @param flags a set of `JSONSL_FILEf_*` flags
+ * @return 0 on success, -1 on an I/O error (`errno` is set). Success means
+ * that the lexer has either consumed the entire file, or returned early
+ * (e.g. via jsonsl_stop()); compare jsonsl_st::pos with the size of the file
+ * to tell the two apart.
+ */
+JSONSL_API
+int jsonsl_feed_file(jsonsl_t jsn, const char *path, int flags);
+
+#ifdef JSONSL_USE_PTHREADS
+/**
+ * @name Read-ahead pipeline
+ *
+ * This is available when compiled with JSONSL_USE_PTHREADS. A reader thread
+ * fills a ring of fixed-size buffers from a file descriptor while the
+ * calling thread feeds the filled buffers (in order) to the lexer, so that
+ * I/O and lexing overlap.
+ *
+ * Buffers are handed back to the reader thread only once the lexer no longer
+ * references them. A buffer is considered referenced if it contains the
+ * beginning of the string or special currently being lexed (i.e. the
+ * jsonsl_state_st::pos_begin of the topmost state), or any position at or
+ * after the one passed to jsonsl_reader_retain(). Thus, from within a POP
+ * callback, the bytes of the popped string are always available via
+ * jsonsl_reader_at(). At most `nbufs-1` buffers are ever held back in this
+ * manner; older data is released regardless so the reader can make progress.
+ * @{
+ */
+typedef struct jsonsl_reader_st *jsonsl_reader_t;
+
+/**
+ * Create a new reader. The reader is good for a single stream.
+ *
+ * @param fd the descriptor to read from. It is not closed by the reader
+ * @param bufsize the size of each buffer
+ * @param nbufs the number of buffers in the ring. Must be at least 2
+ * @return a new reader, or NULL on allocation failure or bad arguments
+ */
+JSONSL_API
+jsonsl_reader_t jsonsl_reader_new(int fd, size_t bufsize, unsigned nbufs);
+
+/**
+ * Feed the entire stream to the lexer. This starts the reader thread and
+ * returns once end of file is reached, or once the lexer has stopped (via
+ * jsonsl_stop() or an error). In the latter case this still waits for a
+ * pending read() in the reader thread to complete.
+ *
+ * @param rd the reader
+ * @param jsn the lexer
+ * @return 0 on success, -1 on a read error (`errno` is set)
+ */
+JSONSL_API
+int jsonsl_reader_run(jsonsl_reader_t rd, jsonsl_t jsn);
+
+/**
+ * Get the data at a given stream position. This may only be called from
+ * within the lexer's callbacks.
+ *
+ * @param rd the reader
+ * @param pos the position, relative to the beginning of the stream
+ * @param[out] navail how many bytes are contiguous at the returned pointer
+ * @return a pointer to the byte at `pos`, or NULL if it has been released
+ * (or not yet read)
+ */
+JSONSL_API
+const jsonsl_char_t *jsonsl_reader_at(jsonsl_reader_t rd,
+                                      size_t pos, size_t *navail);
+
+/**
+ * Keep all data at and after `pos` available to jsonsl_reader_at().
+ * Pass `(size_t)-1` to remove the constraint.
+ */
+JSONSL_API
+void jsonsl_reader_retain(jsonsl_reader_t rd, size_t pos);
+
+JSONSL_API
+void jsonsl_reader_destroy(jsonsl_reader_t rd);
+/**@}*/
+#endif /* JSONSL_USE_PTHREADS */
+
+#if defined(JSONSL_USE_ZLIB) || defined(JSONSL_USE_ZSTD)
+/**
+ * @name Compressed input
+ *
+ * This is available when compiled with JSONSL_USE_ZLIB and/or
+ * JSONSL_USE_ZSTD. The input is decompressed into a small window which is
+ * fed to the lexer as soon as it fills up, and then reused; the
+ * decompressed document is never held in memory in full.
+ * @{
+ */
+
+/** Detect the format from the file's magic number */
+#define JSONSL_COMPRESS_AUTO 0
+/** gzip (or zlib) data. Concatenated gzip members are read in sequence */
+#define JSONSL_COMPRESS_GZIP 1
+/** zstd data. Multiple frames are read in sequence */
+#define JSONSL_COMPRESS_ZSTD 2
+
+/**
+ * Size of the decompression window, in characters. The default is meant to
+ * keep the window (and the compressed input buffer, which is half its size)
+ * resident in L2 while the lexer runs over it.
+ */
+#ifndef JSONSL_DECOMPRESS_WINDOW
+#define JSONSL_DECOMPRESS_WINDOW (64 * 1024)
+#endif
+
+/**
+ * Feeds the decompressed contents of a file into the lexer.
+ *
+ * The same restrictions apply to the callbacks as with jsonsl_feed_file():
+ * only positions within the current window may be dereferenced.
+ *
+ * @param jsn the lexer object
+ * @param path the file to read
+ * @param format one of the `JSONSL_COMPRESS_*` constants. With
+ * @ref JSONSL_COMPRESS_AUTO, a file which is not recognized as compressed is
+ * fed as-is.
+ * @return 0 on success, -1 on error. `errno` is set to EINVAL if the data is
+ * corrupt or truncated, or if support for the format was not compiled in.
+ * As with jsonsl_feed_file(), success also covers the case where the lexer
+ * returned early.
+ */
+JSONSL_API
+int jsonsl_feed_compressed(jsonsl_t jsn, const char *path, int format);
+/**@}*/
+#endif /* JSONSL_USE_ZLIB || JSONSL_USE_ZSTD */
+
+/**
+ * @name NDJSON record indexes
+ *
+ * A record index makes it possible to start reading an NDJSON (newline
+ * delimited JSON) file at a given record, rather than at its beginning. It
+ * holds the offset of every Nth record, and is built by looking for
+ * newlines only, without lexing the records. A record is any line which is
+ * neither empty nor a lone carriage return, so a valid file is indexed
+ * exactly, as JSON strings cannot contain raw newlines.
+ *
+ * An index may be saved (e.g. next to the file it indexes) and loaded
+ * again. Offsets are stored as differences between consecutive ones, so
+ * that a saved index takes a few bytes per indexed record.
+ * @{
+ */
+typedef struct jsonsl_recindex_st *jsonsl_recindex_t;
+
+/**
+ * Create a record index, to be built with jsonsl_recindex_feed() and
+ * jsonsl_recindex_finish(), or with jsonsl_recindex_build_file()
+ *
+ * @param interval the offset of every `interval`th record (starting with the
+ * first) is kept. Seeking reads up to this many records past the closest
+ * one; larger intervals make smaller indexes
+ * @return a new index, or NULL if `interval` is 0 or on allocation failure
+ */
+JSONSL_API
+jsonsl_recindex_t jsonsl_recindex_new(size_t interval);
+
+/**
+ * Feed the next chunk of the file to the index
+ *
+ * @return JSONSL_ERROR_SUCCESS, or JSONSL_ERROR_ENOMEM
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_recindex_feed(jsonsl_recindex_t idx,
+                                    const char *bytes, size_t nbytes);
+
+/**
+ * Finish building the index, once the whole file has been fed. This
+ * accounts for a last record without a trailing newline
+ *
+ * @return JSONSL_ERROR_SUCCESS, or JSONSL_ERROR_ENOMEM
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_recindex_finish(jsonsl_recindex_t idx);
+
+/**
+ * Build the index by reading a file in windows of @ref JSONSL_FILE_WINDOW
+ * bytes, and finish it
+ *
+ * @param idx a new index
+ * @param path the file
+ * @return 0 on success, -1 on error (`errno` is set)
+ */
+JSONSL_API
+int jsonsl_recindex_build_file(jsonsl_recindex_t idx, const char *path);
+
+/** Get the number of records seen by an index */
+JSONSL_API
+size_t jsonsl_recindex_count(jsonsl_recindex_t idx);
+
+/**
+ * Get the length of the file an index was built from, e.g. to check
+ * whether a saved index still matches it, or whether records were
+ * appended since
+ */
+JSONSL_API
+size_t jsonsl_recindex_length(jsonsl_recindex_t idx);
+
+/**
+ * Find where a record begins. The closest indexed record before it is
+ * looked up, and the file is then read from there up to the end of the
+ * record.
+ *
+ * @param idx a finished index
+ * @param path the file which was indexed
+ * @param recno the number of the record, counting from 0
+ * @param[out] offset set to the offset of the record's first character
+ * @return 0 on success, -1 on error (`errno` is set). `errno` is EINVAL if
+ * there is no such record, or if the file is shorter than when it was
+ * indexed, and EOVERFLOW if the record lies further in than the platform
+ * can seek (past 2GB where there is neither fseeko() with a 64 bit off_t
+ * nor _fseeki64())
+ */
+JSONSL_API
+int jsonsl_recindex_seek(jsonsl_recindex_t idx, const char *path,
+                         size_t recno, size_t *offset);
+
+/**
+ * Save a finished index to a file. The file does not depend on the host's
+ * byte order or word size.
+ *
+ * @return 0 on success, -1 on an I/O error (`errno` is set)
+ */
+JSONSL_API
+int jsonsl_recindex_save(jsonsl_recindex_t idx, const char *path);
+
+/**
+ * Load an index saved by jsonsl_recindex_save()
+ *
+ * @return the index, or NULL on error. `errno` is set to EINVAL if the file
+ * is not a valid index
+ */
+JSONSL_API
+jsonsl_recindex_t jsonsl_recindex_load(const char *path);
+
+JSONSL_API
+void jsonsl_recindex_destroy(jsonsl_recindex_t idx);
+/**@}*/
+
 /**
  * Resets the internal parser state. This does not free the parser
  * but does clean it internally, so that the next time feed() is called,
@@ -639,7 +1051,8 @@ struct jsonsl_state_st *jsonsl_last_child(const jsonsl_t jsn,
 }
 
 /**Call to instruct the parser to stop parsing and return. This is valid
- * only from within a callback */
+ * only from within a callback. jsonsl_st::pos is left at the character
+ * being processed (see jsonsl_feed_budget()) */
 static JSONSL_INLINE
 void jsonsl_stop(jsonsl_t jsn)
 {
@@ -721,6 +1134,49 @@ void jsonsl_dump_global_metrics(void);
  * multiple levels of matches e.g.
  *  /foo/bar/baz/^/blah
  *
+ * Paths created with jsonsl_jpr_new_extended() may also use the syntax
+ * below. jsonsl_jpr_new() does not know it: there, /^^, /a:b, /a[0],
+ * /x[a=b] and /k[i] each name a key spelled that way.
+ *
+ * A component of the form start:end:step is a slice, which matches list
+ * elements from index 'start' (default 0) up to but not including 'end'
+ * (default: no limit), every 'step' (default 1) elements; e.g. /items/:10
+ * matches the first ten elements of "items", and /items/1000: the rest.
+ * Negative indexes are not supported, since the length of a list is not
+ * known while it is being lexed. A key which looks like a slice can be
+ * written with its ':' escaped as %3A.
+ *
+ * A component consisting of two wildcard characters (^^) matches any number
+ * of levels, including none, like JSONPath's '..' operator; /^^/id matches
+ * every "id" member in the document, and /foo/^^/^ every value inside
+ * "foo". It must be followed by another component. Only path sets (see
+ * jsonsl_jpr_set_new()) understand it; the other matching functions treat
+ * it as a component which matches nothing.
+ *
+ * The last component may be followed by a predicate in brackets, of the
+ * form [key=value], which only lets through objects whose member 'key' has
+ * the given value; e.g. /items/^[type="error"]. The value is JSON text, and
+ * is compared with the member's value as it appears in the input, so
+ * strings must be quoted and are compared without decoding escapes. Both
+ * the key and the value may contain percent-escapes (%2F for a '/'), and a
+ * key which ends in brackets can be written with its '[' escaped as %5B.
+ * Predicates are evaluated by path sets in query mode, where objects which
+ * fail them are skipped as soon as the member is seen (see
+ * jsonsl_st::predicate_callback). jsonsl_jpr_match() and the other
+ * functions matching a single path never report such a path as COMPLETE,
+ * only POSSIBLE, and jsonsl_jpr_set_match_state() never reports it at all.
+ * A component with brackets which are not a predicate (or flags, see
+ * below), such as /a[0], or with a predicate anywhere but the last
+ * component, fails with JSONSL_ERROR_JPR_BADPATH.
+ *
+ * A key component may be followed by flags in brackets, before any
+ * predicate: [i] compares it with keys case-insensitively (for ASCII
+ * letters), and [g] makes it a glob, in which '*' matches any run of
+ * characters and '?' any single character; e.g. /users/^/userid[i] or
+ * /metrics/metric_*[g], or both with [ig]. In a glob these are always
+ * wildcards, even when percent-escaped. A component with flags is always
+ * a key, never a list index or a slice. See jsonsl_jpr_component_st::flags.
+ *
  *  @{
  */
 
@@ -729,6 +1185,10 @@ void jsonsl_dump_global_metrics(void);
 #define JSONSL_PATH_WILDCARD_CHAR '^'
 #endif /* WILDCARD_CHAR */
 
+/** Flags of a key component; see jsonsl_jpr_component_st::flags */
+#define JSONSL_JPR_ICASE 0x01
+#define JSONSL_JPR_GLOB 0x02
+
 #define JSONSL_XMATCH \
     X(COMPLETE,1) \
     X(POSSIBLE,0) \
@@ -750,6 +1210,8 @@ typedef enum {
     JSONSL_PATH_WILDCARD,
     JSONSL_PATH_NUMERIC,
     JSONSL_PATH_ROOT,
+    JSONSL_PATH_DESCENDANT,
+    JSONSL_PATH_SLICE,
 
     /* Special */
     JSONSL_PATH_INVALID = -1,
@@ -759,12 +1221,32 @@ typedef enum {
 struct jsonsl_jpr_component_st {
     /** The string the component points to */
     char *pstr;
-    /** if this is a numeric type, the number is 'cached' here */
+    /** if this is a numeric type, the number is 'cached' here. For a
+     * slice, this is the first index */
     unsigned long idx;
+    /** For a slice, one past the last index (ULONG_MAX if open-ended) */
+    unsigned long idx_end;
+    /** For a slice, the distance between matched indexes (at least 1) */
+    unsigned long idx_step;
     /** The length of the string */
     size_t len;
     /** The type of component (NUMERIC or STRING) */
     jsonsl_jpr_type_t ptype;
+    /** The hash of pstr, which keys are compared against first, or zero
+     * for a component built by hand, which is then only compared as text */
+    uint32_t key_hash;
+    /** JSONSL_JPR_ICASE and/or JSONSL_JPR_GLOB, for a STRING component.
+     * Such components have no key_hash, and those with JSONSL_JPR_ICASE
+     * have pstr folded to lower case. jsonsl_jpr_new_extended() drops
+     * JSONSL_JPR_GLOB from a pattern without wildcards, so that it is
+     * compared like any other key */
+    unsigned flags;
+    /** For the last component, the key and (JSON) value of its predicate,
+     * or NULL if it has none */
+    const char *pred_key;
+    size_t npred_key;
+    const char *pred_value;
+    size_t npred_value;
 
     /** Set this to true to enforce type checking between dict keys and array
      * indices. jsonsl_jpr_match() will return TYPE_MISMATCH if it detects
@@ -800,10 +1282,48 @@ struct jsonsl_jpr_st {
  * then more details will be in this variable.
  *
  * @return a new jsonsl_jpr_t object, or NULL on error.
+ *
+ * A JPR is never modified after it is created; matching functions only read
+ * it, so the same JPR may be used by any number of lexers and threads at
+ * once (provided it outlives them).
  */
 JSONSL_API
 jsonsl_jpr_t jsonsl_jpr_new(const char *path, jsonsl_error_t *errp);
 
+/**
+ * Create a new JPR object from a path which may use the extended syntax:
+ * descendant components (^^), slices, predicates and key flags, as
+ * described at the beginning of the JSON Pointer API.
+ *
+ * @param path the path specification
+ * @param errp as for jsonsl_jpr_new(). JSONSL_ERROR_JPR_BADPATH is also
+ * returned for misplaced or malformed extended components.
+ *
+ * @return a new jsonsl_jpr_t object, or NULL on error.
+ */
+JSONSL_API
+jsonsl_jpr_t jsonsl_jpr_new_extended(const char *path, jsonsl_error_t *errp);
+
+/**
+ * Create a new JPR object from an RFC 6901 JSON Pointer.
+ *
+ * @param ptr the pointer, either empty (the whole document) or beginning
+ * with a '/'. Reference tokens are unescaped with ~0 for '~' and ~1 for '/';
+ * '%', '^' and ':' have no special meaning. A token which is an array index
+ * ("0", or digits without a leading zero) becomes a numeric component, and
+ * so matches either that list element or a member of that name.
+ * @param errp as for jsonsl_jpr_new(). JSONSL_ERROR_JPR_BADPATH is returned
+ * for a '~' not followed by '0' or '1'.
+ *
+ * @return a new jsonsl_jpr_t object, to be destroyed with
+ * jsonsl_jpr_destroy(), or NULL on error.
+ *
+ * The pointer is compiled directly into the components, so there is no
+ * need to translate it into jsonsl_jpr_new() syntax first.
+ */
+JSONSL_API
+jsonsl_jpr_t jsonsl_jpr_new_pointer(const char *ptr, jsonsl_error_t *errp);
+
 /**
  * Destroy a JPR object
  */
@@ -875,9 +1395,9 @@ jsonsl_path_match(jsonsl_jpr_t jpr,
  * After using this function, you may subsequently call match_state() on
  * given states (presumably from within the callbacks).
  *
- * Note that currently the first JPR is the quickest and comes
- * pre-allocated with the state structure. Further JPR objects
- * are chained.
+ * The JPR objects are referenced (not copied), and must remain valid until
+ * jsonsl_jpr_match_state_cleanup() is called. When matching more than a
+ * few paths, consider jsonsl_jpr_set_new() instead.
  *
  * @param jsn The lexer
  * @param jprs An array of jsonsl_jpr_t objects
@@ -893,8 +1413,10 @@ void jsonsl_jpr_match_state_init(jsonsl_t jsn,
  * except we infer parent and type information from the relevant state objects.
  * The match status (for all possible JPR objects) is set in the *out parameter.
  *
- * If a match has succeeded, then its JPR object will be returned. In all other
- * instances, NULL is returned;
+ * If a match has succeeded, then its JPR object will be returned. If more
+ * than one JPR was completed, the one which came first in the array passed
+ * to jsonsl_jpr_match_state_init() is returned. In all other instances, NULL
+ * is returned;
  *
  * @param jpr The jsonsl_jpr_t handle
  * @param state The jsonsl_state_st which is a candidate
@@ -924,6 +1446,719 @@ jsonsl_jpr_t jsonsl_jpr_match_state(jsonsl_t jsn,
 JSONSL_API
 void jsonsl_jpr_match_state_cleanup(jsonsl_t jsn);
 
+/**
+ * @name Path sets
+ *
+ * Matching each element against every JPR (as jsonsl_jpr_match_state() does)
+ * gets expensive once there are more than a handful of paths. A path set
+ * compiles any number of JPRs into a single trie keyed by path component,
+ * so that matching an element costs a hash lookup for each trie node which
+ * is still live at the parent, regardless of how many paths were compiled.
+ *
+ * Object keys are looked up by hash, list indices by value. Wildcard
+ * components are followed in addition to any exact match; numeric
+ * components also match object keys which spell the same number (as
+ * with jsonsl_jpr_match()), unless jsonsl_jpr_component_st::is_arridx is
+ * set. A descendant (^^) component stays live at every level below its
+ * parent, but each trie node is matched at most once per level, so the
+ * work per element is still bounded by the size of the trie.
+ *
+ * A set is immutable once compiled, and is reference counted. It is meant to
+ * be created once (e.g. at startup) and shared by any number of lexers on
+ * any number of threads: attaching it only takes a reference, and the
+ * per-lexer matching state (a cursor sized by the set and the lexer's
+ * depth) is kept by the lexer across jsonsl_jpr_set_detach() and
+ * jsonsl_reset(), so that attaching a set to a reused lexer does not
+ * allocate unless the set is larger than any it held before.
+ *
+ * A lexer itself is still not thread safe; each thread must use its own.
+ * @{
+ */
+
+/**
+ * Compile a set of paths.
+ *
+ * The set keeps its own copy of everything it needs, so the JPR objects may
+ * be destroyed afterwards. Paths are identified by their index in `jprs`.
+ *
+ * @param jprs the paths. The same path may appear more than once
+ * @param njprs the number of paths
+ * @param errp if not NULL, set to the reason for failure
+ * @return a new set, or NULL on error
+ */
+JSONSL_API
+jsonsl_jpr_set_t jsonsl_jpr_set_new(jsonsl_jpr_t *jprs, size_t njprs,
+                                    jsonsl_error_t *errp);
+
+/**
+ * Take an additional reference to a set. This may be called from any thread
+ * which already holds a reference.
+ *
+ * @param set the set
+ * @return the set
+ */
+JSONSL_API
+jsonsl_jpr_set_t jsonsl_jpr_set_ref(jsonsl_jpr_set_t set);
+
+/**
+ * Release a reference to a set. The set returned by jsonsl_jpr_set_new()
+ * holds one reference; the set is freed once the last reference (including
+ * those held by lexers it is attached to) is released.
+ */
+JSONSL_API
+void jsonsl_jpr_set_destroy(jsonsl_jpr_set_t set);
+
+/**
+ * Associate a set with a lexer, replacing any previously attached one. Like
+ * jsonsl_jpr_match_state_init(), this should be done before feeding data.
+ *
+ * The lexer holds a reference to the set until it is detached.
+ *
+ * @param jsn the lexer
+ * @param set the set
+ * @return JSONSL_ERROR_SUCCESS, or JSONSL_ERROR_ENOMEM if the cursor had to
+ * be grown and could not be. In that case no set is attached
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_jpr_set_attach(jsonsl_t jsn, jsonsl_jpr_set_t set);
+
+/**
+ * Remove the set associated with the lexer (if any), releasing the lexer's
+ * reference to it. The cursor is kept for the next jsonsl_jpr_set_attach(),
+ * and freed by jsonsl_destroy() (which also detaches the set)
+ */
+JSONSL_API
+void jsonsl_jpr_set_detach(jsonsl_t jsn);
+
+/**
+ * Match a state against all paths in the attached set.
+ *
+ * As with jsonsl_jpr_match_state(), this must be called from the PUSH
+ * callback of every non-key state which is to be considered, in order
+ * (i.e. a state's parent must have been matched before the state itself).
+ *
+ * @param jsn the lexer
+ * @param state the state which was just pushed
+ * @param key the key of the state, if its parent is an object. For lists,
+ * the index is taken from the parent state.
+ * @param nkey the length of the key
+ * @param[out] ids set to the ids of all paths which this state completes.
+ * The array is owned by the lexer and valid until the next call
+ * @param[out] nids the number of entries in `ids`
+ * @return @ref JSONSL_MATCH_COMPLETE if any path was completed (note that
+ * longer paths may still match descendants), @ref JSONSL_MATCH_POSSIBLE if
+ * only descendants can match, and @ref JSONSL_MATCH_NOMATCH if neither the
+ * state nor anything below it can match.
+ */
+JSONSL_API
+jsonsl_jpr_match_t jsonsl_jpr_set_match_state(jsonsl_t jsn,
+                                              struct jsonsl_state_st *state,
+                                              const char *key,
+                                              size_t nkey,
+                                              const size_t **ids,
+                                              size_t *nids);
+
+/**
+ * Get the result of the most recent jsonsl_jpr_set_match_state() call. This
+ * is how the PUSH callback retrieves matches in query mode (see
+ * jsonsl_st::options), where the lexer does the matching itself.
+ *
+ * @param jsn the lexer
+ * @param[out] ids set to the ids of the completed paths, as with
+ * jsonsl_jpr_set_match_state()
+ * @param[out] nids the number of entries in `ids`
+ * @return the match result, or @ref JSONSL_MATCH_NOMATCH if no set is
+ * attached
+ */
+JSONSL_API
+jsonsl_jpr_match_t jsonsl_jpr_set_last_match(jsonsl_t jsn,
+                                             const size_t **ids,
+                                             size_t *nids);
+
+/**
+ * Whether the lexer stopped because all paths were satisfied (see
+ * jsonsl_st::options)
+ *
+ * @param jsn the lexer
+ * @return true if query_stop stopped the lexer in the current document
+ */
+JSONSL_API
+int jsonsl_jpr_set_satisfied(jsonsl_t jsn);
+/**@}*/
+
+/**
+ * @name Extraction
+ *
+ * jsonsl_extract() finds the values of every path in a set within a single
+ * buffer, and returns their positions. It lexes the buffer once in query
+ * mode (see jsonsl_st::options), so that anything which cannot lead to a
+ * match is skipped, and stops as soon as nothing else can match.
+ * @{
+ */
+
+/** A value matched by jsonsl_extract() */
+struct jsonsl_span_st {
+    /** The path which matched (its index in the set) */
+    size_t id;
+    /** Position of the value's first character. For strings this is the
+     * opening quote, as with jsonsl_state_st::pos_begin */
+    size_t pos_begin;
+    /** Position just past the value's last character (i.e. the closing
+     * quote or bracket, if any) */
+    size_t pos_end;
+    /** The value's level, as with jsonsl_state_st::level */
+    unsigned level;
+    /** The value's type */
+    jsonsl_type_t type;
+    /** For specials, the jsonsl_special_t flags of the value */
+    unsigned special_flags;
+};
+typedef struct jsonsl_span_st jsonsl_span_t;
+
+/**
+ * Depth of the lexer created by jsonsl_extract(). Only values which may
+ * contain a match are pushed, so this limits the depth of the matched values
+ * and of their contents, rather than that of the document
+ */
+#ifndef JSONSL_EXTRACT_LEVELS
+#define JSONSL_EXTRACT_LEVELS 256
+#endif
+
+/**
+ * Find the values of the paths in a set.
+ *
+ * A span is reported for each value a path completes, except that a path
+ * without wildcards completes only once (see jsonsl_st::options): if an
+ * object repeats a key, only its first value is reported, and the rest of
+ * the buffer is not read for later ones. A value completing several paths
+ * gets one span for each. Spans are in the order in which the
+ * matches were found, which is the order of the values in the buffer,
+ * except that an object matching a path with a predicate is only found
+ * once its predicate is decided, after any matches among its earlier
+ * members.
+ *
+ * As in query mode, containers which cannot contain a match are not
+ * validated, and neither is anything after the last possible match. Errors
+ * in the rest of the buffer are reported.
+ *
+ * This creates (and destroys) a lexer of @ref JSONSL_EXTRACT_LEVELS levels
+ * on each call, and may be used on any number of threads with the same set.
+ * Callers which extract from many small buffers should keep a lexer and use
+ * jsonsl_extract_with() instead.
+ *
+ * @param buf the buffer, which must contain a single complete document
+ * @param nbuf the number of characters in `buf`
+ * @param set the paths
+ * @param[out] spans the spans, of which there is room for `*nspans`
+ * @param[in,out] nspans the size of `spans`. Set to the number of matches
+ * found, which may be more than the size of `spans`, in which case only the
+ * first ones are returned; retry with a larger array to get the rest
+ * @return JSONSL_ERROR_SUCCESS, JSONSL_ERROR_INCOMPLETE if the document
+ * is truncated, JSONSL_ERROR_ENOMEM, or the error reported by the lexer. On
+ * error, `*nspans` is set to 0.
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_extract(const jsonsl_char_t *buf, size_t nbuf,
+                              jsonsl_jpr_set_t set,
+                              jsonsl_span_t *spans, size_t *nspans);
+
+/**
+ * Like jsonsl_extract(), but use an existing lexer. The lexer is reset,
+ * and its callbacks, callback flags, jsonsl_st::data and query options are
+ * replaced, so it is best kept for extraction only; the set is detached
+ * again afterwards. Other options (e.g. allow_trailing_comma) still apply.
+ *
+ * @param jsn the lexer
+ * @param buf the buffer
+ * @param nbuf the number of characters in `buf`
+ * @param set the paths
+ * @param[out] spans the spans
+ * @param[in,out] nspans as with jsonsl_extract()
+ * @return as with jsonsl_extract()
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_extract_with(jsonsl_t jsn,
+                                   const jsonsl_char_t *buf, size_t nbuf,
+                                   jsonsl_jpr_set_t set,
+                                   jsonsl_span_t *spans, size_t *nspans);
+/**@}*/
+
+/**
+ * @name Offset indexes
+ *
+ * An index records the position of every value in the top levels of a
+ * document, so that a path can be looked up without lexing the document
+ * again: each component of the path costs a binary search (object keys) or
+ * an array access (list indices) in the index, and the resulting range of
+ * the document can then be read and fed to a fresh lexer on its own.
+ *
+ * An index is built by feeding the document to it in one pass, in any
+ * number of chunks, and may be saved to a file (e.g. next to the document)
+ * and loaded again for later queries. It is immutable once built, so a
+ * single index may be shared by any number of threads; the exception is
+ * jsonsl_index_update(), which must not run while it is being used.
+ *
+ * Object keys are recorded as they appear in the document, so keys with
+ * escapes are only found by paths which spell the escapes out. Where a key
+ * appears more than once in the same object, the first one is found.
+ * @{
+ */
+typedef struct jsonsl_index_st *jsonsl_index_t;
+
+/**
+ * Depth of the lexer which builds an index. This limits the depth of the
+ * document, not that of the index
+ */
+#ifndef JSONSL_INDEX_LEVELS
+#define JSONSL_INDEX_LEVELS 512
+#endif
+
+/**
+ * Create an index, to be built with jsonsl_index_feed() and
+ * jsonsl_index_finish().
+ *
+ * @param depth the number of levels below the root whose values are
+ * recorded. With a depth of 1, only the members (or elements) of the root
+ * are recorded; paths which go deeper are looked up as far as the index
+ * goes.
+ * @return a new index, or NULL on allocation failure
+ */
+JSONSL_API
+jsonsl_index_t jsonsl_index_new(unsigned depth);
+
+/**
+ * Feed the next chunk of the document to the index.
+ *
+ * @param idx the index
+ * @param bytes the chunk
+ * @param nbytes the number of characters in `bytes`
+ * @return JSONSL_ERROR_SUCCESS, JSONSL_ERROR_ENOMEM, or the error reported
+ * by the lexer. The index may not be used after an error, other than to be
+ * destroyed
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_index_feed(jsonsl_index_t idx,
+                                 const jsonsl_char_t *bytes, size_t nbytes);
+
+/**
+ * Finish building an index, once the whole document has been fed. This
+ * releases the lexer used to build it.
+ *
+ * @param idx the index
+ * @return JSONSL_ERROR_SUCCESS, JSONSL_ERROR_INCOMPLETE if the document is
+ * truncated, JSONSL_ERROR_ENOMEM, or the error which stopped
+ * jsonsl_index_feed()
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_index_finish(jsonsl_index_t idx);
+
+/**
+ * Look a path up in a finished index.
+ *
+ * Lookups follow object keys and list indices (numeric components, which
+ * may also name object keys) for as long as the index records the values
+ * they lead to. They stop at the first component which is anything else
+ * (e.g. a wildcard), or which is below the indexed levels, with the value
+ * reached so far; the rest of the path is then to be matched by lexing that
+ * value. A path which ends in a predicate is likewise only resolved to the
+ * object it applies to.
+ *
+ * @param idx the index
+ * @param jpr the path
+ * @param[out] span set to the value found. Its level is one more than the
+ * number of components which were resolved (i.e. the root is at level 1),
+ * and its id is always 0
+ * @return @ref JSONSL_MATCH_COMPLETE if the whole path was resolved,
+ * @ref JSONSL_MATCH_POSSIBLE if only its first components were, and
+ * @ref JSONSL_MATCH_NOMATCH or @ref JSONSL_MATCH_TYPE_MISMATCH if it does not
+ * exist in the document, in which case `span` is not set
+ */
+JSONSL_API
+jsonsl_jpr_match_t jsonsl_index_lookup(jsonsl_index_t idx, jsonsl_jpr_t jpr,
+                                       jsonsl_span_t *span);
+
+/**
+ * Get the length of the document an index was built from, e.g. to check
+ * whether a saved index still matches its document.
+ *
+ * @param idx the index
+ * @return the number of characters fed to the index
+ */
+JSONSL_API
+size_t jsonsl_index_length(jsonsl_index_t idx);
+
+/**
+ * Update an index after its document was edited, without lexing all of it
+ * again. Only the innermost recorded value which contains the edit is lexed
+ * (its parent if the edit turned it into more or less than one value, and
+ * so on up to the root), and the positions after it are moved; the cost of
+ * an edit within one value of a large document is that of the value, not of
+ * the document.
+ *
+ * @param idx a finished index
+ * @param doc the whole edited document
+ * @param begin where the edit begins
+ * @param old_end where the replaced characters ended before the edit, so
+ * that `old_end - begin` characters were removed
+ * @param new_end where the inserted characters end in the edited document,
+ * so that `new_end - begin` characters were inserted
+ * @return JSONSL_ERROR_SUCCESS, or the error found in the edited document
+ * (or JSONSL_ERROR_ENOMEM), in which case the index is unchanged
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_index_update(jsonsl_index_t idx,
+                                   const jsonsl_char_t *doc, size_t begin,
+                                   size_t old_end, size_t new_end);
+
+/**
+ * Save a finished index to a file. The file does not depend on the host's
+ * byte order or word size.
+ *
+ * @param idx the index
+ * @param path the file to write
+ * @return 0 on success, -1 on an I/O error (`errno` is set)
+ */
+JSONSL_API
+int jsonsl_index_save(jsonsl_index_t idx, const char *path);
+
+/**
+ * Load an index saved by jsonsl_index_save()
+ *
+ * @param path the file to read
+ * @return the index, or NULL on error. `errno` is set to EINVAL if the file
+ * is not a valid index
+ */
+JSONSL_API
+jsonsl_index_t jsonsl_index_load(const char *path);
+
+JSONSL_API
+void jsonsl_index_destroy(jsonsl_index_t idx);
+/**@}*/
+
+/**
+ * @name Tapes
+ *
+ * A tape is a compact DOM: a parsed document laid out as one array of 64 bit
+ * words, in document order, with the (unescaped) text of its strings and
+ * keys in a second buffer. A string or an object key is one word, a number
+ * or other special two (the second holding its value), and an object or a
+ * list is one word before its contents and one after them. The first of
+ * these holds the position of the second, so that skipping a container
+ * (e.g. to get to its next sibling) takes constant time.
+ *
+ * Values are referred to by their positions in the tape, with the
+ * document's root at 0. Navigating returns @ref JSONSL_TAPE_NONE where there
+ * is no such value.
+ *
+ * The two buffers belong to the tape. Before parsing a document, it grows
+ * them to the most the document could need (the words take up to eight
+ * bytes per character of the document, most of them never touched), so
+ * that parsing allocates at most once for each. They are reused by the
+ * next document parsed into it, so that parsing a stream of documents into
+ * one tape stops allocating once it has seen the largest.
+ * @{
+ */
+typedef struct jsonsl_tape_st *jsonsl_tape_t;
+
+/** Position returned where there is no value */
+#define JSONSL_TAPE_NONE ((size_t)-1)
+
+/** Depth of the lexer which parses documents into a tape */
+#ifndef JSONSL_TAPE_LEVELS
+#define JSONSL_TAPE_LEVELS 512
+#endif
+
+/**
+ * Objects with at least this many members get a hash table of their keys,
+ * unless changed with jsonsl_tape_set_index_min()
+ */
+#ifndef JSONSL_TAPE_INDEX_MIN
+#define JSONSL_TAPE_INDEX_MIN 32
+#endif
+
+/**
+ * Create a tape
+ *
+ * @return a new, empty tape, or NULL on allocation failure
+ */
+JSONSL_API
+jsonsl_tape_t jsonsl_tape_new(void);
+
+/**
+ * Set how many members an object needs for jsonsl_tape_parse() to build a
+ * hash table of its keys, as it parses the object. Looking a key up in an
+ * object with a table takes constant time, rather than a scan of its
+ * members; the table takes two to four slots (a position and a hash) per
+ * member. Smaller objects are quicker to scan than to hash.
+ *
+ * @param tape the tape
+ * @param nkeys the least number of members, or 0 to build no tables. This
+ * applies from the next document parsed.
+ */
+JSONSL_API
+void jsonsl_tape_set_index_min(jsonsl_tape_t tape, size_t nkeys);
+
+/**
+ * Parse a document into a tape, replacing the one it held.
+ *
+ * @param tape the tape
+ * @param buf the whole document
+ * @param nbuf its length
+ * @return JSONSL_ERROR_SUCCESS; JSONSL_ERROR_INCOMPLETE if the document
+ * ends early (or is empty); JSONSL_ERROR_ENOMEM; or the lexer's error
+ * (which includes another value following the document). The tape is empty
+ * on error
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_tape_parse(jsonsl_tape_t tape,
+                                 const jsonsl_char_t *buf, size_t nbuf);
+
+/**
+ * Get the type of a value: JSONSL_T_OBJECT, JSONSL_T_LIST, JSONSL_T_STRING
+ * or JSONSL_T_SPECIAL
+ */
+JSONSL_API
+jsonsl_type_t jsonsl_tape_type(jsonsl_tape_t tape, size_t node);
+
+/** Get the special flags of a value, or 0 if it is not a special */
+JSONSL_API
+unsigned jsonsl_tape_special_flags(jsonsl_tape_t tape, size_t node);
+
+/**
+ * Get the number of elements of a list or members of an object, or 0 for
+ * other values
+ */
+JSONSL_API
+size_t jsonsl_tape_size(jsonsl_tape_t tape, size_t node);
+
+/**
+ * Get the first element of a list, or the value of the first member of an
+ * object
+ */
+JSONSL_API
+size_t jsonsl_tape_child(jsonsl_tape_t tape, size_t node);
+
+/**
+ * Get the value after this one in the same list (or object), skipping
+ * its contents
+ */
+JSONSL_API
+size_t jsonsl_tape_next(jsonsl_tape_t tape, size_t node);
+
+/**
+ * Look up the value of an object's member. Keys are compared by hash
+ * before their text is, using the object's hash table if it has one (see
+ * jsonsl_tape_set_index_min()). Where a key appears more than once, the
+ * first member is found.
+ *
+ * @param tape the tape
+ * @param node the object
+ * @param key the (unescaped) key
+ * @param nkey its length
+ * @return the member's value, or JSONSL_TAPE_NONE if there is no such member
+ * or `node` is not an object
+ */
+JSONSL_API
+size_t jsonsl_tape_lookup(jsonsl_tape_t tape, size_t node,
+                          const char *key, size_t nkey);
+
+/**
+ * Get the element of a list (or the value of the member of an object) at an
+ * index. This skips the values before it, so iterate with
+ * jsonsl_tape_next() rather than call this for each index
+ */
+JSONSL_API
+size_t jsonsl_tape_at(jsonsl_tape_t tape, size_t node, size_t index);
+
+/**
+ * Get the key of an object member
+ *
+ * @param tape the tape
+ * @param node the member's value, which must be in an object
+ * @param[out] len set to the length of the key
+ * @return the key, NUL terminated
+ */
+JSONSL_API
+const char *jsonsl_tape_key(jsonsl_tape_t tape, size_t node, size_t *len);
+
+/**
+ * Get the contents of a string
+ *
+ * @param[out] len set to the length of the string, which may contain NULs
+ * of its own (from "\u0000")
+ * @return the unescaped string, NUL terminated, or NULL if the value is not
+ * a string
+ */
+JSONSL_API
+const char *jsonsl_tape_string(jsonsl_tape_t tape, size_t node, size_t *len);
+
+/**
+ * Get the value of a number, truncated towards zero if it is not an
+ * integer. Integers of up to 18 digits are exact; longer ones, and numbers
+ * with fractions or exponents, are converted from their double value.
+ * Returns 0 for other values
+ */
+JSONSL_API
+int64_t jsonsl_tape_int(jsonsl_tape_t tape, size_t node);
+
+/** Get the value of a number as a double, or 0 for other values */
+JSONSL_API
+double jsonsl_tape_double(jsonsl_tape_t tape, size_t node);
+
+JSONSL_API
+void jsonsl_tape_destroy(jsonsl_tape_t tape);
+/**@}*/
+
+/**
+ * @name Lazy documents
+ *
+ * A lazy document is a DOM which is only built as far as it is read. Parsing
+ * one only finds where each object and list begins and ends, with a scan
+ * which looks at nothing but brackets and quotes. The members of a container
+ * are found the first time it is navigated, stepping over nested containers
+ * in constant time, and a string is unescaped (or a number converted) the
+ * first time its value is asked for. The results are kept, so that each
+ * value is decoded at most once. Reading a few members of a large document
+ * thus leaves most of it undecoded; strings without escapes are never
+ * copied.
+ *
+ * The flip side is that a document is only checked as far as it is read:
+ * parsing checks that its brackets match and that its strings end, scanning
+ * a container checks the punctuation between its members and that its
+ * strings and keys hold no raw control characters, and decoding a value
+ * checks that value. Navigation stops (returning
+ * @ref JSONSL_LAZY_NONE, NULL or 0) at the first error, which
+ * jsonsl_lazy_error() returns. NaN and Infinity are not accepted, even with
+ * JSONSL_PARSE_NAN.
+ *
+ * Values are referred to by number, with the document's root at 0. The
+ * document's text must outlive it, as strings are returned from it.
+ * @{
+ */
+typedef struct jsonsl_lazy_st *jsonsl_lazy_t;
+
+/** Returned by the navigation functions when there is no such value */
+#define JSONSL_LAZY_NONE ((size_t)-1)
+
+/**
+ * Create a lazy document
+ *
+ * @return a new, empty document, or NULL on allocation failure
+ */
+JSONSL_API
+jsonsl_lazy_t jsonsl_lazy_new(void);
+
+/**
+ * Find the containers of a document, replacing the one held. Memory is
+ * reused from one document to the next.
+ *
+ * @param lazy the lazy document
+ * @param buf the whole document, which must be kept until the next call
+ * (or jsonsl_lazy_destroy())
+ * @param nbuf its length
+ * @return JSONSL_ERROR_SUCCESS; JSONSL_ERROR_INCOMPLETE if a string or
+ * container is not closed (or the document is empty);
+ * JSONSL_ERROR_BRACKET_MISMATCH or JSONSL_ERROR_STRAY_TOKEN for brackets
+ * which do not match; JSONSL_ERROR_GARBAGE_TRAILING if another value
+ * follows the document; or JSONSL_ERROR_ENOMEM
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_lazy_parse(jsonsl_lazy_t lazy,
+                                 const char *buf, size_t nbuf);
+
+/** Get the first error found while reading the document */
+JSONSL_API
+jsonsl_error_t jsonsl_lazy_error(jsonsl_lazy_t lazy);
+
+/**
+ * Get the type of a value: JSONSL_T_OBJECT, JSONSL_T_LIST, JSONSL_T_STRING
+ * or JSONSL_T_SPECIAL. This does not decode it
+ */
+JSONSL_API
+jsonsl_type_t jsonsl_lazy_type(jsonsl_lazy_t lazy, size_t node);
+
+/**
+ * Get the special flags of a value (decoding it), or 0 if it is not a
+ * special
+ */
+JSONSL_API
+unsigned jsonsl_lazy_special_flags(jsonsl_lazy_t lazy, size_t node);
+
+/**
+ * Get the number of elements of a list or members of an object, or 0 for
+ * other values
+ */
+JSONSL_API
+size_t jsonsl_lazy_size(jsonsl_lazy_t lazy, size_t node);
+
+/**
+ * Get the first element of a list, or the value of the first member of an
+ * object
+ */
+JSONSL_API
+size_t jsonsl_lazy_child(jsonsl_lazy_t lazy, size_t node);
+
+/** Get the value after this one in the same list (or object) */
+JSONSL_API
+size_t jsonsl_lazy_next(jsonsl_lazy_t lazy, size_t node);
+
+/**
+ * Get the element of a list (or the value of the member of an object) at an
+ * index, in constant time once the container has been scanned
+ */
+JSONSL_API
+size_t jsonsl_lazy_at(jsonsl_lazy_t lazy, size_t node, size_t index);
+
+/**
+ * Look up the value of an object's member. Keys are compared by hash
+ * before their text is, and keys with escapes are unescaped for the
+ * comparison. Where a key appears more than once, the first member is
+ * found.
+ *
+ * @return the member's value, or JSONSL_LAZY_NONE if there is no such member
+ * or `node` is not an object
+ */
+JSONSL_API
+size_t jsonsl_lazy_lookup(jsonsl_lazy_t lazy, size_t node,
+                          const char *key, size_t nkey);
+
+/**
+ * Get the (unescaped) key of an object member
+ *
+ * @param lazy the lazy document
+ * @param node the member's value
+ * @param[out] len set to the length of the key
+ * @return the key, which is not NUL terminated, or NULL if `node` is not in
+ * an object
+ */
+JSONSL_API
+const char *jsonsl_lazy_key(jsonsl_lazy_t lazy, size_t node, size_t *len);
+
+/**
+ * Get the contents of a string, unescaping it if it has not been
+ *
+ * @param[out] len set to the length of the string
+ * @return the string, which is not NUL terminated, or NULL if the value is
+ * not a string
+ */
+JSONSL_API
+const char *jsonsl_lazy_string(jsonsl_lazy_t lazy, size_t node, size_t *len);
+
+/**
+ * Get the value of a number, as for jsonsl_tape_int(). Returns 0 for other
+ * values
+ */
+JSONSL_API
+int64_t jsonsl_lazy_int(jsonsl_lazy_t lazy, size_t node);
+
+/** Get the value of a number as a double, or 0 for other values */
+JSONSL_API
+double jsonsl_lazy_double(jsonsl_lazy_t lazy, size_t node);
+
+JSONSL_API
+void jsonsl_lazy_destroy(jsonsl_lazy_t lazy);
+/**@}*/
+
 /**
  * Return a string representation of the match result returned by match()
  */
@@ -997,6 +2232,159 @@ size_t jsonsl_util_unescape_ex(const char *in,
 
 #endif /* JSONSL_NO_JPR */
 
+/**
+ * @name Writers
+ *
+ * A writer serializes a document from a sequence of calls, one for each
+ * value (and key) in document order, the way the lexer reports them. It
+ * keeps track of the containers open, writes the commas and colons between
+ * values, and escapes strings and keys, so that its output is valid JSON
+ * as long as its calls are (raw values are written as they are given).
+ * Output is compact, without whitespace.
+ *
+ * The output goes to a buffer supplied by the caller, which is handed to a
+ * flush callback each time it fills up, and once more at the end of the
+ * document. Strings are scanned for characters which need escaping a word
+ * at a time, and runs without any are copied to the buffer whole.
+ *
+ * Writing functions return the writer's error, which is sticky: once a
+ * call fails (e.g. with JSONSL_ERROR_HKEY_EXPECTED for a value without a key
+ * in an object, or JSONSL_ERROR_WRITE_FAILED when the callback fails),
+ * nothing more is written until jsonsl_writer_finish().
+ * @{
+ */
+typedef struct jsonsl_writer_st *jsonsl_writer_t;
+
+/**
+ * Called with the contents of a writer's buffer, which may then be reused.
+ *
+ * @param data the pointer passed to jsonsl_writer_new()
+ * @param buf the output
+ * @param nbuf its length
+ * @return 0 to go on writing, or anything else to fail the writer with
+ * JSONSL_ERROR_WRITE_FAILED
+ */
+typedef int (*jsonsl_writer_flush_callback)(void *data,
+                                            const char *buf, size_t nbuf);
+
+/**
+ * Create a writer
+ *
+ * @param nlevels the deepest nesting of containers which may be written
+ * @param buf the buffer to write into, which must be kept as long as the
+ * writer is
+ * @param nbuf its size, which may be anything from 1 up
+ * @param flush the callback to hand the buffer's contents to
+ * @param data passed to the callback
+ * @return a new writer, or NULL if `nbuf` is 0 or on allocation failure
+ */
+JSONSL_API
+jsonsl_writer_t jsonsl_writer_new(unsigned nlevels, char *buf, size_t nbuf,
+                                  jsonsl_writer_flush_callback flush,
+                                  void *data);
+
+/** Open an object */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_begin_object(jsonsl_writer_t writer);
+
+/** Close the object open innermost */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_end_object(jsonsl_writer_t writer);
+
+/** Open a list */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_begin_list(jsonsl_writer_t writer);
+
+/** Close the list open innermost */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_end_list(jsonsl_writer_t writer);
+
+/**
+ * Write the key of the next member of the object open innermost, escaping
+ * it. The key may contain NULs, and is not checked to be valid UTF-8.
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_key(jsonsl_writer_t writer,
+                                 const char *key, size_t nkey);
+
+/** Write a string, escaping it as for jsonsl_writer_key() */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_string(jsonsl_writer_t writer,
+                                    const char *str, size_t nstr);
+
+/** Write an integer, formatted by jsonsl_format_int() */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_int(jsonsl_writer_t writer, int64_t value);
+
+/**
+ * Write a number, formatted by jsonsl_format_double(). NaN and infinities
+ * fail with JSONSL_ERROR_INVALID_NUMBER, as JSON has no way to write them
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_double(jsonsl_writer_t writer, double value);
+
+/**
+ * Write a value as it is, e.g. `true`, `null`, a number as it was read, or
+ * a whole document serialized elsewhere
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_raw(jsonsl_writer_t writer,
+                                 const char *text, size_t ntext);
+
+/**
+ * End the document, flushing what remains in the buffer, and reset the
+ * writer for the next document.
+ *
+ * @return the writer's error, or JSONSL_ERROR_INCOMPLETE if no value was
+ * written or a container is still open (in which case nothing is flushed)
+ */
+JSONSL_API
+jsonsl_error_t jsonsl_writer_finish(jsonsl_writer_t writer);
+
+JSONSL_API
+void jsonsl_writer_destroy(jsonsl_writer_t writer);
+
+/**
+ * Room for the longest text jsonsl_format_int() or jsonsl_format_double()
+ * writes, with its NUL
+ */
+#define JSONSL_NUMBER_BUFSIZE 32
+
+/**
+ * Format an integer in decimal
+ *
+ * @param value the integer
+ * @param[out] buf at least JSONSL_NUMBER_BUFSIZE characters, to be NUL
+ * terminated
+ * @return the length of the text
+ */
+JSONSL_API
+size_t jsonsl_format_int(int64_t value, char *buf);
+
+/**
+ * Format a double with digits that strtod() always reads back as the same
+ * double, usually as few as do: `0.1` rather than `0.10000000000000001`. The
+ * digits come from Grisu2, which round trips but is not always shortest:
+ * about one double in five hundred, with a shorter form only at the very
+ * edge of the range which reads back, gets a digit or two more
+ * (`420.71498771498773` rather than `420.7149877149877`).
+ *
+ * Numbers from 1e-4 up to 1e17 are written in positional notation
+ * (`1234.5`, `0.00125`, `100`; a whole number has no decimal point, as with
+ * printf's "%g"), others in scientific notation, with a sign on the
+ * exponent only when it is negative (`1e100`, `2.5e-7`).
+ * Negative zero is written as `-0`.
+ *
+ * @param value the double
+ * @param[out] buf at least JSONSL_NUMBER_BUFSIZE characters, to be NUL
+ * terminated
+ * @return the length of the text, or 0 for NaN and infinities, which JSON
+ * has no way to write
+ */
+JSONSL_API
+size_t jsonsl_format_double(double value, char *buf);
+/**@}*/
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -12,19 +12,26 @@ int main(int argc, char **argv)
     jsonsl_t jsn;
     int rv, itermax, ii;
     int is_rawscan = 0;
+    int file_flags = -1;
     time_t begin_time;
     size_t total_size;
     unsigned long duration;
     unsigned stuff = 0;
 
     if (argc < 3) {
-        fprintf(stderr, "%s: FILE ITERATIONS [MODE]\n", argv[0]);
+        fprintf(stderr, "%s: FILE ITERATIONS [raw|mmap|read]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     if (argc > 3) {
         if (strcmp("raw", argv[3]) == 0) {
             is_rawscan = 1;
+        } else if (strcmp("mmap", argv[3]) == 0) {
+            /* Map the file window by window on each iteration */
+            file_flags = JSONSL_FILEf_SEQUENTIAL|JSONSL_FILEf_HUGEPAGE;
+        } else if (strcmp("read", argv[3]) == 0) {
+            /* Read the file window by window on each iteration */
+            file_flags = JSONSL_FILEf_NOMMAP;
         }
     }
 
@@ -35,31 +42,42 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    fh = fopen(argv[1], "rb");
-    if (fh == NULL) {
-        perror(argv[1]);
-        exit(EXIT_FAILURE);
-    }
-    buf = malloc(sb.st_size + 1);
-    fread(buf, 1, sb.st_size, fh);
-    buf[sb.st_size] = '\0';
-    begin_time = time(NULL);
-
     jsn = jsonsl_new(512);
 
-    if (is_rawscan) {
+    if (file_flags != -1) {
+        begin_time = time(NULL);
         for (ii = 0; ii < itermax; ii++) {
-            unsigned jj;
-            for (jj = 0; jj < sb.st_size; jj++) {
-                if (buf[jj] == '"') {
-                    stuff++;
-                }
+            jsonsl_reset(jsn);
+            if (jsonsl_feed_file(jsn, argv[1], file_flags) != 0) {
+                perror(argv[1]);
+                exit(EXIT_FAILURE);
             }
         }
     } else {
-        for (ii = 0; ii < itermax; ii++) {
-            jsonsl_reset(jsn);
-            jsonsl_feed(jsn, buf, sb.st_size);
+        fh = fopen(argv[1], "rb");
+        if (fh == NULL) {
+            perror(argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        buf = malloc(sb.st_size + 1);
+        fread(buf, 1, sb.st_size, fh);
+        buf[sb.st_size] = '\0';
+        begin_time = time(NULL);
+
+        if (is_rawscan) {
+            for (ii = 0; ii < itermax; ii++) {
+                unsigned jj;
+                for (jj = 0; jj < sb.st_size; jj++) {
+                    if (buf[jj] == '"') {
+                        stuff++;
+                    }
+                }
+            }
+        } else {
+            for (ii = 0; ii < itermax; ii++) {
+                jsonsl_reset(jsn);
+                jsonsl_feed(jsn, buf, sb.st_size);
+            }
         }
     }
 
@@ -0,0 +1,170 @@
+/**
+ * Latency benchmark for jsonsl_feed_budget().
+ *
+ * This simulates a single-threaded event loop servicing many connections.
+ * Each connection is a loopback stand-in which "receives" the same document
+ * in large reads. The loop services each ready connection in turn, and we
+ * measure how long each individual call into the parser blocks the loop.
+ *
+ * The run is performed twice: once feeding all received data in a single
+ * call, and once with a per-call budget. The tail latencies are what
+ * matter here.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_STREAMS 64
+#define DEFAULT_BUDGET 16384
+#define DEFAULT_ROUNDS 4
+
+/* How much data a single 'recv' on a connection yields */
+#define RECV_SIZE (1024 * 1024)
+
+struct stream_st {
+    jsonsl_t jsn;
+    size_t received; /* offset of data which arrived on the 'socket' */
+    size_t parsed; /* offset of data which was fed to the parser */
+    int rounds;
+};
+
+static double
+now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static void
+run(const char *buf, size_t nbuf, int nstreams, int rounds, size_t budget)
+{
+    struct stream_st *streams;
+    double *samples, begin, elapsed;
+    size_t nsamples = 0, maxsamples = 1024;
+    int ii, active = nstreams;
+
+    streams = calloc(nstreams, sizeof(*streams));
+    samples = malloc(sizeof(*samples) * maxsamples);
+
+    for (ii = 0; ii < nstreams; ii++) {
+        streams[ii].jsn = jsonsl_new(512);
+        streams[ii].jsn->error_callback = error_callback;
+        jsonsl_enable_all_callbacks(streams[ii].jsn);
+    }
+
+    begin = now_usec();
+    while (active) {
+        for (ii = 0; ii < nstreams; ii++) {
+            struct stream_st *st = streams + ii;
+            double t0;
+            size_t consumed;
+
+            if (st->rounds == rounds) {
+                continue;
+            }
+
+            /* Socket becomes readable */
+            if (st->received == st->parsed) {
+                st->received += RECV_SIZE;
+                if (st->received > nbuf) {
+                    st->received = nbuf;
+                }
+            }
+
+            t0 = now_usec();
+            consumed = jsonsl_feed_budget(st->jsn, buf + st->parsed,
+                                          st->received - st->parsed, budget);
+            if (nsamples == maxsamples) {
+                maxsamples *= 2;
+                samples = realloc(samples, sizeof(*samples) * maxsamples);
+            }
+            samples[nsamples++] = now_usec() - t0;
+
+            st->parsed += consumed;
+            if (st->parsed == nbuf) {
+                jsonsl_reset(st->jsn);
+                st->parsed = st->received = 0;
+                if (++st->rounds == rounds) {
+                    active--;
+                }
+            }
+        }
+    }
+    elapsed = now_usec() - begin;
+
+    qsort(samples, nsamples, sizeof(*samples), cmp_double);
+    printf("%-10s %10lu calls  p50=%9.1fus  p99=%9.1fus  max=%9.1fus  "
+           "%.0f MB/sec\n",
+           budget == (size_t)-1 ? "unbounded" : "budgeted",
+           (unsigned long)nsamples,
+           samples[nsamples / 2],
+           samples[(size_t)(nsamples * 0.99)],
+           samples[nsamples - 1],
+           ((double)nbuf * nstreams * rounds) / elapsed);
+
+    for (ii = 0; ii < nstreams; ii++) {
+        jsonsl_destroy(streams[ii].jsn);
+    }
+    free(streams);
+    free(samples);
+}
+
+int main(int argc, char **argv)
+{
+    struct stat sb;
+    char *buf;
+    FILE *fh;
+    int nstreams = DEFAULT_STREAMS;
+    unsigned long budget = DEFAULT_BUDGET;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: FILE [STREAMS] [BUDGET]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        sscanf(argv[2], "%d", &nstreams);
+    }
+    if (argc > 3) {
+        sscanf(argv[3], "%lu", &budget);
+    }
+
+    if (stat(argv[1], &sb) != 0 || (fh = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    buf = malloc(sb.st_size);
+    if (fread(buf, 1, sb.st_size, fh) != (size_t)sb.st_size) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fh);
+
+    printf("%d streams, %lu byte document, budget=%lu\n",
+           nstreams, (unsigned long)sb.st_size, budget);
+    run(buf, sb.st_size, nstreams, DEFAULT_ROUNDS, (size_t)-1);
+    run(buf, sb.st_size, nstreams, DEFAULT_ROUNDS, budget);
+    free(buf);
+    return 0;
+}
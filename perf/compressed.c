@@ -0,0 +1,218 @@
+/**
+ * Compares parsing compressed files by first decompressing them into a
+ * temporary buffer and then feeding that, against decompressing straight
+ * into the lexer with jsonsl_feed_compressed().
+ *
+ * Each input file is compressed (with every format which was compiled in)
+ * into a scratch file in the current directory before the timed runs.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <jsonsl.h>
+#ifdef JSONSL_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef JSONSL_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#define DEFAULT_ITERATIONS 20
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static jsonsl_t
+new_lexer(void)
+{
+    jsonsl_t jsn = jsonsl_new(512);
+    jsn->error_callback = error_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    return jsn;
+}
+
+static char *
+read_file(const char *path, size_t *len)
+{
+    struct stat sb;
+    FILE *fh;
+    char *buf;
+    if (stat(path, &sb) != 0 || (fh = fopen(path, "rb")) == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    buf = malloc(sb.st_size);
+    if (fread(buf, 1, sb.st_size, fh) != (size_t)sb.st_size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fh);
+    *len = sb.st_size;
+    return buf;
+}
+
+static void
+report(const char *name, size_t nbuf, int iterations, double elapsed,
+       size_t scratch)
+{
+    printf("  %-18s %8.1f MB/sec (decompressed)  scratch memory: %8lu KB\n",
+           name, (double)nbuf * iterations / (1024 * 1024) / elapsed,
+           (unsigned long)(scratch / 1024));
+}
+
+static void
+run_fused(const char *path, int format, size_t nbuf, int iterations)
+{
+    int ii;
+    double begin = now_sec();
+    for (ii = 0; ii < iterations; ii++) {
+        jsonsl_t jsn = new_lexer();
+        if (jsonsl_feed_compressed(jsn, path, format) != 0) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        if (jsn->pos != nbuf) {
+            fprintf(stderr, "Short read on %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        jsonsl_destroy(jsn);
+    }
+    report("fused", nbuf, iterations, now_sec() - begin,
+           JSONSL_DECOMPRESS_WINDOW * 3 / 2);
+}
+
+#ifdef JSONSL_USE_ZLIB
+static void
+bench_gzip(const char *buf, size_t nbuf, int iterations)
+{
+    const char *path = "jsonsl-bench.json.gz";
+    gzFile gz = gzopen(path, "wb");
+    char *out = NULL;
+    size_t nalloc = 0;
+    double begin;
+    int ii;
+
+    if (!gz || gzwrite(gz, buf, (unsigned)nbuf) != (int)nbuf) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    gzclose(gz);
+
+    printf(" gzip\n");
+    begin = now_sec();
+    for (ii = 0; ii < iterations; ii++) {
+        jsonsl_t jsn = new_lexer();
+        size_t nout = 0;
+        int nr;
+        gz = gzopen(path, "rb");
+        for (;;) {
+            if (nout == nalloc) {
+                nalloc = nalloc ? nalloc * 2 : 65536;
+                out = realloc(out, nalloc);
+            }
+            if ((nr = gzread(gz, out + nout, (unsigned)(nalloc - nout))) <= 0) {
+                break;
+            }
+            nout += nr;
+        }
+        gzclose(gz);
+        jsonsl_feed(jsn, out, nout);
+        jsonsl_destroy(jsn);
+        /* Start from scratch each time, like a one-shot decompression */
+        free(out);
+        out = NULL;
+        nalloc = 0;
+    }
+    report("decompress+feed", nbuf, iterations, now_sec() - begin, nbuf);
+    run_fused(path, JSONSL_COMPRESS_GZIP, nbuf, iterations);
+    remove(path);
+}
+#endif /* JSONSL_USE_ZLIB */
+
+#ifdef JSONSL_USE_ZSTD
+static void
+bench_zstd(const char *buf, size_t nbuf, int iterations)
+{
+    const char *path = "jsonsl-bench.json.zst";
+    size_t nzbuf;
+    char *zbuf = malloc(ZSTD_compressBound(nbuf));
+    FILE *fp;
+    double begin;
+    int ii;
+
+    nzbuf = ZSTD_compress(zbuf, ZSTD_compressBound(nbuf), buf, nbuf, 3);
+    if (ZSTD_isError(nzbuf) || (fp = fopen(path, "wb")) == NULL ||
+            fwrite(zbuf, 1, nzbuf, fp) != nzbuf) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    free(zbuf);
+
+    printf(" zstd\n");
+    begin = now_sec();
+    for (ii = 0; ii < iterations; ii++) {
+        jsonsl_t jsn = new_lexer();
+        size_t ncomp, nout;
+        char *comp = read_file(path, &ncomp);
+        char *out = malloc(ZSTD_getFrameContentSize(comp, ncomp));
+        nout = ZSTD_decompress(out, nbuf, comp, ncomp);
+        jsonsl_feed(jsn, out, nout);
+        jsonsl_destroy(jsn);
+        free(comp);
+        free(out);
+    }
+    report("decompress+feed", nbuf, iterations, now_sec() - begin, nbuf);
+    run_fused(path, JSONSL_COMPRESS_ZSTD, nbuf, iterations);
+    remove(path);
+}
+#endif /* JSONSL_USE_ZSTD */
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    int ii;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: [-n ITERATIONS] FILE..\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (ii = 1; ii < argc; ii++) {
+        size_t nbuf;
+        char *buf;
+        if (strcmp(argv[ii], "-n") == 0 && ii + 1 < argc) {
+            sscanf(argv[++ii], "%d", &iterations);
+            continue;
+        }
+        buf = read_file(argv[ii], &nbuf);
+        printf("%s: %lu bytes, %d iterations\n",
+               argv[ii], (unsigned long)nbuf, iterations);
+#ifdef JSONSL_USE_ZLIB
+        bench_gzip(buf, nbuf, iterations);
+#endif
+#ifdef JSONSL_USE_ZSTD
+        bench_zstd(buf, nbuf, iterations);
+#endif
+        free(buf);
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+/**
+ * Finds every "id" member, and every "id" of a "user" object, at any depth
+ * in the documents of documents.c (a twitter timeline, a flickr feed and a
+ * github commit log). The baseline receives a callback for every element and
+ * compares keys itself, which is what callers had to do before descendant
+ * (^^) path components; this is compared against matching /^^/id with a
+ * path set from the same callbacks, and against the set in query mode,
+ * where only the matching values (and their ancestors) reach the caller.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+#include "documents.h"
+
+#define DEFAULT_ITERATIONS 2000
+
+static const char *Paths[] = { "/^^/id", "/^^/user/id", NULL };
+
+struct bench_ctx {
+    const char *buf;
+    const char *hkey;
+    size_t nhkey;
+    size_t nmatches;
+    size_t ncallbacks;
+    int mode;
+};
+
+enum { MODE_FILTER, MODE_SET, MODE_QUERY, MODE_MAX };
+static const char *ModeNames[] = { "filter", "set", "query" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    const size_t *ids;
+    size_t nids;
+
+    ctx->ncallbacks++;
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    if (ctx->mode == MODE_FILTER) {
+        struct jsonsl_state_st *parent = jsonsl_last_state(jsn, state);
+        if (parent && parent->type == JSONSL_T_OBJECT &&
+                ctx->nhkey == 2 && memcmp(ctx->hkey, "id", 2) == 0) {
+            /* Inside a "user" object, /^^/user/id matches as well */
+            ctx->nmatches += parent->data ? 2 : 1;
+        }
+        if (state->type == JSONSL_T_OBJECT) {
+            state->data = parent && parent->type == JSONSL_T_OBJECT &&
+                    ctx->nhkey == 4 && memcmp(ctx->hkey, "user", 4) == 0 ?
+                    (void *)ctx : NULL;
+        }
+        return;
+    }
+    if (ctx->mode == MODE_QUERY) {
+        jsonsl_jpr_set_last_match(jsn, &ids, &nids);
+    } else {
+        jsonsl_jpr_set_match_state(jsn, state, ctx->hkey, ctx->nhkey,
+                                   &ids, &nids);
+    }
+    ctx->nmatches += nids;
+}
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    ctx->ncallbacks++;
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->hkey = ctx->buf + state->pos_begin + 1;
+        ctx->nhkey = jsn->pos - state->pos_begin - 1;
+    }
+}
+
+/* The documents are split into chunks; the callbacks above want each one
+ * in a single buffer */
+static char *
+join_doc(int doc, size_t *len)
+{
+    const char **chunk;
+    char *buf;
+    size_t pos = 0;
+
+    buf = malloc(doc_size(doc) + 1);
+    for (chunk = get_doc(doc); *chunk; chunk++) {
+        size_t n = strlen(*chunk);
+        memcpy(buf + pos, *chunk, n);
+        pos += n;
+    }
+    *len = pos;
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    jsonsl_jpr_t jprs[2];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    size_t npaths, nbufs[8], total = 0;
+    char *bufs[8];
+    double elapsed[MODE_MAX];
+    size_t nmatches[MODE_MAX], ncallbacks[MODE_MAX];
+    int ndocs, doc, mode, ii;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    ndocs = num_docs() < 8 ? num_docs() : 8;
+    for (doc = 0; doc < ndocs; doc++) {
+        bufs[doc] = join_doc(doc, nbufs + doc);
+        total += nbufs[doc];
+    }
+
+    for (npaths = 0; Paths[npaths]; npaths++) {
+        jprs[npaths] = jsonsl_jpr_new_extended(Paths[npaths], NULL);
+    }
+    set = jsonsl_jpr_set_new(jprs, npaths, NULL);
+    jsn = jsonsl_new(64);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = push_callback;
+    jsn->action_callback_POP = pop_callback;
+
+    printf("%d documents, %lu bytes, %d iterations\n",
+           ndocs, (unsigned long)total, iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        struct bench_ctx ctx;
+        double begin = now_sec();
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.mode = mode;
+        jsn->data = &ctx;
+        for (ii = 0; ii < iterations; ii++) {
+            for (doc = 0; doc < ndocs; doc++) {
+                jsonsl_reset(jsn);
+                jsonsl_enable_all_callbacks(jsn);
+                if (mode != MODE_FILTER) {
+                    jsonsl_jpr_set_attach(jsn, set);
+                }
+                jsn->options.query = mode == MODE_QUERY;
+                ctx.buf = bufs[doc];
+                jsonsl_feed(jsn, bufs[doc], nbufs[doc]);
+            }
+        }
+        elapsed[mode] = now_sec() - begin;
+        nmatches[mode] = ctx.nmatches;
+        ncallbacks[mode] = ctx.ncallbacks;
+        jsonsl_jpr_set_detach(jsn);
+    }
+
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        if (nmatches[mode] != nmatches[MODE_FILTER]) {
+            fprintf(stderr, "Mismatch: %s found %lu, %s found %lu\n",
+                    ModeNames[MODE_FILTER],
+                    (unsigned long)nmatches[MODE_FILTER], ModeNames[mode],
+                    (unsigned long)nmatches[mode]);
+            exit(EXIT_FAILURE);
+        }
+        printf("  %-6s %8.1f MB/sec  %6lu matches  %8lu callbacks/iteration\n",
+               ModeNames[mode],
+               (double)total * iterations / (1024 * 1024) / elapsed[mode],
+               (unsigned long)nmatches[mode] / iterations,
+               (unsigned long)ncallbacks[mode] / iterations);
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+    for (ii = 0; (size_t)ii < npaths; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+    for (doc = 0; doc < ndocs; doc++) {
+        free(bufs[doc]);
+    }
+    return 0;
+}
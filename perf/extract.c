@@ -0,0 +1,267 @@
+/**
+ * Extracts the spans of a few fields from many small order records, one
+ * record per buffer (as a service does for each request it handles), and
+ * from a single large list of them. The baseline wires up PUSH and POP
+ * callbacks with jsonsl_jpr_match_state() and tracks the open values itself,
+ * which is what callers did before jsonsl_extract(); this is compared
+ * against jsonsl_extract(), which creates a lexer for each buffer, and
+ * jsonsl_extract_with(), which reuses one.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 20
+#define NRECORDS 10000
+#define MAX_SPANS (NRECORDS * 4)
+
+static const char *RecordPaths[] = {
+    "/id", "/user/name", "/user/prefs/lang", "/items/0/sku", "/status", NULL
+};
+static const char *ListPaths[] = {
+    "/orders/^/id", "/orders/^/user/name", "/orders/^/status", NULL
+};
+
+struct bench_ctx {
+    const char *buf;
+    const char *hkey;
+    size_t nhkey;
+    jsonsl_jpr_t *jprs;
+    size_t njprs;
+    jsonsl_span_t *spans;
+    size_t nspans;
+    /* 1 + the index of the span opened at each level, or 0 */
+    size_t open[64];
+};
+
+enum { MODE_CALLBACKS, MODE_EXTRACT, MODE_EXTRACT_WITH, MODE_MAX };
+static const char *ModeNames[] = { "callbacks", "extract", "extract_with" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    jsonsl_jpr_match_t match;
+    jsonsl_jpr_t jpr;
+    size_t id;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    jpr = jsonsl_jpr_match_state(jsn, state, ctx->hkey, ctx->nhkey, &match);
+    if (!jpr) {
+        return;
+    }
+    for (id = 0; ctx->jprs[id] != jpr; id++) {
+    }
+    ctx->spans[ctx->nspans].id = id;
+    ctx->spans[ctx->nspans].pos_begin = state->pos_begin;
+    ctx->open[state->level] = ++ctx->nspans;
+}
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    jsonsl_span_t *span;
+
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->hkey = ctx->buf + state->pos_begin + 1;
+        ctx->nhkey = jsn->pos - state->pos_begin - 1;
+        return;
+    }
+    if (!ctx->open[state->level]) {
+        return;
+    }
+    span = ctx->spans + ctx->open[state->level] - 1;
+    ctx->open[state->level] = 0;
+    span->pos_end = state->type == JSONSL_T_SPECIAL ? jsn->pos : jsn->pos + 1;
+    span->level = state->level;
+    span->type = (jsonsl_type_t)state->type;
+    span->special_flags = state->special_flags;
+}
+
+static size_t
+make_record(char *outp, int ii)
+{
+    return sprintf(outp,
+            "{\"id\": %d, \"user\": {\"id\": %d, \"name\": \"user %d\", "
+            "\"email\": \"user%d@example.com\", "
+            "\"prefs\": {\"lang\": \"en\", \"tz\": \"UTC\", \"mail\": false}}, "
+            "\"items\": [{\"sku\": \"A-%d\", \"qty\": %d, \"price\": %d.99}, "
+            "{\"sku\": \"B-%d\", \"qty\": 1, \"price\": 4.50}], "
+            "\"status\": \"%s\", \"meta\": {\"created\": \"2016-03-%02dT12:00:00Z\", "
+            "\"tags\": [\"web\", \"eu\", \"priority\"], \"notes\": \"Leave the "
+            "parcel with the neighbour if nobody is at home; call first.\"}}",
+            ii, ii % 977, ii % 977, ii % 977, ii, ii % 5 + 1, ii % 50,
+            ii % 31, ii % 3 ? "shipped" : "pending", ii % 28 + 1);
+}
+
+static jsonsl_jpr_set_t
+make_set(const char **paths, jsonsl_jpr_t *jprs, size_t *njprs)
+{
+    jsonsl_jpr_set_t set;
+    for (*njprs = 0; paths[*njprs]; (*njprs)++) {
+        jprs[*njprs] = jsonsl_jpr_new(paths[*njprs], NULL);
+    }
+    set = jsonsl_jpr_set_new(jprs, *njprs, NULL);
+    if (!set) {
+        fprintf(stderr, "Couldn't compile paths\n");
+        exit(EXIT_FAILURE);
+    }
+    return set;
+}
+
+/* Extract from each of the 'ndocs' documents, returning the total number of
+ * spans and the sum of their lengths in 'nchars' */
+static size_t
+run(int mode, jsonsl_t jsn, jsonsl_jpr_set_t set, struct bench_ctx *ctx,
+    char **docs, size_t *lens, size_t ndocs, size_t *nchars)
+{
+    size_t ii, jj, nspans, total = 0;
+    for (ii = 0; ii < ndocs; ii++) {
+        jsonsl_error_t err = JSONSL_ERROR_SUCCESS;
+        nspans = MAX_SPANS;
+        if (mode == MODE_CALLBACKS) {
+            ctx->buf = docs[ii];
+            ctx->nspans = 0;
+            jsonsl_reset(jsn);
+            jsonsl_enable_all_callbacks(jsn);
+            jsn->action_callback_PUSH = push_callback;
+            jsn->action_callback_POP = pop_callback;
+            jsn->error_callback = error_callback;
+            jsn->data = ctx;
+            jsonsl_jpr_match_state_init(jsn, ctx->jprs, ctx->njprs);
+            jsonsl_feed(jsn, docs[ii], lens[ii]);
+            jsonsl_jpr_match_state_cleanup(jsn);
+            nspans = ctx->nspans;
+        } else if (mode == MODE_EXTRACT) {
+            err = jsonsl_extract(docs[ii], lens[ii], set, ctx->spans, &nspans);
+        } else {
+            err = jsonsl_extract_with(jsn, docs[ii], lens[ii], set,
+                                      ctx->spans, &nspans);
+        }
+        if (err != JSONSL_ERROR_SUCCESS) {
+            fprintf(stderr, "Got error %s\n", jsonsl_strerror(err));
+            exit(EXIT_FAILURE);
+        }
+        for (jj = 0; jj < nspans; jj++) {
+            *nchars += ctx->spans[jj].pos_end - ctx->spans[jj].pos_begin;
+        }
+        total += nspans;
+    }
+    return total;
+}
+
+static void
+bench(const char *title, const char **paths, char **docs, size_t *lens,
+      size_t ndocs, int iterations)
+{
+    struct bench_ctx ctx;
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    size_t nbytes = 0, nspans[MODE_MAX], nchars[MODE_MAX], ii;
+    double elapsed[MODE_MAX];
+    jsonsl_t jsn = jsonsl_new(64);
+    int mode, iter;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.spans = malloc(sizeof(*ctx.spans) * MAX_SPANS);
+    set = make_set(paths, jprs, &ctx.njprs);
+    ctx.jprs = jprs;
+    for (ii = 0; ii < ndocs; ii++) {
+        nbytes += lens[ii];
+    }
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        double begin = now_sec();
+        nchars[mode] = 0;
+        for (iter = 0; iter < iterations; iter++) {
+            nspans[mode] = run(mode, jsn, set, &ctx, docs, lens, ndocs,
+                               nchars + mode);
+        }
+        elapsed[mode] = now_sec() - begin;
+    }
+
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        if (nspans[mode] != nspans[MODE_CALLBACKS] ||
+                nchars[mode] != nchars[MODE_CALLBACKS]) {
+            fprintf(stderr, "Mismatch: %s found %lu (%lu chars), "
+                    "%s found %lu (%lu chars)\n", ModeNames[MODE_CALLBACKS],
+                    (unsigned long)nspans[MODE_CALLBACKS],
+                    (unsigned long)nchars[MODE_CALLBACKS], ModeNames[mode],
+                    (unsigned long)nspans[mode], (unsigned long)nchars[mode]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("%s: %lu buffers, %lu bytes, %lu spans, %d iterations\n", title,
+           (unsigned long)ndocs, (unsigned long)nbytes,
+           (unsigned long)nspans[0], iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        printf("  %-12s %8.1f MB/sec  %8.1f ns/buffer\n", ModeNames[mode],
+               (double)nbytes * iterations / (1024 * 1024) / elapsed[mode],
+               elapsed[mode] * 1e9 / ((double)iterations * ndocs));
+    }
+
+    for (ii = 0; ii < ctx.njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+    jsonsl_jpr_set_destroy(set);
+    jsonsl_destroy(jsn);
+    free(ctx.spans);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    char **docs = malloc(sizeof(*docs) * NRECORDS);
+    size_t *lens = malloc(sizeof(*lens) * NRECORDS);
+    char *list = malloc(NRECORDS * 640 + 32), *outp = list;
+    size_t nlist;
+    int ii;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    outp += sprintf(outp, "{\"orders\": [");
+    for (ii = 0; ii < NRECORDS; ii++) {
+        docs[ii] = malloc(640);
+        lens[ii] = make_record(docs[ii], ii);
+        outp += sprintf(outp, "%s%s", ii ? ", " : "", docs[ii]);
+    }
+    outp += sprintf(outp, "]}");
+    nlist = outp - list;
+
+    bench("records", RecordPaths, docs, lens, NRECORDS, iterations);
+    bench("list", ListPaths, &list, &nlist, 1, iterations);
+
+    for (ii = 0; ii < NRECORDS; ii++) {
+        free(docs[ii]);
+    }
+    free(docs);
+    free(lens);
+    free(list);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * Benchmark for jsonsl_feedv().
+ *
+ * A document held in memory is cut into segments of a fixed size, as a
+ * network stack would hand it over, and lexed three ways: in a single
+ * jsonsl_feed() call, with one jsonsl_feed() call per segment, and with one
+ * jsonsl_feedv() call for all the segments.
+ *
+ * Each way is timed many times in CPU time, interleaved with the others so
+ * that they see the same machine, and the fastest run of each is reported:
+ * the per-call cost being looked for is smaller than the noise of a single
+ * run, but the minimum is stable from one invocation to the next.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_REPS 50
+
+static const size_t SegmentSizes[] = { 16, 64, 1500, 4096, 65536, 0 };
+
+enum { FEED_SINGLE, FEED_SEGMENTS, FEED_V, FEED_MAX };
+
+static const char *FeedNames[] = { "single", "per-segment", "feedv" };
+
+static double
+now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static double
+run(jsonsl_t jsn, int how, const char *buf, size_t nbuf,
+    const jsonsl_iovec_t *iov, int niov)
+{
+    double begin;
+    int ii;
+
+    jsonsl_reset(jsn);
+    begin = now_usec();
+    switch (how) {
+    case FEED_SINGLE:
+        jsonsl_feed(jsn, buf, nbuf);
+        break;
+    case FEED_SEGMENTS:
+        for (ii = 0; ii < niov; ii++) {
+            jsonsl_feed(jsn, (const char *)iov[ii].iov_base,
+                        iov[ii].iov_len);
+        }
+        break;
+    default:
+        jsonsl_feedv(jsn, iov, niov);
+        break;
+    }
+    begin = now_usec() - begin;
+    if (jsn->pos != nbuf || jsn->level) {
+        fprintf(stderr, "%s: stopped at %lu of %lu\n", FeedNames[how],
+                (unsigned long)jsn->pos, (unsigned long)nbuf);
+        abort();
+    }
+    return begin;
+}
+
+int main(int argc, char **argv)
+{
+    struct stat sb;
+    jsonsl_iovec_t *iov;
+    jsonsl_t jsn;
+    char *buf;
+    FILE *fh;
+    int reps = DEFAULT_REPS, ii;
+    size_t jj;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: FILE [REPS]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        sscanf(argv[2], "%d", &reps);
+    }
+
+    if (stat(argv[1], &sb) != 0 || (fh = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    buf = malloc(sb.st_size);
+    if (fread(buf, 1, sb.st_size, fh) != (size_t)sb.st_size) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fh);
+    iov = malloc(sizeof(*iov) * (sb.st_size / SegmentSizes[0] + 1));
+
+    jsn = jsonsl_new(512);
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->error_callback = error_callback;
+
+    printf("%lu byte document, fastest of %d runs\n",
+           (unsigned long)sb.st_size, reps);
+    for (jj = 0; SegmentSizes[jj]; jj++) {
+        double best[FEED_MAX];
+        size_t off;
+        int niov = 0, how;
+
+        for (off = 0; off < (size_t)sb.st_size; off += SegmentSizes[jj]) {
+            iov[niov].iov_base = buf + off;
+            iov[niov].iov_len = (size_t)sb.st_size - off < SegmentSizes[jj] ?
+                    (size_t)sb.st_size - off : SegmentSizes[jj];
+            niov++;
+        }
+        for (how = 0; how < FEED_MAX; how++) {
+            best[how] = -1;
+        }
+        for (ii = 0; ii < reps; ii++) {
+            for (how = 0; how < FEED_MAX; how++) {
+                double elapsed = run(jsn, how, buf, sb.st_size, iov, niov);
+                if (best[how] < 0 || elapsed < best[how]) {
+                    best[how] = elapsed;
+                }
+            }
+        }
+        printf("%6lu byte segments:", (unsigned long)SegmentSizes[jj]);
+        for (how = 0; how < FEED_MAX; how++) {
+            printf("  %s %.0f MB/sec (%+.1f%% time)", FeedNames[how],
+                   sb.st_size / best[how],
+                   (best[how] / best[FEED_SINGLE] - 1) * 100);
+        }
+        printf("\n");
+    }
+
+    jsonsl_destroy(jsn);
+    free(iov);
+    free(buf);
+    return 0;
+}
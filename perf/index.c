@@ -0,0 +1,264 @@
+/**
+ * Looks up the prices of random products in a large catalog, written to a
+ * temporary file. The baseline finds each one with jsonsl_extract() over
+ * the whole document, which is what every query did before offset indexes;
+ * this is compared against looking the product up in an index of the top two
+ * levels (saved next to the document, and loaded again), reading just the
+ * product from the file, and extracting the price from that.
+ *
+ * Then the stock of random products is edited in memory, and the index is
+ * updated after each edit, which is compared against building it again.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <jsonsl.h>
+
+#define DEFAULT_QUERIES 50
+#define NPRODUCTS 200000
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+make_doc(size_t *len)
+{
+    char *buf = malloc(NPRODUCTS * 256 + 256), *outp = buf;
+    int ii;
+
+    outp += sprintf(outp, "{\"version\": 3, \"products\": {");
+    for (ii = 0; ii < NPRODUCTS; ii++) {
+        outp += sprintf(outp,
+                "%s\"sku-%06d\": {\"name\": \"Product %d\", \"price\": %d.%02d, "
+                "\"stock\": %d, \"tags\": [\"t%d\", \"t%d\"], "
+                "\"dims\": {\"w\": %d, \"h\": %d, \"d\": %d}}",
+                ii ? ", " : "", ii, ii, ii % 500, ii % 100, ii % 37,
+                ii % 11, ii % 13, ii % 50, ii % 60, ii % 70);
+    }
+    outp += sprintf(outp, "}, \"categories\": [\"a\", \"b\", \"c\"]}");
+    *len = outp - buf;
+    return buf;
+}
+
+static jsonsl_jpr_set_t
+make_set(const char *path)
+{
+    jsonsl_jpr_t jpr = jsonsl_jpr_new(path, NULL);
+    jsonsl_jpr_set_t set = jpr ? jsonsl_jpr_set_new(&jpr, 1, NULL) : NULL;
+    if (!set) {
+        fprintf(stderr, "Couldn't compile %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    jsonsl_jpr_destroy(jpr);
+    return set;
+}
+
+static jsonsl_index_t
+build_index(const char *buf, size_t nbuf)
+{
+    jsonsl_index_t idx = jsonsl_index_new(2);
+    size_t pos;
+    for (pos = 0; pos < nbuf; pos += 65536) {
+        jsonsl_index_feed(idx, buf + pos, nbuf - pos < 65536 ? nbuf - pos : 65536);
+    }
+    if (jsonsl_index_finish(idx) != JSONSL_ERROR_SUCCESS) {
+        fprintf(stderr, "Couldn't build the index\n");
+        exit(EXIT_FAILURE);
+    }
+    return idx;
+}
+
+static jsonsl_span_t
+lookup(jsonsl_index_t idx, const char *path)
+{
+    jsonsl_jpr_t jpr = jsonsl_jpr_new(path, NULL);
+    jsonsl_span_t span;
+    if (jsonsl_index_lookup(idx, jpr, &span) == JSONSL_MATCH_NOMATCH) {
+        fprintf(stderr, "Lookup of %s failed\n", path);
+        exit(EXIT_FAILURE);
+    }
+    jsonsl_jpr_destroy(jpr);
+    return span;
+}
+
+/* Replace the stock of each of 'nedits' random products by a longer or
+ * shorter number, and update the index. Sets the seconds taken by the first
+ * update (which grows the index's arrays), and returns those taken by the
+ * others */
+static double
+run_edits(jsonsl_index_t idx, char *buf, size_t *nbuf, int nedits,
+          double *first)
+{
+    char path[64], stock[16], *at, *end;
+    jsonsl_index_t fresh;
+    jsonsl_span_t span, expected;
+    double elapsed = 0, begin;
+    size_t nstock;
+    int ii;
+
+    *first = 0;
+    for (ii = 0; ii < nedits; ii++) {
+        sprintf(path, "/products/sku-%06d", rand() % NPRODUCTS);
+        span = lookup(idx, path);
+        at = strstr(buf + span.pos_begin, "\"stock\": ") + 9;
+        end = at + strspn(at, "0123456789");
+        nstock = sprintf(stock, "%d", ii % 2 ? ii : ii * 100000);
+        memmove(at + nstock, end, *nbuf - (end - buf));
+        memcpy(at, stock, nstock);
+        begin = now_sec();
+        if (jsonsl_index_update(idx, buf, at - buf, end - buf,
+                                at + nstock - buf) != JSONSL_ERROR_SUCCESS) {
+            fprintf(stderr, "Couldn't update the index\n");
+            exit(EXIT_FAILURE);
+        }
+        if (ii) {
+            elapsed += now_sec() - begin;
+        } else {
+            *first = now_sec() - begin;
+        }
+        *nbuf += nstock - (end - at);
+    }
+
+    fresh = build_index(buf, *nbuf);
+    strcat(path, "/stock");
+    span = lookup(idx, path);
+    expected = lookup(fresh, path);
+    if (span.pos_begin != expected.pos_begin ||
+            span.pos_end != expected.pos_end) {
+        fprintf(stderr, "Mismatch: %s at %lu, expected %lu\n", path,
+                (unsigned long)span.pos_begin,
+                (unsigned long)expected.pos_begin);
+        exit(EXIT_FAILURE);
+    }
+    jsonsl_index_destroy(fresh);
+    return elapsed;
+}
+
+static void
+check(jsonsl_error_t err, size_t nspans)
+{
+    if (err != JSONSL_ERROR_SUCCESS || nspans != 1) {
+        fprintf(stderr, "Extraction failed: %s, %lu spans\n",
+                jsonsl_strerror(err), (unsigned long)nspans);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int nqueries = DEFAULT_QUERIES;
+    char docpath[] = "/tmp/jsonsl-index-XXXXXX", idxpath[64], path[64];
+    char *buf, *range = malloc(4096);
+    size_t nbuf, nspans, sum[2] = { 0, 0 };
+    jsonsl_jpr_set_t price = make_set("/price");
+    jsonsl_span_t span;
+    jsonsl_index_t idx;
+    jsonsl_t jsn = jsonsl_new(64);
+    double begin, t_build, t_load, t_rebuild, t_first, t_update, elapsed[2];
+    int fd, ii;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &nqueries);
+    }
+    buf = make_doc(&nbuf);
+    fd = mkstemp(docpath);
+    if (fd < 0 || write(fd, buf, nbuf) != (ssize_t)nbuf) {
+        perror(docpath);
+        exit(EXIT_FAILURE);
+    }
+    sprintf(idxpath, "%s.idx", docpath);
+
+    begin = now_sec();
+    idx = build_index(buf, nbuf);
+    if (jsonsl_index_save(idx, idxpath) != 0) {
+        fprintf(stderr, "Couldn't build the index\n");
+        exit(EXIT_FAILURE);
+    }
+    jsonsl_index_destroy(idx);
+    t_build = now_sec() - begin;
+    begin = now_sec();
+    idx = jsonsl_index_load(idxpath);
+    if (!idx) {
+        perror(idxpath);
+        exit(EXIT_FAILURE);
+    }
+    t_load = now_sec() - begin;
+
+    /* Reparse the whole document for each query */
+    srand(42);
+    begin = now_sec();
+    for (ii = 0; ii < nqueries; ii++) {
+        jsonsl_jpr_set_t set;
+        sprintf(path, "/products/sku-%06d/price", rand() % NPRODUCTS);
+        set = make_set(path);
+        nspans = 1;
+        check(jsonsl_extract_with(jsn, buf, nbuf, set, &span, &nspans), nspans);
+        sum[0] += span.pos_end - span.pos_begin;
+        jsonsl_jpr_set_destroy(set);
+    }
+    elapsed[0] = now_sec() - begin;
+
+    /* Look the product up, read it, and extract the price from it */
+    srand(42);
+    begin = now_sec();
+    for (ii = 0; ii < nqueries; ii++) {
+        jsonsl_jpr_t jpr;
+        size_t len;
+        sprintf(path, "/products/sku-%06d/price", rand() % NPRODUCTS);
+        jpr = jsonsl_jpr_new(path, NULL);
+        if (jsonsl_index_lookup(idx, jpr, &span) != JSONSL_MATCH_POSSIBLE ||
+                span.level != 3) {
+            fprintf(stderr, "Lookup of %s failed\n", path);
+            exit(EXIT_FAILURE);
+        }
+        jsonsl_jpr_destroy(jpr);
+        len = span.pos_end - span.pos_begin;
+        if (len > 4096 || pread(fd, range, len, span.pos_begin) != (ssize_t)len) {
+            perror("pread");
+            exit(EXIT_FAILURE);
+        }
+        nspans = 1;
+        check(jsonsl_extract_with(jsn, range, len, price, &span, &nspans), nspans);
+        sum[1] += span.pos_end - span.pos_begin;
+    }
+    elapsed[1] = now_sec() - begin;
+
+    if (sum[0] != sum[1]) {
+        fprintf(stderr, "Mismatch: %lu vs %lu characters\n",
+                (unsigned long)sum[0], (unsigned long)sum[1]);
+        exit(EXIT_FAILURE);
+    }
+    printf("%d products, %lu bytes, %d queries\n", NPRODUCTS,
+           (unsigned long)nbuf, nqueries);
+    printf("  index: built and saved in %.1f ms, loaded in %.1f ms\n",
+           t_build * 1e3, t_load * 1e3);
+    printf("  reparse: %10.1f us/query\n", elapsed[0] * 1e6 / nqueries);
+    printf("  index:   %10.1f us/query\n", elapsed[1] * 1e6 / nqueries);
+
+    begin = now_sec();
+    jsonsl_index_destroy(build_index(buf, nbuf));
+    t_rebuild = now_sec() - begin;
+    t_update = run_edits(idx, buf, &nbuf, nqueries + 1, &t_first);
+    printf("%d edits\n", nqueries + 1);
+    printf("  rebuild: %10.1f us/edit\n", t_rebuild * 1e6);
+    printf("  update:  %10.1f us (first), %.1f us/edit\n", t_first * 1e6,
+           t_update * 1e6 / nqueries);
+
+    jsonsl_index_destroy(idx);
+    jsonsl_jpr_set_destroy(price);
+    jsonsl_destroy(jsn);
+    close(fd);
+    unlink(docpath);
+    unlink(idxpath);
+    free(range);
+    free(buf);
+    return 0;
+}
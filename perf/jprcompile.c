@@ -0,0 +1,112 @@
+/**
+ * Measures how quickly RFC 6901 JSON Pointers are compiled into JPRs, as
+ * happens when a service compiles the pointers it is sent for every request.
+ * The baseline translates each pointer into jsonsl_jpr_new() syntax first
+ * (~1 and ~0 unescaped, then '%', '/', '^' and ':' percent-escaped), which is
+ * what callers had to do before jsonsl_jpr_new_pointer(); this is compared
+ * against compiling the pointer directly.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 200000
+
+static const char *Pointers[] = {
+    "/realm/name",
+    "/alliance/auctions/0/owner",
+    "/horde/auctions/125/buyout",
+    "/statuses/12/user/screen_name",
+    "/statuses/12/entities/urls/0/expanded_url",
+    "/paths/~1users~1{id}/get/responses/200",
+    "/definitions/a~0b/properties/x:y",
+    "/data/items/-",
+    "",
+    NULL
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Rewrite a pointer in the syntax of jsonsl_jpr_new() */
+static char *
+translate(const char *ptr)
+{
+    char *ret = malloc(strlen(ptr) * 3 + 2), *outp = ret;
+    const char *tok;
+
+    if (!*ptr) {
+        strcpy(ret, "/");
+        return ret;
+    }
+    for (tok = ptr; *tok; ) {
+        const char *begin = ++tok;
+        *outp++ = '/';
+        for (; *tok && *tok != '/'; tok++) {
+            char c = *tok;
+            if (c == '~') {
+                c = *++tok == '1' ? '/' : '~';
+            }
+            if (c == '%' || c == '/' || c == ':' ||
+                    (c == '^' && tok == begin && (!tok[1] || tok[1] == '/'))) {
+                outp += sprintf(outp, "%%%02X", (unsigned char)c);
+            } else {
+                *outp++ = c;
+            }
+        }
+    }
+    *outp = '\0';
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    size_t npointers, ii;
+    double elapsed[2];
+    int mode, iter;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    for (npointers = 0; Pointers[npointers]; npointers++) {
+    }
+
+    for (mode = 0; mode < 2; mode++) {
+        double begin = now_sec();
+        for (iter = 0; iter < iterations; iter++) {
+            for (ii = 0; ii < npointers; ii++) {
+                jsonsl_jpr_t jpr;
+                if (mode == 0) {
+                    char *path = translate(Pointers[ii]);
+                    jpr = jsonsl_jpr_new(path, NULL);
+                    free(path);
+                } else {
+                    jpr = jsonsl_jpr_new_pointer(Pointers[ii], NULL);
+                }
+                if (!jpr) {
+                    fprintf(stderr, "Couldn't compile %s\n", Pointers[ii]);
+                    exit(EXIT_FAILURE);
+                }
+                jsonsl_jpr_destroy(jpr);
+            }
+        }
+        elapsed[mode] = now_sec() - begin;
+    }
+
+    printf("%lu pointers, %d iterations\n", (unsigned long)npointers,
+           iterations);
+    printf("  translated: %8.1f ns/pointer\n",
+           elapsed[0] * 1e9 / ((double)iterations * npointers));
+    printf("  native:     %8.1f ns/pointer\n",
+           elapsed[1] * 1e9 / ((double)iterations * npointers));
+    return 0;
+}
@@ -0,0 +1,308 @@
+/**
+ * Measures matching a growing number of JSONPointer paths while lexing,
+ * using per-lexer match state (jsonsl_jpr_match_state()), a compiled
+ * path set (jsonsl_jpr_set_match_state()), and the same set in query mode,
+ * where subtrees which can't match are skipped rather than lexed.
+ *
+ * The paths select fields of the entries of the auction document shipped
+ * in json_samples.tgz; most of them never complete, which is the common case
+ * when a caller registers many paths against a stream. A last run selects
+ * a few values from the small sections of the document, so that most of it
+ * can be skipped, one takes the first entries of each faction with slices,
+ * so that the rest of each list is skipped, and one more stops as soon as
+ * its paths are satisfied.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 5
+
+static const char *Fields[] = {
+    "auc", "item", "owner", "bid", "buyout", "quantity", "timeLeft", NULL
+};
+static const char *Factions[] = { "alliance", "horde", "neutral" };
+static const char *Selective[] = {
+    "/realm/name", "/neutral/auctions/0/owner", "/neutral/auctions/^/bid", NULL
+};
+static const char *Sliced[] = {
+    "/alliance/auctions/:10/owner", "/horde/auctions/:10/owner",
+    "/neutral/auctions/:10/owner", NULL
+};
+static const char *Header[] = { "/realm/name", "/realm/slug", NULL };
+
+struct bench_ctx {
+    const char *buf;
+    const char *hkey;
+    size_t nhkey;
+    size_t nmatches;
+    int mode;
+};
+
+enum { MODE_STATE, MODE_SET, MODE_QUERY, MODE_MAX };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    jsonsl_jpr_match_t match;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    if (ctx->mode == MODE_QUERY) {
+        const size_t *ids;
+        size_t nids;
+        if (jsonsl_jpr_set_last_match(jsn, &ids, &nids) ==
+                JSONSL_MATCH_COMPLETE) {
+            ctx->nmatches++;
+        }
+        return;
+    } else if (ctx->mode == MODE_SET) {
+        const size_t *ids;
+        size_t nids;
+        match = jsonsl_jpr_set_match_state(jsn, state, ctx->hkey, ctx->nhkey,
+                                           &ids, &nids);
+    } else {
+        jsonsl_jpr_match_state(jsn, state, ctx->hkey, ctx->nhkey, &match);
+    }
+    if (match == JSONSL_MATCH_COMPLETE) {
+        ctx->nmatches++;
+    }
+    if (state->type != JSONSL_T_OBJECT && state->type != JSONSL_T_LIST) {
+        return;
+    }
+    if (match == JSONSL_MATCH_NOMATCH || match == JSONSL_MATCH_COMPLETE) {
+        state->ignore_callback = 1;
+    }
+}
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->hkey = ctx->buf + state->pos_begin + 1;
+        ctx->nhkey = jsn->pos - state->pos_begin - 1;
+    }
+}
+
+static char *
+read_file(const char *path, size_t *len)
+{
+    struct stat sb;
+    FILE *fh;
+    char *buf;
+    if (stat(path, &sb) != 0 || (fh = fopen(path, "rb")) == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    buf = malloc(sb.st_size);
+    if (fread(buf, 1, sb.st_size, fh) != (size_t)sb.st_size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fh);
+    *len = sb.st_size;
+    return buf;
+}
+
+/* The first paths select real fields; the rest are fields which don't
+ * exist, spread over the three factions. If 'fixed' is given, those paths
+ * are used instead */
+static jsonsl_jpr_t *
+make_paths(size_t npaths, const char **fixed)
+{
+    jsonsl_jpr_t *jprs = malloc(sizeof(*jprs) * npaths);
+    size_t ii, nfields;
+    for (nfields = 0; Fields[nfields]; nfields++) {
+    }
+    for (ii = 0; ii < npaths; ii++) {
+        char path[128];
+        if (fixed) {
+            strcpy(path, fixed[ii]);
+        } else if (ii < nfields) {
+            sprintf(path, "/alliance/auctions/^/%s", Fields[ii]);
+        } else {
+            sprintf(path, "/%s/auctions/^/k%lu",
+                    Factions[ii % 3], (unsigned long)ii);
+        }
+        jprs[ii] = jsonsl_jpr_new_extended(path, NULL);
+        if (!jprs[ii]) {
+            fprintf(stderr, "Couldn't parse %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return jprs;
+}
+
+static void
+run(const char *buf, size_t nbuf, size_t npaths, const char **fixed,
+    int iterations)
+{
+    jsonsl_jpr_t *jprs = make_paths(npaths, fixed);
+    jsonsl_jpr_set_t set = jsonsl_jpr_set_new(jprs, npaths, NULL);
+    struct bench_ctx ctx;
+    double elapsed[MODE_MAX];
+    size_t nmatches[MODE_MAX], legacy_mem = 0, bitset_mem = 0;
+    int mode, ii;
+
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        double begin = now_sec();
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.buf = buf;
+        ctx.mode = mode;
+        for (ii = 0; ii < iterations; ii++) {
+            jsonsl_t jsn = jsonsl_new(64);
+            jsn->error_callback = error_callback;
+            jsn->action_callback_PUSH = push_callback;
+            jsn->action_callback_POP = pop_callback;
+            jsonsl_enable_all_callbacks(jsn);
+            jsn->data = &ctx;
+            if (mode != MODE_STATE) {
+                jsonsl_jpr_set_attach(jsn, set);
+                jsn->options.query = mode == MODE_QUERY;
+            } else {
+                jsonsl_jpr_match_state_init(jsn, jprs, npaths);
+                /* What a table of njprs size_t's for every level used to
+                 * cost, against the bitsets */
+                legacy_mem = npaths * jsn->levels_max * sizeof(size_t);
+                bitset_mem = jsn->jpr_nlevels * jsn->jpr_nwords *
+                        sizeof(unsigned long);
+            }
+            jsonsl_feed(jsn, buf, nbuf);
+            if (mode == MODE_STATE) {
+                jsonsl_jpr_match_state_cleanup(jsn);
+            }
+            jsonsl_destroy(jsn);
+        }
+        elapsed[mode] = now_sec() - begin;
+        nmatches[mode] = ctx.nmatches;
+    }
+
+    if (nmatches[MODE_SET] != nmatches[MODE_STATE] ||
+            nmatches[MODE_QUERY] != nmatches[MODE_STATE]) {
+        fprintf(stderr, "Mismatch: %lu vs %lu vs %lu matches\n",
+                (unsigned long)nmatches[MODE_STATE],
+                (unsigned long)nmatches[MODE_SET],
+                (unsigned long)nmatches[MODE_QUERY]);
+        exit(EXIT_FAILURE);
+    }
+    printf("%6lu paths  state: %8lu B (was %8lu B)  %7.1f MB/sec  "
+           "set: %7.1f MB/sec  query: %7.1f MB/sec\n",
+           (unsigned long)npaths, (unsigned long)bitset_mem,
+           (unsigned long)legacy_mem,
+           (double)nbuf * iterations / (1024 * 1024) / elapsed[MODE_STATE],
+           (double)nbuf * iterations / (1024 * 1024) / elapsed[MODE_SET],
+           (double)nbuf * iterations / (1024 * 1024) / elapsed[MODE_QUERY]);
+
+    jsonsl_jpr_set_destroy(set);
+    for (ii = 0; (size_t)ii < npaths; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+    free(jprs);
+}
+
+/* Query mode with query_stop, for paths near the beginning of the input */
+static void
+run_stop(const char *buf, size_t nbuf, const char **paths, int iterations)
+{
+    jsonsl_jpr_t *jprs;
+    jsonsl_jpr_set_t set;
+    struct bench_ctx ctx;
+    size_t npaths, nread = 0;
+    double begin;
+    int ii;
+
+    for (npaths = 0; paths[npaths]; npaths++) {
+    }
+    jprs = make_paths(npaths, paths);
+    set = jsonsl_jpr_set_new(jprs, npaths, NULL);
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mode = MODE_QUERY;
+
+    begin = now_sec();
+    for (ii = 0; ii < iterations; ii++) {
+        jsonsl_t jsn = jsonsl_new(64);
+        jsn->error_callback = error_callback;
+        jsn->action_callback_PUSH = push_callback;
+        jsonsl_enable_all_callbacks(jsn);
+        jsn->data = &ctx;
+        jsn->options.query = jsn->options.query_stop = 1;
+        jsonsl_jpr_set_attach(jsn, set);
+        jsonsl_feed(jsn, buf, nbuf);
+        if (!jsonsl_jpr_set_satisfied(jsn)) {
+            fprintf(stderr, "Paths were not satisfied\n");
+            exit(EXIT_FAILURE);
+        }
+        nread = jsn->pos + 1;
+        jsonsl_destroy(jsn);
+    }
+    printf("%6lu paths  stopped after %lu of %lu bytes, %.2f usec/document\n",
+           (unsigned long)npaths, (unsigned long)nread, (unsigned long)nbuf,
+           (now_sec() - begin) * 1e6 / iterations);
+
+    jsonsl_jpr_set_destroy(set);
+    for (ii = 0; (size_t)ii < npaths; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+    free(jprs);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t counts[] = { 1, 10, 100, 500, 1000, 0 };
+    int iterations = DEFAULT_ITERATIONS;
+    size_t nbuf, ii;
+    char *buf;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: FILE [ITERATIONS]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        sscanf(argv[2], "%d", &iterations);
+    }
+    buf = read_file(argv[1], &nbuf);
+    printf("%s: %lu bytes, %d iterations\n",
+           argv[1], (unsigned long)nbuf, iterations);
+    for (ii = 0; counts[ii]; ii++) {
+        run(buf, nbuf, counts[ii], NULL, iterations);
+    }
+    for (ii = 0; Selective[ii]; ii++) {
+    }
+    printf("Selective:\n");
+    run(buf, nbuf, ii, Selective, iterations);
+    for (ii = 0; Sliced[ii]; ii++) {
+    }
+    printf("Slices:\n");
+    run(buf, nbuf, ii, Sliced, iterations);
+    printf("Early stop:\n");
+    run_stop(buf, nbuf, Header, iterations);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,195 @@
+/**
+ * Matches a few fields of wide rows, whose keys are all the same length
+ * ("field_0000" through "field_0199"), against a handful of paths with
+ * jsonsl_jpr_match_state(), which hashes the key it is passed once and
+ * compares that against the hash each path component is compiled with. The
+ * baseline clears those hashes, so that every key of the right length is
+ * compared as text; this is compared against the same paths with their
+ * hashes, and against
+ * case-insensitive ([i]) and glob ([g]) versions of them which select the
+ * same fields.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 200
+#define NROWS 500
+#define NFIELDS 200
+
+static const char *Fields[] = {
+    "field_0007", "field_0042", "field_0099", "field_0150", "field_0198",
+    "field_1000", NULL
+};
+
+struct bench_ctx {
+    const char *buf;
+    const char *hkey;
+    size_t nhkey;
+    size_t nmatches;
+};
+
+enum { MODE_TEXT, MODE_HASH, MODE_ICASE, MODE_GLOB, MODE_MAX };
+static const char *ModeNames[] = { "text", "hash", "icase", "glob" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    jsonsl_jpr_match_t match;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    if (jsonsl_jpr_match_state(jsn, state, ctx->hkey, ctx->nhkey, &match)) {
+        ctx->nmatches++;
+    }
+}
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->hkey = ctx->buf + state->pos_begin + 1;
+        ctx->nhkey = jsn->pos - state->pos_begin - 1;
+    }
+}
+
+static jsonsl_jpr_t
+make_path(const char *field, int mode)
+{
+    char path[64];
+    jsonsl_jpr_t jpr;
+    size_t ii;
+
+    if (mode == MODE_ICASE) {
+        char *outp = path + sprintf(path, "/rows/^/");
+        for (; *field; field++) {
+            *outp++ = *field >= 'a' && *field <= 'z' ?
+                    *field - 'a' + 'A' : *field;
+        }
+        strcpy(outp, "[i]");
+    } else {
+        sprintf(path, "/rows/^/%s%s", field, mode == MODE_GLOB ? "*[g]" : "");
+    }
+    jpr = jsonsl_jpr_new_extended(path, NULL);
+    if (!jpr) {
+        fprintf(stderr, "Couldn't parse %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (mode == MODE_TEXT) {
+        for (ii = 0; ii < jpr->ncomponents; ii++) {
+            jpr->components[ii].key_hash = 0;
+        }
+    }
+    return jpr;
+}
+
+static char *
+make_doc(size_t *len)
+{
+    char *buf = malloc(NROWS * NFIELDS * 24 + 32), *outp = buf;
+    int row, field;
+
+    outp += sprintf(outp, "{\"rows\": [");
+    for (row = 0; row < NROWS; row++) {
+        outp += sprintf(outp, "%s{", row ? ", " : "");
+        for (field = 0; field < NFIELDS; field++) {
+            outp += sprintf(outp, "%s\"field_%04d\": %d",
+                            field ? ", " : "", field, row * field);
+        }
+        *outp++ = '}';
+    }
+    outp += sprintf(outp, "]}");
+    *len = outp - buf;
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    size_t nbuf, njprs, nmatches[MODE_MAX], ii;
+    double elapsed[MODE_MAX];
+    jsonsl_jpr_t jprs[8];
+    char *buf;
+    jsonsl_t jsn;
+    int mode, iter;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    buf = make_doc(&nbuf);
+    jsn = jsonsl_new(64);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = push_callback;
+    jsn->action_callback_POP = pop_callback;
+
+    printf("%d rows of %d fields, %lu bytes, %d iterations\n",
+           NROWS, NFIELDS, (unsigned long)nbuf, iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        struct bench_ctx ctx;
+        double begin;
+
+        for (njprs = 0; Fields[njprs]; njprs++) {
+            jprs[njprs] = make_path(Fields[njprs], mode);
+        }
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.buf = buf;
+        jsn->data = &ctx;
+        begin = now_sec();
+        for (iter = 0; iter < iterations; iter++) {
+            jsonsl_reset(jsn);
+            jsonsl_enable_all_callbacks(jsn);
+            jsonsl_jpr_match_state_init(jsn, jprs, njprs);
+            jsonsl_feed(jsn, buf, nbuf);
+            jsonsl_jpr_match_state_cleanup(jsn);
+        }
+        elapsed[mode] = now_sec() - begin;
+        nmatches[mode] = ctx.nmatches;
+        for (ii = 0; ii < njprs; ii++) {
+            jsonsl_jpr_destroy(jprs[ii]);
+        }
+    }
+
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        if (nmatches[mode] != nmatches[MODE_TEXT]) {
+            fprintf(stderr, "Mismatch: %s found %lu, %s found %lu\n",
+                    ModeNames[MODE_TEXT], (unsigned long)nmatches[MODE_TEXT],
+                    ModeNames[mode], (unsigned long)nmatches[mode]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        printf("  %-5s %8.1f MB/sec  %6lu matches\n", ModeNames[mode],
+               (double)nbuf * iterations / (1024 * 1024) / elapsed[mode],
+               (unsigned long)nmatches[mode] / iterations);
+    }
+
+    jsonsl_destroy(jsn);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * Reads a few fields out of each of many wide documents (a record with 200
+ * fields, a fifth of them nested), as a service picking out the fields it
+ * routes on would. Parsing each document into a (reused) tape, which decodes
+ * all of it, is compared against a lazy document reading the same fields,
+ * and against a lazy document reading every field.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 10
+#define NDOCS 2000
+#define NFIELDS 200
+
+enum { MODE_TAPE, MODE_LAZY, MODE_LAZY_ALL, MODE_MAX };
+static const char *ModeNames[] = {
+    "tape, 5 fields", "lazy, 5 fields", "lazy, all fields"
+};
+
+static const char *Fields[] = { "f3", "f50", "f101", "f152", "f199" };
+#define NREAD (sizeof(Fields) / sizeof(Fields[0]))
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+make_doc(int docno, size_t *len)
+{
+    char *buf = malloc(NFIELDS * 128 + 8), *outp = buf;
+    int ii;
+
+    *outp++ = '{';
+    for (ii = 0; ii < NFIELDS; ii++) {
+        outp += sprintf(outp, "%s\"f%d\": ", ii ? ", " : "", ii);
+        if (ii % 5 == 0) {
+            outp += sprintf(outp, "{\"when\": %d, \"tags\": [\"a\", \"b\"]}",
+                            docno + ii);
+        } else if (ii % 5 == 1) {
+            outp += sprintf(outp, "\"value \\\"%d\\\" of %d\"", ii, docno);
+        } else if (ii % 5 == 2) {
+            outp += sprintf(outp, "%d.%02d", docno, ii % 100);
+        } else {
+            outp += sprintf(outp, "%d", docno * NFIELDS + ii);
+        }
+    }
+    *outp++ = '}';
+    *len = outp - buf;
+    return buf;
+}
+
+/* A number for a value, to check that each mode read the same ones */
+static double
+value_of(jsonsl_type_t type, size_t len, double num)
+{
+    return type == JSONSL_T_SPECIAL ? num : (double)len;
+}
+
+static double
+read_tape(jsonsl_tape_t tape, const char *buf, size_t nbuf)
+{
+    double sum = 0;
+    size_t ii, node, len;
+
+    if (jsonsl_tape_parse(tape, buf, nbuf) != JSONSL_ERROR_SUCCESS) {
+        fprintf(stderr, "Couldn't parse the document\n");
+        exit(EXIT_FAILURE);
+    }
+    for (ii = 0; ii < NREAD; ii++) {
+        node = jsonsl_tape_lookup(tape, 0, Fields[ii], strlen(Fields[ii]));
+        if (jsonsl_tape_type(tape, node) == JSONSL_T_STRING) {
+            jsonsl_tape_string(tape, node, &len);
+        } else {
+            len = jsonsl_tape_size(tape, node);
+        }
+        sum += value_of(jsonsl_tape_type(tape, node), len,
+                        jsonsl_tape_double(tape, node));
+    }
+    return sum;
+}
+
+static double
+read_lazy(jsonsl_lazy_t lazy, int all, const char *buf, size_t nbuf)
+{
+    double sum = 0;
+    size_t ii, node, len;
+
+    if (jsonsl_lazy_parse(lazy, buf, nbuf) != JSONSL_ERROR_SUCCESS) {
+        fprintf(stderr, "Couldn't parse the document\n");
+        exit(EXIT_FAILURE);
+    }
+    for (ii = 0; ii < (all ? NFIELDS : NREAD); ii++) {
+        if (all) {
+            node = jsonsl_lazy_at(lazy, 0, ii);
+            jsonsl_lazy_key(lazy, node, &len);
+        } else {
+            node = jsonsl_lazy_lookup(lazy, 0, Fields[ii], strlen(Fields[ii]));
+        }
+        if (jsonsl_lazy_type(lazy, node) == JSONSL_T_STRING) {
+            jsonsl_lazy_string(lazy, node, &len);
+        } else {
+            len = jsonsl_lazy_size(lazy, node);
+        }
+        sum += value_of(jsonsl_lazy_type(lazy, node), len,
+                        jsonsl_lazy_double(lazy, node));
+    }
+    if (jsonsl_lazy_error(lazy) != JSONSL_ERROR_SUCCESS) {
+        fprintf(stderr, "Got error %s\n",
+                jsonsl_strerror(jsonsl_lazy_error(lazy)));
+        exit(EXIT_FAILURE);
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS, mode, iter, ii;
+    char *docs[NDOCS];
+    size_t lens[NDOCS], total = 0;
+    jsonsl_tape_t tape = jsonsl_tape_new();
+    jsonsl_lazy_t lazy = jsonsl_lazy_new();
+    double elapsed[MODE_MAX], sum[MODE_MAX];
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    for (ii = 0; ii < NDOCS; ii++) {
+        docs[ii] = make_doc(ii, &lens[ii]);
+        total += lens[ii];
+    }
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        double begin = now_sec();
+        for (iter = 0; iter < iterations; iter++) {
+            sum[mode] = 0;
+            for (ii = 0; ii < NDOCS; ii++) {
+                sum[mode] += mode == MODE_TAPE ?
+                        read_tape(tape, docs[ii], lens[ii]) :
+                        read_lazy(lazy, mode == MODE_LAZY_ALL,
+                                  docs[ii], lens[ii]);
+            }
+        }
+        elapsed[mode] = now_sec() - begin;
+    }
+
+    if (sum[MODE_LAZY] != sum[MODE_TAPE]) {
+        fprintf(stderr, "Mismatch: %s read %f, %s read %f\n",
+                ModeNames[MODE_TAPE], sum[MODE_TAPE], ModeNames[MODE_LAZY],
+                sum[MODE_LAZY]);
+        exit(EXIT_FAILURE);
+    }
+    printf("%d documents of %d fields, %lu bytes, %d iterations\n",
+           NDOCS, NFIELDS, (unsigned long)total, iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        printf("  %-16s %8.1f MB/sec\n", ModeNames[mode],
+               (double)total * iterations / (1024 * 1024) / elapsed[mode]);
+    }
+
+    for (ii = 0; ii < NDOCS; ii++) {
+        free(docs[ii]);
+    }
+    jsonsl_lazy_destroy(lazy);
+    jsonsl_tape_destroy(tape);
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Formats numbers as a serializer does. Doubles are formatted with
+ * printf("%.17g"), which always reads back but writes 0.1 as
+ * 0.10000000000000001, and with jsonsl_format_double(), which writes
+ * digits that read back, usually as few as do; integers with printf, a digit at a time,
+ * and with jsonsl_format_int(). Each set is checked to read back as the
+ * numbers it came from.
+ *
+ * The doubles are of three kinds: prices (two decimal places, as in a
+ * document of orders), measurements (a few significant digits at all sorts
+ * of scales) and random bit patterns, which mostly need all 17 digits.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 20
+#define NNUMBERS 100000
+
+enum { SET_PRICES, SET_MEASURES, SET_RANDOM, SET_MAX };
+static const char *SetNames[] = { "prices", "measures", "random" };
+
+enum { MODE_PRINTF, MODE_DIGITS, MODE_JSONSL, MODE_MAX };
+static const char *DoubleModeNames[] = { "%.17g", NULL, "jsonsl" };
+static const char *IntModeNames[] = { "%ld", "digits", "jsonsl" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void
+make_doubles(int set, double *values)
+{
+    uint64_t state = 88172645;
+    int ii;
+
+    for (ii = 0; ii < NNUMBERS; ii++) {
+        uint64_t bits = next_random(&state);
+        if (set == SET_PRICES) {
+            values[ii] = (double)(bits % 100000) / 100;
+        } else if (set == SET_MEASURES) {
+            values[ii] = (double)(bits % 10000) *
+                    (bits & 0x10000 ? 1e-6 : 1e3);
+        } else {
+            memcpy(&values[ii], &bits, sizeof(values[ii]));
+            if (values[ii] != values[ii] || values[ii] - values[ii] != 0) {
+                values[ii] = 0;
+            }
+        }
+    }
+}
+
+/* The integers a document has: mostly small, with some ids and times */
+static void
+make_ints(int64_t *values)
+{
+    uint64_t state = 88172645;
+    int ii;
+
+    for (ii = 0; ii < NNUMBERS; ii++) {
+        uint64_t bits = next_random(&state);
+        values[ii] = (int64_t)(bits >> (bits % 4 * 16)) / 2;
+    }
+}
+
+static size_t
+format_digits(int64_t value, char *buf)
+{
+    char digits[24], *p = digits + sizeof(digits);
+    int neg = value < 0;
+    size_t len;
+
+    do {
+        int digit = (int)(value % 10);
+        *--p = (char)('0' + (neg ? -digit : digit));
+        value /= 10;
+    } while (value);
+    if (neg) {
+        *--p = '-';
+    }
+    len = digits + sizeof(digits) - p;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return len;
+}
+
+/* Format all the numbers into 'out', one after another, separated by NULs.
+ * Returns the length of the text without them */
+static size_t
+run_doubles(int mode, const double *values, char *out)
+{
+    size_t total = 0, len;
+    int ii;
+
+    for (ii = 0; ii < NNUMBERS; ii++) {
+        if (mode == MODE_PRINTF) {
+            len = sprintf(out, "%.17g", values[ii]);
+        } else {
+            len = jsonsl_format_double(values[ii], out);
+        }
+        out += len + 1;
+        total += len;
+    }
+    return total;
+}
+
+static size_t
+run_ints(int mode, const int64_t *values, char *out)
+{
+    size_t total = 0, len;
+    int ii;
+
+    for (ii = 0; ii < NNUMBERS; ii++) {
+        if (mode == MODE_PRINTF) {
+            len = sprintf(out, "%ld", (long)values[ii]);
+        } else if (mode == MODE_DIGITS) {
+            len = format_digits(values[ii], out);
+        } else {
+            len = jsonsl_format_int(values[ii], out);
+        }
+        out += len + 1;
+        total += len;
+    }
+    return total;
+}
+
+static void
+check(const char *name, const double *doubles, const int64_t *ints,
+      const char *out)
+{
+    int ii;
+    for (ii = 0; ii < NNUMBERS; ii++) {
+        if (doubles ? strtod(out, NULL) != doubles[ii] :
+                strtol(out, NULL, 10) != (long)ints[ii]) {
+            fprintf(stderr, "%s: %s doesn't read back\n", name, out);
+            exit(EXIT_FAILURE);
+        }
+        out += strlen(out) + 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS, set, mode, iter;
+    double *doubles = malloc(NNUMBERS * sizeof(*doubles));
+    int64_t *ints = malloc(NNUMBERS * sizeof(*ints));
+    char *out = malloc(NNUMBERS * JSONSL_NUMBER_BUFSIZE);
+    size_t len = 0;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    printf("%d numbers, %d iterations\n", NNUMBERS, iterations);
+    for (set = 0; set < SET_MAX; set++) {
+        make_doubles(set, doubles);
+        printf("%s\n", SetNames[set]);
+        for (mode = 0; mode < MODE_MAX; mode++) {
+            double begin;
+            if (!DoubleModeNames[mode]) {
+                continue;
+            }
+            begin = now_sec();
+            for (iter = 0; iter < iterations; iter++) {
+                len = run_doubles(mode, doubles, out);
+            }
+            printf("  %-10s %8.1f ns/number, %5.2f characters\n",
+                   DoubleModeNames[mode],
+                   (now_sec() - begin) * 1e9 / iterations / NNUMBERS,
+                   (double)len / NNUMBERS);
+            check(DoubleModeNames[mode], doubles, NULL, out);
+        }
+    }
+
+    make_ints(ints);
+    printf("integers\n");
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        double begin = now_sec();
+        for (iter = 0; iter < iterations; iter++) {
+            len = run_ints(mode, ints, out);
+        }
+        printf("  %-10s %8.1f ns/number, %5.2f characters\n",
+               IntModeNames[mode],
+               (now_sec() - begin) * 1e9 / iterations / NNUMBERS,
+               (double)len / NNUMBERS);
+        check(IntModeNames[mode], NULL, ints, out);
+    }
+
+    free(out);
+    free(ints);
+    free(doubles);
+    return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * Compares a plain read-then-feed loop against the read-ahead pipeline
+ * (jsonsl_reader_run) when reading from a pipe.
+ *
+ * The pipe is fed by a child process which writes the input file,
+ * optionally throttled to a given rate to emulate a slow disk or network.
+ * With the plain loop, I/O and lexing are serialized; with the pipeline the
+ * total time should approach the larger of the two.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <jsonsl.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define NBUFS 8
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+/* Spawn a process writing 'iterations' copies of buf (as a stream of
+ * documents, separated by whitespace) to a pipe, at 'rate' MB/sec (0 for
+ * unlimited). Returns the read end */
+static int
+spawn_producer(const char *buf, size_t nbuf, int iterations, double rate,
+               pid_t *pid)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    if ((*pid = fork()) == 0) {
+        double begin = now_sec(), sent = 0;
+        int ii;
+        close(fds[0]);
+        for (ii = 0; ii < iterations; ii++) {
+            size_t off = 0;
+            while (off < nbuf) {
+                size_t n = nbuf - off < CHUNK_SIZE ? nbuf - off : CHUNK_SIZE;
+                ssize_t nw = write(fds[1], buf + off, n);
+                if (nw <= 0) {
+                    _exit(1);
+                }
+                off += nw;
+                sent += nw;
+                if (rate > 0) {
+                    double due = begin + sent / (rate * 1024 * 1024);
+                    double delay = due - now_sec();
+                    if (delay > 0) {
+                        struct timespec ts;
+                        ts.tv_sec = (time_t)delay;
+                        ts.tv_nsec = (long)((delay - ts.tv_sec) * 1e9);
+                        nanosleep(&ts, NULL);
+                    }
+                }
+            }
+            if (write(fds[1], "\n", 1) != 1) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    return fds[0];
+}
+
+/* Resets the lexer between documents */
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    if (state->level == 1) {
+        /* Keep positions continuous for the reader */
+        size_t pos = jsn->pos;
+        jsonsl_reset(jsn);
+        jsn->pos = pos;
+    }
+}
+
+static jsonsl_t
+new_lexer(void)
+{
+    jsonsl_t jsn = jsonsl_new(512);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->call_OBJECT = jsn->call_LIST = 1;
+    return jsn;
+}
+
+static void
+run(const char *name, const char *buf, size_t nbuf, int iterations,
+    double rate, int use_pipeline)
+{
+    pid_t pid;
+    int status;
+    int fd = spawn_producer(buf, nbuf, iterations, rate, &pid);
+    jsonsl_t jsn = new_lexer();
+    double begin = now_sec(), elapsed;
+
+    if (use_pipeline) {
+        jsonsl_reader_t rd = jsonsl_reader_new(fd, CHUNK_SIZE, NBUFS);
+        if (jsonsl_reader_run(rd, jsn) != 0) {
+            perror("jsonsl_reader_run");
+            exit(EXIT_FAILURE);
+        }
+        jsonsl_reader_destroy(rd);
+    } else {
+        char *chunk = malloc(CHUNK_SIZE);
+        ssize_t nr;
+        while ((nr = read(fd, chunk, CHUNK_SIZE)) > 0) {
+            jsonsl_feed(jsn, chunk, nr);
+        }
+        free(chunk);
+    }
+
+    elapsed = now_sec() - begin;
+    waitpid(pid, &status, 0);
+    close(fd);
+    jsonsl_destroy(jsn);
+    printf("%-10s %8.3f sec  %8.1f MB/sec\n", name, elapsed,
+           (double)nbuf * iterations / (1024 * 1024) / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    struct stat sb;
+    FILE *fh;
+    char *buf;
+    int iterations = 10;
+    double rate = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: FILE [ITERATIONS] [PRODUCER_MB_PER_SEC]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        sscanf(argv[2], "%d", &iterations);
+    }
+    if (argc > 3) {
+        sscanf(argv[3], "%lf", &rate);
+    }
+
+    if (stat(argv[1], &sb) != 0 || (fh = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    buf = malloc(sb.st_size);
+    if (fread(buf, 1, sb.st_size, fh) != (size_t)sb.st_size) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fh);
+
+    printf("%d x %lu bytes through a pipe, producer rate: ",
+           iterations, (unsigned long)sb.st_size);
+    if (rate > 0) {
+        printf("%.0f MB/sec\n", rate);
+    } else {
+        printf("unlimited\n");
+    }
+    run("plain", buf, sb.st_size, iterations, rate, 0);
+    run("pipeline", buf, sb.st_size, iterations, rate, 1);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * Selects the elements of a log whose "type" is "error", about one in
+ * twenty. The baseline matches every element with /items/^ in query mode
+ * and compares each element's "type" member in its callbacks, as callers
+ * had to before predicates; this is compared against /items/^[type="error"],
+ * where elements are dropped, and the rest of them skipped, as soon as
+ * their "type" is seen.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 200
+#define NITEMS 10000
+
+struct bench_ctx {
+    const char *buf;
+    const char *hkey;
+    size_t nhkey;
+    size_t nmatches;
+    size_t ncallbacks;
+};
+
+enum { MODE_FILTER, MODE_PREDICATE, MODE_MAX };
+static const char *ModeNames[] = { "filter", "predicate" };
+static const char *Paths[] = { "/items/^", "/items/^[type=\"error\"]" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    ctx->ncallbacks++;
+}
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    ctx->ncallbacks++;
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->hkey = ctx->buf + state->pos_begin + 1;
+        ctx->nhkey = jsn->pos - state->pos_begin - 1;
+    } else if (state->type == JSONSL_T_STRING && state->level == 4 &&
+            ctx->nhkey == 4 && memcmp(ctx->hkey, "type", 4) == 0 &&
+            jsn->pos - state->pos_begin == 6 &&
+            memcmp(ctx->buf + state->pos_begin, "\"error", 6) == 0) {
+        ctx->nmatches++;
+    }
+}
+
+static void
+predicate_callback(jsonsl_t jsn, struct jsonsl_state_st *state, size_t id)
+{
+    struct bench_ctx *ctx = (struct bench_ctx *)jsn->data;
+    ctx->nmatches++;
+}
+
+static char *
+make_doc(size_t *len)
+{
+    char *buf = malloc(NITEMS * 160 + 32), *outp = buf;
+    int ii;
+
+    outp += sprintf(outp, "{\"items\": [");
+    for (ii = 0; ii < NITEMS; ii++) {
+        outp += sprintf(outp,
+                "%s{\"id\": %d, \"type\": \"%s\", \"ts\": %d, "
+                "\"msg\": \"request %d served in %d ms\", "
+                "\"tags\": [\"web\", \"eu-%d\"], \"user\": {\"id\": %d}}",
+                ii ? ", " : "", ii, ii % 20 ? "info" : "error",
+                1500000000 + ii, ii, ii % 97, ii % 4, ii % 1000);
+    }
+    outp += sprintf(outp, "]}");
+    *len = outp - buf;
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    size_t nbuf, nmatches[MODE_MAX], ncallbacks[MODE_MAX];
+    double elapsed[MODE_MAX];
+    char *buf;
+    jsonsl_t jsn;
+    int mode, ii;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    buf = make_doc(&nbuf);
+    jsn = jsonsl_new(64);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = push_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->predicate_callback = predicate_callback;
+
+    printf("%d elements, %lu bytes, %d iterations\n",
+           NITEMS, (unsigned long)nbuf, iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        jsonsl_jpr_t jpr = jsonsl_jpr_new_extended(Paths[mode], NULL);
+        jsonsl_jpr_set_t set = jsonsl_jpr_set_new(&jpr, 1, NULL);
+        struct bench_ctx ctx;
+        double begin = now_sec();
+
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.buf = buf;
+        jsn->data = &ctx;
+        for (ii = 0; ii < iterations; ii++) {
+            jsonsl_reset(jsn);
+            jsonsl_enable_all_callbacks(jsn);
+            jsonsl_jpr_set_attach(jsn, set);
+            jsn->options.query = 1;
+            jsonsl_feed(jsn, buf, nbuf);
+        }
+        elapsed[mode] = now_sec() - begin;
+        nmatches[mode] = ctx.nmatches;
+        ncallbacks[mode] = ctx.ncallbacks;
+        jsonsl_jpr_set_detach(jsn);
+        jsonsl_jpr_set_destroy(set);
+        jsonsl_jpr_destroy(jpr);
+    }
+
+    if (nmatches[MODE_PREDICATE] != nmatches[MODE_FILTER]) {
+        fprintf(stderr, "Mismatch: filter found %lu, predicate found %lu\n",
+                (unsigned long)nmatches[MODE_FILTER],
+                (unsigned long)nmatches[MODE_PREDICATE]);
+        exit(EXIT_FAILURE);
+    }
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        printf("  %-9s %8.1f MB/sec  %6lu matches  %8lu callbacks/iteration\n",
+               ModeNames[mode],
+               (double)nbuf * iterations / (1024 * 1024) / elapsed[mode],
+               (unsigned long)nmatches[mode] / iterations,
+               (unsigned long)ncallbacks[mode] / iterations);
+    }
+
+    jsonsl_destroy(jsn);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * Pages into a large NDJSON file, written to a temporary file. Building the
+ * record index (which only looks for newlines) is compared against lexing
+ * every record, which is what reading the file from the start costs; seeking
+ * to random records with the index is compared against counting newlines
+ * from the start of the file, which is the least any scan must do.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <jsonsl.h>
+
+#define DEFAULT_SEEKS 20
+#define NRECORDS 500000
+#define INTERVAL 1000
+#define WINDOW (1024 * 1024)
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+/* Lex every record of the file, one lexer reset per record. Returns the
+ * number of records */
+static size_t
+lex_file(const char *path, char *buf)
+{
+    FILE *fp = fopen(path, "rb");
+    jsonsl_t jsn = jsonsl_new(64);
+    size_t nread, nrecords = 0;
+
+    jsn->error_callback = error_callback;
+    while ((nread = fread(buf, 1, WINDOW, fp)) > 0) {
+        char *p = buf, *end = buf + nread;
+        while (p < end) {
+            char *nl = memchr(p, '\n', end - p);
+            jsonsl_feed(jsn, p, (nl ? nl : end) - p);
+            if (!nl) {
+                break;
+            }
+            if (jsn->pos) {
+                nrecords++;
+                jsonsl_reset(jsn);
+            }
+            p = nl + 1;
+        }
+    }
+    fclose(fp);
+    jsonsl_destroy(jsn);
+    return nrecords;
+}
+
+/* Count newlines from the start of the file up to record 'recno' */
+static size_t
+scan_to(const char *path, char *buf, size_t recno)
+{
+    FILE *fp = fopen(path, "rb");
+    size_t nread, pos = 0, nrecords = 0;
+
+    while (nrecords < recno && (nread = fread(buf, 1, WINDOW, fp)) > 0) {
+        char *p = buf, *end = buf + nread;
+        while (nrecords < recno &&
+                (p = memchr(p, '\n', end - p)) != NULL) {
+            p++;
+            nrecords++;
+        }
+        pos += (p ? p : end) - buf;
+    }
+    fclose(fp);
+    return pos;
+}
+
+int main(int argc, char **argv)
+{
+    int nseeks = DEFAULT_SEEKS, ii;
+    char docpath[] = "/tmp/jsonsl-recindex-XXXXXX", idxpath[64];
+    char *buf = malloc(WINDOW);
+    size_t nbuf = 0, nrecords, offset;
+    double begin, t_lex, t_build, t_scan, t_seek;
+    jsonsl_recindex_t idx;
+    FILE *fp;
+    int fd;
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &nseeks);
+    }
+    fd = mkstemp(docpath);
+    if (fd < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+        perror(docpath);
+        exit(EXIT_FAILURE);
+    }
+    for (ii = 0; ii < NRECORDS; ii++) {
+        nbuf += fprintf(fp, "{\"id\": %d, \"ts\": %d, \"level\": \"%s\", "
+                        "\"msg\": \"request %d served in %d ms\", "
+                        "\"tags\": [\"web\", \"eu-%d\"], \"user\": {\"id\": %d}}\n",
+                        ii, 1500000000 + ii, ii % 20 ? "info" : "error",
+                        ii, ii % 97, ii % 4, ii % 1000);
+    }
+    fclose(fp);
+    sprintf(idxpath, "%s.idx", docpath);
+
+    begin = now_sec();
+    nrecords = lex_file(docpath, buf);
+    t_lex = now_sec() - begin;
+
+    begin = now_sec();
+    idx = jsonsl_recindex_new(INTERVAL);
+    if (jsonsl_recindex_build_file(idx, docpath) != 0 ||
+            jsonsl_recindex_count(idx) != nrecords ||
+            jsonsl_recindex_save(idx, idxpath) != 0) {
+        fprintf(stderr, "Couldn't build the index\n");
+        exit(EXIT_FAILURE);
+    }
+    t_build = now_sec() - begin;
+    jsonsl_recindex_destroy(idx);
+    idx = jsonsl_recindex_load(idxpath);
+
+    srand(42);
+    begin = now_sec();
+    for (ii = 0, offset = 0; ii < nseeks; ii++) {
+        offset += scan_to(docpath, buf, rand() % NRECORDS);
+    }
+    t_scan = now_sec() - begin;
+
+    srand(42);
+    begin = now_sec();
+    for (ii = 0; ii < nseeks; ii++) {
+        size_t recoff;
+        if (jsonsl_recindex_seek(idx, docpath, rand() % NRECORDS, &recoff) != 0) {
+            perror("jsonsl_recindex_seek");
+            exit(EXIT_FAILURE);
+        }
+        offset -= recoff;
+    }
+    t_seek = now_sec() - begin;
+    if (offset) {
+        fprintf(stderr, "Mismatch between the scanned and indexed offsets\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fp = fopen(idxpath, "rb");
+    fseek(fp, 0, SEEK_END);
+    printf("%lu records, %lu bytes; index of every %dth record: %ld bytes\n",
+           (unsigned long)nrecords, (unsigned long)nbuf, INTERVAL, ftell(fp));
+    fclose(fp);
+    printf("  lex all records: %8.1f MB/sec\n",
+           nbuf / (1024.0 * 1024) / t_lex);
+    printf("  build index:     %8.1f MB/sec\n",
+           nbuf / (1024.0 * 1024) / t_build);
+    printf("  seek by scan:    %10.1f us/seek\n", t_scan * 1e6 / nseeks);
+    printf("  seek by index:   %10.1f us/seek\n", t_seek * 1e6 / nseeks);
+
+    jsonsl_recindex_destroy(idx);
+    unlink(docpath);
+    unlink(idxpath);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * Builds a DOM of a list of order records from the lexer's callbacks, the
+ * way the glib example does (a malloc for every value and key, with each
+ * container's children linked together; plain C stands in for GList and
+ * GHashTable), and then sums a field of every record by looking it up in
+ * each. This is compared against parsing the document into a tape, both
+ * with a new tape each time and with one tape reused, and against lexing it
+ * without building anything.
+ *
+ * Then every key of a wide object (a map of per-user counters) is looked
+ * up, with and without the object's key table.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 10
+#define NRECORDS 50000
+#define NCOUNTERS 20000
+
+struct node_st {
+    jsonsl_type_t type;
+    char *key;
+    char *text;
+    struct node_st *parent;
+    struct node_st *children;
+    struct node_st *last_child;
+    struct node_st *next;
+};
+
+struct dom_ctx {
+    const char *buf;
+    struct node_st *root;
+    struct node_st *cur;
+    char *key;
+};
+
+enum { MODE_LEX, MODE_DOM, MODE_TAPE_NEW, MODE_TAPE, MODE_MAX };
+static const char *ModeNames[] = { "lex", "malloc DOM", "tape (new)", "tape" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err, struct jsonsl_state_st *state,
+               char *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static char *
+copy_text(const char *text, size_t len)
+{
+    char *copy = malloc(len + 1);
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static void
+dom_push(jsonsl_t jsn, jsonsl_action_t action,
+         struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct dom_ctx *ctx = (struct dom_ctx *)jsn->data;
+    struct node_st *node;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    node = calloc(1, sizeof(*node));
+    node->type = (jsonsl_type_t)state->type;
+    node->key = ctx->key;
+    ctx->key = NULL;
+    node->parent = ctx->cur;
+    if (!ctx->cur) {
+        ctx->root = node;
+    } else if (ctx->cur->last_child) {
+        ctx->cur->last_child->next = node;
+        ctx->cur->last_child = node;
+    } else {
+        ctx->cur->children = ctx->cur->last_child = node;
+    }
+    ctx->cur = node;
+}
+
+static void
+dom_pop(jsonsl_t jsn, jsonsl_action_t action,
+        struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct dom_ctx *ctx = (struct dom_ctx *)jsn->data;
+    size_t begin = state->pos_begin;
+
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->key = copy_text(ctx->buf + begin + 1, jsn->pos - begin - 1);
+        return;
+    }
+    if (state->type == JSONSL_T_STRING) {
+        ctx->cur->text = copy_text(ctx->buf + begin + 1, jsn->pos - begin - 1);
+    } else if (state->type == JSONSL_T_SPECIAL) {
+        ctx->cur->text = copy_text(ctx->buf + begin, jsn->pos - begin);
+    }
+    ctx->cur = ctx->cur->parent;
+}
+
+static void
+dom_free(struct node_st *node)
+{
+    while (node) {
+        struct node_st *next = node->next;
+        dom_free(node->children);
+        free(node->key);
+        free(node->text);
+        free(node);
+        node = next;
+    }
+}
+
+static struct node_st *
+dom_lookup(struct node_st *obj, const char *key)
+{
+    struct node_st *node;
+    for (node = obj->children; node; node = node->next) {
+        if (strcmp(node->key, key) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static char *
+make_doc(size_t *len)
+{
+    char *buf = malloc(NRECORDS * 512 + 32), *outp = buf;
+    int ii;
+
+    outp += sprintf(outp, "{\"orders\": [");
+    for (ii = 0; ii < NRECORDS; ii++) {
+        outp += sprintf(outp,
+                "%s{\"id\": %d, \"user\": {\"id\": %d, \"name\": \"user %d\", "
+                "\"email\": \"user%d@example.com\"}, "
+                "\"items\": [{\"sku\": \"A-%d\", \"qty\": %d, \"price\": %d.99}, "
+                "{\"sku\": \"B-%d\", \"qty\": 1, \"price\": 4.50}], "
+                "\"status\": \"%s\", \"paid\": %s, \"coupon\": null, "
+                "\"total\": %d, \"note\": \"Leave it at the \\\"back\\\" door\"}",
+                ii ? ", " : "", ii, ii % 977, ii % 977, ii % 977, ii,
+                ii % 5 + 1, ii % 50, ii % 31, ii % 3 ? "shipped" : "pending",
+                ii % 4 ? "true" : "false", ii % 1000);
+    }
+    outp += sprintf(outp, "]}");
+    *len = outp - buf;
+    return buf;
+}
+
+/* Parse the document, and sum the totals of its orders */
+static long
+run(int mode, jsonsl_t jsn, jsonsl_tape_t tape, const char *buf, size_t nbuf)
+{
+    long sum = 0;
+
+    if (mode == MODE_LEX) {
+        jsonsl_reset(jsn);
+        jsonsl_feed(jsn, buf, nbuf);
+    } else if (mode == MODE_DOM) {
+        struct dom_ctx ctx;
+        struct node_st *order;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.buf = buf;
+        jsonsl_reset(jsn);
+        jsonsl_enable_all_callbacks(jsn);
+        jsn->action_callback_PUSH = dom_push;
+        jsn->action_callback_POP = dom_pop;
+        jsn->data = &ctx;
+        jsonsl_feed(jsn, buf, nbuf);
+        for (order = dom_lookup(ctx.root, "orders")->children; order;
+                order = order->next) {
+            sum += atol(dom_lookup(order, "total")->text);
+        }
+        dom_free(ctx.root);
+        jsn->action_callback_PUSH = NULL;
+        jsn->action_callback_POP = NULL;
+    } else {
+        size_t order;
+        if (mode == MODE_TAPE_NEW) {
+            tape = jsonsl_tape_new();
+        }
+        if (jsonsl_tape_parse(tape, buf, nbuf) != JSONSL_ERROR_SUCCESS) {
+            fprintf(stderr, "Couldn't parse the document\n");
+            exit(EXIT_FAILURE);
+        }
+        for (order = jsonsl_tape_child(tape,
+                    jsonsl_tape_lookup(tape, 0, "orders", 6));
+                order != JSONSL_TAPE_NONE;
+                order = jsonsl_tape_next(tape, order)) {
+            sum += (long)jsonsl_tape_int(tape,
+                    jsonsl_tape_lookup(tape, order, "total", 5));
+        }
+        if (mode == MODE_TAPE_NEW) {
+            jsonsl_tape_destroy(tape);
+        }
+    }
+    return sum;
+}
+
+static char *
+make_counters(size_t *len)
+{
+    char *buf = malloc(NCOUNTERS * 32 + 4), *outp = buf;
+    int ii;
+
+    *outp++ = '{';
+    for (ii = 0; ii < NCOUNTERS; ii++) {
+        outp += sprintf(outp, "%s\"user-%d\": %d", ii ? ", " : "", ii,
+                        ii % 1000);
+    }
+    *outp++ = '}';
+    *len = outp - buf;
+    return buf;
+}
+
+/* Parse the counters, with tables for objects of 'index_min' members, then
+ * look each one up. Returns the seconds taken by the lookups */
+static double
+run_counters(jsonsl_tape_t tape, size_t index_min, const char *buf,
+             size_t nbuf)
+{
+    char key[32];
+    long sum = 0, expected = 0;
+    double begin;
+    int ii;
+
+    jsonsl_tape_set_index_min(tape, index_min);
+    if (jsonsl_tape_parse(tape, buf, nbuf) != JSONSL_ERROR_SUCCESS) {
+        fprintf(stderr, "Couldn't parse the document\n");
+        exit(EXIT_FAILURE);
+    }
+    begin = now_sec();
+    for (ii = 0; ii < NCOUNTERS; ii++) {
+        size_t nkey = sprintf(key, "user-%d", ii);
+        sum += (long)jsonsl_tape_int(tape,
+                jsonsl_tape_lookup(tape, 0, key, nkey));
+        expected += ii % 1000;
+    }
+    if (sum != expected) {
+        fprintf(stderr, "Mismatch: summed %ld, expected %ld\n", sum, expected);
+        exit(EXIT_FAILURE);
+    }
+    return now_sec() - begin;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS, mode, iter;
+    size_t nbuf;
+    char *buf = make_doc(&nbuf);
+    jsonsl_t jsn = jsonsl_new(64);
+    jsonsl_tape_t tape = jsonsl_tape_new();
+    double elapsed[MODE_MAX];
+    long sum[MODE_MAX];
+
+    if (argc > 1) {
+        sscanf(argv[1], "%d", &iterations);
+    }
+    jsn->error_callback = error_callback;
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        double begin = now_sec();
+        for (iter = 0; iter < iterations; iter++) {
+            sum[mode] = run(mode, jsn, tape, buf, nbuf);
+        }
+        elapsed[mode] = now_sec() - begin;
+    }
+
+    for (mode = MODE_TAPE_NEW; mode < MODE_MAX; mode++) {
+        if (sum[mode] != sum[MODE_DOM]) {
+            fprintf(stderr, "Mismatch: %s summed %ld, %s summed %ld\n",
+                    ModeNames[MODE_DOM], sum[MODE_DOM], ModeNames[mode],
+                    sum[mode]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("%d records, %lu bytes, %d iterations\n", NRECORDS,
+           (unsigned long)nbuf, iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        printf("  %-10s %8.1f MB/sec\n", ModeNames[mode],
+               (double)nbuf * iterations / (1024 * 1024) / elapsed[mode]);
+    }
+
+    free(buf);
+    buf = make_counters(&nbuf);
+    printf("%d keys in one object\n", NCOUNTERS);
+    printf("  %-10s %8.2f us/lookup\n", "scan",
+           run_counters(tape, 0, buf, nbuf) * 1e6 / NCOUNTERS);
+    printf("  %-10s %8.2f us/lookup\n", "key table",
+           run_counters(tape, JSONSL_TAPE_INDEX_MIN, buf, nbuf) * 1e6 /
+           NCOUNTERS);
+
+    jsonsl_tape_destroy(tape);
+    jsonsl_destroy(jsn);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,306 @@
+/**
+ * Round-trips the documents of json_samples.tgz: each one is parsed into a
+ * tape once, and then serialized from the tape again and again. A writer
+ * which escapes strings a character at a time (into the same buffer, flushed
+ * the same way) is compared against jsonsl's writer, which looks for
+ * characters to escape a word at a time and copies the runs between them
+ * whole. Both must produce the same output, which must parse back into the
+ * same document.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <jsonsl.h>
+
+#define DEFAULT_ITERATIONS 100
+#define BUFSIZE 4096
+
+enum { MODE_BYTES, MODE_WRITER, MODE_MAX };
+static const char *ModeNames[] = { "bytewise", "writer" };
+
+/* Where the output goes: counted, or kept to be checked */
+struct sink {
+    char *text;
+    size_t len;
+    size_t alloc;
+    int keep;
+};
+
+/* The byte at a time writer, for comparison */
+struct bytes_writer {
+    char buf[BUFSIZE];
+    size_t pos;
+    struct sink *sink;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+flush_sink(void *data, const char *buf, size_t nbuf)
+{
+    struct sink *sink = (struct sink *)data;
+    if (sink->keep) {
+        if (sink->len + nbuf > sink->alloc) {
+            sink->alloc = (sink->len + nbuf) * 2;
+            sink->text = realloc(sink->text, sink->alloc);
+        }
+        memcpy(sink->text + sink->len, buf, nbuf);
+    }
+    sink->len += nbuf;
+    return 0;
+}
+
+static void
+bw_putc(struct bytes_writer *bw, char c)
+{
+    if (bw->pos == BUFSIZE) {
+        flush_sink(bw->sink, bw->buf, bw->pos);
+        bw->pos = 0;
+    }
+    bw->buf[bw->pos++] = c;
+}
+
+static void
+bw_puts(struct bytes_writer *bw, const char *text, size_t ntext)
+{
+    size_t ii;
+    for (ii = 0; ii < ntext; ii++) {
+        bw_putc(bw, text[ii]);
+    }
+}
+
+static void
+bw_string(struct bytes_writer *bw, const char *str, size_t nstr)
+{
+    size_t ii;
+    char esc[8];
+    bw_putc(bw, '"');
+    for (ii = 0; ii < nstr; ii++) {
+        unsigned char c = (unsigned char)str[ii];
+        switch (c) {
+        case '"': bw_puts(bw, "\\\"", 2); break;
+        case '\\': bw_puts(bw, "\\\\", 2); break;
+        case '\b': bw_puts(bw, "\\b", 2); break;
+        case '\f': bw_puts(bw, "\\f", 2); break;
+        case '\n': bw_puts(bw, "\\n", 2); break;
+        case '\r': bw_puts(bw, "\\r", 2); break;
+        case '\t': bw_puts(bw, "\\t", 2); break;
+        default:
+            if (c < 0x20) {
+                sprintf(esc, "\\u%04x", c);
+                bw_puts(bw, esc, 6);
+            } else {
+                bw_putc(bw, (char)c);
+            }
+        }
+    }
+    bw_putc(bw, '"');
+}
+
+/* The text of a number, or of true, false or null */
+static size_t
+special_text(jsonsl_tape_t tape, size_t node, char *text)
+{
+    unsigned flags = jsonsl_tape_special_flags(tape, node);
+    if (flags & JSONSL_SPECIALf_TRUE) {
+        return sprintf(text, "true");
+    } else if (flags & JSONSL_SPECIALf_FALSE) {
+        return sprintf(text, "false");
+    } else if (flags & JSONSL_SPECIALf_NULL) {
+        return sprintf(text, "null");
+    } else if (flags & JSONSL_SPECIALf_NUMNOINT) {
+        return jsonsl_format_double(jsonsl_tape_double(tape, node), text);
+    }
+    return jsonsl_format_int(jsonsl_tape_int(tape, node), text);
+}
+
+static void
+write_bytes(struct bytes_writer *bw, jsonsl_tape_t tape, size_t node)
+{
+    jsonsl_type_t type = jsonsl_tape_type(tape, node);
+    const char *str;
+    char text[JSONSL_NUMBER_BUFSIZE];
+    size_t kid, len;
+
+    if (type == JSONSL_T_OBJECT || type == JSONSL_T_LIST) {
+        bw_putc(bw, type == JSONSL_T_OBJECT ? '{' : '[');
+        for (kid = jsonsl_tape_child(tape, node); kid != JSONSL_TAPE_NONE;
+                kid = jsonsl_tape_next(tape, kid)) {
+            if (kid != jsonsl_tape_child(tape, node)) {
+                bw_putc(bw, ',');
+            }
+            if (type == JSONSL_T_OBJECT) {
+                str = jsonsl_tape_key(tape, kid, &len);
+                bw_string(bw, str, len);
+                bw_putc(bw, ':');
+            }
+            write_bytes(bw, tape, kid);
+        }
+        bw_putc(bw, type == JSONSL_T_OBJECT ? '}' : ']');
+    } else if (type == JSONSL_T_STRING) {
+        str = jsonsl_tape_string(tape, node, &len);
+        bw_string(bw, str, len);
+    } else {
+        bw_puts(bw, text, special_text(tape, node, text));
+    }
+}
+
+static void
+write_writer(jsonsl_writer_t writer, jsonsl_tape_t tape, size_t node)
+{
+    jsonsl_type_t type = jsonsl_tape_type(tape, node);
+    unsigned flags;
+    const char *str;
+    char text[JSONSL_NUMBER_BUFSIZE];
+    size_t kid, len;
+
+    if (type == JSONSL_T_OBJECT || type == JSONSL_T_LIST) {
+        if (type == JSONSL_T_OBJECT) {
+            jsonsl_writer_begin_object(writer);
+        } else {
+            jsonsl_writer_begin_list(writer);
+        }
+        for (kid = jsonsl_tape_child(tape, node); kid != JSONSL_TAPE_NONE;
+                kid = jsonsl_tape_next(tape, kid)) {
+            if (type == JSONSL_T_OBJECT) {
+                str = jsonsl_tape_key(tape, kid, &len);
+                jsonsl_writer_key(writer, str, len);
+            }
+            write_writer(writer, tape, kid);
+        }
+        if (type == JSONSL_T_OBJECT) {
+            jsonsl_writer_end_object(writer);
+        } else {
+            jsonsl_writer_end_list(writer);
+        }
+    } else if (type == JSONSL_T_STRING) {
+        str = jsonsl_tape_string(tape, node, &len);
+        jsonsl_writer_string(writer, str, len);
+    } else {
+        flags = jsonsl_tape_special_flags(tape, node);
+        if (flags & JSONSL_SPECIALf_NUMNOINT) {
+            jsonsl_writer_double(writer, jsonsl_tape_double(tape, node));
+        } else if (flags & JSONSL_SPECIALf_NUMERIC) {
+            jsonsl_writer_int(writer, jsonsl_tape_int(tape, node));
+        } else {
+            jsonsl_writer_raw(writer, text, special_text(tape, node, text));
+        }
+    }
+}
+
+static void
+run(int mode, jsonsl_tape_t tape, struct sink *sink)
+{
+    static char buf[BUFSIZE];
+    static struct bytes_writer bw;
+
+    if (mode == MODE_BYTES) {
+        bw.pos = 0;
+        bw.sink = sink;
+        write_bytes(&bw, tape, 0);
+        flush_sink(sink, bw.buf, bw.pos);
+    } else {
+        jsonsl_writer_t writer = jsonsl_writer_new(JSONSL_TAPE_LEVELS, buf,
+                                                   sizeof(buf), flush_sink,
+                                                   sink);
+        write_writer(writer, tape, 0);
+        if (jsonsl_writer_finish(writer) != JSONSL_ERROR_SUCCESS) {
+            fprintf(stderr, "Couldn't write the document\n");
+            exit(EXIT_FAILURE);
+        }
+        jsonsl_writer_destroy(writer);
+    }
+}
+
+static char *
+read_file(const char *path, size_t *len)
+{
+    struct stat sb;
+    FILE *fh;
+    char *buf;
+    if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+            (fh = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    buf = malloc(sb.st_size);
+    if (fread(buf, 1, sb.st_size, fh) != (size_t)sb.st_size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fh);
+    *len = sb.st_size;
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS, mode, iter, ii, ndocs = 0;
+    jsonsl_tape_t tape = jsonsl_tape_new(), check = jsonsl_tape_new();
+    double elapsed[MODE_MAX] = { 0, 0 };
+    size_t total = 0;
+
+    if (argc < 3 || sscanf(argv[1], "%d", &iterations) != 1) {
+        fprintf(stderr, "Usage: %s ITERATIONS FILE...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (ii = 2; ii < argc; ii++) {
+        struct sink sinks[MODE_MAX];
+        size_t nbuf;
+        char *buf = read_file(argv[ii], &nbuf);
+
+        /* Directories, and documents with NaN and such */
+        if (!buf || jsonsl_tape_parse(tape, buf, nbuf) !=
+                JSONSL_ERROR_SUCCESS) {
+            free(buf);
+            continue;
+        }
+        memset(sinks, 0, sizeof(sinks));
+        for (mode = 0; mode < MODE_MAX; mode++) {
+            double begin;
+            sinks[mode].keep = 1;
+            run(mode, tape, &sinks[mode]);
+            sinks[mode].keep = 0;
+            begin = now_sec();
+            for (iter = 0; iter < iterations; iter++) {
+                sinks[mode].len = 0;
+                run(mode, tape, &sinks[mode]);
+            }
+            elapsed[mode] += now_sec() - begin;
+        }
+        if (sinks[MODE_BYTES].len != sinks[MODE_WRITER].len ||
+                memcmp(sinks[MODE_BYTES].text, sinks[MODE_WRITER].text,
+                       sinks[MODE_BYTES].len) != 0 ||
+                jsonsl_tape_parse(check, sinks[MODE_WRITER].text,
+                                  sinks[MODE_WRITER].len) !=
+                JSONSL_ERROR_SUCCESS ||
+                jsonsl_tape_size(check, 0) != jsonsl_tape_size(tape, 0)) {
+            fprintf(stderr, "%s: the output differs\n", argv[ii]);
+            exit(EXIT_FAILURE);
+        }
+        total += sinks[MODE_WRITER].len;
+        ndocs++;
+        for (mode = 0; mode < MODE_MAX; mode++) {
+            free(sinks[mode].text);
+        }
+        free(buf);
+    }
+
+    printf("%d documents, %lu bytes written, %d iterations\n", ndocs,
+           (unsigned long)total, iterations);
+    for (mode = 0; mode < MODE_MAX; mode++) {
+        printf("  %-10s %8.1f MB/sec\n", ModeNames[mode],
+               (double)total * iterations / (1024 * 1024) / elapsed[mode]);
+    }
+    jsonsl_tape_destroy(check);
+    jsonsl_tape_destroy(tape);
+    return 0;
+}
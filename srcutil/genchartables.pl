@@ -68,6 +68,16 @@ my @string_passthrough;
 $string_passthrough[ord($_)] = 1 for ('\\','"');
 $string_passthrough[$_] = 1 for (0..19);
 
+#Escapes for writing strings: the reverse of @unescapes, with u-escapes for
+#the other control characters
+my @escapes;
+$escapes[$_] = "'u'" for (0..0x1f);
+foreach my $x (grep { defined $unescapes[$_] } (0..$#unescapes)) {
+    $escapes[$unescapes[$x]] = "'" . chr($x) . "'";
+}
+$escapes[ord('"')] = "'\"'";
+$escapes[ord('\\')] = "'\\\\'";
+
 ################################################################################
 ################################################################################
 ### CLI Options                                                              ###
@@ -82,7 +92,8 @@ my %HMap = (
     whitespace => [ undef, \@wstable ],
     unescapes => [undef, \@unescapes],
     allowed_escapes => [ undef, \@allowed_escapes],
-    string_passthrough => [ undef, \@string_passthrough ]
+    string_passthrough => [ undef, \@string_passthrough ],
+    escapes => [ undef, \@escapes ]
 );
 
 my $Table;
@@ -0,0 +1,167 @@
+/**
+ * Checks that jsonsl copes when its allocations fail. The library is built
+ * into this test (as cxxtest does), so that its allocations can be made to
+ * fail on demand.
+ */
+
+/* As jsonsl.c asks for, since the system headers come before it here */
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+static int FailAllocs;
+static int NumReallocs;
+
+static void *
+failing_realloc(void *ptr, size_t size)
+{
+    NumReallocs++;
+    return FailAllocs ? NULL : realloc(ptr, size);
+}
+
+#define realloc failing_realloc
+#include "jsonsl.c"
+#undef realloc
+
+struct query_ctx {
+    int nmatches;
+    int matched_bar;
+};
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err,
+               struct jsonsl_state_st *state, char *at)
+{
+    fprintf(stderr, "Got error %s at %lu\n", jsonsl_strerror(err),
+            (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct query_ctx *ctx = (struct query_ctx *)jsn->data;
+    const size_t *ids;
+    size_t nids;
+
+    if (state->type != JSONSL_T_HKEY && state->level > 1 &&
+            jsonsl_jpr_set_last_match(jsn, &ids, &nids) ==
+            JSONSL_MATCH_COMPLETE) {
+        ctx->nmatches++;
+        ctx->matched_bar += ids[0] == 1;
+    }
+}
+
+/* A key split across buffers is copied when the first one is handed back.
+ * If that copy fails, the key must not be read from the (since reused)
+ * buffer, and its member must match nothing */
+static void
+query_key_test(void)
+{
+    static const char *paths[] = { "/xx*[g]", "/bar" };
+    char chunk[8];
+    jsonsl_jpr_t jprs[2];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    struct query_ctx ctx;
+    size_t ii;
+
+    fprintf(stderr, "==== %-40s ====\n", "query key");
+    for (ii = 0; ii < 2; ii++) {
+        jprs[ii] = jsonsl_jpr_new_extended(paths[ii], NULL);
+        assert(jprs[ii]);
+    }
+    set = jsonsl_jpr_set_new(jprs, 2, NULL);
+    assert(set);
+    jsn = jsonsl_new(8);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = push_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->options.query = 1;
+    jsonsl_jpr_set_attach(jsn, set);
+    memset(&ctx, 0, sizeof(ctx));
+    jsn->data = &ctx;
+
+    memcpy(chunk, "{\"ba", 4);
+    FailAllocs = 1;
+    jsonsl_feed(jsn, chunk, 4);
+    FailAllocs = 0;
+    /* Reusing the buffer would make a borrowed key read "xx", which the
+     * glob (compared by text, not by hash) would match */
+    memcpy(chunk, "{\"xx", 4);
+    jsonsl_feed(jsn, "r\": 1, ", 7);
+    assert(ctx.nmatches == 0);
+
+    /* The next member's key is kept as usual */
+    jsonsl_feed(jsn, "\"bar\": 2}", 9);
+    assert(jsn->level == 0);
+    assert(ctx.nmatches == 1 && ctx.matched_bar == 1);
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+    for (ii = 0; ii < 2; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+}
+
+/* A tape allocates its words and strings once for a document, however
+ * densely packed it is, and not at all when parsing another of the same
+ * size */
+static void
+tape_alloc_test(void)
+{
+    static const struct {
+        const char *elem;
+        char open;
+        char close;
+    } docs[] = {
+        { "0", '[', ']' },
+        { "\"\"", '[', ']' },
+        { "[]", '[', ']' },
+        { "[0]", '[', ']' },
+        { "\"\":0", '{', '}' },
+        { "-1.5e3", '[', ']' }
+    };
+    size_t nelems = 20000, ii, jj;
+    char *buf = malloc(nelems * 8 + 2);
+
+    fprintf(stderr, "==== %-40s ====\n", "tape allocations");
+    for (ii = 0; ii < sizeof(docs) / sizeof(docs[0]); ii++) {
+        jsonsl_tape_t tape = jsonsl_tape_new();
+        size_t nbuf = 0, len = strlen(docs[ii].elem);
+        assert(tape);
+        jsonsl_tape_set_index_min(tape, 0);
+        buf[nbuf++] = docs[ii].open;
+        for (jj = 0; jj < nelems; jj++) {
+            if (jj) {
+                buf[nbuf++] = ',';
+            }
+            memcpy(buf + nbuf, docs[ii].elem, len);
+            nbuf += len;
+        }
+        buf[nbuf++] = docs[ii].close;
+
+        NumReallocs = 0;
+        assert(jsonsl_tape_parse(tape, buf, nbuf) == JSONSL_ERROR_SUCCESS);
+        assert(NumReallocs == 2);
+        NumReallocs = 0;
+        assert(jsonsl_tape_parse(tape, buf, nbuf) == JSONSL_ERROR_SUCCESS);
+        assert(NumReallocs == 0);
+        jsonsl_tape_destroy(tape);
+    }
+    free(buf);
+}
+
+int main(void)
+{
+    query_key_test();
+    tape_alloc_test();
+    return 0;
+}
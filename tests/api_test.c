@@ -5,6 +5,12 @@
 #include <assert.h>
 #include <errno.h>
 #include "all-tests.h"
+#ifdef JSONSL_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef JSONSL_USE_ZSTD
+#include <zstd.h>
+#endif
 
 
 /* "actual" must have at least all the same bits set as "expected" */
@@ -37,6 +43,1024 @@ special_flags_test_pop_callback (jsonsl_t jsn,
 }
 
 
+/* Accumulates a cheap fingerprint of the callback stream */
+struct budget_ctx {
+    unsigned long events;
+    unsigned long sum;
+};
+
+static void
+budget_test_callback (jsonsl_t jsn,
+                      jsonsl_action_t action,
+                      struct jsonsl_state_st *state,
+                      const char *buf)
+{
+    struct budget_ctx *ctx = (struct budget_ctx *) jsn->data;
+    ctx->events++;
+    ctx->sum += (unsigned long) (state->pos_begin * 31 + jsn->pos * 7 +
+                                 state->level + action);
+}
+
+static void
+budget_test (void)
+{
+    const char *doc =
+        "{\"hello\": [1, 22, 333, \"four\", {\"five\": true}],"
+        " \"nested\": {\"a\": {\"b\": [null, false, -1.5e3]}},"
+        " \"long string value\": \"0123456789abcdef0123456789\"}";
+    size_t ndoc = strlen(doc);
+    struct budget_ctx full = { 0, 0 };
+    size_t budget;
+
+    fprintf (stderr, "==== %-40s ====\n", "feed_budget");
+
+    {
+        size_t consumed;
+        jsonsl_t jsn = jsonsl_new(64);
+        jsonsl_enable_all_callbacks (jsn);
+        jsn->action_callback = budget_test_callback;
+        jsn->data = &full;
+        consumed = jsonsl_feed_budget (jsn, doc, ndoc, ndoc + 1);
+        assert (consumed == ndoc);
+        assert (jsn->level == 0);
+        jsonsl_destroy (jsn);
+    }
+
+    for (budget = 1; budget < 17; budget++) {
+        struct budget_ctx sliced = { 0, 0 };
+        const char *cur = doc;
+        size_t remaining = ndoc;
+        jsonsl_t jsn = jsonsl_new(64);
+        jsonsl_enable_all_callbacks (jsn);
+        jsn->action_callback = budget_test_callback;
+        jsn->data = &sliced;
+
+        while (remaining) {
+            size_t consumed = jsonsl_feed_budget (jsn, cur, remaining, budget);
+            assert (consumed == (remaining < budget ? remaining : budget));
+            cur += consumed;
+            remaining -= consumed;
+        }
+        assert (jsn->pos == ndoc);
+        assert (jsn->level == 0);
+        assert (sliced.events == full.events);
+        assert (sliced.sum == full.sum);
+        jsonsl_destroy (jsn);
+    }
+}
+
+static void
+stop_test_callback (jsonsl_t jsn,
+                    jsonsl_action_t action,
+                    struct jsonsl_state_st *state,
+                    const char *buf)
+{
+    if (action == JSONSL_ACTION_PUSH && state->type == JSONSL_T_OBJECT &&
+            state->level == 2) {
+        jsonsl_stop (jsn);
+    }
+}
+
+static void
+stop_resume_test (void)
+{
+    const char *doc =
+        "[\"caf\\u00e9 \\u00e0\", \"\\u0041\","
+        " {\"a\": {\"b\": [null, false, -1.5e3]}}, 4]";
+    const char *value = "{\"a\": {\"b\": [null, false, -1.5e3]}}";
+    size_t ndoc = strlen (doc), remaining = ndoc, consumed, nstops = 0;
+    struct budget_ctx full = { 0, 0 }, resumed = { 0, 0 };
+    const char *cur = doc;
+    jsonsl_t jsn = jsonsl_new (64);
+
+    fprintf (stderr, "==== %-40s ====\n", "stop_resume");
+
+    jsonsl_enable_all_callbacks (jsn);
+    jsn->action_callback = budget_test_callback;
+    jsn->data = &full;
+    jsonsl_feed_budget (jsn, doc, ndoc, ndoc);
+    assert (jsn->level == 0);
+
+    /* Stopped at each u-escape, and fed again from where it stopped */
+    jsonsl_reset (jsn);
+    jsn->data = &resumed;
+    jsn->return_UESCAPE = 1;
+    while (remaining) {
+        consumed = jsonsl_feed_budget (jsn, cur, remaining, remaining);
+        if (consumed < remaining) {
+            assert (cur[consumed] == 'u');
+            nstops++;
+        }
+        cur += consumed;
+        remaining -= consumed;
+    }
+    assert (nstops == 3);
+    assert (jsn->pos == ndoc && jsn->level == 0);
+    assert (resumed.events == full.events && resumed.sum == full.sum);
+
+    /* Stopped by a callback, at the character which pushed the object,
+     * which may then be lexed on its own */
+    jsonsl_reset (jsn);
+    jsn->return_UESCAPE = 0;
+    jsn->action_callback = stop_test_callback;
+    consumed = jsonsl_feed_budget (jsn, doc, ndoc, ndoc);
+    assert (consumed == (size_t) (strchr (doc, '{') - doc));
+    assert (jsn->pos == consumed);
+    jsonsl_reset (jsn);
+    jsn->action_callback = budget_test_callback;
+    jsn->data = &resumed;
+    consumed = jsonsl_feed_budget (jsn, doc + consumed, ndoc - consumed,
+                                   strlen (value));
+    assert (consumed == strlen (value));
+    assert (jsn->level == 0);
+    jsonsl_destroy (jsn);
+}
+
+static void
+feedv_stop_callback (jsonsl_t jsn,
+                     jsonsl_action_t action,
+                     struct jsonsl_state_st *state,
+                     const char *buf)
+{
+    if (state->type == JSONSL_T_STRING) {
+        jsonsl_stop (jsn);
+    }
+}
+
+static void
+feedv_test (void)
+{
+    const char *doc =
+        "{\"hello\": [1, 22, 333, \"four\", {\"five\": true}],"
+        " \"nested\": {\"a\": {\"b\": [null, false, -1.5e3]}},"
+        " \"long string value\": \"0123456789abcdef0123456789\"}";
+    /* Includes empty segments, and ones which split every kind of token */
+    static const size_t seglens[] = { 0, 1, 3, 7, 0, 2, 11, 5 };
+    const size_t nseglens = sizeof(seglens) / sizeof(seglens[0]);
+    jsonsl_iovec_t iov[256];
+    size_t ndoc = strlen(doc), off = 0, consumed;
+    struct budget_ctx full = { 0, 0 }, split = { 0, 0 };
+    int niov = 0;
+    jsonsl_t jsn;
+
+    fprintf (stderr, "==== %-40s ====\n", "feedv");
+
+    jsn = jsonsl_new(64);
+    jsonsl_enable_all_callbacks (jsn);
+    jsn->action_callback = budget_test_callback;
+    jsn->data = &full;
+    jsonsl_feed (jsn, doc, ndoc);
+    assert (jsn->level == 0);
+    jsonsl_destroy (jsn);
+
+    while (off < ndoc) {
+        size_t len = seglens[niov % nseglens];
+        if (len > ndoc - off) {
+            len = ndoc - off;
+        }
+        iov[niov].iov_base = (void *) (doc + off);
+        iov[niov].iov_len = len;
+        off += len;
+        niov++;
+    }
+
+    jsn = jsonsl_new(64);
+    jsonsl_enable_all_callbacks (jsn);
+    jsn->action_callback = budget_test_callback;
+    jsn->data = &split;
+    consumed = jsonsl_feedv (jsn, iov, niov);
+    assert (consumed == ndoc);
+    assert (jsn->pos == ndoc);
+    assert (jsn->level == 0);
+    assert (split.events == full.events);
+    assert (split.sum == full.sum);
+
+    /* Stopping must not process any further segments */
+    jsonsl_reset (jsn);
+    jsn->action_callback = NULL;
+    jsn->action_callback_POP = feedv_stop_callback;
+    consumed = jsonsl_feedv (jsn, iov, niov);
+    assert (jsn->stopfl);
+    assert (consumed == jsn->pos);
+    assert (consumed < ndoc);
+    assert (doc[consumed] == '"');
+    jsonsl_destroy (jsn);
+}
+
+static void
+feed_file_test (void)
+{
+    const char *elem =
+        "{\"key\": \"value \\\"0123456789\", \"n\": 12345, "
+        "\"f\": [true, false, null, -1.5e3]},\n";
+    const char *path = "jsonsl_feed_file.json";
+    size_t nelem = strlen(elem), ndoc = 0, ii;
+    /* Make sure we cross at least one window boundary */
+    size_t count = (JSONSL_FILE_WINDOW / nelem) + 100;
+    struct budget_ctx expected = { 0, 0 };
+    char *doc = malloc(count * nelem + 16);
+    FILE *fp;
+    int mode;
+
+    fprintf (stderr, "==== %-40s ====\n", "feed_file");
+
+    doc[ndoc++] = '[';
+    for (ii = 0; ii < count; ii++) {
+        memcpy (doc + ndoc, elem, nelem);
+        ndoc += nelem;
+    }
+    memcpy (doc + ndoc, "\"end\"]", 6);
+    ndoc += 6;
+
+    fp = fopen (path, "wb");
+    assert (fp);
+    ii = fwrite (doc, 1, ndoc, fp);
+    assert (ii == ndoc);
+    fclose (fp);
+
+    {
+        jsonsl_t jsn = jsonsl_new(64);
+        jsonsl_enable_all_callbacks (jsn);
+        jsn->action_callback = budget_test_callback;
+        jsn->data = &expected;
+        jsonsl_feed (jsn, doc, ndoc);
+        assert (jsn->level == 0);
+        jsonsl_destroy (jsn);
+    }
+
+    for (mode = 0; mode < 2; mode++) {
+        struct budget_ctx got = { 0, 0 };
+        int rv;
+        jsonsl_t jsn = jsonsl_new(64);
+        jsonsl_enable_all_callbacks (jsn);
+        jsn->action_callback = budget_test_callback;
+        jsn->data = &got;
+        rv = jsonsl_feed_file (jsn, path, mode ?
+                               JSONSL_FILEf_NOMMAP :
+                               JSONSL_FILEf_SEQUENTIAL|JSONSL_FILEf_HUGEPAGE);
+        assert (rv == 0);
+        assert (jsn->pos == ndoc);
+        assert (jsn->level == 0);
+        assert (got.events == expected.events);
+        assert (got.sum == expected.sum);
+        jsonsl_destroy (jsn);
+    }
+
+    {
+        int rv;
+        jsonsl_t jsn = jsonsl_new(64);
+        rv = jsonsl_feed_file (jsn, "/nonexistent/jsonsl", 0);
+        assert (rv == -1);
+        jsonsl_destroy (jsn);
+    }
+
+#ifdef JSONSL_USE_ZLIB
+    {
+        const char *gzpath = "jsonsl_feed_file.json.gz";
+        struct budget_ctx got = { 0, 0 };
+        gzFile gz;
+        int rv, format;
+
+        /* Write the document as two gzip members, as if it were appended to */
+        gz = gzopen (gzpath, "wb");
+        assert (gz);
+        rv = gzwrite (gz, doc, (unsigned) (ndoc / 3));
+        assert (rv == (int) (ndoc / 3));
+        gzclose (gz);
+        gz = gzopen (gzpath, "ab");
+        assert (gz);
+        rv = gzwrite (gz, doc + ndoc / 3, (unsigned) (ndoc - ndoc / 3));
+        assert (rv == (int) (ndoc - ndoc / 3));
+        gzclose (gz);
+
+        for (format = JSONSL_COMPRESS_AUTO; format <= JSONSL_COMPRESS_GZIP;
+                format++) {
+            jsonsl_t jsn = jsonsl_new(64);
+            memset (&got, 0, sizeof got);
+            jsonsl_enable_all_callbacks (jsn);
+            jsn->action_callback = budget_test_callback;
+            jsn->data = &got;
+            rv = jsonsl_feed_compressed (jsn, gzpath, format);
+            assert (rv == 0);
+            assert (jsn->pos == ndoc);
+            assert (got.events == expected.events);
+            assert (got.sum == expected.sum);
+            jsonsl_destroy (jsn);
+        }
+
+        /* Uncompressed input is passed through in auto mode */
+        {
+            jsonsl_t jsn = jsonsl_new(64);
+            memset (&got, 0, sizeof got);
+            jsonsl_enable_all_callbacks (jsn);
+            jsn->action_callback = budget_test_callback;
+            jsn->data = &got;
+            rv = jsonsl_feed_compressed (jsn, path, JSONSL_COMPRESS_AUTO);
+            assert (rv == 0);
+            assert (jsn->pos == ndoc);
+            assert (got.sum == expected.sum);
+            jsonsl_destroy (jsn);
+        }
+
+        /* ..but not when gzip was asked for explicitly */
+        {
+            jsonsl_t jsn = jsonsl_new(64);
+            rv = jsonsl_feed_compressed (jsn, path, JSONSL_COMPRESS_GZIP);
+            assert (rv == -1);
+            assert (errno == EINVAL);
+            jsonsl_destroy (jsn);
+        }
+
+        remove (gzpath);
+    }
+#endif /* JSONSL_USE_ZLIB */
+
+#ifdef JSONSL_USE_ZSTD
+    {
+        const char *zstpath = "jsonsl_feed_file.json.zst";
+        size_t bound = ZSTD_compressBound (ndoc), nz, nfirst;
+        char *zbuf = malloc (bound * 2);
+        struct budget_ctx got = { 0, 0 };
+        int rv;
+
+        /* Two frames, as if the file were appended to */
+        nfirst = ZSTD_compress (zbuf, bound, doc, ndoc / 3, 3);
+        assert (!ZSTD_isError (nfirst));
+        nz = ZSTD_compress (zbuf + nfirst, bound, doc + ndoc / 3,
+                            ndoc - ndoc / 3, 3);
+        assert (!ZSTD_isError (nz));
+        nz += nfirst;
+        fp = fopen (zstpath, "wb");
+        assert (fp);
+        ii = fwrite (zbuf, 1, nz, fp);
+        assert (ii == nz);
+        fclose (fp);
+
+        for (ii = 0; ii < 2; ii++) {
+            jsonsl_t jsn = jsonsl_new(64);
+            memset (&got, 0, sizeof got);
+            jsonsl_enable_all_callbacks (jsn);
+            jsn->action_callback = budget_test_callback;
+            jsn->data = &got;
+            rv = jsonsl_feed_compressed (jsn, zstpath, ii ?
+                                         JSONSL_COMPRESS_ZSTD :
+                                         JSONSL_COMPRESS_AUTO);
+            assert (rv == 0);
+            assert (jsn->pos == ndoc);
+            assert (got.events == expected.events);
+            assert (got.sum == expected.sum);
+            jsonsl_destroy (jsn);
+        }
+
+        /* Truncated in the second frame */
+        fp = fopen (zstpath, "wb");
+        assert (fp);
+        ii = fwrite (zbuf, 1, nz - 1, fp);
+        assert (ii == nz - 1);
+        fclose (fp);
+        {
+            jsonsl_t jsn = jsonsl_new(64);
+            rv = jsonsl_feed_compressed (jsn, zstpath, JSONSL_COMPRESS_AUTO);
+            assert (rv == -1);
+            assert (errno == EINVAL);
+            jsonsl_destroy (jsn);
+        }
+
+        /* Uncompressed input isn't zstd data */
+        {
+            jsonsl_t jsn = jsonsl_new(64);
+            rv = jsonsl_feed_compressed (jsn, path, JSONSL_COMPRESS_ZSTD);
+            assert (rv == -1);
+            assert (errno == EINVAL);
+            jsonsl_destroy (jsn);
+        }
+
+        remove (zstpath);
+        free (zbuf);
+    }
+#endif /* JSONSL_USE_ZSTD */
+
+    remove (path);
+    free (doc);
+}
+
+
+static void
+recindex_test (void)
+{
+    const char *path = "jsonsl_recindex.ndjson";
+    const char *idxpath = "jsonsl_recindex.idx";
+    size_t nrec = 1000, ndoc = 0, ii, offset;
+    size_t *expected = malloc (nrec * sizeof (*expected));
+    char *doc = malloc (nrec * 64);
+    jsonsl_recindex_t idx, built;
+    FILE *fp;
+    int rv, pass;
+
+    fprintf (stderr, "==== %-40s ====\n", "recindex");
+
+    /* Empty lines (with or without a carriage return) aren't records, and
+     * the last record has no newline */
+    for (ii = 0; ii < nrec; ii++) {
+        if (ii % 5 == 0) {
+            ndoc += sprintf (doc + ndoc, ii % 10 ? "\n" : "\r\n");
+        }
+        expected[ii] = ndoc;
+        ndoc += sprintf (doc + ndoc, "{\"n\": %lu, \"s\": \"%*s\"}%s",
+                         (unsigned long) ii, (int) (ii % 13), "",
+                         ii == nrec - 1 ? "" : ii % 3 ? "\n" : "\r\n");
+    }
+    fp = fopen (path, "wb");
+    assert (fp);
+    ii = fwrite (doc, 1, ndoc, fp);
+    assert (ii == ndoc);
+    fclose (fp);
+
+    /* Fed in small chunks, and built from the file */
+    built = jsonsl_recindex_new (7);
+    for (ii = 0; ii < ndoc; ii += 3) {
+        jsonsl_recindex_feed (built, doc + ii, ndoc - ii < 3 ? ndoc - ii : 3);
+    }
+    jsonsl_recindex_finish (built);
+    idx = jsonsl_recindex_new (7);
+    rv = jsonsl_recindex_build_file (idx, path);
+    assert (rv == 0);
+
+    for (pass = 0; pass < 3; pass++) {
+        jsonsl_recindex_t cur = pass == 0 ? built : idx;
+        assert (jsonsl_recindex_count (cur) == nrec);
+        assert (jsonsl_recindex_length (cur) == ndoc);
+        for (ii = 0; ii < nrec; ii++) {
+            rv = jsonsl_recindex_seek (cur, path, ii, &offset);
+            assert (rv == 0);
+            assert (offset == expected[ii]);
+        }
+        rv = jsonsl_recindex_seek (cur, path, nrec, &offset);
+        assert (rv == -1 && errno == EINVAL);
+        if (pass == 1) {
+            /* Saved and loaded */
+            rv = jsonsl_recindex_save (idx, idxpath);
+            assert (rv == 0);
+            jsonsl_recindex_destroy (idx);
+            idx = jsonsl_recindex_load (idxpath);
+            assert (idx);
+        }
+    }
+
+    jsonsl_recindex_destroy (idx);
+
+    /* A record 4GB in, which the file doesn't reach. Seeking there must
+     * fail, not wrap around to the start of the file */
+    if (sizeof (size_t) > 4) {
+        static const unsigned char hdr[] = {
+            'J', 'S', 'L', 'R', 'E', 'C', 'I', 'X', 1, 0, 0, 0, 0, 0, 0, 0,
+            2, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0,
+            100, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0,
+            /* The offsets: 0, and 1 << 32 after it */
+            0, 0x80, 0x80, 0x80, 0x80, 0x10
+        };
+        fp = fopen (idxpath, "wb");
+        assert (fp);
+        ii = fwrite (hdr, 1, sizeof (hdr), fp);
+        assert (ii == sizeof (hdr));
+        fclose (fp);
+        idx = jsonsl_recindex_load (idxpath);
+        assert (idx);
+        rv = jsonsl_recindex_seek (idx, path, 3, &offset);
+        assert (rv == -1 && (errno == EINVAL || errno == EOVERFLOW));
+        jsonsl_recindex_destroy (idx);
+    }
+
+    /* Not an index */
+    idx = jsonsl_recindex_load (path);
+    assert (idx == NULL && errno == EINVAL);
+
+    jsonsl_recindex_destroy (built);
+    remove (path);
+    remove (idxpath);
+    free (expected);
+    free (doc);
+}
+
+
+static void
+tape_test (void)
+{
+    static const char doc[] =
+        "{\"name\": \"caf\\u00e9\\n\", \"n\": -42, \"big\": 12345678901234567890,"
+        " \"pi\": 3.25e1, \"ok\": true, \"none\": null, \"empty\": {},"
+        " \"list\": [1, [2, 3], {\"a\\\"b\": \"x\"}, []], \"n\": 7}";
+    jsonsl_tape_t tape = jsonsl_tape_new ();
+    size_t root, node, list, len, ii;
+    const char *text;
+    jsonsl_error_t err;
+
+    fprintf (stderr, "==== %-40s ====\n", "tape");
+    assert (tape);
+    err = jsonsl_tape_parse (tape, doc, sizeof (doc) - 1);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    root = 0;
+    assert (jsonsl_tape_type (tape, root) == JSONSL_T_OBJECT);
+    assert (jsonsl_tape_size (tape, root) == 9);
+    assert (jsonsl_tape_next (tape, root) == JSONSL_TAPE_NONE);
+
+    /* Unescaped strings and keys */
+    node = jsonsl_tape_lookup (tape, root, "name", 4);
+    assert (jsonsl_tape_type (tape, node) == JSONSL_T_STRING);
+    text = jsonsl_tape_string (tape, node, &len);
+    assert (len == 6 && memcmp (text, "caf\xc3\xa9\n", 7) == 0);
+    text = jsonsl_tape_key (tape, node, &len);
+    assert (len == 4 && strcmp (text, "name") == 0);
+
+    /* Numbers and other specials; the first of duplicate keys is found */
+    node = jsonsl_tape_lookup (tape, root, "n", 1);
+    assert (jsonsl_tape_type (tape, node) == JSONSL_T_SPECIAL);
+    assert (jsonsl_tape_special_flags (tape, node) & JSONSL_SPECIALf_SIGNED);
+    assert (jsonsl_tape_int (tape, node) == -42);
+    assert (jsonsl_tape_double (tape, node) == -42.0);
+    assert (jsonsl_tape_string (tape, node, &len) == NULL);
+    node = jsonsl_tape_lookup (tape, root, "big", 3);
+    assert (jsonsl_tape_double (tape, node) == 12345678901234567890.0);
+    node = jsonsl_tape_lookup (tape, root, "pi", 2);
+    assert (jsonsl_tape_double (tape, node) == 32.5);
+    assert (jsonsl_tape_int (tape, node) == 32);
+    node = jsonsl_tape_lookup (tape, root, "ok", 2);
+    assert (jsonsl_tape_special_flags (tape, node) == JSONSL_SPECIALf_TRUE);
+    node = jsonsl_tape_lookup (tape, root, "none", 4);
+    assert (jsonsl_tape_special_flags (tape, node) == JSONSL_SPECIALf_NULL);
+    assert (jsonsl_tape_int (tape, node) == 0);
+    node = jsonsl_tape_lookup (tape, root, "empty", 5);
+    assert (jsonsl_tape_type (tape, node) == JSONSL_T_OBJECT);
+    assert (jsonsl_tape_size (tape, node) == 0);
+    assert (jsonsl_tape_child (tape, node) == JSONSL_TAPE_NONE);
+    assert (jsonsl_tape_lookup (tape, root, "nam", 3) == JSONSL_TAPE_NONE);
+
+    /* Iterating, skipping nested containers */
+    list = jsonsl_tape_lookup (tape, root, "list", 4);
+    assert (jsonsl_tape_type (tape, list) == JSONSL_T_LIST);
+    assert (jsonsl_tape_size (tape, list) == 4);
+    for (ii = 0, node = jsonsl_tape_child (tape, list);
+            node != JSONSL_TAPE_NONE;
+            ii++, node = jsonsl_tape_next (tape, node)) {
+        assert (node == jsonsl_tape_at (tape, list, ii));
+    }
+    assert (ii == 4);
+    assert (jsonsl_tape_at (tape, list, 4) == JSONSL_TAPE_NONE);
+    node = jsonsl_tape_at (tape, list, 1);
+    assert (jsonsl_tape_size (tape, node) == 2);
+    assert (jsonsl_tape_int (tape, jsonsl_tape_at (tape, node, 1)) == 3);
+    node = jsonsl_tape_lookup (tape, jsonsl_tape_at (tape, list, 2), "a\"b", 3);
+    text = jsonsl_tape_string (tape, node, &len);
+    assert (len == 1 && strcmp (text, "x") == 0);
+    assert (jsonsl_tape_lookup (tape, list, "a", 1) == JSONSL_TAPE_NONE);
+    node = jsonsl_tape_next (tape, list);
+    assert (jsonsl_tape_int (tape, node) == 7);
+    assert (jsonsl_tape_next (tape, node) == JSONSL_TAPE_NONE);
+
+    /* A scalar document, then errors */
+    err = jsonsl_tape_parse (tape, "-1.5", 4);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_tape_double (tape, 0) == -1.5);
+    assert (jsonsl_tape_next (tape, 0) == JSONSL_TAPE_NONE);
+    err = jsonsl_tape_parse (tape, "[1, 2", 5);
+    assert (err == JSONSL_ERROR_INCOMPLETE);
+    err = jsonsl_tape_parse (tape, " ", 1);
+    assert (err == JSONSL_ERROR_INCOMPLETE);
+    err = jsonsl_tape_parse (tape, "[1,,2]", 6);
+    assert (err != JSONSL_ERROR_SUCCESS);
+    err = jsonsl_tape_parse (tape, "{} {}", 5);
+    assert (err != JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_tape_parse (tape, "[]", 2) == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_tape_size (tape, 0) == 0);
+
+    /* Every object gets a key table; duplicates still find the first */
+    jsonsl_tape_set_index_min (tape, 1);
+    err = jsonsl_tape_parse (tape, doc, sizeof (doc) - 1);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_tape_size (tape, root) == 9);
+    node = jsonsl_tape_lookup (tape, root, "n", 1);
+    assert (jsonsl_tape_int (tape, node) == -42);
+    assert (jsonsl_tape_lookup (tape, root, "nam", 3) == JSONSL_TAPE_NONE);
+    list = jsonsl_tape_lookup (tape, root, "list", 4);
+    node = jsonsl_tape_lookup (tape, jsonsl_tape_at (tape, list, 2), "a\"b", 3);
+    text = jsonsl_tape_string (tape, node, &len);
+    assert (len == 1 && strcmp (text, "x") == 0);
+    node = jsonsl_tape_lookup (tape, root, "empty", 5);
+    assert (jsonsl_tape_lookup (tape, node, "a", 1) == JSONSL_TAPE_NONE);
+
+    /* A wide object, with nested ones */
+    jsonsl_tape_set_index_min (tape, JSONSL_TAPE_INDEX_MIN);
+    {
+        char *wide = malloc (1000 * 32), *outp = wide;
+        char key[16];
+        outp += sprintf (outp, "{");
+        for (ii = 0; ii < 1000; ii++) {
+            outp += sprintf (outp, "%s\"k%lu\": %s%lu%s", ii ? ", " : "",
+                             (unsigned long)ii, ii % 2 ? "{\"v\": " : "",
+                             (unsigned long)ii, ii % 2 ? "}" : "");
+        }
+        outp += sprintf (outp, "}");
+        err = jsonsl_tape_parse (tape, wide, outp - wide);
+        assert (err == JSONSL_ERROR_SUCCESS);
+        assert (jsonsl_tape_size (tape, 0) == 1000);
+        for (ii = 0; ii < 1000; ii++) {
+            len = sprintf (key, "k%lu", (unsigned long)ii);
+            node = jsonsl_tape_lookup (tape, 0, key, len);
+            if (ii % 2) {
+                node = jsonsl_tape_lookup (tape, node, "v", 1);
+            }
+            assert (jsonsl_tape_int (tape, node) == (int64_t)ii);
+        }
+        assert (jsonsl_tape_lookup (tape, 0, "k1000", 5) == JSONSL_TAPE_NONE);
+        free (wide);
+    }
+
+    jsonsl_tape_destroy (tape);
+}
+
+
+static void
+lazy_test (void)
+{
+    static const char doc[] =
+        "{\"name\": \"caf\\u00e9\\n\", \"n\": -42, \"big\": 12345678901234567890,"
+        " \"pi\": 3.25e1, \"ok\": true, \"none\": null, \"empty\": {},"
+        " \"list\": [1, [2, 3], {\"a\\\"b\": \"x\"}, []], \"n\": 7,"
+        " \"bad\": [1 2], \"worse\": 01}";
+    jsonsl_lazy_t lazy = jsonsl_lazy_new ();
+    size_t root, node, list, len, ii;
+    const char *text;
+    jsonsl_error_t err;
+
+    fprintf (stderr, "==== %-40s ====\n", "lazy");
+    assert (lazy);
+    err = jsonsl_lazy_parse (lazy, doc, sizeof (doc) - 1);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    root = 0;
+    assert (jsonsl_lazy_type (lazy, root) == JSONSL_T_OBJECT);
+    assert (jsonsl_lazy_size (lazy, root) == 11);
+    assert (jsonsl_lazy_next (lazy, root) == JSONSL_LAZY_NONE);
+
+    /* Strings are unescaped when read, and otherwise point into the text */
+    node = jsonsl_lazy_lookup (lazy, root, "name", 4);
+    assert (jsonsl_lazy_type (lazy, node) == JSONSL_T_STRING);
+    text = jsonsl_lazy_string (lazy, node, &len);
+    assert (len == 6 && memcmp (text, "caf\xc3\xa9\n", 6) == 0);
+    assert (jsonsl_lazy_string (lazy, node, &len) == text);
+    text = jsonsl_lazy_key (lazy, node, &len);
+    assert (len == 4 && text == doc + 2);
+
+    /* Numbers and other specials; the first of duplicate keys is found */
+    node = jsonsl_lazy_lookup (lazy, root, "n", 1);
+    assert (jsonsl_lazy_type (lazy, node) == JSONSL_T_SPECIAL);
+    assert (jsonsl_lazy_special_flags (lazy, node) & JSONSL_SPECIALf_SIGNED);
+    assert (jsonsl_lazy_int (lazy, node) == -42);
+    assert (jsonsl_lazy_double (lazy, node) == -42.0);
+    assert (jsonsl_lazy_string (lazy, node, &len) == NULL);
+    node = jsonsl_lazy_lookup (lazy, root, "big", 3);
+    assert (jsonsl_lazy_double (lazy, node) == 12345678901234567890.0);
+    node = jsonsl_lazy_lookup (lazy, root, "pi", 2);
+    assert (jsonsl_lazy_special_flags (lazy, node) ==
+            (JSONSL_SPECIALf_UNSIGNED|JSONSL_SPECIALf_FLOAT|
+             JSONSL_SPECIALf_EXPONENT));
+    assert (jsonsl_lazy_double (lazy, node) == 32.5);
+    assert (jsonsl_lazy_int (lazy, node) == 32);
+    node = jsonsl_lazy_lookup (lazy, root, "ok", 2);
+    assert (jsonsl_lazy_special_flags (lazy, node) == JSONSL_SPECIALf_TRUE);
+    node = jsonsl_lazy_lookup (lazy, root, "none", 4);
+    assert (jsonsl_lazy_special_flags (lazy, node) == JSONSL_SPECIALf_NULL);
+    assert (jsonsl_lazy_int (lazy, node) == 0);
+    node = jsonsl_lazy_lookup (lazy, root, "empty", 5);
+    assert (jsonsl_lazy_type (lazy, node) == JSONSL_T_OBJECT);
+    assert (jsonsl_lazy_size (lazy, node) == 0);
+    assert (jsonsl_lazy_child (lazy, node) == JSONSL_LAZY_NONE);
+    assert (jsonsl_lazy_lookup (lazy, root, "nam", 3) == JSONSL_LAZY_NONE);
+
+    /* Iterating, and escaped keys */
+    list = jsonsl_lazy_lookup (lazy, root, "list", 4);
+    assert (jsonsl_lazy_type (lazy, list) == JSONSL_T_LIST);
+    assert (jsonsl_lazy_size (lazy, list) == 4);
+    for (ii = 0, node = jsonsl_lazy_child (lazy, list);
+            node != JSONSL_LAZY_NONE;
+            ii++, node = jsonsl_lazy_next (lazy, node)) {
+        assert (node == jsonsl_lazy_at (lazy, list, ii));
+        assert (jsonsl_lazy_key (lazy, node, &len) == NULL);
+    }
+    assert (ii == 4);
+    assert (jsonsl_lazy_at (lazy, list, 4) == JSONSL_LAZY_NONE);
+    node = jsonsl_lazy_at (lazy, list, 1);
+    assert (jsonsl_lazy_size (lazy, node) == 2);
+    assert (jsonsl_lazy_int (lazy, jsonsl_lazy_at (lazy, node, 1)) == 3);
+    node = jsonsl_lazy_lookup (lazy, jsonsl_lazy_at (lazy, list, 2), "a\"b", 3);
+    text = jsonsl_lazy_string (lazy, node, &len);
+    assert (len == 1 && *text == 'x');
+    text = jsonsl_lazy_key (lazy, node, &len);
+    assert (len == 3 && memcmp (text, "a\"b", 3) == 0);
+    assert (jsonsl_lazy_lookup (lazy, list, "a", 1) == JSONSL_LAZY_NONE);
+    node = jsonsl_lazy_next (lazy, list);
+    assert (jsonsl_lazy_int (lazy, node) == 7);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_SUCCESS);
+
+    /* Errors are only found in what is read */
+    node = jsonsl_lazy_lookup (lazy, root, "worse", 5);
+    assert (jsonsl_lazy_int (lazy, node) == 0);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_INVALID_NUMBER);
+    node = jsonsl_lazy_lookup (lazy, root, "bad", 3);
+    assert (jsonsl_lazy_size (lazy, node) == 0);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_INVALID_NUMBER);
+
+    /* A scalar document, then errors found by parsing or scanning */
+    err = jsonsl_lazy_parse (lazy, " -1.5 ", 6);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_lazy_double (lazy, 0) == -1.5);
+    assert (jsonsl_lazy_next (lazy, 0) == JSONSL_LAZY_NONE);
+    err = jsonsl_lazy_parse (lazy, "[\"\\\\\", \"]\\\"[\"]", 14);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_lazy_size (lazy, 0) == 2);
+    text = jsonsl_lazy_string (lazy, 1, &len);
+    assert (len == 1 && *text == '\\');
+    text = jsonsl_lazy_string (lazy, 2, &len);
+    assert (len == 3 && memcmp (text, "]\"[", 3) == 0);
+    err = jsonsl_lazy_parse (lazy, "[1, [2]", 7);
+    assert (err == JSONSL_ERROR_INCOMPLETE);
+    err = jsonsl_lazy_parse (lazy, "[\"]\"", 4);
+    assert (err == JSONSL_ERROR_INCOMPLETE);
+    err = jsonsl_lazy_parse (lazy, " ", 1);
+    assert (err == JSONSL_ERROR_INCOMPLETE);
+    err = jsonsl_lazy_parse (lazy, "[1}", 3);
+    assert (err == JSONSL_ERROR_BRACKET_MISMATCH);
+    err = jsonsl_lazy_parse (lazy, "{} {}", 5);
+    assert (err == JSONSL_ERROR_GARBAGE_TRAILING);
+    err = jsonsl_lazy_parse (lazy, "[1,,2]", 6);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_lazy_size (lazy, 0) == 0);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_VALUE_EXPECTED);
+    err = jsonsl_lazy_parse (lazy, "[1, ]", 5);
+    assert (jsonsl_lazy_child (lazy, 0) == JSONSL_LAZY_NONE);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_TRAILING_COMMA);
+    err = jsonsl_lazy_parse (lazy, "{\"a\" 1}", 7);
+    assert (jsonsl_lazy_lookup (lazy, 0, "a", 1) == JSONSL_LAZY_NONE);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_MISSING_TOKEN);
+    err = jsonsl_lazy_parse (lazy, "[\"\x01\"]", 5);
+    assert (err == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_lazy_child (lazy, 0) == JSONSL_LAZY_NONE);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_WEIRD_WHITESPACE);
+    err = jsonsl_lazy_parse (lazy, "{\"\n\": 1}", 8);
+    assert (jsonsl_lazy_size (lazy, 0) == 0);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_WEIRD_WHITESPACE);
+    err = jsonsl_lazy_parse (lazy, "\"\t\"", 3);
+    assert (err == JSONSL_ERROR_WEIRD_WHITESPACE);
+    err = jsonsl_lazy_parse (lazy, "{1: 1}", 6);
+    assert (jsonsl_lazy_size (lazy, 0) == 0);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_HKEY_EXPECTED);
+    assert (jsonsl_lazy_parse (lazy, "[]", 2) == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_lazy_size (lazy, 0) == 0);
+    assert (jsonsl_lazy_error (lazy) == JSONSL_ERROR_SUCCESS);
+
+    jsonsl_lazy_destroy (lazy);
+}
+
+struct writer_out {
+    char text[512];
+    size_t len;
+    int nflushes;
+    int fail;
+};
+
+static int
+writer_flush (void *data, const char *buf, size_t nbuf)
+{
+    struct writer_out *out = (struct writer_out *) data;
+    if (out->fail) {
+        return -1;
+    }
+    assert (out->len + nbuf < sizeof (out->text));
+    memcpy (out->text + out->len, buf, nbuf);
+    out->len += nbuf;
+    out->text[out->len] = '\0';
+    out->nflushes++;
+    return 0;
+}
+
+static void
+writer_test (void)
+{
+    static const char expected[] =
+        "{\"a\":[1,-9223372036854775808,0.5,\"a \\\"clean\\\" run\\\\"
+        "\\n\\u0001\\u001f/\xc3\xa9\"],\"b\\tc\":{},\"d\":[[]],\"e\":true}";
+    static char big[1024];
+    char buf[3], str[0x81];
+    struct writer_out out;
+    jsonsl_writer_t writer;
+    jsonsl_tape_t tape;
+    const char *text;
+    size_t ii, len, nbig;
+
+    fprintf (stderr, "==== %-40s ====\n", "writer");
+    memset (&out, 0, sizeof (out));
+    writer = jsonsl_writer_new (3, buf, sizeof (buf), writer_flush, &out);
+    assert (writer);
+
+    /* A buffer smaller than anything written */
+    jsonsl_writer_begin_object (writer);
+    jsonsl_writer_key (writer, "a", 1);
+    jsonsl_writer_begin_list (writer);
+    jsonsl_writer_int (writer, 1);
+    jsonsl_writer_int (writer, INT64_MIN);
+    jsonsl_writer_double (writer, 0.5);
+    jsonsl_writer_string (writer, "a \"clean\" run\\\n\x01\x1f/\xc3\xa9", 20);
+    jsonsl_writer_end_list (writer);
+    jsonsl_writer_key (writer, "b\tc", 3);
+    jsonsl_writer_begin_object (writer);
+    jsonsl_writer_end_object (writer);
+    jsonsl_writer_key (writer, "d", 1);
+    jsonsl_writer_begin_list (writer);
+    jsonsl_writer_begin_list (writer);
+    jsonsl_writer_end_list (writer);
+    jsonsl_writer_end_list (writer);
+    jsonsl_writer_key (writer, "e", 1);
+    assert (jsonsl_writer_raw (writer, "true", 4) == JSONSL_ERROR_SUCCESS);
+    assert (jsonsl_writer_end_object (writer) == JSONSL_ERROR_SUCCESS);
+    assert (out.len < sizeof (expected) - 1);
+    assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_SUCCESS);
+    assert (strcmp (out.text, expected) == 0);
+    assert (out.nflushes == (int) (sizeof (expected) + 1) / 3);
+    jsonsl_writer_destroy (writer);
+
+    /* Every ASCII character reads back as itself */
+    for (ii = 0; ii < sizeof (str); ii++) {
+        str[ii] = (char) (ii + 1);
+    }
+    /* Both into a buffer it may fill, and one with room for it all */
+    tape = jsonsl_tape_new ();
+    for (nbig = 256; nbig <= sizeof (big); nbig *= 4) {
+        memset (&out, 0, sizeof (out));
+        writer = jsonsl_writer_new (1, big, nbig, writer_flush, &out);
+        jsonsl_writer_begin_list (writer);
+        jsonsl_writer_string (writer, str, sizeof (str));
+        jsonsl_writer_end_list (writer);
+        assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_SUCCESS);
+        assert (jsonsl_tape_parse (tape, out.text, out.len) ==
+                JSONSL_ERROR_SUCCESS);
+        text = jsonsl_tape_string (tape, jsonsl_tape_child (tape, 0), &len);
+        assert (len == sizeof (str) && memcmp (text, str, len) == 0);
+        jsonsl_writer_destroy (writer);
+    }
+    jsonsl_tape_destroy (tape);
+
+    /* There must be room for at least one character */
+    assert (jsonsl_writer_new (1, buf, 0, writer_flush, &out) == NULL);
+
+    /* Calls out of order fail, until the writer is finished */
+    memset (&out, 0, sizeof (out));
+    writer = jsonsl_writer_new (1, buf, sizeof (buf), writer_flush, &out);
+    jsonsl_writer_begin_object (writer);
+    assert (jsonsl_writer_int (writer, 1) == JSONSL_ERROR_HKEY_EXPECTED);
+    assert (jsonsl_writer_end_object (writer) == JSONSL_ERROR_HKEY_EXPECTED);
+    assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_HKEY_EXPECTED);
+    jsonsl_writer_begin_list (writer);
+    assert (jsonsl_writer_key (writer, "a", 1) ==
+            JSONSL_ERROR_KEY_OUTSIDE_OBJECT);
+    jsonsl_writer_finish (writer);
+    jsonsl_writer_begin_list (writer);
+    assert (jsonsl_writer_end_object (writer) ==
+            JSONSL_ERROR_BRACKET_MISMATCH);
+    jsonsl_writer_finish (writer);
+    jsonsl_writer_begin_list (writer);
+    assert (jsonsl_writer_begin_list (writer) ==
+            JSONSL_ERROR_LEVELS_EXCEEDED);
+    jsonsl_writer_finish (writer);
+    jsonsl_writer_begin_object (writer);
+    jsonsl_writer_key (writer, "a", 1);
+    assert (jsonsl_writer_end_object (writer) == JSONSL_ERROR_VALUE_EXPECTED);
+    jsonsl_writer_finish (writer);
+    assert (jsonsl_writer_end_list (writer) == JSONSL_ERROR_STRAY_TOKEN);
+    jsonsl_writer_finish (writer);
+    assert (jsonsl_writer_double (writer, 1e308 * 10) ==
+            JSONSL_ERROR_INVALID_NUMBER);
+    jsonsl_writer_finish (writer);
+    jsonsl_writer_raw (writer, "null", 4);
+    assert (jsonsl_writer_raw (writer, "null", 4) ==
+            JSONSL_ERROR_GARBAGE_TRAILING);
+    jsonsl_writer_finish (writer);
+    assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_INCOMPLETE);
+    jsonsl_writer_begin_list (writer);
+    assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_INCOMPLETE);
+
+    /* A failed flush */
+    memset (&out, 0, sizeof (out));
+    out.fail = 1;
+    assert (jsonsl_writer_string (writer, "long enough", 11) ==
+            JSONSL_ERROR_WRITE_FAILED);
+    assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_WRITE_FAILED);
+    out.fail = 0;
+    jsonsl_writer_int (writer, 42);
+    assert (jsonsl_writer_finish (writer) == JSONSL_ERROR_SUCCESS);
+    assert (strcmp (out.text, "42") == 0);
+    jsonsl_writer_destroy (writer);
+}
+
+/* The number of significant digits in a formatted number */
+static int
+count_digits (const char *text)
+{
+    const char *begin, *end = text + strcspn (text, "e");
+    int n = 0;
+
+    for (begin = text; begin < end && (*begin < '1' || *begin > '9'); begin++);
+    while (end > begin && (end[-1] < '1' || end[-1] > '9')) {
+        end--;
+    }
+    for (; begin < end; begin++) {
+        n += *begin != '.';
+    }
+    return n;
+}
+
+static void
+format_test (void)
+{
+    static const struct {
+        double value;
+        const char *text;
+    } doubles[] = {
+        { 0, "0" }, { -0.0, "-0" }, { 0.1, "0.1" }, { 0.3, "0.3" },
+        { -1.5, "-1.5" }, { 123.456, "123.456" }, { 100, "100" },
+        { 1e16, "10000000000000000" }, { 1e17, "1e17" },
+        { 0.001, "0.001" }, { 1e-4, "0.0001" }, { 1e-5, "1e-5" },
+        { 2.5e-7, "2.5e-7" }, { 5e-324, "5e-324" }, { 1e100, "1e100" },
+        { -1.25e21, "-1.25e21" },
+        { 2.2250738585072014e-308, "2.2250738585072014e-308" },
+        { 1.7976931348623157e308, "1.7976931348623157e308" },
+        { 9007199254740992.0, "9007199254740992" }
+    };
+    char text[JSONSL_NUMBER_BUFSIZE], expected[32], *p;
+    uint64_t bits = (uint64_t) 88172645 * 1000000000 + 463325252, mag;
+    double value, back;
+    int ii, ntests = 200000, nlonger = 0, prec;
+
+    fprintf (stderr, "==== %-40s ====\n", "format");
+    for (ii = 0; ii < (int) (sizeof (doubles) / sizeof (doubles[0])); ii++) {
+        assert (jsonsl_format_double (doubles[ii].value, text) ==
+                strlen (doubles[ii].text));
+        assert (strcmp (text, doubles[ii].text) == 0);
+    }
+    value = 1e308;
+    assert (jsonsl_format_double (value * 10, text) == 0);
+    assert (jsonsl_format_double ((value * 10) - (value * 10), text) == 0);
+
+    /* Random doubles read back the same, with the fewest digits that do
+     * but for a few, where Grisu2 leaves out a candidate at the very edge of
+     * those which read back (about one in five hundred) */
+    for (ii = 0; ii < ntests; ii++) {
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        memcpy (&value, &bits, sizeof (value));
+        if (value != value || value - value != 0) {
+            continue;
+        }
+        assert (jsonsl_format_double (value, text) == strlen (text));
+        back = strtod (text, NULL);
+        assert (memcmp (&back, &value, sizeof (back)) == 0);
+        for (prec = 0; prec < 17; prec++) {
+            sprintf (expected, "%.*e", prec, value);
+            if (strtod (expected, NULL) == value) {
+                break;
+            }
+        }
+        nlonger += count_digits (text) > prec + 1;
+    }
+    assert (nlonger < ntests / 500);
+
+    /* Integers, against a digit at a time */
+    assert (jsonsl_format_int (INT64_MIN, text) == 20);
+    assert (strcmp (text, "-9223372036854775808") == 0);
+    assert (jsonsl_format_int (INT64_MAX, text) == 19);
+    assert (strcmp (text, "9223372036854775807") == 0);
+    for (ii = 0; ii < ntests; ii++) {
+        int64_t ival;
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        /* Of every length */
+        ival = (int64_t) (bits >> (ii % 64));
+        mag = ival < 0 ? 0 - (uint64_t) ival : (uint64_t) ival;
+        p = expected + sizeof (expected);
+        *--p = '\0';
+        do {
+            *--p = (char) ('0' + mag % 10);
+            mag /= 10;
+        } while (mag);
+        if (ival < 0) {
+            *--p = '-';
+        }
+        assert (jsonsl_format_int (ival, text) == strlen (p));
+        assert (strcmp (text, p) == 0);
+    }
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -77,5 +1101,14 @@ main (int argc, char **argv)
         jsonsl_destroy (jsn);
     }
 
+    budget_test ();
+    stop_resume_test ();
+    feedv_test ();
+    feed_file_test ();
+    recindex_test ();
+    tape_test ();
+    lazy_test ();
+    writer_test ();
+    format_test ();
     return 0;
 }
@@ -1,7 +1,9 @@
 #include <jsonsl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include "all-tests.h"
 
 #define _JSTR(e) \
@@ -20,6 +22,16 @@ const char SampleJSON[] =
            "}"
         "}";
 
+/* Whether check_path() and the others below use jsonsl_jpr_new_extended()
+ * rather than jsonsl_jpr_new() */
+static int ExtendedPaths;
+
+static jsonsl_jpr_t new_path(const char *path, jsonsl_error_t *err)
+{
+    return ExtendedPaths ? jsonsl_jpr_new_extended(path, err) :
+            jsonsl_jpr_new(path, err);
+}
+
 static void check_path(const char *path)
 {
     jsonsl_error_t err;
@@ -28,7 +40,7 @@ static void check_path(const char *path)
 
     fprintf(stderr, "=== Testing %s ===\n", path);
 
-    jpr = jsonsl_jpr_new(path, &err);
+    jpr = new_path(path, &err);
     if (jpr == NULL) {
         fprintf(stderr, "Couldn't create new JPR with path '%s': %s\n",
                 path, jsonsl_strerror(err));
@@ -45,8 +57,19 @@ static void check_path(const char *path)
             printf("\tNumeric: %lu\n", comp->idx);
         } else if (comp->ptype == JSONSL_PATH_WILDCARD) {
             printf("\tWildcard: %c\n", JSONSL_PATH_WILDCARD_CHAR);
+        } else if (comp->ptype == JSONSL_PATH_SLICE) {
+            printf("\tSlice: %lu:%lu:%lu\n", comp->idx, comp->idx_end,
+                   comp->idx_step);
+        } else if (comp->ptype == JSONSL_PATH_DESCENDANT) {
+            printf("\tDescendant: %c%c\n", JSONSL_PATH_WILDCARD_CHAR,
+                   JSONSL_PATH_WILDCARD_CHAR);
         } else {
-            printf("\tString: %s\n", comp->pstr);
+            printf("\tString: %s%s%s\n", comp->pstr,
+                   comp->flags & JSONSL_JPR_ICASE ? " (case-insensitive)" : "",
+                   comp->flags & JSONSL_JPR_GLOB ? " (glob)" : "");
+        }
+        if (comp->pred_key) {
+            printf("\tPredicate: %s=%s\n", comp->pred_key, comp->pred_value);
         }
     }
     printf("Destroying..\n\n");
@@ -58,7 +81,7 @@ static void check_bad_path(const char *bad_path)
     jsonsl_error_t err;
     jsonsl_jpr_t jpr;
     fprintf(stderr, "=== Checking bad path %s ===\n", bad_path);
-    jpr = jsonsl_jpr_new(bad_path, &err);
+    jpr = new_path(bad_path, &err);
     if (jpr != NULL) {
         fprintf(stderr, "Expected %s to fail validation\n", bad_path);
         abort();
@@ -89,7 +112,7 @@ static void check_match(const char *path,
     }
     fprintf(stderr, " Exp: %s ===\n", jsonsl_strmatchtype(expected));
 
-    jpr = jsonsl_jpr_new(path, NULL);
+    jpr = new_path(path, NULL);
     assert(jpr);
 
     matchres = jsonsl_jpr_match(jpr, type, level, key, nkey);
@@ -169,6 +192,1791 @@ static void lexjpr(void)
     jsonsl_feed(jsn, SampleJSON, sizeof(SampleJSON)-1);
 }
 
+/* Elements of SampleJSON, the paths in SetPaths which should match them, and
+ * the expected result when only "/foo/bar/1" is in the set */
+static struct {
+    const char *locator;
+    int offset;
+    unsigned long expected;
+    jsonsl_jpr_match_t expected_single;
+    unsigned long got;
+    jsonsl_jpr_match_t got_single;
+    size_t pos;
+} SetElements[] = {
+    { "{", 0, 1 << 0, JSONSL_MATCH_POSSIBLE },
+    { ": {", 2, 1 << 1, JSONSL_MATCH_POSSIBLE },
+    { "[", 0, (1 << 4) | (1 << 11), JSONSL_MATCH_POSSIBLE },
+    { "\"element0\"", 0, 1 << 5, JSONSL_MATCH_NOMATCH },
+    { "\"element1\"", 0, (1 << 2) | (1 << 5) | (1 << 8) | (1 << 10),
+            JSONSL_MATCH_COMPLETE },
+    { "\"inner object\": {", 16, (1 << 4) | (1 << 6), JSONSL_MATCH_NOMATCH },
+    { "\"qux\"", 0, 1 << 3, JSONSL_MATCH_NOMATCH },
+    { NULL }
+};
+
+static const char *SetPaths[] = {
+    "/",
+    "/foo",
+    "/foo/bar/1",
+    "/foo/^/baz",
+    "/foo/^",
+    "/foo/bar/^",
+    "/foo/inner%20object",
+    "/nope/x",
+    "/foo/bar/1",
+    "/foo/bar/0", /* match_type is set to OBJECT */
+    "/foo/bar/01",
+    "/foo/bar", /* match_type is set to LIST */
+    NULL
+};
+
+static void set_push_callback(jsonsl_t jsn,
+                              jsonsl_action_t action,
+                              struct jsonsl_state_st *state,
+                              const jsonsl_char_t *at)
+{
+    struct lexer_global_st *global = (struct lexer_global_st*)jsn->data;
+    const size_t *ids;
+    size_t nids, ii;
+    jsonsl_jpr_match_t matchres;
+    int elem;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    matchres = jsonsl_jpr_set_match_state(jsn, state, global->hkey,
+                                          global->nhkey, &ids, &nids);
+    for (elem = 0; SetElements[elem].locator; elem++) {
+        if (SetElements[elem].pos == state->pos_begin) {
+            break;
+        }
+    }
+    assert(SetElements[elem].locator);
+    assert((matchres == JSONSL_MATCH_COMPLETE) == (nids != 0));
+    SetElements[elem].got_single = matchres;
+    for (ii = 0; ii < nids; ii++) {
+        assert(!(SetElements[elem].got & (1UL << ids[ii])));
+        SetElements[elem].got |= 1UL << ids[ii];
+    }
+}
+
+static void lexjpr_set_run(jsonsl_jpr_set_t set)
+{
+    struct lexer_global_st global;
+    jsonsl_error_t err;
+    jsonsl_t jsn;
+    size_t ii;
+
+    for (ii = 0; SetElements[ii].locator; ii++) {
+        const char *found = strstr(SampleJSON, SetElements[ii].locator);
+        assert(found);
+        SetElements[ii].pos = found - SampleJSON + SetElements[ii].offset;
+        SetElements[ii].got = 0;
+        SetElements[ii].got_single = JSONSL_MATCH_UNKNOWN;
+    }
+
+    jsn = jsonsl_new(24);
+    assert(jsn);
+    err = jsonsl_jpr_set_attach(jsn, set);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->action_callback_PUSH = set_push_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->data = &global;
+    jsonsl_feed(jsn, SampleJSON, sizeof(SampleJSON)-1);
+    jsonsl_destroy(jsn);
+}
+
+/* Number of paths which are placed ahead of SetPaths for lexjpr_multi(), so
+ * that the candidates span more than one bitset word */
+#define MULTI_PADDING 70
+
+static jsonsl_jpr_t MultiJprs[MULTI_PADDING + 32];
+
+static void multi_push_callback(jsonsl_t jsn,
+                                jsonsl_action_t action,
+                                struct jsonsl_state_st *state,
+                                const jsonsl_char_t *at)
+{
+    struct lexer_global_st *global = (struct lexer_global_st*)jsn->data;
+    jsonsl_jpr_match_t matchres;
+    jsonsl_jpr_t matchjpr;
+    int elem;
+    size_t ii;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    matchjpr = jsonsl_jpr_match_state(jsn, state, global->hkey,
+                                      global->nhkey, &matchres);
+    for (elem = 0; SetElements[elem].locator; elem++) {
+        if (SetElements[elem].pos == state->pos_begin) {
+            break;
+        }
+    }
+    assert(SetElements[elem].locator);
+    assert((matchres == JSONSL_MATCH_COMPLETE) == (matchjpr != NULL));
+    if (!matchjpr) {
+        return;
+    }
+    for (ii = 0; MultiJprs[ii] != matchjpr; ii++) {
+    }
+    assert(ii >= MULTI_PADDING);
+    SetElements[elem].got |= 1UL << (ii - MULTI_PADDING);
+}
+
+/* The same paths as lexjpr_set(), with jsonsl_jpr_match_state() */
+static void lexjpr_multi(void)
+{
+    struct lexer_global_st global;
+    jsonsl_t jsn;
+    size_t njprs, ii;
+
+    fprintf(stderr, "=== Testing multiple JPRs ===\n");
+
+    for (njprs = 0; njprs < MULTI_PADDING; njprs++) {
+        char path[64];
+        sprintf(path, "/foo/bar/%lu", (unsigned long)(njprs + 100));
+        MultiJprs[njprs] = jsonsl_jpr_new(path, NULL);
+        assert(MultiJprs[njprs]);
+    }
+    for (ii = 0; SetPaths[ii]; ii++, njprs++) {
+        MultiJprs[njprs] = jsonsl_jpr_new(SetPaths[ii], NULL);
+        assert(MultiJprs[njprs]);
+    }
+    for (ii = 0; SetElements[ii].locator; ii++) {
+        const char *found = strstr(SampleJSON, SetElements[ii].locator);
+        SetElements[ii].pos = found - SampleJSON + SetElements[ii].offset;
+        SetElements[ii].got = 0;
+    }
+
+    jsn = jsonsl_new(24);
+    assert(jsn);
+    jsonsl_jpr_match_state_init(jsn, MultiJprs, njprs);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->action_callback_PUSH = multi_push_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->data = &global;
+    jsonsl_feed(jsn, SampleJSON, sizeof(SampleJSON)-1);
+
+    /* Only the first completed path is reported, and match_type isn't
+     * taken into account */
+    for (ii = 0; SetElements[ii].locator; ii++) {
+        unsigned long expected = SetElements[ii].expected;
+        assert(SetElements[ii].got == (expected & (~expected + 1)));
+    }
+
+    jsonsl_jpr_match_state_cleanup(jsn);
+    jsonsl_destroy(jsn);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(MultiJprs[ii]);
+    }
+}
+
+static void lexjpr_set(void)
+{
+    jsonsl_jpr_t jprs[32];
+    jsonsl_jpr_set_t set;
+    jsonsl_error_t err;
+    size_t njprs, ii;
+
+    fprintf(stderr, "=== Testing path set ===\n");
+
+    for (njprs = 0; SetPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new(SetPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    jprs[9]->match_type = JSONSL_T_OBJECT;
+    jprs[11]->match_type = JSONSL_T_LIST;
+    set = jsonsl_jpr_set_new(jprs, njprs, &err);
+    assert(set);
+    /* The set doesn't depend on the original paths */
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    lexjpr_set_run(set);
+    for (ii = 0; SetElements[ii].locator; ii++) {
+        if (SetElements[ii].got != SetElements[ii].expected) {
+            fprintf(stderr, "Element at %lu: expected 0x%lx, got 0x%lx\n",
+                    (unsigned long)SetElements[ii].pos,
+                    SetElements[ii].expected, SetElements[ii].got);
+            abort();
+        }
+    }
+    jsonsl_jpr_set_destroy(set);
+
+    /* Check that subtrees which can't match are reported as such */
+    jprs[0] = jsonsl_jpr_new("/foo/bar/1", NULL);
+    set = jsonsl_jpr_set_new(jprs, 1, NULL);
+    assert(set);
+    jsonsl_jpr_destroy(jprs[0]);
+    lexjpr_set_run(set);
+    for (ii = 0; SetElements[ii].locator; ii++) {
+        assert(SetElements[ii].got_single == SetElements[ii].expected_single);
+    }
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* Query mode input. The "tru" is never lexed, since nothing under "skip"
+ * can match */
+static const char QueryJSON[] =
+    "{\"skip\": {\"a\": [\"]\", \"}\\\"{[\", [1, {\"x\": 2}, tru]], \"b\": null},"
+    " \"keep\": {\"n\": 1, \"obj\": {\"deep\": [true]}, \"other\": [1, 2]},"
+    " \"list\": [{\"id\": 1}, {\"id\": 2, \"more\": {\"id\": 3}}],"
+    " \"a long key which spans many small buffers\": \"v\"}";
+
+static const char *QueryPaths[] = {
+    "/keep/obj",
+    "/list/^/id",
+    "/a%20long%20key%20which%20spans%20many%20small%20buffers",
+    NULL
+};
+
+/* Each pushed state's type, followed by '*' and the path id if it matched.
+ * Only ancestors of matches, and the contents of matches are seen */
+static const char QueryExpected[] = "{{{*0#[^[{^*1{^*1\"*2";
+
+struct query_ctx {
+    char trace[64];
+    size_t ntrace;
+    int depth;
+};
+
+static void query_push_callback(jsonsl_t jsn,
+                                jsonsl_action_t action,
+                                struct jsonsl_state_st *state,
+                                const jsonsl_char_t *at)
+{
+    struct query_ctx *ctx = (struct query_ctx *)jsn->data;
+    const size_t *ids;
+    size_t nids;
+
+    assert(ctx->ntrace + 3 < sizeof(ctx->trace));
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->trace[ctx->ntrace++] = '#';
+    } else {
+        ctx->trace[ctx->ntrace++] = (char)state->type;
+        if (jsonsl_jpr_set_last_match(jsn, &ids, &nids) ==
+                JSONSL_MATCH_COMPLETE) {
+            assert(nids == 1);
+            ctx->trace[ctx->ntrace++] = '*';
+            ctx->trace[ctx->ntrace++] = (char)('0' + ids[0]);
+        }
+    }
+    ctx->depth++;
+}
+
+static void query_pop_callback(jsonsl_t jsn,
+                               jsonsl_action_t action,
+                               struct jsonsl_state_st *state,
+                               const jsonsl_char_t *at)
+{
+    struct query_ctx *ctx = (struct query_ctx *)jsn->data;
+    ctx->depth--;
+    assert(ctx->depth >= 0);
+}
+
+static void lexjpr_query(void)
+{
+    static const size_t chunks[] = { 1, 2, 3, 5, 7, 16, sizeof(QueryJSON), 0 };
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    size_t njprs, ii;
+
+    fprintf(stderr, "=== Testing query mode ===\n");
+
+    for (njprs = 0; QueryPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new(QueryPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    jsn = jsonsl_new(24);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = query_push_callback;
+    jsn->action_callback_POP = query_pop_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->options.query = 1;
+
+    /* Chunking the input exercises skips and keys which span buffers */
+    for (ii = 0; chunks[ii]; ii++) {
+        struct query_ctx ctx;
+        size_t pos;
+
+        memset(&ctx, 0, sizeof(ctx));
+        jsonsl_reset(jsn);
+        jsonsl_jpr_set_attach(jsn, set);
+        jsn->data = &ctx;
+        for (pos = 0; pos < sizeof(QueryJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(QueryJSON) - 1 - pos;
+            jsonsl_feed(jsn, QueryJSON + pos, n < chunks[ii] ? n : chunks[ii]);
+        }
+        assert(jsn->level == 0);
+        assert(ctx.depth == 0);
+        if (strcmp(ctx.trace, QueryExpected) != 0) {
+            fprintf(stderr, "Chunks of %lu: expected %s, got %s\n",
+                    (unsigned long)chunks[ii], QueryExpected, ctx.trace);
+            abort();
+        }
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* The trailing garbage must never be reached when stopping early */
+static const char StopJSON[] =
+    "{\"meta\": {\"id\": 42, \"type\": \"event\", \"tags\": [\"a\", \"b\"],"
+    " \"more\": {\"x\": 1}}, \"data\": [1, 2, 3]} !!garbage!!";
+
+/* Feeds StopJSON (in 'chunk' sized pieces) with 'paths' in query_stop mode,
+ * and checks that the lexer stopped just after 'last' */
+static void lexjpr_stop_run(const char **paths, const char *last,
+                            size_t chunk)
+{
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    struct query_ctx ctx;
+    size_t njprs, pos;
+
+    for (njprs = 0; paths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_extended(paths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    while (njprs--) {
+        jsonsl_jpr_destroy(jprs[njprs]);
+    }
+
+    jsn = jsonsl_new(24);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = query_push_callback;
+    jsn->action_callback_POP = query_pop_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->options.query = 1;
+    jsn->options.query_stop = 1;
+    jsonsl_jpr_set_attach(jsn, set);
+    memset(&ctx, 0, sizeof(ctx));
+    jsn->data = &ctx;
+
+    for (pos = 0; pos < sizeof(StopJSON) - 1 && !jsn->stopfl; pos += chunk) {
+        size_t n = sizeof(StopJSON) - 1 - pos;
+        jsonsl_feed(jsn, StopJSON + pos, n < chunk ? n : chunk);
+    }
+    assert(jsn->stopfl);
+    assert(jsonsl_jpr_set_satisfied(jsn));
+    assert(jsn->pos == (size_t)(strstr(StopJSON, last) - StopJSON) +
+           strlen(last) - 1);
+
+    /* A new document starts over (it is left open, since a document which
+     * ends satisfies any wildcard path) */
+    jsonsl_reset(jsn);
+    jsonsl_feed(jsn, "{\"meta\": {}", 11);
+    assert(!jsn->stopfl);
+    assert(!jsonsl_jpr_set_satisfied(jsn));
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+static void lexjpr_stop(void)
+{
+    static const char *exact[] = { "/meta/id", "/meta/type", NULL };
+    static const char *container[] = { "/meta/id", "/meta", NULL };
+    static const char *wild[] = { "/meta/id", "/meta/tags/^", NULL };
+    static const char *nested[] = { "/meta/tags/^", "/meta/more/x", NULL };
+    static const char *anywhere[] = { "/^^/x", NULL };
+    size_t chunk;
+
+    fprintf(stderr, "=== Testing early termination ===\n");
+    for (chunk = 1; chunk < sizeof(StopJSON); chunk *= 3) {
+        /* Stops on the closing quote of the last value */
+        lexjpr_stop_run(exact, "\"event\"", chunk);
+        /* /meta/id is inside /meta, so that must be closed first */
+        lexjpr_stop_run(container, "\"more\": {\"x\": 1}}", chunk);
+        /* "tags" may have any number of elements, so it must be closed */
+        lexjpr_stop_run(wild, "\"b\"]", chunk);
+        /* Numbers pop on the following character */
+        lexjpr_stop_run(nested, "\"x\": 1}", chunk);
+        /* Another "x" may turn up anywhere until the document ends */
+        lexjpr_stop_run(anywhere, "3]}", chunk);
+    }
+}
+
+/* Descendant components */
+static const char DescJSON[] =
+    "{\"id\": 1, \"a\": {\"id\": 2, \"b\": [{\"id\": 3},"
+    " {\"x\": {\"id\": {\"id\": 4}}}]},"
+    " \"c\": [[{\"id\": 5}]], \"d\": {\"e\": {\"id\": 6}}}";
+
+static const char *DescPaths[] = {
+    "/^^/id",
+    "/a/^^/id",
+    "/^^/b/^^/id",
+    "/^^/^^/id", /* Same as the first; each match must be reported once */
+    "/^^/1",
+    "/d/^^/e",
+    "/^^/x/^",
+    "/^^/nope",
+    NULL
+};
+static const size_t DescExpected[] = { 7, 4, 3, 7, 1, 1, 1, 0 };
+
+struct desc_ctx {
+    struct lexer_global_st global;
+    size_t counts[8];
+    int query;
+};
+
+static void desc_push_callback(jsonsl_t jsn,
+                               jsonsl_action_t action,
+                               struct jsonsl_state_st *state,
+                               const jsonsl_char_t *at)
+{
+    struct desc_ctx *ctx = (struct desc_ctx *)jsn->data;
+    const size_t *ids;
+    size_t nids, ii;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    if (ctx->query) {
+        jsonsl_jpr_set_last_match(jsn, &ids, &nids);
+    } else {
+        jsonsl_jpr_set_match_state(jsn, state, ctx->global.hkey,
+                                   ctx->global.nhkey, &ids, &nids);
+    }
+    for (ii = 0; ii < nids; ii++) {
+        ctx->counts[ids[ii]]++;
+    }
+}
+
+static void lexjpr_descendant(void)
+{
+    static const size_t chunks[] = { 1, 3, 8, sizeof(DescJSON), 0 };
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    struct desc_ctx ctx;
+    size_t njprs, ii, jj, pos;
+
+    fprintf(stderr, "=== Testing descendant paths ===\n");
+    ExtendedPaths = 1;
+    check_path("/foo/^^/bar");
+    check_bad_path("/foo/^^");
+    check_match("/^^/id", JSONSL_T_OBJECT, 1, "id", JSONSL_MATCH_NOMATCH);
+    ExtendedPaths = 0;
+
+    for (njprs = 0; DescPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_extended(DescPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    /* A shallow lexer, so that a cursor sized for too few levels would
+     * overflow */
+    jsn = jsonsl_new(8);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = desc_push_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->data = &ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    jsonsl_jpr_set_attach(jsn, set);
+    jsonsl_feed(jsn, DescJSON, sizeof(DescJSON) - 1);
+    for (ii = 0; ii < njprs; ii++) {
+        if (ctx.counts[ii] != DescExpected[ii]) {
+            fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                    DescPaths[ii], (unsigned long)DescExpected[ii],
+                    (unsigned long)ctx.counts[ii]);
+            abort();
+        }
+    }
+
+    /* Nothing can be skipped under a descendant component, but the matches
+     * must be the same in query mode */
+    jsn->action_callback_POP = NULL;
+    jsn->options.query = 1;
+    for (ii = 0; chunks[ii]; ii++) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.query = 1;
+        jsonsl_reset(jsn);
+        jsonsl_jpr_set_attach(jsn, set);
+        for (pos = 0; pos < sizeof(DescJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(DescJSON) - 1 - pos;
+            jsonsl_feed(jsn, DescJSON + pos, n < chunks[ii] ? n : chunks[ii]);
+        }
+        assert(jsn->level == 0);
+        for (jj = 0; jj < njprs; jj++) {
+            assert(ctx.counts[jj] == DescExpected[jj]);
+        }
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* Slices. Nothing after "16" may be lexed, since no path can match past
+ * index 5 of "items" */
+static const char SliceJSON[] =
+    "{\"items\": [10, 11, {\"n\": 12}, [13], \"14\", 15, 16, tru, \"]\\\"[\", 19],"
+    " \"after\": [0, 1, 2]}";
+
+static const char *SlicePaths[] = {
+    "/items/:3",
+    "/items/1:6:2",
+    "/after/1:",
+    "/items/2/n",
+    NULL
+};
+static const size_t SliceExpected[] = { 3, 3, 2, 1 };
+
+static void lexjpr_slice(void)
+{
+    static const size_t chunks[] = { 1, 2, 5, sizeof(SliceJSON), 0 };
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    struct desc_ctx ctx;
+    size_t njprs, ii, jj, pos;
+
+    fprintf(stderr, "=== Testing slices ===\n");
+    ExtendedPaths = 1;
+    check_path("/items/10:20:2");
+    check_path("/items/:");
+    check_bad_path("/items/1:2:0");
+    check_match("/items/2:5", JSONSL_T_LIST, 2, (void *)4, JSONSL_MATCH_COMPLETE);
+    check_match("/items/2:5", JSONSL_T_LIST, 2, (void *)5, JSONSL_MATCH_NOMATCH);
+    check_match("/items/1::2", JSONSL_T_LIST, 2, (void *)2, JSONSL_MATCH_NOMATCH);
+    check_match("/items/1::2/x", JSONSL_T_LIST, 2, (void *)3, JSONSL_MATCH_POSSIBLE);
+    check_match("/items/2:5", JSONSL_T_OBJECT, 2, "3", JSONSL_MATCH_TYPE_MISMATCH);
+    ExtendedPaths = 0;
+
+    for (njprs = 0; SlicePaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_extended(SlicePaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    jsn = jsonsl_new(24);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = desc_push_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->data = &ctx;
+    jsn->options.query = 1;
+    for (ii = 0; chunks[ii]; ii++) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.query = 1;
+        jsonsl_reset(jsn);
+        jsonsl_jpr_set_attach(jsn, set);
+        for (pos = 0; pos < sizeof(SliceJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(SliceJSON) - 1 - pos;
+            jsonsl_feed(jsn, SliceJSON + pos, n < chunks[ii] ? n : chunks[ii]);
+        }
+        assert(jsn->level == 0);
+        for (jj = 0; jj < njprs; jj++) {
+            if (ctx.counts[jj] != SliceExpected[jj]) {
+                fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                        SlicePaths[jj], (unsigned long)SliceExpected[jj],
+                        (unsigned long)ctx.counts[jj]);
+                abort();
+            }
+        }
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* RFC 6901 pointers. "^", "%" and ":" are plain characters in them */
+static const char PointerJSON[] =
+    "{\"a/b\": {\"m~n\": [1, {\"^\": 2, \"\": 3, \"1:2\": 4}]},"
+    " \"%25\": 5, \"01\": 6, \"0\": 7}";
+
+static const char *PointerPaths[] = {
+    "/a~1b/m~0n/1/^",   /* 1 */
+    "/a~1b/m~0n/1/",    /* 1 */
+    "/a~1b/m~0n/0",     /* 1 */
+    "/a~1b/m~0n/1/1:2", /* 1 */
+    "/%25",             /* 1 */
+    "/01",              /* 1, a member name */
+    "/0",               /* 1, an index or a member name */
+    "",                 /* 1 */
+    NULL
+};
+static const size_t PointerExpected[] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+
+static void check_pointer(const char *ptr, const char *path)
+{
+    jsonsl_jpr_t a, b;
+    size_t ii;
+
+    fprintf(stderr, "=== Pointer %-20s Exp: %s ===\n", ptr, path);
+    a = jsonsl_jpr_new_pointer(ptr, NULL);
+    b = jsonsl_jpr_new_extended(path, NULL);
+    assert(a && b);
+    assert(a->ncomponents == b->ncomponents);
+    assert(a->norig == strlen(ptr) && strcmp(a->orig, ptr) == 0);
+    for (ii = 0; ii < a->ncomponents; ii++) {
+        const struct jsonsl_jpr_component_st *ca = a->components + ii;
+        const struct jsonsl_jpr_component_st *cb = b->components + ii;
+        assert(ca->ptype == cb->ptype);
+        if (ca->ptype == JSONSL_PATH_NUMERIC) {
+            assert(ca->idx == cb->idx);
+        } else if (ca->ptype == JSONSL_PATH_STRING) {
+            assert(ca->len == cb->len);
+            assert(memcmp(ca->pstr, cb->pstr, ca->len) == 0);
+        }
+    }
+    jsonsl_jpr_destroy(a);
+    jsonsl_jpr_destroy(b);
+}
+
+static void lexjpr_pointer(void)
+{
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_error_t err;
+    jsonsl_t jsn;
+    struct desc_ctx ctx;
+    size_t njprs, ii;
+    int query;
+
+    fprintf(stderr, "=== Testing JSON Pointers ===\n");
+    check_pointer("/foo/anArray/0", "/foo/anArray/0");
+    check_pointer("/a~1b/c~0d/~01", "/a%2Fb/c~d/~1");
+    check_pointer("/^/%41/1:2/-/007", "/%5E/%2541/1%3A2/-/%3007");
+
+    err = JSONSL_ERROR_SUCCESS;
+    assert(jsonsl_jpr_new_pointer("rootless", &err) == NULL);
+    assert(err == JSONSL_ERROR_JPR_NOROOT);
+    assert(jsonsl_jpr_new_pointer("/bad~2escape", &err) == NULL);
+    assert(err == JSONSL_ERROR_JPR_BADPATH);
+    assert(jsonsl_jpr_new_pointer("/trailing~", &err) == NULL);
+    assert(err == JSONSL_ERROR_JPR_BADPATH);
+
+    /* Empty reference tokens are empty member names */
+    jprs[0] = jsonsl_jpr_new_pointer("//", NULL);
+    assert(jprs[0] && jprs[0]->ncomponents == 3);
+    assert(jprs[0]->components[2].ptype == JSONSL_PATH_STRING);
+    assert(jprs[0]->components[2].len == 0);
+    jsonsl_jpr_destroy(jprs[0]);
+
+    for (njprs = 0; PointerPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_pointer(PointerPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    jsn = jsonsl_new(8);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = desc_push_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->data = &ctx;
+    for (query = 0; query < 2; query++) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.query = query;
+        jsonsl_reset(jsn);
+        jsonsl_enable_all_callbacks(jsn);
+        jsn->options.query = query;
+        jsonsl_jpr_set_attach(jsn, set);
+        jsonsl_feed(jsn, PointerJSON, sizeof(PointerJSON) - 1);
+        assert(jsn->level == 0);
+        for (ii = 0; ii < njprs; ii++) {
+            if (ctx.counts[ii] != PointerExpected[ii]) {
+                fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                        PointerPaths[ii], (unsigned long)PointerExpected[ii],
+                        (unsigned long)ctx.counts[ii]);
+                abort();
+            }
+        }
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* Predicates. The second object's "x" can't be lexed, and must be skipped
+ * once its "type" is known not to match */
+static const char PredJSON[] =
+    "{\"items\": [{\"type\": \"error\", \"id\": 1},"
+    " {\"id\": 2, \"type\": \"warn\", \"x\": [tru]},"
+    " {\"type\": \"error\", \"id\": 3, \"sub\": {\"type\": \"error\"}},"
+    " {\"id\": 10}, {\"type\": \"err\\\"or\"}, {\"type\": [\"error\"]},"
+    " {\"id\": 4, \"type\": \"error\"}],"
+    " \"after\": {\"type\": true, \"n\": 1}}";
+
+static const char *PredPaths[] = {
+    "/items/^[type=\"error\"]",
+    "/items/^[id=1]",
+    "/items/^[id=4]",
+    "/after[type=true]",
+    "/after[n=2]",
+    NULL
+};
+static const size_t PredExpected[] = { 3, 1, 1, 1, 0 };
+
+static void pred_callback(jsonsl_t jsn,
+                          struct jsonsl_state_st *state,
+                          size_t id)
+{
+    struct desc_ctx *ctx = (struct desc_ctx *)jsn->data;
+    assert(state->type == JSONSL_T_OBJECT);
+    ctx->counts[id]++;
+}
+
+static void pred_pop_callback(jsonsl_t jsn,
+                              jsonsl_action_t action,
+                              struct jsonsl_state_st *state,
+                              const jsonsl_char_t *at)
+{
+    struct desc_ctx *ctx = (struct desc_ctx *)jsn->data;
+    if (state->type == JSONSL_T_OBJECT && state->level == 3) {
+        /* Only objects which satisfied a predicate */
+        ctx->counts[7]++;
+    }
+}
+
+static void lexjpr_predicate(void)
+{
+    static const size_t chunks[] = { 1, 2, 5, sizeof(PredJSON), 0 };
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    struct desc_ctx ctx;
+    size_t njprs, ii, jj, pos;
+
+    fprintf(stderr, "=== Testing predicates ===\n");
+    ExtendedPaths = 1;
+    check_path("/items/^[type=\"error\"]");
+    check_path("/a%5Bb%5D[k%3D=%22v%5D%22]");
+    check_bad_path("/items/^[type]");
+    check_bad_path("/items/^[type=]");
+    check_bad_path("/items[type=1]/^");
+    check_bad_path("/items/^[type=%G1]");
+    check_match("/items/^[id=1]", JSONSL_T_LIST, 2, (void *)0, JSONSL_MATCH_POSSIBLE);
+    check_match("/items[id=1]", JSONSL_T_OBJECT, 1, "items", JSONSL_MATCH_POSSIBLE);
+    check_match("/items[id=1]", JSONSL_T_OBJECT, 1, "other", JSONSL_MATCH_NOMATCH);
+
+    /* Keys with brackets must have the '[' escaped */
+    check_bad_path("/a[0]");
+    check_bad_path("/tags[x]");
+    check_match("/x[a=b]", JSONSL_T_OBJECT, 1, "x[a=b]", JSONSL_MATCH_NOMATCH);
+    check_match("/a%5B0]", JSONSL_T_OBJECT, 1, "a[0]", JSONSL_MATCH_COMPLETE);
+    check_match("/tags%5Bx]", JSONSL_T_OBJECT, 1, "tags[x]", JSONSL_MATCH_COMPLETE);
+    check_match("/x%5Ba=b]", JSONSL_T_OBJECT, 1, "x[a=b]", JSONSL_MATCH_COMPLETE);
+    check_match("/x%5Ba=b]", JSONSL_T_OBJECT, 1, "x", JSONSL_MATCH_NOMATCH);
+    ExtendedPaths = 0;
+
+    for (njprs = 0; PredPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_extended(PredPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    jsn = jsonsl_new(24);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = desc_push_callback;
+    jsn->action_callback_POP = pred_pop_callback;
+    jsn->predicate_callback = pred_callback;
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->data = &ctx;
+    jsn->options.query = 1;
+    for (ii = 0; chunks[ii]; ii++) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.query = 1;
+        jsonsl_reset(jsn);
+        jsonsl_jpr_set_attach(jsn, set);
+        for (pos = 0; pos < sizeof(PredJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(PredJSON) - 1 - pos;
+            jsonsl_feed(jsn, PredJSON + pos, n < chunks[ii] ? n : chunks[ii]);
+        }
+        assert(jsn->level == 0);
+        for (jj = 0; jj < njprs; jj++) {
+            if (ctx.counts[jj] != PredExpected[jj]) {
+                fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                        PredPaths[jj], (unsigned long)PredExpected[jj],
+                        (unsigned long)ctx.counts[jj]);
+                abort();
+            }
+        }
+        assert(ctx.counts[7] == 3);
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* Key hashes. The second key is "abc" escaped, and must still match when
+ * unescaped by the caller. Paths are matched against whatever key they are
+ * passed, so each member of the root is also matched as "abd" */
+static const char HashJSON[] =
+    "{\"abc\": 1, \"a\\u0062c\": {\"abc\": [2]}, \"abd\": 3}";
+
+static const char *HashPaths[] = { "/abc", "/abc/abc/0", "/abd", NULL };
+static const size_t HashExpected[] = { 2, 1, 1 };
+
+/* In query mode the lexer hashes the keys itself, also when they span
+ * buffers */
+static const char QueryHashJSON[] =
+    "{\"ab\": 0, \"abc\": 1, \"abcd\": 2, \"abd\": {\"ab\": 3, \"abc\": 4}}";
+
+static const char *QueryHashPaths[] = { "/abc", "/abd/abc", NULL };
+static const size_t QueryHashExpected[] = { 1, 1 };
+
+struct hash_ctx {
+    jsonsl_jpr_t jprs[4];
+    size_t counts[4];
+    const char *key;
+    size_t nkey;
+    int escaped;
+};
+
+static void hash_push_callback(jsonsl_t jsn,
+                               jsonsl_action_t action,
+                               struct jsonsl_state_st *state,
+                               const jsonsl_char_t *at)
+{
+    struct hash_ctx *ctx = (struct hash_ctx *)jsn->data;
+    struct jsonsl_state_st *parent = jsonsl_last_state(jsn, state);
+    jsonsl_jpr_match_t match;
+    jsonsl_jpr_t jpr;
+    size_t ii;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    if (parent && parent->type == JSONSL_T_OBJECT &&
+            jsonsl_last_state(jsn, parent) == NULL) {
+        assert(jsonsl_path_match(ctx->jprs[2], parent, state, "abd", 3) ==
+               JSONSL_MATCH_COMPLETE);
+        assert(jsonsl_path_match(ctx->jprs[0], parent, state, "abd", 3) ==
+               JSONSL_MATCH_NOMATCH);
+    }
+    if (parent && parent->type == JSONSL_T_OBJECT && ctx->escaped) {
+        /* Unescaped by the caller */
+        jpr = jsonsl_jpr_match_state(jsn, state, "abc", 3, &match);
+    } else {
+        jpr = jsonsl_jpr_match_state(jsn, state, ctx->key, ctx->nkey, &match);
+    }
+    for (ii = 0; jpr && HashPaths[ii]; ii++) {
+        if (ctx->jprs[ii] == jpr) {
+            ctx->counts[ii]++;
+        }
+    }
+}
+
+static void hash_pop_callback(jsonsl_t jsn,
+                              jsonsl_action_t action,
+                              struct jsonsl_state_st *state,
+                              const jsonsl_char_t *at)
+{
+    struct hash_ctx *ctx = (struct hash_ctx *)jsn->data;
+    if (state->type != JSONSL_T_HKEY) {
+        return;
+    }
+    ctx->key = HashJSON + state->pos_begin + 1;
+    ctx->nkey = jsn->pos - state->pos_begin - 1;
+    ctx->escaped = state->nescapes != 0;
+}
+
+static void query_hash_push_callback(jsonsl_t jsn,
+                                     jsonsl_action_t action,
+                                     struct jsonsl_state_st *state,
+                                     const jsonsl_char_t *at)
+{
+    struct hash_ctx *ctx = (struct hash_ctx *)jsn->data;
+    const size_t *ids;
+    size_t nids, ii;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    if (jsonsl_jpr_set_last_match(jsn, &ids, &nids) ==
+            JSONSL_MATCH_COMPLETE) {
+        for (ii = 0; ii < nids; ii++) {
+            ctx->counts[ids[ii]]++;
+        }
+    }
+}
+
+static void lexjpr_hash(void)
+{
+    static const size_t chunks[] = { 1, 3, sizeof(HashJSON), 0 };
+    struct hash_ctx ctx;
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    size_t njprs, ii, jj, pos;
+
+    fprintf(stderr, "=== Testing key hashes ===\n");
+    memset(&ctx, 0, sizeof(ctx));
+    for (njprs = 0; HashPaths[njprs]; njprs++) {
+        ctx.jprs[njprs] = jsonsl_jpr_new(HashPaths[njprs], NULL);
+        assert(ctx.jprs[njprs]);
+    }
+    jsn = jsonsl_new(24);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = hash_push_callback;
+    jsn->action_callback_POP = hash_pop_callback;
+    jsn->data = &ctx;
+    for (ii = 0; chunks[ii]; ii++) {
+        memset(ctx.counts, 0, sizeof(ctx.counts));
+        jsonsl_reset(jsn);
+        jsonsl_enable_all_callbacks(jsn);
+        jsonsl_jpr_match_state_init(jsn, ctx.jprs, njprs);
+        for (pos = 0; pos < sizeof(HashJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(HashJSON) - 1 - pos;
+            jsonsl_feed(jsn, HashJSON + pos, n < chunks[ii] ? n : chunks[ii]);
+        }
+        assert(jsn->level == 0);
+        jsonsl_jpr_match_state_cleanup(jsn);
+        for (jj = 0; jj < njprs; jj++) {
+            if (ctx.counts[jj] != HashExpected[jj]) {
+                fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                        HashPaths[jj], (unsigned long)HashExpected[jj],
+                        (unsigned long)ctx.counts[jj]);
+                abort();
+            }
+        }
+    }
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(ctx.jprs[ii]);
+    }
+
+    for (njprs = 0; QueryHashPaths[njprs]; njprs++) {
+        ctx.jprs[njprs] = jsonsl_jpr_new(QueryHashPaths[njprs], NULL);
+        assert(ctx.jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(ctx.jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(ctx.jprs[ii]);
+    }
+    jsonsl_reset(jsn);
+    jsn->action_callback_PUSH = query_hash_push_callback;
+    jsn->action_callback_POP = NULL;
+    jsn->options.query = 1;
+    for (ii = 0; chunks[ii]; ii++) {
+        memset(ctx.counts, 0, sizeof(ctx.counts));
+        jsonsl_reset(jsn);
+        jsonsl_enable_all_callbacks(jsn);
+        jsonsl_jpr_set_attach(jsn, set);
+        for (pos = 0; pos < sizeof(QueryHashJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(QueryHashJSON) - 1 - pos;
+            jsonsl_feed(jsn, QueryHashJSON + pos,
+                        n < chunks[ii] ? n : chunks[ii]);
+        }
+        assert(jsn->level == 0);
+        for (jj = 0; jj < njprs; jj++) {
+            if (ctx.counts[jj] != QueryHashExpected[jj]) {
+                fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                        QueryHashPaths[jj],
+                        (unsigned long)QueryHashExpected[jj],
+                        (unsigned long)ctx.counts[jj]);
+                abort();
+            }
+        }
+    }
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* Case-insensitive and glob components */
+static const char FlagJSON[] =
+    "{\"users\": [{\"UserId\": 1}, {\"userid\": 2},"
+    " {\"USERID\": 3, \"userId2\": 4}],"
+    " \"metrics\": {\"metric_cpu\": 1, \"metric_mem\": [2],"
+    " \"other\": {\"metric_x\": 3}, \"metric_\": 4, \"metrics\": 5}}";
+
+static const char *FlagPaths[] = {
+    "/users/^/userid[i]",
+    "/metrics/metric_*[g]",
+    "/^^/METRIC_?*[ig]",
+    "/users/^/userid",
+    "/users/^/user?d[g]",
+    NULL
+};
+static const size_t FlagExpected[] = { 3, 3, 3, 1, 1 };
+
+static void lexjpr_flags(void)
+{
+    static const size_t chunks[] = { 1, 4, sizeof(FlagJSON), 0 };
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_t jsn;
+    struct desc_ctx ctx;
+    size_t njprs, ii, jj, pos;
+    int query;
+
+    fprintf(stderr, "=== Testing component flags ===\n");
+    ExtendedPaths = 1;
+    check_path("/users/^/UserId[i]");
+    check_path("/metrics/metric_*[g]");
+    check_path("/a/B?*[ig][k=1]");
+    check_bad_path("/a[x]");
+    check_bad_path("/a[i]b]");
+    check_bad_path("/a[i][k]");
+    check_match("/users/^/userid[i]", JSONSL_T_OBJECT, 3, "UserID", JSONSL_MATCH_COMPLETE);
+    check_match("/users/^/userid[i]", JSONSL_T_OBJECT, 3, "UserIDs", JSONSL_MATCH_NOMATCH);
+    check_match("/m/metric_*[g]", JSONSL_T_OBJECT, 2, "metric_cpu", JSONSL_MATCH_COMPLETE);
+    check_match("/m/metric_*[g]", JSONSL_T_OBJECT, 2, "metrics_cpu", JSONSL_MATCH_NOMATCH);
+    check_match("/m/a?c*d[g]", JSONSL_T_OBJECT, 2, "abcxxd", JSONSL_MATCH_COMPLETE);
+    check_match("/m/a?c*d[g]", JSONSL_T_OBJECT, 2, "acd", JSONSL_MATCH_NOMATCH);
+    check_match("/m/*[g]", JSONSL_T_OBJECT, 2, "", JSONSL_MATCH_COMPLETE);
+    check_match("/m/A*[ig]/x", JSONSL_T_OBJECT, 2, "abc", JSONSL_MATCH_POSSIBLE);
+    check_match("/m/0[i]", JSONSL_T_LIST, 2, (void *)0, JSONSL_MATCH_TYPE_MISMATCH);
+    /* Escaped, flags are part of the key */
+    check_match("/k[i]", JSONSL_T_OBJECT, 1, "K", JSONSL_MATCH_COMPLETE);
+    check_match("/k[i]", JSONSL_T_OBJECT, 1, "k[i]", JSONSL_MATCH_NOMATCH);
+    check_match("/k%5Bi]", JSONSL_T_OBJECT, 1, "k[i]", JSONSL_MATCH_COMPLETE);
+    check_match("/k%5Bi]", JSONSL_T_OBJECT, 1, "K", JSONSL_MATCH_NOMATCH);
+    {
+        /* A glob without wildcards is an ordinary key */
+        jsonsl_jpr_t jpr = jsonsl_jpr_new_extended("/m/abc[g]", NULL);
+        assert(jpr && jpr->components[2].flags == 0);
+        assert(jpr->components[2].key_hash != 0);
+        jsonsl_jpr_destroy(jpr);
+    }
+    ExtendedPaths = 0;
+
+    for (njprs = 0; FlagPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_extended(FlagPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    jsn = jsonsl_new(24);
+    jsn->error_callback = error_callback;
+    jsn->action_callback_PUSH = desc_push_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->data = &ctx;
+    for (query = 0; query < 2; query++) {
+        for (ii = 0; chunks[ii]; ii++) {
+            if (!query && chunks[ii] != sizeof(FlagJSON)) {
+                /* pop_callback() wants each key in a single buffer */
+                continue;
+            }
+            memset(&ctx, 0, sizeof(ctx));
+            ctx.query = query;
+            jsonsl_reset(jsn);
+            jsonsl_enable_all_callbacks(jsn);
+            jsonsl_jpr_set_attach(jsn, set);
+            jsn->options.query = query;
+            for (pos = 0; pos < sizeof(FlagJSON) - 1; pos += chunks[ii]) {
+                size_t n = sizeof(FlagJSON) - 1 - pos;
+                jsonsl_feed(jsn, FlagJSON + pos,
+                            n < chunks[ii] ? n : chunks[ii]);
+            }
+            assert(jsn->level == 0);
+            for (jj = 0; jj < njprs; jj++) {
+                if (ctx.counts[jj] != FlagExpected[jj]) {
+                    fprintf(stderr, "%s: expected %lu matches, got %lu\n",
+                            FlagPaths[jj], (unsigned long)FlagExpected[jj],
+                            (unsigned long)ctx.counts[jj]);
+                    abort();
+                }
+            }
+        }
+    }
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* jsonsl_jpr_new() has no extended syntax: paths which would use it name
+ * keys spelled the same way */
+static const char LiteralJSON[] =
+    "{\"a[0]\": 1, \"k[i]\": 2, \"K\": 3, \"^^\": {\"id\": 4}, \"id\": 5,"
+    " \"1:2\": 6, \"x[a=b]\": 7, \"m*[g]\": 8, \"mx\": 9}";
+
+static const char *LiteralPaths[] = {
+    "/a[0]", "/k[i]", "/^^/id", "/1:2", "/x[a=b]", "/m*[g]", NULL
+};
+
+static const char *LiteralExpected[] = { "1", "2", "4", "6", "7", "8" };
+
+static void lexjpr_literal(void)
+{
+    jsonsl_jpr_t jprs[8];
+    jsonsl_jpr_set_t set;
+    jsonsl_span_t spans[16];
+    jsonsl_error_t err;
+    size_t njprs, nspans, ii;
+
+    fprintf(stderr, "=== Testing paths without extended syntax ===\n");
+    check_path("/a[0]");
+    check_path("/^^");
+    check_path("/items/1:2");
+    check_match("/a[0]", JSONSL_T_OBJECT, 1, "a[0]", JSONSL_MATCH_COMPLETE);
+    check_match("/a[0]", JSONSL_T_OBJECT, 1, "a", JSONSL_MATCH_NOMATCH);
+    check_match("/k[i]", JSONSL_T_OBJECT, 1, "k[i]", JSONSL_MATCH_COMPLETE);
+    check_match("/k[i]", JSONSL_T_OBJECT, 1, "K", JSONSL_MATCH_NOMATCH);
+    check_match("/x[a=b]", JSONSL_T_OBJECT, 1, "x[a=b]", JSONSL_MATCH_COMPLETE);
+    check_match("/^^/id", JSONSL_T_OBJECT, 1, "^^", JSONSL_MATCH_POSSIBLE);
+    check_match("/^^/id", JSONSL_T_OBJECT, 1, "id", JSONSL_MATCH_NOMATCH);
+    check_match("/items/2:5", JSONSL_T_OBJECT, 2, "2:5", JSONSL_MATCH_COMPLETE);
+    check_match("/items/2:5", JSONSL_T_LIST, 2, (void *)3, JSONSL_MATCH_TYPE_MISMATCH);
+    check_match("/m/a*[g]", JSONSL_T_OBJECT, 2, "a*[g]", JSONSL_MATCH_COMPLETE);
+    check_match("/m/a*[g]", JSONSL_T_OBJECT, 2, "ab", JSONSL_MATCH_NOMATCH);
+
+    for (njprs = 0; LiteralPaths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new(LiteralPaths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    nspans = 16;
+    err = jsonsl_extract(LiteralJSON, sizeof(LiteralJSON) - 1, set,
+                         spans, &nspans);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    assert(nspans == njprs);
+    for (ii = 0; ii < nspans; ii++) {
+        assert(spans[ii].id == ii);
+        assert(spans[ii].pos_end - spans[ii].pos_begin == 1);
+        assert(LiteralJSON[spans[ii].pos_begin] == *LiteralExpected[ii]);
+    }
+    jsonsl_jpr_set_destroy(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+}
+
+/* Extraction. The second item's "type" is found before the first item is
+ * known to match its predicate, and must still get the right end */
+static const char ExtractJSON[] =
+    "{\"id\": 7, \"name\": \"a\\\"b\", \"tags\": [\"x\", \"y\"],"
+    " \"items\": [{\"type\": \"error\", \"n\": 1.5}, {\"type\": \"info\"}],"
+    " \"ok\": true, \"skip\": {\"deep\": [1, 2, 3]}}";
+
+static const char *ExtractPaths[] = {
+    "/id",
+    "/name",
+    "/tags",
+    "/tags/^",
+    "/items/^[type=\"error\"]",
+    "/items/^/type",
+    "/ok",
+    "/missing",
+    NULL
+};
+
+static const struct {
+    size_t id;
+    const char *text;
+} ExtractExpected[] = {
+    { 0, "7" },
+    { 1, "\"a\\\"b\"" },
+    { 2, "[\"x\", \"y\"]" },
+    { 3, "\"x\"" },
+    { 3, "\"y\"" },
+    { 5, "\"error\"" },
+    { 4, "{\"type\": \"error\", \"n\": 1.5}" },
+    { 5, "\"info\"" },
+    { 6, "true" }
+};
+
+#define NEXTRACT (sizeof(ExtractExpected) / sizeof(ExtractExpected[0]))
+
+static jsonsl_jpr_set_t make_set(const char **paths)
+{
+    jsonsl_jpr_t jprs[16];
+    jsonsl_jpr_set_t set;
+    size_t njprs, ii;
+
+    for (njprs = 0; paths[njprs]; njprs++) {
+        jprs[njprs] = jsonsl_jpr_new_extended(paths[njprs], NULL);
+        assert(jprs[njprs]);
+    }
+    set = jsonsl_jpr_set_new(jprs, njprs, NULL);
+    assert(set);
+    for (ii = 0; ii < njprs; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+    return set;
+}
+
+static void lexjpr_extract(void)
+{
+    static const char *root[] = { "/", NULL };
+    static const char *first[] = { "/id", NULL };
+    static const char *dup[] = { "/z", NULL };
+    static const char *dupmore[] = { "/z", "/w", NULL };
+    static const char *dupwild[] = { "/^", NULL };
+    static const char **dupsets[] = { dup, dupmore, dupwild };
+    static const size_t dupfound[] = { 1, 1, 3 };
+    static const char DupJSON[] = "{\"z\":1,\"y\":2,\"z\":3}";
+    jsonsl_span_t spans[16];
+    jsonsl_jpr_set_t set, set2;
+    jsonsl_t jsn;
+    jsonsl_error_t err;
+    size_t nspans, ii;
+    int reuse;
+
+    fprintf(stderr, "=== Testing extraction ===\n");
+    set = make_set(ExtractPaths);
+    jsn = jsonsl_new(24);
+    for (reuse = 0; reuse < 2; reuse++) {
+        nspans = 16;
+        if (reuse) {
+            err = jsonsl_extract_with(jsn, ExtractJSON, sizeof(ExtractJSON) - 1,
+                                      set, spans, &nspans);
+        } else {
+            err = jsonsl_extract(ExtractJSON, sizeof(ExtractJSON) - 1,
+                                 set, spans, &nspans);
+        }
+        assert(err == JSONSL_ERROR_SUCCESS);
+        assert(nspans == NEXTRACT);
+        for (ii = 0; ii < nspans; ii++) {
+            const char *text = ExtractExpected[ii].text;
+            size_t len = spans[ii].pos_end - spans[ii].pos_begin;
+            if (spans[ii].id != ExtractExpected[ii].id ||
+                    len != strlen(text) ||
+                    memcmp(ExtractJSON + spans[ii].pos_begin, text, len)) {
+                fprintf(stderr, "Span %lu: expected %lu:%s, got %lu:%.*s\n",
+                        (unsigned long)ii,
+                        (unsigned long)ExtractExpected[ii].id, text,
+                        (unsigned long)spans[ii].id, (int)len,
+                        ExtractJSON + spans[ii].pos_begin);
+                abort();
+            }
+        }
+        assert(spans[0].type == JSONSL_T_SPECIAL);
+        assert(spans[0].special_flags == JSONSL_SPECIALf_UNSIGNED);
+        assert(spans[0].level == 2);
+        assert(spans[2].type == JSONSL_T_LIST);
+        assert(spans[6].type == JSONSL_T_OBJECT && spans[6].level == 3);
+        assert(spans[8].special_flags == JSONSL_SPECIALf_TRUE);
+    }
+
+    /* Not enough room */
+    nspans = 3;
+    err = jsonsl_extract_with(jsn, ExtractJSON, sizeof(ExtractJSON) - 1,
+                              set, spans, &nspans);
+    assert(err == JSONSL_ERROR_SUCCESS && nspans == NEXTRACT);
+    assert(spans[2].id == 2 && spans[2].pos_end - spans[2].pos_begin == 10);
+
+    /* Truncated, and invalid */
+    nspans = 16;
+    err = jsonsl_extract_with(jsn, ExtractJSON, sizeof(ExtractJSON) - 2,
+                              set, spans, &nspans);
+    assert(err == JSONSL_ERROR_INCOMPLETE && nspans == 0);
+    nspans = 16;
+    err = jsonsl_extract_with(jsn, "{\"id\": 7,, \"ok\": 1}", 19,
+                              set, spans, &nspans);
+    assert(err == JSONSL_ERROR_STRAY_TOKEN && nspans == 0);
+    jsonsl_jpr_set_destroy(set);
+
+    /* A number at the top level */
+    set = make_set(root);
+    nspans = 16;
+    err = jsonsl_extract_with(jsn, "-42", 3, set, spans, &nspans);
+    assert(err == JSONSL_ERROR_SUCCESS && nspans == 1);
+    assert(spans[0].pos_begin == 0 && spans[0].pos_end == 3);
+    assert(spans[0].special_flags == JSONSL_SPECIALf_SIGNED);
+
+    /* Nothing after the last exact match is read */
+    set2 = make_set(first);
+    nspans = 16;
+    err = jsonsl_extract_with(jsn, "{\"id\": 1, \"x\": [tru", 19,
+                              set2, spans, &nspans);
+    assert(err == JSONSL_ERROR_SUCCESS && nspans == 1);
+    assert(spans[0].pos_begin == 7 && spans[0].pos_end == 8);
+    jsonsl_jpr_set_destroy(set2);
+
+    /* A duplicate key is reported the first time only, whether or not the
+     * rest of the object is read. A wildcard matches every member */
+    for (ii = 0; ii < 3; ii++) {
+        set2 = make_set(dupsets[ii]);
+        nspans = 16;
+        err = jsonsl_extract_with(jsn, DupJSON, sizeof(DupJSON) - 1,
+                                  set2, spans, &nspans);
+        assert(err == JSONSL_ERROR_SUCCESS && nspans == dupfound[ii]);
+        assert(spans[0].pos_begin == 5 && spans[0].pos_end == 6);
+        jsonsl_jpr_set_destroy(set2);
+    }
+    assert(spans[2].pos_begin == 17 && spans[2].pos_end == 18);
+
+    jsonsl_destroy(jsn);
+    jsonsl_jpr_set_destroy(set);
+}
+
+/* Offset indexes, built with depth 2 */
+static const char IndexJSON[] =
+    "{\"name\": \"idx\", \"tags\": [\"x\", \"y\"], \"dup\": 1,"
+    " \"items\": [{\"type\": \"a\"}, {\"type\": \"b\", \"n\": [1, 2]}],"
+    " \"obj\": {\"k\": 1, \"long key\": -1.5, \"dup\": 3}, \"dup\": 2}";
+
+static const struct {
+    const char *path;
+    jsonsl_jpr_match_t match;
+    const char *text;
+} IndexExpected[] = {
+    { "/", JSONSL_MATCH_COMPLETE, IndexJSON },
+    { "/name", JSONSL_MATCH_COMPLETE, "\"idx\"" },
+    { "/tags/1", JSONSL_MATCH_COMPLETE, "\"y\"" },
+    { "/dup", JSONSL_MATCH_COMPLETE, "1" },
+    { "/obj/long%20key", JSONSL_MATCH_COMPLETE, "-1.5" },
+    { "/obj/dup", JSONSL_MATCH_COMPLETE, "3" },
+    { "/items/1", JSONSL_MATCH_COMPLETE, "{\"type\": \"b\", \"n\": [1, 2]}" },
+    { "/items/1/n/0", JSONSL_MATCH_POSSIBLE, "{\"type\": \"b\", \"n\": [1, 2]}" },
+    { "/items/^/type", JSONSL_MATCH_POSSIBLE, "[{\"type\": \"a\"}, {\"type\": \"b\", \"n\": [1, 2]}]" },
+    { "/obj[k=1]", JSONSL_MATCH_POSSIBLE, "{\"k\": 1, \"long key\": -1.5, \"dup\": 3}" },
+    { "/missing", JSONSL_MATCH_NOMATCH, NULL },
+    { "/tags/2", JSONSL_MATCH_NOMATCH, NULL },
+    { "/tags/x", JSONSL_MATCH_TYPE_MISMATCH, NULL },
+    { "/name/x", JSONSL_MATCH_NOMATCH, NULL },
+    { NULL }
+};
+
+static void check_index(jsonsl_index_t idx)
+{
+    size_t ii;
+    for (ii = 0; IndexExpected[ii].path; ii++) {
+        jsonsl_jpr_t jpr = jsonsl_jpr_new_extended(IndexExpected[ii].path,
+                                                   NULL);
+        const char *text = IndexExpected[ii].text;
+        jsonsl_span_t span;
+        jsonsl_jpr_match_t match;
+
+        assert(jpr);
+        match = jsonsl_index_lookup(idx, jpr, &span);
+        if (match != IndexExpected[ii].match || (text &&
+                (span.pos_end - span.pos_begin != strlen(text) ||
+                 memcmp(IndexJSON + span.pos_begin, text, strlen(text))))) {
+            fprintf(stderr, "%s: expected %s %s, got %s %.*s\n",
+                    IndexExpected[ii].path,
+                    jsonsl_strmatchtype(IndexExpected[ii].match),
+                    text ? text : "",
+                    jsonsl_strmatchtype(match),
+                    text ? (int)(span.pos_end - span.pos_begin) : 0,
+                    text ? IndexJSON + span.pos_begin : "");
+            abort();
+        }
+        jsonsl_jpr_destroy(jpr);
+    }
+}
+
+static void lexjpr_index(void)
+{
+    static const size_t chunks[] = { 1, 3, sizeof(IndexJSON), 0 };
+    static const char idxfile[] = "jpr_test_index.tmp";
+    jsonsl_index_t idx;
+    jsonsl_span_t span;
+    jsonsl_jpr_t root = jsonsl_jpr_new("/", NULL);
+    jsonsl_jpr_match_t match;
+    jsonsl_error_t err;
+    size_t ii, pos;
+    FILE *fp;
+    int rv;
+
+    fprintf(stderr, "=== Testing offset indexes ===\n");
+    for (ii = 0; chunks[ii]; ii++) {
+        idx = jsonsl_index_new(2);
+        assert(idx);
+        for (pos = 0; pos < sizeof(IndexJSON) - 1; pos += chunks[ii]) {
+            size_t n = sizeof(IndexJSON) - 1 - pos;
+            err = jsonsl_index_feed(idx, IndexJSON + pos,
+                                    n < chunks[ii] ? n : chunks[ii]);
+            assert(err == JSONSL_ERROR_SUCCESS);
+        }
+        err = jsonsl_index_finish(idx);
+        assert(err == JSONSL_ERROR_SUCCESS);
+        assert(jsonsl_index_length(idx) == sizeof(IndexJSON) - 1);
+        check_index(idx);
+        if (chunks[ii + 1]) {
+            jsonsl_index_destroy(idx);
+        }
+    }
+
+    /* Saved and loaded */
+    rv = jsonsl_index_save(idx, idxfile);
+    assert(rv == 0);
+    jsonsl_index_destroy(idx);
+    idx = jsonsl_index_load(idxfile);
+    assert(idx);
+    assert(jsonsl_index_length(idx) == sizeof(IndexJSON) - 1);
+    check_index(idx);
+    jsonsl_index_destroy(idx);
+
+    /* Not an index */
+    fp = fopen(idxfile, "wb");
+    assert(fp);
+    fputs(IndexJSON, fp);
+    fclose(fp);
+    idx = jsonsl_index_load(idxfile);
+    assert(idx == NULL && errno == EINVAL);
+    remove(idxfile);
+
+    /* Truncated, and a number at the top level */
+    idx = jsonsl_index_new(2);
+    jsonsl_index_feed(idx, IndexJSON, sizeof(IndexJSON) - 2);
+    err = jsonsl_index_finish(idx);
+    assert(err == JSONSL_ERROR_INCOMPLETE);
+    match = jsonsl_index_lookup(idx, root, &span);
+    assert(match == JSONSL_MATCH_NOMATCH);
+    jsonsl_index_destroy(idx);
+    idx = jsonsl_index_new(2);
+    jsonsl_index_feed(idx, "-42", 3);
+    err = jsonsl_index_finish(idx);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    match = jsonsl_index_lookup(idx, root, &span);
+    assert(match == JSONSL_MATCH_COMPLETE);
+    assert(span.pos_begin == 0 && span.pos_end == 3 && span.level == 1);
+    assert(span.special_flags == JSONSL_SPECIALf_SIGNED);
+    jsonsl_index_destroy(idx);
+
+    /* No keys at all, collected after updates and saved */
+    idx = jsonsl_index_new(2);
+    jsonsl_index_feed(idx, "[[1],[2]]", 9);
+    err = jsonsl_index_finish(idx);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    for (ii = 0; ii < 4; ii++) {
+        err = jsonsl_index_update(idx, "[[3],[2]]", 1, 4, 4);
+        assert(err == JSONSL_ERROR_SUCCESS);
+    }
+    rv = jsonsl_index_save(idx, idxfile);
+    assert(rv == 0);
+    jsonsl_index_destroy(idx);
+    idx = jsonsl_index_load(idxfile);
+    assert(idx);
+    remove(idxfile);
+    assert(jsonsl_index_length(idx) == 9);
+    jsonsl_index_destroy(idx);
+    jsonsl_jpr_destroy(root);
+}
+
+static const char *IndexUpdatePaths[] = {
+    "/", "/name", "/tags", "/tags/0", "/tags/1", "/tags/2", "/dup", "/items",
+    "/items/0", "/items/1", "/items/1/type", "/obj", "/obj/k", "/obj/kx",
+    "/obj/dup",
+    "/obj/long%20key", "/new", NULL
+};
+
+/* Replace [begin, end) of 'doc' by 'text', and check that updating 'idx'
+ * gives the same lookups as indexing the edited document. The edit is
+ * undone if the update fails */
+static jsonsl_error_t
+edit_index(jsonsl_index_t idx, char *doc, size_t begin, size_t end,
+           const char *text)
+{
+    size_t ntext = strlen(text), ii;
+    jsonsl_index_t fresh;
+    jsonsl_error_t err;
+    char old[1024];
+
+    strcpy(old, doc);
+    memmove(doc + begin + ntext, doc + end, strlen(doc + end) + 1);
+    memcpy(doc + begin, text, ntext);
+    err = jsonsl_index_update(idx, doc, begin, end, begin + ntext);
+    if (err != JSONSL_ERROR_SUCCESS) {
+        strcpy(doc, old);
+        return err;
+    }
+    assert(jsonsl_index_length(idx) == strlen(doc));
+    fresh = jsonsl_index_new(2);
+    jsonsl_index_feed(fresh, doc, strlen(doc));
+    err = jsonsl_index_finish(fresh);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    for (ii = 0; IndexUpdatePaths[ii]; ii++) {
+        jsonsl_jpr_t jpr = jsonsl_jpr_new(IndexUpdatePaths[ii], NULL);
+        jsonsl_span_t got, expected;
+        jsonsl_jpr_match_t match;
+        memset(&got, 0, sizeof(got));
+        memset(&expected, 0, sizeof(expected));
+        match = jsonsl_index_lookup(fresh, jpr, &expected);
+        if (jsonsl_index_lookup(idx, jpr, &got) != match ||
+                memcmp(&got, &expected, sizeof(got)) != 0) {
+            fprintf(stderr, "%s: got [%lu, %lu) instead of [%lu, %lu) in %s\n",
+                    IndexUpdatePaths[ii], (unsigned long)got.pos_begin,
+                    (unsigned long)got.pos_end,
+                    (unsigned long)expected.pos_begin,
+                    (unsigned long)expected.pos_end, doc);
+            abort();
+        }
+        jsonsl_jpr_destroy(jpr);
+    }
+    jsonsl_index_destroy(fresh);
+    return JSONSL_ERROR_SUCCESS;
+}
+
+static void lexjpr_index_update(void)
+{
+    static const char idxfile[] = "jpr_test_index.tmp";
+    static unsigned char saved[8192];
+    char doc[1024];
+    const char *at;
+    jsonsl_index_t idx;
+    jsonsl_error_t err;
+    size_t nsaved;
+    FILE *fp;
+    int ii;
+
+    fprintf(stderr, "=== Testing offset index updates ===\n");
+    strcpy(doc, IndexJSON);
+    idx = jsonsl_index_new(2);
+    jsonsl_index_feed(idx, doc, strlen(doc));
+    err = jsonsl_index_finish(idx);
+    assert(err == JSONSL_ERROR_SUCCESS);
+
+    /* The same length, longer, shorter, and a different type */
+    at = strstr(doc, "\"idx\"");
+    err = edit_index(idx, doc, at + 1 - doc, at + 4 - doc, "IDX");
+    assert(err == JSONSL_ERROR_SUCCESS);
+    at = strstr(doc, "-1.5");
+    err = edit_index(idx, doc, at - doc, at + 4 - doc, "12345.25e3");
+    assert(err == JSONSL_ERROR_SUCCESS);
+    at = strstr(doc, "[\"x\"");
+    err = edit_index(idx, doc, at + 1 - doc, at + 9 - doc, "\"z\"");
+    assert(err == JSONSL_ERROR_SUCCESS);
+    at = strstr(doc, "{\"type\": \"a\"}");
+    err = edit_index(idx, doc, at - doc, at + 13 - doc, "[1, {\"type\": 2}]");
+    assert(err == JSONSL_ERROR_SUCCESS);
+
+    /* A value becoming two, and a member added to the root */
+    at = strstr(doc, "\"z\"");
+    err = edit_index(idx, doc, at - doc, at + 3 - doc, "\"x\", \"y\"");
+    assert(err == JSONSL_ERROR_SUCCESS);
+    err = edit_index(idx, doc, 1, 1, "\"new\": [], ");
+    assert(err == JSONSL_ERROR_SUCCESS);
+
+    /* Many edits, for the shifts to be applied and the garbage collected */
+    for (ii = 0; ii < 200; ii++) {
+        at = strstr(doc, "\"long key\": ") + 12;
+        err = edit_index(idx, doc, at - doc, strstr(at, ", \"dup") - doc,
+                         ii % 2 ? "[[1], {}]" : "{\"a\": [3]}");
+        assert(err == JSONSL_ERROR_SUCCESS);
+        at = strstr(doc, "{\"k") + 3;
+        err = edit_index(idx, doc, at - doc, at + ii % 2 - doc,
+                         ii % 2 ? "" : "x");
+        assert(err == JSONSL_ERROR_SUCCESS);
+    }
+
+    /* An invalid edit leaves the index as it was */
+    at = strstr(doc, "\"dup\": 1") + 7;
+    err = edit_index(idx, doc, at - doc, at + 1 - doc, "1 2");
+    assert(err != JSONSL_ERROR_SUCCESS);
+    err = edit_index(idx, doc, at - doc, at + 1 - doc, "[");
+    assert(err != JSONSL_ERROR_SUCCESS);
+    err = edit_index(idx, doc, at - doc, at + 1 - doc, "10");
+    assert(err == JSONSL_ERROR_SUCCESS);
+
+    /* Saved after updates */
+    assert(jsonsl_index_save(idx, idxfile) == 0);
+    jsonsl_index_destroy(idx);
+    idx = jsonsl_index_load(idxfile);
+    assert(idx);
+    err = edit_index(idx, doc, 1, 1, " ");
+    assert(err == JSONSL_ERROR_SUCCESS);
+
+    /* Saved without the document order of the nodes (the last 8 bytes of
+     * each), as it was before it was saved */
+    assert(jsonsl_index_save(idx, idxfile) == 0);
+    jsonsl_index_destroy(idx);
+    fp = fopen(idxfile, "rb");
+    assert(fp);
+    nsaved = fread(saved, 1, sizeof(saved), fp);
+    assert(nsaved < sizeof(saved));
+    fclose(fp);
+    for (ii = 0; ii < saved[24]; ii++) {
+        memset(saved + 40 + ii * 72 + 64, 0, 8);
+    }
+    fp = fopen(idxfile, "wb");
+    assert(fp);
+    assert(fwrite(saved, 1, nsaved, fp) == nsaved);
+    fclose(fp);
+    idx = jsonsl_index_load(idxfile);
+    assert(idx);
+    remove(idxfile);
+    err = edit_index(idx, doc, 1, 1, " ");
+    assert(err == JSONSL_ERROR_SUCCESS);
+    at = strstr(doc, "\"long key\": ") + 12;
+    err = edit_index(idx, doc, at - doc, strstr(at, ", \"dup") - doc,
+                     "{\"b\": [1], \"a\": 2}");
+    assert(err == JSONSL_ERROR_SUCCESS);
+    jsonsl_index_destroy(idx);
+}
+
+/* Keys and indices of the paths checked after random edits, all of them
+ * up to 3 levels deep */
+static const char *RandomComponents[] = {
+    "a", "b", "c", "d", "x", "y", "0", "1", "2", NULL
+};
+
+static const char *RandomValues[] = {
+    "1", "7777777", "[]", "[1,2]", "{\"x\":[3]}", "\"str\"", "{}",
+    "[[4],5]", "{\"y\":1,\"x\":2}", "{\"a\":{\"b\":[1,{\"c\":2}]}}", NULL
+};
+
+#define RANDOM_NPATHS (1 + 9 + 9 * 9 + 9 * 9 * 9)
+
+/* Replace [begin, end) of 'doc' by 'text', and compare every lookup of
+ * 'jprs' in 'idx' with one in a fresh index of the edited document */
+static void
+edit_index_random(jsonsl_index_t idx, char *doc, size_t begin, size_t end,
+                  const char *text, jsonsl_jpr_t *jprs)
+{
+    size_t ntext = strlen(text), ii;
+    jsonsl_index_t fresh;
+    jsonsl_error_t err;
+
+    memmove(doc + begin + ntext, doc + end, strlen(doc + end) + 1);
+    memcpy(doc + begin, text, ntext);
+    err = jsonsl_index_update(idx, doc, begin, end, begin + ntext);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    assert(jsonsl_index_length(idx) == strlen(doc));
+    fresh = jsonsl_index_new(3);
+    jsonsl_index_feed(fresh, doc, strlen(doc));
+    err = jsonsl_index_finish(fresh);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    for (ii = 0; ii < RANDOM_NPATHS; ii++) {
+        jsonsl_span_t got, expected;
+        jsonsl_jpr_match_t match;
+        memset(&got, 0, sizeof(got));
+        memset(&expected, 0, sizeof(expected));
+        match = jsonsl_index_lookup(fresh, jprs[ii], &expected);
+        if (jsonsl_index_lookup(idx, jprs[ii], &got) != match ||
+                memcmp(&got, &expected, sizeof(got)) != 0) {
+            fprintf(stderr, "%s: got [%lu, %lu) instead of [%lu, %lu) in %s\n",
+                    jprs[ii]->orig, (unsigned long)got.pos_begin,
+                    (unsigned long)got.pos_end,
+                    (unsigned long)expected.pos_begin,
+                    (unsigned long)expected.pos_end, doc);
+            abort();
+        }
+    }
+    jsonsl_index_destroy(fresh);
+}
+
+/* Random edits of values found by lookups (whole values, or the inside of
+ * strings, numbers and containers), each checked against a fresh index */
+static void lexjpr_index_random(void)
+{
+    static jsonsl_jpr_t jprs[RANDOM_NPATHS];
+    static char doc[4096];
+    jsonsl_index_t idx;
+    jsonsl_error_t err;
+    size_t ii, jj, kk, njprs = 0;
+    unsigned seed;
+    char path[16];
+
+    fprintf(stderr, "=== Testing random offset index updates ===\n");
+    jprs[njprs++] = jsonsl_jpr_new("/", NULL);
+    for (ii = 0; RandomComponents[ii]; ii++) {
+        sprintf(path, "/%s", RandomComponents[ii]);
+        jprs[njprs++] = jsonsl_jpr_new(path, NULL);
+        for (jj = 0; RandomComponents[jj]; jj++) {
+            sprintf(path, "/%s/%s", RandomComponents[ii], RandomComponents[jj]);
+            jprs[njprs++] = jsonsl_jpr_new(path, NULL);
+            for (kk = 0; RandomComponents[kk]; kk++) {
+                sprintf(path, "/%s/%s/%s", RandomComponents[ii],
+                        RandomComponents[jj], RandomComponents[kk]);
+                jprs[njprs++] = jsonsl_jpr_new(path, NULL);
+            }
+        }
+    }
+    assert(njprs == RANDOM_NPATHS);
+
+    /* A value replaced after an edit within it, then one after it */
+    strcpy(doc, "{\"a\":[1,2],\"b\":[3,4],\"c\":5}");
+    idx = jsonsl_index_new(3);
+    jsonsl_index_feed(idx, doc, strlen(doc));
+    err = jsonsl_index_finish(idx);
+    assert(err == JSONSL_ERROR_SUCCESS);
+    edit_index_random(idx, doc, 5, 10, "[1,2]", jprs);
+    edit_index_random(idx, doc, 8, 9, "7777777", jprs);
+    edit_index_random(idx, doc, 5, 16, "1", jprs);
+    edit_index_random(idx, doc, 14, 15, "7777777", jprs);
+    jsonsl_index_destroy(idx);
+
+    for (seed = 1; seed <= 10; seed++) {
+        srand(seed);
+        /* With enough values which are not edited that the shifts are
+         * kept, rather than applied when the replaced nodes are collected */
+        strcpy(doc, "{\"a\":[1,2,3],\"b\":{\"x\":1,\"y\":[4,5]},\"c\":\"s\","
+               "\"d\":[[1],[2,3]],\"p\":[");
+        for (jj = 0; jj < 200; jj++) {
+            strcat(doc, jj ? ",0" : "0");
+        }
+        strcat(doc, "]}");
+        idx = jsonsl_index_new(3);
+        jsonsl_index_feed(idx, doc, strlen(doc));
+        err = jsonsl_index_finish(idx);
+        assert(err == JSONSL_ERROR_SUCCESS);
+        for (ii = 0; ii < 1500; ii++) {
+            jsonsl_span_t span;
+            const char *text;
+            jsonsl_jpr_match_t match;
+            size_t begin, end;
+
+            /* A value which exists, other than the root */
+            do {
+                match = jsonsl_index_lookup(idx,
+                        jprs[1 + rand() % (RANDOM_NPATHS - 1)], &span);
+            } while (match != JSONSL_MATCH_COMPLETE);
+            begin = span.pos_begin;
+            end = span.pos_end;
+            text = strlen(doc) > 2048 ? "1" :
+                    RandomValues[rand() % (sizeof(RandomValues) /
+                                           sizeof(*RandomValues) - 1)];
+            switch (rand() % 4) {
+            case 0:
+                /* The digits of a number, the characters of a string */
+                if (doc[begin] == '"' || doc[begin] == '[') {
+                    text = doc[begin] == '"' ? "xyz" : "";
+                    begin++;
+                    end--;
+                } else if (doc[begin] != '{') {
+                    text = "42";
+                }
+                break;
+            case 1:
+                /* Whitespace before the value */
+                end = begin;
+                text = " ";
+                break;
+            default:
+                break;
+            }
+            edit_index_random(idx, doc, begin, end, text, jprs);
+        }
+        jsonsl_index_destroy(idx);
+    }
+    for (ii = 0; ii < RANDOM_NPATHS; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+}
+
 JSONSL_TEST_JPR_FUNC
 {
     printf("%s\n", SampleJSON);
@@ -221,5 +2029,20 @@ JSONSL_TEST_JPR_FUNC
     check_match("/foo/bar/something/grrr", JSONSL_T_OBJECT, 3, "anything", JSONSL_MATCH_NOMATCH);
 
     lexjpr();
+    lexjpr_multi();
+    lexjpr_set();
+    lexjpr_query();
+    lexjpr_stop();
+    lexjpr_descendant();
+    lexjpr_slice();
+    lexjpr_pointer();
+    lexjpr_predicate();
+    lexjpr_hash();
+    lexjpr_flags();
+    lexjpr_literal();
+    lexjpr_extract();
+    lexjpr_index();
+    lexjpr_index_update();
+    lexjpr_index_random();
     return 0;
 }
@@ -0,0 +1,170 @@
+/**
+ * Shares a single path set between lexers running on several threads.
+ * Meant to be run under ThreadSanitizer as well (configure with
+ * -DJSONSL_SANITIZE=thread, or build with make JSONSL_SANITIZE=thread).
+ */
+#include "jsonsl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "all-tests.h"
+
+#ifdef JSONSL_USE_PTHREADS
+#include <pthread.h>
+
+#define NTHREADS 8
+#define NLEXERS 4
+#define NDOCS 200
+
+static const char SampleJSON[] =
+    "{\"users\": ["
+    "{\"name\": \"a\", \"tags\": [\"x\", \"y\"]},"
+    "{\"name\": \"b\", \"tags\": []},"
+    "{\"name\": \"c\", \"tags\": [\"z\"], \"extra\": {\"name\": \"d\"}}"
+    "], \"count\": 3}";
+
+static const char *Paths[] = {
+    "/users/^/name",    /* 3 */
+    "/users/^/tags/^",  /* 3 */
+    "/users/0",         /* 1 */
+    "/count",           /* 1 */
+    "/missing/^",       /* 0 */
+    NULL
+};
+static const size_t Expected[] = { 3, 3, 1, 1, 0 };
+#define NPATHS (sizeof(Expected) / sizeof(Expected[0]))
+
+struct thread_ctx {
+    pthread_t thr;
+    jsonsl_jpr_set_t set;
+    const char *hkey;
+    size_t nhkey;
+    size_t counts[NPATHS];
+};
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct thread_ctx *ctx = (struct thread_ctx *)jsn->data;
+    const size_t *ids;
+    size_t nids, ii;
+
+    if (state->type == JSONSL_T_HKEY) {
+        return;
+    }
+    jsonsl_jpr_set_match_state(jsn, state, ctx->hkey, ctx->nhkey,
+                               &ids, &nids);
+    for (ii = 0; ii < nids; ii++) {
+        ctx->counts[ids[ii]]++;
+    }
+}
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct thread_ctx *ctx = (struct thread_ctx *)jsn->data;
+    if (state->type == JSONSL_T_HKEY) {
+        ctx->hkey = SampleJSON + state->pos_begin + 1;
+        ctx->nhkey = jsn->pos - state->pos_begin - 1;
+    }
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err,
+               struct jsonsl_state_st *state, jsonsl_char_t *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void *
+thread_main(void *arg)
+{
+    struct thread_ctx *ctx = (struct thread_ctx *)arg;
+    jsonsl_t lexers[NLEXERS];
+    struct jsonsl_jpr_cursor_st *cursors[NLEXERS];
+    size_t ii;
+    int doc;
+
+    for (ii = 0; ii < NLEXERS; ii++) {
+        jsonsl_t jsn = lexers[ii] = jsonsl_new(16);
+        jsonsl_enable_all_callbacks(jsn);
+        jsn->action_callback_PUSH = push_callback;
+        jsn->action_callback_POP = pop_callback;
+        jsn->error_callback = error_callback;
+        jsn->data = ctx;
+        cursors[ii] = NULL;
+    }
+
+    /* A pool of lexers, each taking the set for one document at a time */
+    for (doc = 0; doc < NDOCS; doc++) {
+        jsonsl_t jsn = lexers[doc % NLEXERS];
+        jsonsl_error_t err = jsonsl_jpr_set_attach(jsn, ctx->set);
+        assert(err == JSONSL_ERROR_SUCCESS);
+        if (cursors[doc % NLEXERS]) {
+            /* The cursor is reused rather than reallocated */
+            assert(jsn->jpr_cursor == cursors[doc % NLEXERS]);
+        }
+        cursors[doc % NLEXERS] = jsn->jpr_cursor;
+        jsonsl_feed(jsn, SampleJSON, sizeof(SampleJSON) - 1);
+        assert(jsn->level == 0);
+        jsonsl_jpr_set_detach(jsn);
+        jsonsl_reset(jsn);
+    }
+
+    for (ii = 0; ii < NLEXERS; ii++) {
+        jsonsl_destroy(lexers[ii]);
+    }
+    jsonsl_jpr_set_destroy(ctx->set);
+    return NULL;
+}
+
+int main(void)
+{
+    struct thread_ctx threads[NTHREADS];
+    jsonsl_jpr_t jprs[NPATHS];
+    jsonsl_jpr_set_t set;
+    size_t ii, jj;
+    int rv;
+
+    for (ii = 0; ii < NPATHS; ii++) {
+        jprs[ii] = jsonsl_jpr_new(Paths[ii], NULL);
+        assert(jprs[ii]);
+    }
+    set = jsonsl_jpr_set_new(jprs, NPATHS, NULL);
+    assert(set);
+    for (ii = 0; ii < NPATHS; ii++) {
+        jsonsl_jpr_destroy(jprs[ii]);
+    }
+
+    for (ii = 0; ii < NTHREADS; ii++) {
+        memset(threads + ii, 0, sizeof(threads[ii]));
+        threads[ii].set = jsonsl_jpr_set_ref(set);
+        rv = pthread_create(&threads[ii].thr, NULL, thread_main, threads + ii);
+        assert(rv == 0);
+    }
+    /* The threads keep the set alive; whichever finishes last frees it */
+    jsonsl_jpr_set_destroy(set);
+
+    for (ii = 0; ii < NTHREADS; ii++) {
+        rv = pthread_join(threads[ii].thr, NULL);
+        assert(rv == 0);
+        for (jj = 0; jj < NPATHS; jj++) {
+            assert(threads[ii].counts[jj] == Expected[jj] * NDOCS);
+        }
+    }
+    return 0;
+}
+
+#else
+int main(void)
+{
+    fprintf(stderr, "Not built with JSONSL_USE_PTHREADS. Skipping\n");
+    return 0;
+}
+#endif /* JSONSL_USE_PTHREADS */
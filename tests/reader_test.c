@@ -0,0 +1,137 @@
+#include "jsonsl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "all-tests.h"
+
+#ifdef JSONSL_USE_PTHREADS
+#include <unistd.h>
+#include <sys/wait.h>
+
+const char SampleJSON[] =
+    "{\"a fairly long key, longer than the buffers\": [1, 22, 333, 4444],"
+    " \"escaped \\\"key\\\"\": {\"nested\": \"a value which spans buffers\"},"
+    " \"list\": [\"x\", \"yy\", \"zzz\", true, false, null, -1.25e+10],"
+    " \"empty\": \"\", \"last\": {\"k\": [[[\"deep\"]]]}}";
+
+struct reader_ctx {
+    jsonsl_reader_t rd;
+    unsigned nstrings;
+    unsigned nevents;
+};
+
+static void
+pop_callback(jsonsl_t jsn, jsonsl_action_t action,
+             struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct reader_ctx *ctx = (struct reader_ctx *)jsn->data;
+    size_t pos;
+
+    ctx->nevents++;
+    if (!(state->type & JSONSL_Tf_STRINGY)) {
+        return;
+    }
+
+    /* The entire string (including the quotes) must still be available,
+     * even if it started in a previous buffer */
+    for (pos = state->pos_begin; pos <= jsn->pos; ) {
+        size_t navail;
+        const char *p = jsonsl_reader_at(ctx->rd, pos, &navail);
+        assert(p != NULL);
+        assert(navail > 0);
+        for (; navail && pos <= jsn->pos; navail--, p++, pos++) {
+            assert(*p == SampleJSON[pos]);
+        }
+    }
+    ctx->nstrings++;
+}
+
+static void
+push_callback(jsonsl_t jsn, jsonsl_action_t action,
+              struct jsonsl_state_st *state, const jsonsl_char_t *at)
+{
+    struct reader_ctx *ctx = (struct reader_ctx *)jsn->data;
+    ctx->nevents++;
+}
+
+static int
+error_callback(jsonsl_t jsn, jsonsl_error_t err,
+               struct jsonsl_state_st *state, jsonsl_char_t *at)
+{
+    fprintf(stderr, "Got error %s at pos %lu\n",
+            jsonsl_strerror(err), (unsigned long)jsn->pos);
+    abort();
+    return 0;
+}
+
+static void
+run_reader(size_t bufsize, unsigned nbufs, size_t wrsize)
+{
+    struct reader_ctx ctx = { NULL, 0, 0 };
+    jsonsl_t jsn;
+    int fds[2], rv, status;
+    pid_t pid;
+
+    fprintf(stderr, "==== bufsize=%-4lu nbufs=%-2u writes=%-4lu ====\n",
+            (unsigned long)bufsize, nbufs, (unsigned long)wrsize);
+
+    rv = pipe(fds);
+    assert(rv == 0);
+
+    pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        /* Producer. Trickle the document through the pipe */
+        size_t off = 0, len = sizeof(SampleJSON) - 1;
+        close(fds[0]);
+        while (off < len) {
+            size_t n = len - off < wrsize ? len - off : wrsize;
+            if (write(fds[1], SampleJSON + off, n) != (ssize_t)n) {
+                _exit(1);
+            }
+            off += n;
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    ctx.rd = jsonsl_reader_new(fds[0], bufsize, nbufs);
+    assert(ctx.rd);
+
+    jsn = jsonsl_new(64);
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->action_callback_PUSH = push_callback;
+    jsn->action_callback_POP = pop_callback;
+    jsn->error_callback = error_callback;
+    jsn->data = &ctx;
+
+    rv = jsonsl_reader_run(ctx.rd, jsn);
+    assert(rv == 0);
+    assert(jsn->pos == sizeof(SampleJSON) - 1);
+    assert(jsn->level == 0);
+    assert(ctx.nstrings == 13);
+
+    jsonsl_destroy(jsn);
+    jsonsl_reader_destroy(ctx.rd);
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void)
+{
+    /* Each configuration must be able to hold the longest string */
+    run_reader(4096, 2, 4096);
+    run_reader(7, 12, 5);
+    run_reader(16, 5, 16);
+    run_reader(1, 64, 3);
+    return 0;
+}
+
+#else
+int main(void)
+{
+    fprintf(stderr, "Not built with JSONSL_USE_PTHREADS. Skipping\n");
+    return 0;
+}
+#endif /* JSONSL_USE_PTHREADS */